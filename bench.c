@@ -0,0 +1,1127 @@
+/*bench.c*/
+
+/**
+  * @brief benchmarks for nuPython's memory unit
+  *
+  * Build with "make bench", then run "./bench.out" to run every
+  * benchmark, or "./bench.out <name>" to run just one. Results
+  * are printed to the console.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>  // sysconf
+
+#include "ram.h"
+#include "ram_heap.h"
+#include "ram_journal.h"
+#include "ram_latency.h"
+#include "ram_layout.h"
+#include "ram_scope.h"
+#include "ram_slab.h"
+
+
+/**
+ * @brief now_ns: current time in nanoseconds
+ *
+ * @return nanoseconds since an arbitrary fixed point
+ */
+static long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+//
+// journal: cost per write at each durability level
+//
+
+#define JOURNAL_VARS 1000
+
+/**
+ * @brief journal_writes: times int writes by name to a memory
+ *
+ * @param memory Pointer to struct denoting memory unit
+ * @param names JOURNAL_VARS variable names to cycle through
+ * @param writes # of writes to time
+ * @return average ns per write
+ */
+static double journal_writes(struct RAM* memory, char names[][16], int writes)
+{
+  struct RAM_VALUE value;
+  value.value_type = RAM_TYPE_INT;
+
+  long long start = now_ns();
+
+  for (int i = 0; i < writes; i++) {
+    value.types.i = i;
+    ram_write_cell_by_name(memory, value, names[i % JOURNAL_VARS]);
+  }
+
+  return (double) (now_ns() - start) / writes;
+}
+
+static void bench_journal(void)
+{
+  static char names[JOURNAL_VARS][16];
+
+  for (int i = 0; i < JOURNAL_VARS; i++) {
+    sprintf(names[i], "var%d", i);
+  }
+
+  struct
+  {
+    char* label;
+    struct RAM_JOURNAL_CONFIG config;
+    int writes;
+  } levels[] = {
+    { "no sync (buffer only)",   { 0, 0 },    1000000 },
+    { "group, every 10 ms",      { 0, 10 },   1000000 },
+    { "group, every 1000 recs",  { 1000, 0 }, 200000 },
+    { "group, every 100 recs",   { 100, 0 },  50000 },
+    { "every record",            { 1, 0 },    2000 },
+  };
+  int num_levels = sizeof(levels) / sizeof(levels[0]);
+
+  printf("journal: ns per ram_write_cell_by_name (int, %d vars)\n", JOURNAL_VARS);
+
+  struct RAM* memory = ram_init();
+  double base = journal_writes(memory, names, 1000000);
+  ram_destroy(memory);
+
+  printf("  %-26s %10.1f ns\n", "not journaled", base);
+
+  for (int i = 0; i < num_levels; i++) {
+    remove("bench_journal.tmp");
+
+    memory = ram_init_journaled("bench_journal.tmp", levels[i].config);
+
+    if (memory == NULL) {
+      printf("  **cannot open bench_journal.tmp\n");
+      return;
+    }
+
+    double ns = journal_writes(memory, names, levels[i].writes);
+    struct RAM_JOURNAL_STATS stats = ram_journal_stats(memory);
+
+    printf("  %-26s %10.1f ns  (+%.1f ns, %.1f bytes/record, %lld syncs)\n",
+           levels[i].label, ns, ns - base,
+           (double) stats.bytes / stats.records, stats.syncs);
+
+    ram_destroy(memory);
+  }
+
+  remove("bench_journal.tmp");
+}
+
+
+//
+// typed: generic RAM_VALUE read/write vs. the typed fast paths
+//
+
+#define TYPED_VARS 64
+#define TYPED_OPS  10000000
+
+static void bench_typed(void)
+{
+  struct RAM* memory = ram_init();
+  struct RAM_VALUE value;
+  char name[16];
+
+  value.value_type = RAM_TYPE_INT;
+  value.types.i = 0;
+
+  for (int i = 0; i < TYPED_VARS; i++) {
+    sprintf(name, "var%d", i);
+    ram_write_cell_by_name(memory, value, name);
+  }
+
+  printf("typed: ns per x = x + 1 by address (%d vars)\n", TYPED_VARS);
+
+  long long start = now_ns();
+
+  for (int i = 0; i < TYPED_OPS; i++) {
+    int address = i % TYPED_VARS;
+    struct RAM_VALUE* x = ram_read_cell_by_addr(memory, address);
+    value.types.i = x->types.i + 1;
+    ram_free_value(x);
+    ram_write_cell_by_addr(memory, value, address);
+  }
+
+  double generic = (double) (now_ns() - start) / TYPED_OPS;
+
+  start = now_ns();
+
+  for (int i = 0; i < TYPED_OPS; i++) {
+    int address = i % TYPED_VARS;
+    int x = 0;
+    ram_read_int_by_addr(memory, address, &x);
+    ram_write_int_by_addr(memory, x + 1, address);
+  }
+
+  double typed = (double) (now_ns() - start) / TYPED_OPS;
+
+  int check = 0;
+  ram_read_int_by_addr(memory, 0, &check);
+
+  printf("  %-26s %10.1f ns\n", "read/write_cell_by_addr", generic);
+  printf("  %-26s %10.1f ns  (%.1fx, check %d)\n", "read/write_int_by_addr", typed, generic / typed, check);
+
+  ram_destroy(memory);
+}
+
+
+//
+// batch: ram_get_addr one name at a time vs. ram_get_addrs
+//
+
+#define BATCH_LOOKUPS 2000000
+#define BATCH_SIZE    64
+
+static void bench_batch(void)
+{
+  int sizes[] = { 1000, 100000, 4000000 };
+  int num_sizes = sizeof(sizes) / sizeof(sizes[0]);
+
+  printf("batch: ns per lookup, random names\n");
+
+  char** names = (char**) malloc(BATCH_LOOKUPS * sizeof(char*));
+  char* chars = (char*) malloc(BATCH_LOOKUPS * 16);
+  int* addrs = (int*) malloc(BATCH_LOOKUPS * sizeof(int));
+
+  for (int s = 0; s < num_sizes; s++) {
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE value;
+    char name[16];
+
+    value.value_type = RAM_TYPE_INT;
+    value.types.i = 0;
+
+    ram_reserve(memory, sizes[s]);
+
+    for (int i = 0; i < sizes[s]; i++) {
+      sprintf(name, "v%08d", i);  // in sorted order, so inserts append
+      ram_write_cell_by_name(memory, value, name);
+    }
+
+    srand(s + 1);
+
+    for (int i = 0; i < BATCH_LOOKUPS; i++) {
+      int k = (int) (((long long) rand() * RAND_MAX + rand()) % sizes[s]);
+      names[i] = chars + i * 16;
+      strcpy(names[i], ram_map_name(memory, k));
+    }
+
+    long long sum = 0;
+    long long start = now_ns();
+
+    for (int i = 0; i < BATCH_LOOKUPS; i++) {
+      sum += ram_get_addr(memory, names[i]);
+    }
+
+    double single = (double) (now_ns() - start) / BATCH_LOOKUPS;
+
+    start = now_ns();
+
+    for (int i = 0; i < BATCH_LOOKUPS; i += BATCH_SIZE) {
+      ram_get_addrs(memory, names + i, BATCH_SIZE, addrs + i);
+    }
+
+    double batched = (double) (now_ns() - start) / BATCH_LOOKUPS;
+
+    for (int i = 0; i < BATCH_LOOKUPS; i++) {
+      sum -= addrs[i];
+    }
+
+    printf("  %8d vars: ram_get_addr %7.1f ns, ram_get_addrs(%d) %7.1f ns  (%.1fx%s)\n",
+           sizes[s], single, BATCH_SIZE, batched, single / batched,
+           (sum == 0) ? "" : ", **MISMATCH");
+
+    ram_destroy(memory);
+  }
+
+  free(names);
+  free(chars);
+  free(addrs);
+}
+
+
+//
+// scope: resolving names through locals -> enclosing -> globals -> builtins
+//
+
+#define SCOPE_LOOKUPS 4000000
+
+static void bench_scope(void)
+{
+  int sizes[] = { 8, 8, 2000, 150 };  // locals, enclosing, globals, builtins
+  char* prefixes[] = { "l", "e", "g", "b" };
+  struct RAM* levels[4];
+  struct RAM_VALUE value;
+  char name[16];
+
+  value.value_type = RAM_TYPE_INT;
+  value.types.i = 0;
+
+  for (int l = 0; l < 4; l++) {
+    levels[l] = ram_init();
+
+    for (int i = 0; i < sizes[l]; i++) {
+      sprintf(name, "%s%d", prefixes[l], i);
+      ram_write_cell_by_name(levels[l], value, name);
+    }
+  }
+
+  //
+  // a mix like a function body: mostly locals, then globals/builtins
+  //
+  static char names[1024][16];
+
+  srand(1);
+
+  for (int i = 0; i < 1024; i++) {
+    int r = rand() % 100;
+    int l = (r < 50) ? 0 : (r < 60) ? 1 : (r < 80) ? 2 : 3;
+
+    sprintf(names[i], "%s%d", prefixes[l], rand() % sizes[l]);
+  }
+
+  printf("scope: ns per lookup, 4 scopes (%d/%d/%d/%d vars)\n", sizes[0], sizes[1], sizes[2], sizes[3]);
+
+  long long found = 0;
+  long long start = now_ns();
+
+  for (int i = 0; i < SCOPE_LOOKUPS; i++) {
+    char* varname = names[i % 1024];
+
+    for (int l = 0; l < 4; l++) {
+      if (ram_get_addr(levels[l], varname) != -1) {
+        found++;
+        break;
+      }
+    }
+  }
+
+  double naive = (double) (now_ns() - start) / SCOPE_LOOKUPS;
+
+  struct RAM_SCOPE* scope = ram_scope_create();
+  int address;
+
+  for (int l = 3; l >= 0; l--) {
+    ram_scope_push(scope, levels[l]);
+  }
+
+  start = now_ns();
+
+  for (int i = 0; i < SCOPE_LOOKUPS; i++) {
+    if (ram_scope_resolve(scope, names[i % 1024], &address) != NULL) {
+      found--;
+    }
+  }
+
+  double chained = (double) (now_ns() - start) / SCOPE_LOOKUPS;
+  struct RAM_SCOPE_STATS stats = ram_scope_stats(scope);
+
+  printf("  %-26s %10.1f ns\n", "ram_get_addr per scope", naive);
+  printf("  %-26s %10.1f ns  (%.1fx, %.1f%% of scopes skipped%s)\n", "ram_scope_resolve", chained,
+         naive / chained, 100.0 * stats.skipped / (stats.skipped + stats.probes),
+         (found == 0) ? "" : ", **MISMATCH");
+
+  ram_scope_destroy(scope);
+
+  for (int l = 0; l < 4; l++) {
+    ram_destroy(levels[l]);
+  }
+}
+
+
+//
+// slab: ram_slab_alloc/free vs. malloc/free, 1 to N threads
+//
+
+#define SLAB_OPS    4000000  // per thread
+#define SLAB_WINDOW 256      // # of blocks each thread keeps live
+
+struct SLAB_RUN
+{
+  bool use_slab;
+  double ns;  // result: ns per alloc+free
+};
+
+static void* slab_thread(void* arg)
+{
+  struct SLAB_RUN* run = (struct SLAB_RUN*) arg;
+  void* live[SLAB_WINDOW] = { NULL };
+  size_t sizes[SLAB_WINDOW] = { 0 };
+  unsigned int seed = 12345;
+
+  long long start = now_ns();
+
+  for (int i = 0; i < SLAB_OPS; i++) {
+    int slot = i % SLAB_WINDOW;
+
+    //
+    // sizes like memory's: values (16), names, short strings:
+    //
+    seed = seed * 1103515245u + 12345u;
+    size_t bytes = 16 + (seed >> 16) % 112;
+
+    if (run->use_slab) {
+      ram_slab_free(live[slot], sizes[slot]);
+      live[slot] = ram_slab_alloc(bytes);
+    }
+    else {
+      free(live[slot]);
+      live[slot] = malloc(bytes);
+    }
+
+    *(char*) live[slot] = (char) i;
+    sizes[slot] = bytes;
+  }
+
+  run->ns = (double) (now_ns() - start) / SLAB_OPS;
+
+  for (int slot = 0; slot < SLAB_WINDOW; slot++) {
+    if (run->use_slab) {
+      ram_slab_free(live[slot], sizes[slot]);
+    }
+    else {
+      free(live[slot]);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief slab_threads: runs slab_thread on n threads at once
+ *
+ * @return average ns per alloc+free, over all threads
+ */
+static double slab_threads(int n, bool use_slab)
+{
+  pthread_t threads[64];
+  struct SLAB_RUN runs[64];
+  double total = 0.0;
+
+  for (int t = 0; t < n; t++) {
+    runs[t].use_slab = use_slab;
+    pthread_create(&threads[t], NULL, slab_thread, &runs[t]);
+  }
+
+  for (int t = 0; t < n; t++) {
+    pthread_join(threads[t], NULL);
+    total += runs[t].ns;
+  }
+
+  return total / n;
+}
+
+static void bench_slab(void)
+{
+  int max_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (max_threads < 4) {
+    max_threads = 4;  // still shows contention, if not parallel speedup
+  }
+  else if (max_threads > 16) {
+    max_threads = 16;
+  }
+
+  printf("slab: ns per alloc+free (16..127 bytes, %d live per thread)\n", SLAB_WINDOW);
+
+  for (int n = 1; n <= max_threads; n *= 2) {
+    double ns_malloc = slab_threads(n, false);
+    double ns_slab = slab_threads(n, true);
+
+    printf("  %2d thread(s): malloc %6.1f ns, ram_slab %6.1f ns  (%.1fx)\n",
+           n, ns_malloc, ns_slab, ns_malloc / ns_slab);
+  }
+
+  struct RAM_SLAB_STATS stats = ram_slab_stats();
+
+  printf("  stats: %lld allocs, %lld frees, %lld refills, %lld slabs (%.1f MB)\n",
+         stats.allocs, stats.frees, stats.refills, stats.slabs, stats.slab_bytes / 1048576.0);
+}
+
+
+//
+// latency: cost of timing every call, and the histograms it gives
+// for a workload whose inserts land at the front of the map
+//
+
+#define LATENCY_VARS 100000
+
+/**
+ * @brief latency_workload: creates vars in descending name order, then reads them
+ *
+ * @return ns taken
+ */
+static long long latency_workload(void)
+{
+  struct RAM* memory = ram_init();
+  struct RAM_VALUE value;
+  char name[16];
+
+  value.value_type = RAM_TYPE_INT;
+
+  long long start = now_ns();
+
+  for (int i = LATENCY_VARS - 1; i >= 0; i--) {
+    sprintf(name, "v%07d", i);
+    value.types.i = i;
+    ram_write_cell_by_name(memory, value, name);
+  }
+
+  for (int i = 0; i < LATENCY_VARS; i++) {
+    sprintf(name, "v%07d", i);
+    ram_free_value(ram_read_cell_by_name(memory, name));
+  }
+
+  long long ns = now_ns() - start;
+
+  ram_destroy(memory);
+
+  return ns;
+}
+
+static void bench_latency(void)
+{
+  printf("latency: %d vars created in descending order, then read by name\n", LATENCY_VARS);
+
+  ram_latency_enable(false);
+  long long off = latency_workload();
+
+  ram_latency_clear();
+  ram_latency_enable(true);
+  long long on = latency_workload();
+  ram_latency_enable(false);
+
+  printf("  timing off %.1f ms, on %.1f ms  (%+.1f%%)\n", off / 1e6, on / 1e6, 100.0 * (on - off) / off);
+
+  struct RAM_LATENCY snapshot;
+  ram_latency_snapshot(&snapshot);
+  ram_latency_print(&snapshot);
+}
+
+
+//
+// bulk: creating many variables one at a time vs. ram_bulk_load
+//
+
+#define BULK_VARS 50000
+
+static void bench_bulk(void)
+{
+  char** names = (char**) malloc(BULK_VARS * sizeof(char*));
+  struct RAM_VALUE* values = (struct RAM_VALUE*) malloc(BULK_VARS * sizeof(struct RAM_VALUE));
+  int* addrs = (int*) malloc(BULK_VARS * sizeof(int));
+
+  for (int i = 0; i < BULK_VARS; i++) {
+    names[i] = (char*) malloc(16);
+    sprintf(names[i], "name%d", (int) ((i * 7919LL) % BULK_VARS));  // scrambled order
+    values[i].value_type = RAM_TYPE_INT;
+    values[i].types.i = i;
+  }
+
+  printf("bulk: ms to create %d vars, names in scrambled order\n", BULK_VARS);
+
+  struct RAM* memory = ram_init();
+  long long start = now_ns();
+
+  for (int i = 0; i < BULK_VARS; i++) {
+    ram_write_cell_by_name(memory, values[i], names[i]);
+  }
+
+  double one_at_a_time = (now_ns() - start) / 1e6;
+
+  ram_destroy(memory);
+
+  memory = ram_init();
+  start = now_ns();
+
+  ram_bulk_load(memory, names, values, BULK_VARS, addrs);
+
+  double bulk = (now_ns() - start) / 1e6;
+
+  ram_destroy(memory);
+
+  printf("  %-26s %10.1f ms\n", "ram_write_cell_by_name", one_at_a_time);
+  printf("  %-26s %10.1f ms  (%.1fx)\n", "ram_bulk_load", bulk, one_at_a_time / bulk);
+
+  for (int i = 0; i < BULK_VARS; i++) {
+    free(names[i]);
+  }
+
+  free(names);
+  free(values);
+  free(addrs);
+}
+
+
+//
+// append: building a string with s = s + "x" vs. ram_append_str_by_addr
+//
+
+#define APPEND_CHARS 20000
+
+static void bench_append(void)
+{
+  printf("append: ms to build a %d-char string one char at a time\n", APPEND_CHARS);
+
+  struct RAM* memory = ram_init();
+  char* buffer = (char*) malloc(APPEND_CHARS + 1);
+
+  ram_write_str_by_name(memory, "", 0, "s");
+
+  long long start = now_ns();
+
+  for (int i = 0; i < APPEND_CHARS; i++) {
+    struct RAM_VALUE* value = ram_read_cell_by_addr(memory, 0);
+    int length = ram_str_length(value->types.s);
+
+    memcpy(buffer, value->types.s, length);
+    buffer[length] = 'x';
+    ram_write_str_by_addr(memory, buffer, length + 1, 0);
+
+    ram_free_value(value);
+  }
+
+  double concat = (now_ns() - start) / 1e6;
+
+  ram_write_str_by_name(memory, "", 0, "s");
+
+  start = now_ns();
+
+  for (int i = 0; i < APPEND_CHARS; i++) {
+    ram_append_str_by_addr(memory, (char*) "x", 1, 0);
+  }
+
+  double append = (now_ns() - start) / 1e6;
+
+  ram_destroy(memory);
+  free(buffer);
+
+  printf("  %-26s %10.1f ms\n", "read, concat, write", concat);
+  printf("  %-26s %10.1f ms  (%.1fx)\n", "ram_append_str_by_addr", append, concat / append);
+}
+
+
+//
+// update: x += 1 as read + add + write by name vs. ram_update_by_addr
+//
+
+#define UPDATE_OPS 2000000
+
+static void bench_update(void)
+{
+  printf("update: ns per x += 1, %d times\n", UPDATE_OPS);
+
+  struct RAM* memory = ram_init();
+  struct RAM_VALUE one;
+
+  one.value_type = RAM_TYPE_INT;
+  one.types.i = 1;
+
+  for (int i = 0; i < 1000; i++) {
+    char name[16];
+    sprintf(name, "v%d", i);
+    ram_write_cell_by_name(memory, one, name);
+  }
+
+  long long start = now_ns();
+
+  for (int i = 0; i < UPDATE_OPS; i++) {
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, (char*) "v500");
+
+    value->types.i += 1;
+    ram_write_cell_by_name(memory, *value, (char*) "v500");
+
+    ram_free_value(value);
+  }
+
+  double separate = (double) (now_ns() - start) / UPDATE_OPS;
+
+  int address = ram_get_addr(memory, (char*) "v500");
+
+  start = now_ns();
+
+  for (int i = 0; i < UPDATE_OPS; i++) {
+    ram_update_by_addr(memory, RAM_UPDATE_ADD, one, address, NULL);
+  }
+
+  double fused = (double) (now_ns() - start) / UPDATE_OPS;
+
+  ram_destroy(memory);
+
+  printf("  %-26s %10.1f ns\n", "read, add, write by name", separate);
+  printf("  %-26s %10.1f ns  (%.1fx)\n", "ram_update_by_addr", fused, separate / fused);
+}
+
+
+//
+// heap: cost of allocating objects vs. malloc/free, and how long
+// the collector pauses, in steps vs. all at once
+//
+
+#define HEAP_ALLOCS 4000000
+#define HEAP_LIVE   200000
+#define HEAP_SLOTS  4
+#define HEAP_STEP_EVERY 100
+
+static void bench_heap(void)
+{
+  printf("heap: ns per %d-slot object, %d live (a step every %d allocations)\n",
+         HEAP_SLOTS, HEAP_LIVE, HEAP_STEP_EVERY);
+
+  struct RAM* memory = ram_init();
+  struct RAM_HEAP_CONFIG config = { 0, 0, 0 };
+  struct RAM_VALUE ptr;
+
+  ram_heap_enable(memory, config);
+
+  ptr.value_type = RAM_TYPE_PTR;
+
+  for (int i = 0; i < HEAP_LIVE; i++) {
+    char name[16];
+    sprintf(name, "o%d", i);
+    ptr.types.i = ram_heap_alloc(memory, HEAP_SLOTS);
+    ram_write_cell_by_name(memory, ptr, name);
+  }
+
+  //
+  // each new object replaces an old one, which becomes garbage:
+  //
+  long long start = now_ns();
+
+  for (int i = 0; i < HEAP_ALLOCS; i++) {
+    ptr.types.i = ram_heap_alloc(memory, HEAP_SLOTS);
+    ram_write_cell_by_addr(memory, ptr, i % HEAP_LIVE);
+
+    if (i % HEAP_STEP_EVERY == 0) {
+      ram_heap_step(memory);
+    }
+  }
+
+  double heap = (double) (now_ns() - start) / HEAP_ALLOCS;
+
+  struct RAM_HEAP_STATS stats = ram_heap_stats(memory);
+
+  start = now_ns();
+  ram_heap_collect(memory);
+  double full = (now_ns() - start) / 1e3;
+
+  ram_destroy(memory);
+
+  void** objects = (void**) calloc(HEAP_LIVE, sizeof(void*));
+  size_t bytes = 16 + HEAP_SLOTS * sizeof(struct RAM_VALUE);
+
+  for (int i = 0; i < HEAP_LIVE; i++) {
+    objects[i] = malloc(bytes);
+  }
+
+  start = now_ns();
+
+  for (int i = 0; i < HEAP_ALLOCS; i++) {
+    free(objects[i % HEAP_LIVE]);
+    objects[i % HEAP_LIVE] = malloc(bytes);
+    memset(objects[i % HEAP_LIVE], 0, bytes);
+  }
+
+  double mallocs = (double) (now_ns() - start) / HEAP_ALLOCS;
+
+  for (int i = 0; i < HEAP_LIVE; i++) {
+    free(objects[i]);
+  }
+
+  free(objects);
+
+  printf("  %-26s %10.1f ns\n", "malloc, memset, free", mallocs);
+  printf("  %-26s %10.1f ns  (%.1fx)\n", "ram_heap_alloc + steps", heap, mallocs / heap);
+  printf("  %lld collections, %lld steps, %lld objects moved\n", stats.cycles, stats.steps, stats.moved);
+  printf("  %-26s %10.1f us\n", "longest step", stats.max_step_ns / 1e3);
+  printf("  %-26s %10.1f us  (all at once)\n", "ram_heap_collect", full);
+}
+
+
+//
+// snapshot: how long the caller is paused by ram_checkpoint_full
+// vs. ram_snapshot_async, which leaves the writing to a child
+//
+
+#define SNAPSHOT_VARS 2000000
+
+static void bench_snapshot(void)
+{
+  printf("snapshot: pause to save %d variables\n", SNAPSHOT_VARS);
+
+  char** names = (char**) malloc(SNAPSHOT_VARS * sizeof(char*));
+  struct RAM_VALUE* values = (struct RAM_VALUE*) malloc(SNAPSHOT_VARS * sizeof(struct RAM_VALUE));
+
+  for (int i = 0; i < SNAPSHOT_VARS; i++) {
+    names[i] = (char*) malloc(16);
+    sprintf(names[i], "v%d", i);
+    values[i].value_type = RAM_TYPE_INT;
+    values[i].types.i = i;
+  }
+
+  struct RAM* memory = ram_init();
+
+  ram_bulk_load(memory, names, values, SNAPSHOT_VARS, NULL);
+
+  for (int i = 0; i < SNAPSHOT_VARS; i++) {
+    free(names[i]);
+  }
+
+  free(names);
+  free(values);
+
+  long long start = now_ns();
+  ram_checkpoint_full(memory, (char*) "bench_snapshot.img");
+  double blocking = (now_ns() - start) / 1e6;
+
+  start = now_ns();
+  struct RAM_SNAPSHOT* snapshot = ram_snapshot_async(memory, (char*) "bench_snapshot.img");
+  double pause = (now_ns() - start) / 1e6;
+
+  //
+  // keep writing every cell while the child saves, which makes the
+  // kernel copy each page the first time it is written:
+  //
+  start = now_ns();
+
+  for (int i = 0; i < SNAPSHOT_VARS; i++) {
+    ram_write_int_by_addr(memory, -i, i);
+  }
+
+  double writes = (now_ns() - start) / 1e6;
+
+  bool success = ram_snapshot_wait(snapshot);
+  double total = (now_ns() - start) / 1e6 + pause;
+
+  remove("bench_snapshot.img");
+  ram_destroy(memory);
+
+  printf("  %-26s %10.1f ms\n", "ram_checkpoint_full", blocking);
+  printf("  %-26s %10.1f ms  (%.1fx)\n", "ram_snapshot_async", pause, blocking / pause);
+  printf("  %-26s %10.1f ms  (while it runs)\n", "writing every cell", writes);
+  printf("  %-26s %10.1f ms  (%s)\n", "until the image is saved", total, success ? "ok" : "failed");
+}
+
+
+//
+// atomic: a counter shared by threads, incremented with
+// ram_fetch_add_int_by_addr vs. ram_update_by_addr under a mutex
+//
+
+#define ATOMIC_OPS 4000000  // in total, split among the threads
+
+struct ATOMIC_ARGS
+{
+  struct RAM* memory;
+  pthread_mutex_t* lock;  // NULL => use ram_fetch_add_int_by_addr
+  int ops;
+};
+
+static void* atomic_run(void* arg)
+{
+  struct ATOMIC_ARGS* args = (struct ATOMIC_ARGS*) arg;
+  struct RAM_VALUE one;
+
+  one.value_type = RAM_TYPE_INT;
+  one.types.i = 1;
+
+  for (int i = 0; i < args->ops; i++) {
+    if (args->lock == NULL) {
+      ram_fetch_add_int_by_addr(args->memory, 1, 0, NULL);
+    }
+    else {
+      pthread_mutex_lock(args->lock);
+      ram_update_by_addr(args->memory, RAM_UPDATE_ADD, one, 0, NULL);
+      pthread_mutex_unlock(args->lock);
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief atomic_counter: times threads incrementing one shared counter
+ *
+ * @param num_threads # of threads
+ * @param lock mutex to update under, NULL => fetch-add
+ * @return average ns per increment, or -1 if the count came out wrong
+ */
+static double atomic_counter(int num_threads, pthread_mutex_t* lock)
+{
+  struct RAM* memory = ram_init();
+  struct ATOMIC_ARGS args = { memory, lock, ATOMIC_OPS / num_threads };
+  pthread_t threads[8];
+  struct RAM_VALUE zero;
+
+  zero.value_type = RAM_TYPE_INT;
+  zero.types.i = 0;
+  ram_write_cell_by_name(memory, zero, (char*) "count");
+
+  long long start = now_ns();
+
+  for (int t = 0; t < num_threads; t++) {
+    pthread_create(&threads[t], NULL, atomic_run, &args);
+  }
+
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  double ns = (double) (now_ns() - start) / ATOMIC_OPS;
+  int count = -1;
+
+  ram_read_int_by_addr(memory, 0, &count);
+  ram_destroy(memory);
+
+  return (count == args.ops * num_threads) ? ns : -1;
+}
+
+static void bench_atomic(void)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+  printf("atomic: ns per increment of a shared counter, %d in all (%ld cores)\n", ATOMIC_OPS, cores);
+
+  pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+  for (int threads = 1; threads <= 8; threads *= 2) {
+    double locked = atomic_counter(threads, &lock);
+    double atomic = atomic_counter(threads, NULL);
+    char label[32];
+
+    sprintf(label, "%d thread%s: mutex", threads, (threads > 1) ? "s" : "");
+    printf("  %-26s %10.1f ns\n", label, locked);
+    printf("  %-26s %10.1f ns  (%.1fx)\n", "   fetch-add", atomic, locked / atomic);
+  }
+}
+
+
+//
+// layout: typed reads of a hot set scattered over a big namespace,
+// before and after ram_renumber_hot_first packs it into a prefix
+//
+
+#define LAYOUT_VARS  2000000
+#define LAYOUT_HOT   32768
+#define LAYOUT_READS 20000000
+
+/**
+ * @brief layout_reads: times random typed reads of the hot cells
+ *
+ * @param memory Pointer to struct denoting memory unit
+ * @param hot LAYOUT_HOT addresses
+ * @return average ns per read
+ */
+static double layout_reads(struct RAM* memory, int* hot)
+{
+  unsigned int r = 12345;
+  long long sum = 0;
+  long long start = now_ns();
+
+  for (int i = 0; i < LAYOUT_READS; i++) {
+    int x = 0;
+
+    r = r * 1103515245u + 12345u;
+    ram_read_int_by_addr(memory, hot[(r >> 8) % LAYOUT_HOT], &x);
+    sum += x;
+  }
+
+  double ns = (double) (now_ns() - start) / LAYOUT_READS;
+
+  if (sum == 42) {  // keep the reads
+    printf(" ");
+  }
+
+  return ns;
+}
+
+static void bench_layout(void)
+{
+  printf("layout: ns per read of %d hot vars among %d\n", LAYOUT_HOT, LAYOUT_VARS);
+
+  char** names = (char**) malloc(LAYOUT_VARS * sizeof(char*));
+  struct RAM_VALUE* values = (struct RAM_VALUE*) malloc(LAYOUT_VARS * sizeof(struct RAM_VALUE));
+  int* hot = (int*) malloc(LAYOUT_HOT * sizeof(int));
+
+  for (int i = 0; i < LAYOUT_VARS; i++) {
+    names[i] = (char*) malloc(16);
+    sprintf(names[i], "v%d", i);
+    values[i].value_type = RAM_TYPE_INT;
+    values[i].types.i = i;
+  }
+
+  struct RAM* memory = ram_init();
+
+  ram_bulk_load(memory, names, values, LAYOUT_VARS, NULL);
+
+  for (int i = 0; i < LAYOUT_HOT; i++) {
+    hot[i] = (int) ((i * 7919LL * 61) % LAYOUT_VARS);  // scattered
+  }
+
+  double before = layout_reads(memory, hot);
+
+  ram_layout_sample_start(memory, 0);
+  double sampling = layout_reads(memory, hot);
+
+  struct RAM_LAYOUT_REPORT report = ram_layout_report(memory);
+  int* new_addrs = (int*) malloc(LAYOUT_VARS * sizeof(int));
+
+  long long start = now_ns();
+  ram_renumber_hot_first(memory, new_addrs);
+  double optimize = (now_ns() - start) / 1e6;
+
+  for (int i = 0; i < LAYOUT_HOT; i++) {
+    hot[i] = new_addrs[hot[i]];
+  }
+
+  ram_layout_sample_stop(memory);
+  double after = layout_reads(memory, hot);
+
+  ram_destroy(memory);
+
+  for (int i = 0; i < LAYOUT_VARS; i++) {
+    free(names[i]);
+  }
+
+  free(names);
+  free(values);
+  free(hot);
+  free(new_addrs);
+
+  printf("  %-28s %10.1f ns\n", "insertion order", before);
+  printf("  %-28s %10.1f ns\n", "  while sampling", sampling);
+  printf("  %-28s %10.1f ns  (%.1fx)\n", "after ram_renumber_hot_first", after, before / after);
+  printf("  %-28s %10.1f ms\n", "ram_renumber_hot_first", optimize);
+  printf("  %lld samples; 90%% of them in %d cells on %d lines, top decile %.0f%%\n",
+         report.samples, report.cells_for_90, report.lines_for_90, report.deciles[0] * 100);
+}
+
+
+
+//
+// names: bytes of map and names per variable, and the cost of
+// lookups and ram_destroy, before and after ram_compact_names
+//
+
+#define NAMES_VARS    2000000
+#define NAMES_LOOKUPS 1000000
+
+static double names_lookups(struct RAM* memory, char** names)
+{
+  unsigned int r = 12345;
+  long long sum = 0;
+  long long start = now_ns();
+
+  for (int i = 0; i < NAMES_LOOKUPS; i++) {
+    r = r * 1103515245u + 12345u;
+    sum += ram_get_addr(memory, names[(r >> 4) % NAMES_VARS]);
+  }
+
+  double ns = (double) (now_ns() - start) / NAMES_LOOKUPS;
+
+  if (sum == 42) {  // keep the lookups
+    printf(" ");
+  }
+
+  return ns;
+}
+
+static double names_bytes(struct RAM* memory)
+{
+  struct RAM_USAGE usage = ram_memory_usage(memory);
+
+  return (double) (usage.map + usage.names) / ram_size(memory);
+}
+
+static void bench_names(void)
+{
+  printf("names: %d variables named v0, v1, ...\n", NAMES_VARS);
+
+  char** names = (char**) malloc(NAMES_VARS * sizeof(char*));
+
+  for (int i = 0; i < NAMES_VARS; i++) {
+    names[i] = (char*) malloc(16);
+    sprintf(names[i], "v%d", i);
+  }
+
+  struct RAM* memory = ram_init();
+
+  ram_bulk_load(memory, names, NULL, NAMES_VARS, NULL);
+
+  double whole = names_bytes(memory);
+  double lookup = names_lookups(memory, names);
+
+  long long start = now_ns();
+  ram_compact_names(memory, true);
+  double compact = (now_ns() - start) / 1e6;
+
+  double coded = names_bytes(memory);
+  double coded_lookup = names_lookups(memory, names);
+
+  start = now_ns();
+  ram_destroy(memory);
+  double destroy = (now_ns() - start) / 1e6;
+
+  for (int i = 0; i < NAMES_VARS; i++) {
+    free(names[i]);
+  }
+
+  free(names);
+
+  printf("  %-26s %10.1f bytes/var  %6.1f ns/lookup\n", "names stored whole", whole, lookup);
+  printf("  %-26s %10.1f bytes/var  %6.1f ns/lookup\n", "front-coded", coded, coded_lookup);
+  printf("  %-26s %10.1f ms\n", "ram_compact_names", compact);
+  printf("  %-26s %10.1f ms\n", "ram_destroy", destroy);
+}
+
+
+int main(int argc, char* argv[])
+{
+  struct
+  {
+    char* name;
+    void (*run)(void);
+  } benchmarks[] = {
+    { "journal", bench_journal },
+    { "typed",   bench_typed },
+    { "batch",   bench_batch },
+    { "scope",   bench_scope },
+    { "slab",    bench_slab },
+    { "latency", bench_latency },
+    { "bulk",    bench_bulk },
+    { "append",  bench_append },
+    { "update",  bench_update },
+    { "heap",    bench_heap },
+    { "snapshot", bench_snapshot },
+    { "atomic",  bench_atomic },
+    { "layout",  bench_layout },
+    { "names",   bench_names },
+  };
+  int num_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+  for (int i = 0; i < num_benchmarks; i++) {
+    if (argc < 2 || strcmp(argv[1], benchmarks[i].name) == 0) {
+      benchmarks[i].run();
+      printf("\n");
+    }
+  }
+
+  return 0;
+}
@@ -17,8 +17,191 @@
 #include <stdbool.h> // true, false
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>  // SIZE_MAX
+#include <stddef.h>  // offsetof
+#include <limits.h>  // INT_MAX
+#include <pthread.h>
+#include <unistd.h>  // sysconf, fork, pipe2
+#include <fcntl.h>   // O_CLOEXEC
+#include <sys/wait.h> // waitpid
+#include <errno.h>
 
 #include "ram.h"
+#include "ram_heap.h"
+#include "ram_journal.h"
+#include "ram_latency.h"
+#include "ram_layout.h"
+#include "ram_slab.h"
+#include "ram_trace.h"
+
+//
+// Hint to bring the cache line holding p into cache ahead of use:
+//
+#if defined(__GNUC__)
+#define RAM_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define RAM_PREFETCH(p) ((void) (p))
+#endif
+
+//
+// # of lookups ram_get_addrs keeps in flight at once, and the # of
+// vars below which the map fits in cache and it just does them one
+// at a time (interleaving only pays off when lookups miss cache):
+//
+#define RAM_BATCH_WIDTH 16
+#define RAM_BATCH_MIN_SIZE 65536
+
+//
+// Times the rest of the enclosing function for the latency
+// histograms, when they are on (see ram_latency.h): the variable's
+// cleanup runs latency_end on every return.
+//
+struct LATENCY_SCOPE
+{
+  int op;                    // enum RAM_LATENCY_OPS, -1 => not timing
+  unsigned long long start;  // latency_ticks() on entry
+};
+
+#define RAM_LATENCY_SCOPE(op) \
+  struct LATENCY_SCOPE latency_scope __attribute__((cleanup(latency_end))) = latency_begin(op)
+
+static inline struct LATENCY_SCOPE latency_begin(int op)
+{
+  struct LATENCY_SCOPE scope = { -1, 0 };
+
+  if (__builtin_expect(__atomic_load_n(&latency_on, __ATOMIC_RELAXED), 0)) {
+    scope.op = op;
+    scope.start = latency_ticks();
+  }
+
+  return scope;
+}
+
+static inline void latency_end(struct LATENCY_SCOPE* scope)
+{
+  if (scope->op >= 0) {
+    latency_record(scope->op, latency_ticks() - scope->start);
+  }
+}
+
+//
+// Names block (see struct RAM_NAMES). A name stored whole is just its
+// chars and a '\0'. A front-coded one is 2 bytes, the # of leading
+// chars it shares with its anchor (3..255) and how far back the
+// anchor starts (1..255 bytes), then the rest of its chars and a
+// '\0'. An anchor is always stored whole, and since front-coded
+// names are only written by ram_compact_names, outside a
+// transaction, no anchor is ever removed before the names that
+// refer to it.
+//
+#define RAM_NAMES_MIN_CAPACITY 64
+#define RAM_NAMES_MAX_CAPACITY (RAM_NAME_CODED - 1)
+#define RAM_NAME_MIN_SHARED    3    // a shorter prefix costs more than it saves
+#define RAM_NAME_MAX_SHARED    255
+#define RAM_NAME_MAX_BACK      255
+
+/**
+ * @brief name_str: a name in the names block, as a C string
+ * 
+ * A front-coded name is decoded into memory->names.scratch, so it
+ * is only good until the next call.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param name the name's offset, as in a map entry
+ * @return '\0'-terminated name
+ */
+static char* name_str(struct RAM* memory, unsigned int name)
+{
+  char* chars = memory->names.chars;
+
+  if (!(name & RAM_NAME_CODED)) {
+    return chars + name;
+  }
+
+  unsigned char* record = (unsigned char*) chars + (name & ~RAM_NAME_CODED);
+  int shared = record[0];
+  char* anchor = (char*) record - record[1];
+  char* scratch = memory->names.scratch;
+
+  memcpy(scratch, anchor, shared);
+  strcpy(scratch + shared, (char*) record + 2);
+
+  return scratch;
+}
+
+/**
+ * @brief name_compare: compares a name in the names block to another
+ * 
+ * Compares a front-coded name without decoding it.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param name the name's offset, as in a map entry
+ * @param varname Variable name to compare it to
+ * @return < 0, 0 or > 0, as strcmp(name, varname)
+ */
+static int name_compare(struct RAM* memory, unsigned int name, char* varname)
+{
+  char* chars = memory->names.chars;
+
+  if (!(name & RAM_NAME_CODED)) {
+    return strcmp(chars + name, varname);
+  }
+
+  unsigned char* record = (unsigned char*) chars + (name & ~RAM_NAME_CODED);
+  int shared = record[0];
+  int cmp = strncmp((char*) record - record[1], varname, shared);
+
+  //
+  // equal => varname has at least shared chars, as strncmp stops at
+  // its '\0' (and the anchor has no '\0' among them):
+  //
+  if (cmp != 0) {
+    return cmp;
+  }
+
+  return strcmp((char*) record + 2, varname + shared);
+}
+
+/**
+ * @brief name_compare_n: compares a name in the names block to one of known length
+ * 
+ * @param memory Pointer to RAM struct
+ * @param name the name's offset, as in a map entry
+ * @param varname Variable name (need not be '\0'-terminated)
+ * @param length # of chars in varname
+ * @return < 0, 0 or > 0, as strcmp(name, varname) if varname were terminated
+ */
+static int name_compare_n(struct RAM* memory, unsigned int name, char* varname, int length)
+{
+  char* chars = memory->names.chars;
+  char* rest = chars + name;
+  int shared = 0;
+
+  if (name & RAM_NAME_CODED) {
+    unsigned char* record = (unsigned char*) chars + (name & ~RAM_NAME_CODED);
+
+    shared = record[0];
+    rest = (char*) record + 2;
+
+    int cmp = strncmp((char*) record - record[1], varname, (shared < length) ? shared : length);
+
+    if (cmp != 0) {
+      return cmp;
+    }
+
+    if (shared >= length) {
+      return (shared > length || rest[0] != '\0');  // name is longer, so it sorts after
+    }
+  }
+
+  int cmp = strncmp(rest, varname + shared, length - shared);
+
+  if (cmp == 0 && rest[length - shared] != '\0') {
+    cmp = 1;  // name is longer, so it sorts after
+  }
+
+  return cmp;
+}
 
 /**
  * @brief binary_search: searches the map for a variable name
@@ -37,7 +220,7 @@ static int binary_search(struct RAM* memory, char* varname)
   
   while (left <= right) {
     int mid = (left + right) / 2;
-    int cmp = strcmp(memory->map[mid].varname, varname);
+    int cmp = name_compare(memory, memory->map[mid].name, varname);
     
     if (cmp == 0) {
       return mid;
@@ -54,396 +237,4913 @@ static int binary_search(struct RAM* memory, char* varname)
 }
 
 /**
- * @brief grow_if_needed: doubles the capacity if memory is full
+ * @brief binary_search_n: searches the map for a name of known length
  * 
- * Checks if size has reached capacity, and if so, doubles the
- * capacity of both the cells and map arrays.
+ * Same as binary_search, but the name is length chars and need
+ * not be '\0'-terminated.
  * 
  * @param memory Pointer to RAM struct
+ * @param varname Variable name to search for
+ * @param length # of chars in varname
+ * @return Index in map if found, -1 if not found
  */
-static void grow_if_needed(struct RAM* memory)
+static int binary_search_n(struct RAM* memory, char* varname, int length)
 {
-  if (memory->size >= memory->capacity) {
-    int new_capacity = memory->capacity * 2;
+  int left = 0;
+  int right = memory->size - 1;
+  
+  while (left <= right) {
+    int mid = (left + right) / 2;
+    int cmp = name_compare_n(memory, memory->map[mid].name, varname, length);
     
-    memory->cells = (struct RAM_VALUE*) realloc(memory->cells, 
-                                                 new_capacity * sizeof(struct RAM_VALUE));
-
-    for (int i = memory->capacity; i < new_capacity; i++) {
-      memory->cells[i].value_type = RAM_TYPE_NONE;
+    if (cmp == 0) {
+      return mid;
+    }
+    else if (cmp < 0) {
+      left = mid + 1;
+    }
+    else {
+      right = mid - 1; 
     }
-
-    memory->map = (struct RAM_MAP*) realloc(memory->map, 
-                                             new_capacity * sizeof(struct RAM_MAP));
-    
-    memory->capacity = new_capacity;
   }
+  
+  return -1;
 }
 
+//
+// One lookup in flight in ram_get_addrs:
+//
+struct RAM_PROBE
+{
+  int query;   // index of the name being looked up, -1 => slot unused
+  int left;    // binary search bounds
+  int right;
+  int mid;     // map entry being probed
+  char* name;  // its name's chars, once loaded (stage 1)
+  int stage;   // 0 => map[mid] prefetched, 1 => name prefetched
+};
+
 /**
- * @brief insert_into_map: inserts a new variable into the map
+ * @brief probe_start: starts the binary search for a name in a batch
  * 
- * Inserts the variable in alphabetical order by shifting existing
- * elements to the right as needed.
+ * Used by ram_get_addrs. Sets up the probe for the given query and
+ * prefetches the first map entry it will look at.
  * 
  * @param memory Pointer to RAM struct
- * @param varname Variable name to insert (will be duplicated)
- * @param cell Cell number where the variable's value is stored
+ * @param probe Probe to start
+ * @param query Index of the name in the batch
  */
-static void insert_into_map(struct RAM* memory, char* varname, int cell)
+static void probe_start(struct RAM* memory, struct RAM_PROBE* probe, int query)
 {
-  // Find insertion position (where this varname should go alphabetically)
-  int insert_pos = 0;
-  while (insert_pos < memory->size && 
-         strcmp(memory->map[insert_pos].varname, varname) < 0) {
-    insert_pos++;
+  probe->query = query;
+  probe->left = 0;
+  probe->right = memory->size - 1;
+  probe->mid = (probe->left + probe->right) / 2;
+  probe->stage = 0;
+
+  RAM_PREFETCH(&memory->map[probe->mid]);
+}
+
+/**
+ * @brief trace_value: records a write of the given value to the trace
+ * 
+ * Only the value's shape is recorded: its type, plus the length of
+ * a string or array.
+ * 
+ * @param trace Pointer to the trace
+ * @param varname Variable name, or NULL if written by address
+ * @param address Address written to, if varname is NULL
+ * @param value Value being written
+ */
+static void trace_value(struct RAM_TRACE* trace, char* varname, int address, struct RAM_VALUE* value)
+{
+  int length = 0;
+  int elem_type = 0;
+
+  if (value->value_type == RAM_TYPE_STR) {
+    length = (int) strlen(value->types.s);
   }
-  
-  // Shift elements to the right to make room
-  for (int i = memory->size; i > insert_pos; i--) {
-    memory->map[i] = memory->map[i-1];
+  else if (value->value_type == RAM_TYPE_ARRAY) {
+    length = value->types.a->length;
+    elem_type = value->types.a->elem_type;
   }
-  
-  // Insert the new entry
-  memory->map[insert_pos].varname = strdup(varname);
-  memory->map[insert_pos].cell = cell;
+
+  trace_write(trace, varname, (varname == NULL) ? 0 : (int) strlen(varname), address,
+              value->value_type, length, elem_type);
 }
 
 /**
- * @brief copy_value: creates a deep copy of a RAM_VALUE
+ * @brief charge: adjusts memory usage accounting
  * 
- * Allocates memory for a new RAM_VALUE and copies the contents.
- * For strings, creates a duplicate of the string.
+ * Adds the given # of bytes (which may be negative) to one of the
+ * categories of memory->usage, and to the total.
  * 
- * @param original Pointer to the value to copy
- * @return Pointer to newly allocated copy
+ * @param memory Pointer to RAM struct
+ * @param category Pointer to the field of memory->usage to adjust
+ * @param bytes # of bytes to add
  */
-static struct RAM_VALUE* copy_value(struct RAM_VALUE* original)
+static void charge(struct RAM* memory, long long* category, long long bytes)
 {
-  struct RAM_VALUE* copy = (struct RAM_VALUE*) malloc(sizeof(struct RAM_VALUE));
-  
-  copy->value_type = original->value_type;
-  
-  if (original->value_type == RAM_TYPE_STR) {
-    copy->types.s = strdup(original->types.s);
+  *category += bytes;
+  memory->usage.total += bytes;
+}
+
+/**
+ * @brief within_budget: can memory grow by this many bytes?
+ * 
+ * @param memory Pointer to RAM struct
+ * @param bytes # of additional bytes needed (may be negative)
+ * @return true if there is no budget or the bytes fit, false if not
+ */
+static bool within_budget(struct RAM* memory, long long bytes)
+{
+  if (memory->budget <= 0 || bytes <= 0) {
+    return true;
+  }
+
+  return memory->usage.total + bytes <= memory->budget;
+}
+
+/**
+ * @brief next_capacity: capacity to grow a full array to
+ * 
+ * Doubles the capacity, but never past max, so the new capacity
+ * (and the # of bytes it needs) cannot overflow.
+ * 
+ * @param capacity Current capacity (>= 1)
+ * @param max Largest capacity allowed
+ * @return new capacity, max if doubling would pass it
+ */
+static int next_capacity(int capacity, int max)
+{
+  if (capacity > max / 2) {
+    return max;
+  }
+
+  return capacity * 2;
+}
+
+/**
+ * @brief growth_bytes: # of bytes grow_if_needed would allocate
+ * 
+ * @param memory Pointer to RAM struct
+ * @return # of additional bytes, 0 if memory is allocated and not full
+ */
+static long long growth_bytes(struct RAM* memory)
+{
+  long long new_cells;
+
+  if (memory->segments == NULL) {
+    new_cells = memory->capacity;
+  }
+  else if (memory->size < memory->capacity) {
+    return 0;
   }
   else {
-    copy->types = original->types;
+    new_cells = next_capacity(memory->capacity, RAM_MAX_CAPACITY) - memory->capacity;
   }
-  
-  return copy;
+
+  return new_cells * (sizeof(struct RAM_VALUE) + sizeof(struct RAM_MAP));
+}
+
+/**
+ * @brief dirty_resize: resizes the dirty-tracking arrays
+ * 
+ * Called whenever the capacity of memory grows, so the bitmap
+ * has a bit for every cell, and the lists have room for every cell.
+ * Does nothing if dirty tracking has not been started. If an array
+ * cannot be grown, the ones already grown just have unused room.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param new_capacity New capacity of memory (>= current capacity)
+ * @return true if successful, false if out of memory
+ */
+static bool dirty_resize(struct RAM* memory, int new_capacity)
+{
+  struct RAM_DIRTY* dirty = &memory->dirty;
+
+  if (dirty->bits == NULL) {
+    return true;
+  }
+
+  long long old_bytes = ((long long) memory->capacity + 7) / 8;
+  long long new_bytes = ((long long) new_capacity + 7) / 8;
+
+  unsigned char* bits = (unsigned char*) realloc(dirty->bits, new_bytes);
+
+  if (bits == NULL) {
+    return false;
+  }
+
+  memset(bits + old_bytes, 0, new_bytes - old_bytes);
+  dirty->bits = bits;
+
+  int* cells = (int*) realloc(dirty->cells, (size_t) new_capacity * sizeof(int));
+
+  if (cells == NULL) {
+    return false;
+  }
+
+  dirty->cells = cells;
+
+  unsigned int* names = (unsigned int*) realloc(dirty->names, (size_t) new_capacity * sizeof(unsigned int));
+
+  if (names == NULL) {
+    return false;
+  }
+
+  dirty->names = names;
+
+  charge(memory, &memory->usage.dirty, 
+         (new_bytes - old_bytes) + 
+         (long long) (new_capacity - memory->capacity) * (sizeof(int) + sizeof(unsigned int)));
+
+  return true;
+}
+
+/**
+ * @brief bloom_mask: the bits a name sets in its Bloom filter word
+ * 
+ * @param hash Hash of the name (see ram_name_hash)
+ * @return 64-bit mask with (up to) 2 bits set
+ */
+static unsigned long long bloom_mask(unsigned int hash)
+{
+  unsigned int mixed = hash * 0x9E3779B1u;
+
+  return (1ULL << (mixed >> 26)) | (1ULL << ((mixed >> 20) & 63));
+}
+
+/**
+ * @brief bloom_add: adds a name to memory's Bloom filter
+ * 
+ * Does nothing if the filter is not enabled.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param varname Variable name
+ */
+static void bloom_add(struct RAM* memory, char* varname)
+{
+  struct RAM_BLOOM* bloom = &memory->bloom;
+
+  if (bloom->words == NULL) {
+    return;
+  }
+
+  unsigned int hash = ram_name_hash(varname);
+
+  bloom->words[hash & (bloom->num_words - 1)] |= bloom_mask(hash);
 }
 
+/**
+ * @brief bloom_build: (re)builds memory's Bloom filter from the map
+ * 
+ * Sizes the filter for the current capacity (about 8 bits per
+ * cell, 512 at least) and adds every name in memory. Rebuilding also drops
+ * names that have since been removed.
+ * 
+ * @param memory Pointer to RAM struct
+ */
+static void bloom_build(struct RAM* memory)
+{
+  struct RAM_BLOOM* bloom = &memory->bloom;
+  int num_words = 8;  // at least one cache line, so small scopes rarely give false positives
+
+  while (num_words < memory->capacity / 8) {
+    num_words *= 2;
+  }
+
+  unsigned long long* words = (unsigned long long*) calloc(num_words, sizeof(unsigned long long));
+
+  //
+  // out of memory: a filter that is too small (or none) still works,
+  // it just answers fewer misses:
+  //
+  if (words == NULL) {
+    return;
+  }
+
+  free(bloom->words);
+
+  bloom->words = words;
+  bloom->num_words = num_words;
+
+  charge(memory, &memory->usage.bloom, 
+         (long long) num_words * sizeof(unsigned long long) - memory->usage.bloom);
+
+  for (int i = 0; i < memory->size; i++) {
+    bloom_add(memory, name_str(memory, memory->map[i].name));
+  }
+}
 
 //
-// Public functions:
+// Segments come from malloc, so every cell is at least 8-byte
+// aligned; the atomic ops in ram.h also need its int and double to
+// be, and lock-free:
 //
+static_assert(offsetof(struct RAM_VALUE, types) % sizeof(double) == 0, "cell contents not 8-byte aligned");
+static_assert(sizeof(struct RAM_VALUE) % sizeof(double) == 0, "cells not a multiple of 8 bytes");
+static_assert(__atomic_always_lock_free(sizeof(double), 0) && __atomic_always_lock_free(sizeof(int), 0),
+              "no lock-free atomics for cell contents");
 
 /**
-  * @brief ram_init: initialize memory unit
-  *
-  * Returns a pointer to a dynamically-allocated memory
-  * for storing nuPython variables and their values. All
-  * memory cells are initialized to the value None. You
-  * take ownership of the returned memory and must call
-  * ram_destroy() when you are done.
-  *
-  * @return pointer to struct denoting memory unit
+ * @brief segments_free: frees every cell segment and the directory
+ * 
+ * @param memory Pointer to RAM struct
+ */
+static void segments_free(struct RAM* memory)
+{
+  for (int k = 0; k < memory->num_segments; k++) {
+    free(memory->segments[k]);
+  }
+
+  charge(memory, &memory->usage.cells, -(long long) memory->max_segments * sizeof(struct RAM_VALUE*));
+
+  free(memory->segments);
+
+  memory->segments = NULL;
+  memory->num_segments = 0;
+  memory->max_segments = 0;
+}
+
+/**
+ * @brief segments_resize: changes the # of cells in the segments
+ * 
+ * Up to RAM_SEGMENT_CELLS cells are all in segment 0, which is
+ * resized to hold just that many (and may move). Past that, every
+ * segment is full: growing adds segments and shrinking frees them,
+ * without moving any cell. New cells are not initialized. Shrinking
+ * always succeeds; if growing fails, the segments are left as they
+ * were (except that segment 0 may have room to spare).
+ * 
+ * @param memory Pointer to RAM struct
+ * @param old_capacity # of cells now, 0 => no segments yet
+ * @param new_capacity # of cells, <= RAM_SEGMENT_CELLS or a multiple of it
+ * @return true if successful, false if out of memory
+ */
+static bool segments_resize(struct RAM* memory, int old_capacity, int new_capacity)
+{
+  int old_segments = memory->num_segments;
+  int new_segments = (new_capacity + RAM_SEGMENT_MASK) >> RAM_SEGMENT_SHIFT;
+
+  if (new_segments > memory->max_segments) {
+    int max_segments = (memory->max_segments > 0) ? memory->max_segments : 1;
+
+    while (max_segments < new_segments) {
+      max_segments *= 2;
+    }
+
+    struct RAM_VALUE** segments = (struct RAM_VALUE**) realloc(memory->segments, 
+                                                               max_segments * sizeof(struct RAM_VALUE*));
+
+    if (segments == NULL) {
+      return false;
+    }
+
+    charge(memory, &memory->usage.cells, 
+           (long long) (max_segments - memory->max_segments) * sizeof(struct RAM_VALUE*));
+
+    memory->segments = segments;
+    memory->max_segments = max_segments;
+  }
+
+  int old_first = (old_capacity < RAM_SEGMENT_CELLS) ? old_capacity : RAM_SEGMENT_CELLS;
+  int new_first = (new_capacity < RAM_SEGMENT_CELLS) ? new_capacity : RAM_SEGMENT_CELLS;
+
+  if (new_first != old_first) {
+    struct RAM_VALUE* first = (struct RAM_VALUE*) realloc((old_segments > 0) ? memory->segments[0] : NULL, 
+                                                          new_first * sizeof(struct RAM_VALUE));
+
+    if (first != NULL) {
+      memory->segments[0] = first;
+      memory->num_segments = (old_segments > 0) ? old_segments : 1;
+    }
+    else if (new_first > old_first) {
+      return false;
+    }
+  }
+
+  //
+  // segments past the first are always full size:
+  //
+  for (int k = memory->num_segments; k < new_segments; k++) {
+    memory->segments[k] = (struct RAM_VALUE*) malloc(RAM_SEGMENT_CELLS * sizeof(struct RAM_VALUE));
+
+    if (memory->segments[k] == NULL) {
+      while (memory->num_segments > old_segments && memory->num_segments > 1) {
+        memory->num_segments--;
+        free(memory->segments[memory->num_segments]);
+      }
+
+      return false;
+    }
+
+    memory->num_segments = k + 1;
+  }
+
+  while (memory->num_segments > new_segments) {
+    memory->num_segments--;
+    free(memory->segments[memory->num_segments]);
+  }
+
+  return true;
+}
+
+/**
+ * @brief resize: changes the capacity of memory
+ * 
+ * Resizes both the cell segments and the map array (allocating them
+ * if this is the first write to memory); new cells are None. A
+ * capacity of more than one segment is rounded up to whole
+ * segments. Shrinking is only allowed down to the current size, and
+ * always succeeds. If growing fails, memory is left as it was (the
+ * map array or segment 0 may just have unused room).
+ * 
+ * @param memory Pointer to RAM struct
+ * @param new_capacity New capacity (>= size, <= RAM_MAX_CAPACITY)
+ * @return true if successful, false if out of memory
+ */
+static bool resize(struct RAM* memory, int new_capacity)
+{
+  int old_capacity = (memory->segments == NULL) ? 0 : memory->capacity;
+
+  if (new_capacity > RAM_SEGMENT_CELLS) {
+    new_capacity = (new_capacity + RAM_SEGMENT_MASK) & ~RAM_SEGMENT_MASK;
+  }
+
+  bool growing = (new_capacity > old_capacity);
+
+  if ((size_t) new_capacity > SIZE_MAX / sizeof(struct RAM_MAP)) {
+    return false;
+  }
+
+  if (!segments_resize(memory, old_capacity, new_capacity)) {
+    if (old_capacity == 0) {
+      segments_free(memory);
+    }
+
+    return false;
+  }
+
+  struct RAM_MAP* map = (struct RAM_MAP*) realloc(memory->map, 
+                                                  (size_t) new_capacity * sizeof(struct RAM_MAP));
+
+  if (map != NULL) {
+    memory->map = map;
+  }
+
+  if (growing && (map == NULL || 
+                  (new_capacity > memory->capacity && !dirty_resize(memory, new_capacity)))) {
+    if (old_capacity == 0) {
+      segments_free(memory);
+    }
+    else {
+      segments_resize(memory, new_capacity, old_capacity);
+    }
+
+    return false;
+  }
+
+  for (int i = old_capacity; i < new_capacity; i++) {
+    ram_cell(memory, i)->value_type = RAM_TYPE_NONE;
+  }
+  
+  charge(memory, &memory->usage.cells, 
+         (long long) (new_capacity - old_capacity) * sizeof(struct RAM_VALUE));
+  charge(memory, &memory->usage.map, 
+         (long long) (new_capacity - old_capacity) * sizeof(struct RAM_MAP));
+
+  memory->capacity = new_capacity;
+
+  if (memory->bloom.words != NULL && memory->bloom.num_words < new_capacity / 8) {
+    bloom_build(memory);
+  }
+
+  return true;
+}
+
+/**
+ * @brief grow_if_needed: doubles the capacity if memory is full
+ * 
+ * Checks if size has reached capacity, and if so, doubles the
+ * capacity of both the cells and the map (see next_capacity). Cells
+ * already in full segments stay where they are. A new memory does
+ * not allocate its cells and map until they are first needed here.
+ * 
+ * @param memory Pointer to RAM struct
+ * @return true if there is room for one more variable, false if
+ *         memory is at RAM_MAX_CAPACITY or out of memory
+ */
+static bool grow_if_needed(struct RAM* memory)
+{
+  if (memory->segments == NULL) {
+    return resize(memory, memory->capacity);
+  }
+
+  if (memory->size < memory->capacity) {
+    return true;
+  }
+
+  if (memory->capacity >= RAM_MAX_CAPACITY) {
+    return false;
+  }
+
+  return resize(memory, next_capacity(memory->capacity, RAM_MAX_CAPACITY));
+}
+
+/**
+ * @brief dirty_stop: stops dirty tracking and frees its arrays
+ * 
+ * A full checkpoint has to be taken before the next delta.
+ * 
+ * @param memory Pointer to RAM struct
+ */
+static void dirty_stop(struct RAM* memory)
+{
+  struct RAM_DIRTY* dirty = &memory->dirty;
+
+  free(dirty->bits);
+  free(dirty->cells);
+  free(dirty->names);
+
+  dirty->bits = NULL;
+  dirty->cells = NULL;
+  dirty->num_cells = 0;
+  dirty->names = NULL;
+  dirty->num_names = 0;
+  dirty->low_size = 0;
+
+  charge(memory, &memory->usage.dirty, -memory->usage.dirty);
+}
+
+/**
+ * @brief mark_dirty: records that a cell has changed
+ * 
+ * Does nothing if dirty tracking has not been started, or the
+ * cell is already marked.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param cell Cell number that changed
+ */
+static void mark_dirty(struct RAM* memory, int cell)
+{
+  struct RAM_DIRTY* dirty = &memory->dirty;
+
+  if (dirty->bits == NULL) {
+    return;
+  }
+
+  unsigned char mask = (unsigned char) (1 << (cell % 8));
+
+  if ((dirty->bits[cell / 8] & mask) == 0) {
+    dirty->bits[cell / 8] |= mask;
+    dirty->cells[dirty->num_cells] = cell;
+    dirty->num_cells++;
+  }
+}
+
+/**
+ * @brief dirty_clear: starts a new checkpoint interval
+ * 
+ * Clears the bits of the cells that changed since the last
+ * checkpoint (not the whole bitmap), and forgets the new names.
+ * 
+ * @param memory Pointer to RAM struct
+ */
+static void dirty_clear(struct RAM* memory)
+{
+  struct RAM_DIRTY* dirty = &memory->dirty;
+
+  for (int i = 0; i < dirty->num_cells; i++) {
+    int cell = dirty->cells[i];
+
+    dirty->bits[cell / 8] &= (unsigned char) ~(1 << (cell % 8));
+  }
+
+  dirty->num_cells = 0;
+  dirty->num_names = 0;
+  dirty->low_size = memory->size;
+}
+
+/**
+ * @brief names_growth: # of bytes the names block grows by to fit more chars
+ * 
+ * @param memory Pointer to RAM struct
+ * @param chars # of chars to be added
+ * @return # of bytes, 0 if they already fit
+ */
+static long long names_growth(struct RAM* memory, long long chars)
+{
+  struct RAM_NAMES* names = &memory->names;
+  long long needed = (long long) names->used + chars;
+  long long capacity = 2 * (long long) names->capacity;
+
+  if (needed <= names->capacity) {
+    return 0;
+  }
+
+  if (capacity < RAM_NAMES_MIN_CAPACITY) {
+    capacity = RAM_NAMES_MIN_CAPACITY;
+  }
+
+  //
+  // double, or grow to just what's needed if that's more (e.g. for
+  // a bulk load):
+  //
+  if (capacity < needed) {
+    capacity = needed;
+  }
+
+  if (capacity > RAM_NAMES_MAX_CAPACITY && needed <= RAM_NAMES_MAX_CAPACITY) {
+    capacity = RAM_NAMES_MAX_CAPACITY;
+  }
+
+  return capacity - names->capacity;
+}
+
+/**
+ * @brief names_reserve: makes room for more chars in the names block
+ * 
+ * The block may move, so pointers into it are no good afterwards;
+ * offsets still are.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param chars # of chars to make room for
+ * @return true if successful, false if out of memory or too many chars
+ */
+static bool names_reserve(struct RAM* memory, long long chars)
+{
+  struct RAM_NAMES* names = &memory->names;
+  long long growth = names_growth(memory, chars);
+
+  if (growth == 0) {
+    return true;
+  }
+
+  long long capacity = names->capacity + growth;
+
+  if (capacity > RAM_NAMES_MAX_CAPACITY) {
+    return false;
+  }
+
+  char* block = (char*) realloc(names->chars, (size_t) capacity);
+
+  if (block == NULL) {
+    return false;
+  }
+
+  names->chars = block;
+  names->capacity = (unsigned int) capacity;
+
+  charge(memory, &memory->usage.names, growth);
+
+  return true;
+}
+
+/**
+ * @brief names_append: adds a name to the end of the names block
+ * 
+ * Room must have been made with names_reserve().
+ * 
+ * @param memory Pointer to RAM struct
+ * @param varname Variable name (need not be '\0'-terminated)
+ * @param length # of chars in the name
+ * @return the name's offset, for its map entry
+ */
+static unsigned int names_append(struct RAM* memory, char* varname, int length)
+{
+  struct RAM_NAMES* names = &memory->names;
+  unsigned int offset = names->used;
+
+  memcpy(names->chars + offset, varname, length);
+  names->chars[offset + length] = '\0';
+  names->used += length + 1;
+
+  return offset;
+}
+
+/**
+ * @brief names_remove: gives back the chars of a name no longer in the map
+ * 
+ * The last name added is cut off the end of the block; any other
+ * becomes garbage, until ram_compact_names or ram_reset.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param name the name's offset, as in its map entry (now removed)
+ */
+static void names_remove(struct RAM* memory, unsigned int name)
+{
+  struct RAM_NAMES* names = &memory->names;
+  unsigned int offset = name & ~RAM_NAME_CODED;
+  unsigned int header = (name & RAM_NAME_CODED) ? 2 : 0;
+  unsigned int end = offset + header + (unsigned int) strlen(names->chars + offset + header) + 1;
+
+  if (end == names->used) {
+    names->used = offset;
+  }
+  else {
+    names->garbage += end - offset;
+  }
+
+  if (names->garbage == names->used) {
+    names->used = 0;
+    names->garbage = 0;
+  }
+}
+
+/**
+ * @brief names_free: frees the names block, and the scratch for decoding
+ * 
+ * @param memory Pointer to RAM struct
+ */
+static void names_free(struct RAM* memory)
+{
+  struct RAM_NAMES* names = &memory->names;
+
+  charge(memory, &memory->usage.names, -memory->usage.names);
+
+  free(names->chars);
+  free(names->scratch);
+
+  names->chars = NULL;
+  names->used = 0;
+  names->capacity = 0;
+  names->garbage = 0;
+  names->scratch = NULL;
+  names->scratch_capacity = 0;
+}
+
+/**
+ * @brief name_free: frees a name from read_name()
+ * 
+ * @param varname Variable name, may be NULL
+ */
+static void name_free(char* varname)
+{
+  if (varname != NULL) {
+    ram_slab_free(varname, strlen(varname) + 1);
+  }
+}
+
+/**
+ * @brief insert_into_map: inserts a new variable into the map
+ * 
+ * Inserts the variable in alphabetical order by shifting existing
+ * elements to the right as needed.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param varname Variable name to insert (copied into the names block)
+ * @param cell Cell number where the variable's value is stored
+ * @return Index in map where the variable was inserted, -1 if out of memory
+ */
+static int insert_into_map(struct RAM* memory, char* varname, int cell)
+{
+  int length = (int) strlen(varname);
+
+  if (!names_reserve(memory, length + 1)) {
+    return -1;
+  }
+
+  // Find insertion position (where this varname should go alphabetically)
+  int insert_pos = 0;
+  int right = memory->size;
+
+  while (insert_pos < right) {
+    int mid = (insert_pos + right) / 2;
+
+    if (name_compare(memory, memory->map[mid].name, varname) < 0) {
+      insert_pos = mid + 1;
+    }
+    else {
+      right = mid;
+    }
+  }
+  
+  // Shift elements to the right to make room
+  for (int i = memory->size; i > insert_pos; i--) {
+    memory->map[i] = memory->map[i-1];
+  }
+  
+  // Insert the new entry
+  memory->map[insert_pos].name = names_append(memory, varname, length);
+  memory->map[insert_pos].cell = cell;
+
+  bloom_add(memory, varname);
+
+  return insert_pos;
+}
+
+/**
+ * @brief str_header: returns the header in front of a RAM string
+ * 
+ * Every string stored in memory (and every string copy handed out
+ * by the read functions) is preceded by a struct RAM_STR header
+ * holding its length, capacity and cached hash.
+ * 
+ * @param s Pointer to the first char of a RAM string
+ * @return Pointer to the string's header
+ */
+static struct RAM_STR* str_header(char* s)
+{
+  return ((struct RAM_STR*) s) - 1;
+}
+
+/**
+ * @brief str_new: allocates a RAM string holding a copy of the given chars
+ * 
+ * Allocates a header plus length+1 chars, copies exactly length
+ * chars via memcpy (embedded '\0' chars are allowed), and adds a
+ * terminating '\0' so the result is also a valid C string.
+ * 
+ * @param s Pointer to the chars to copy, or NULL to leave them
+ *          uninitialized (for the caller to fill in)
+ * @param length Number of chars to copy
+ * @return Pointer to the first char of the new RAM string, NULL if
+ *         out of memory
+ */
+static char* str_new(char* s, int length)
+{
+  struct RAM_STR* header = (struct RAM_STR*) ram_slab_alloc(sizeof(struct RAM_STR) + (size_t) length + 1);
+
+  if (header == NULL) {
+    return NULL;
+  }
+
+  char* chars = (char*) (header + 1);
+
+  header->length = length;
+  header->capacity = length;
+  header->hash = 0;
+  header->reserved = 0;
+
+  if (s != NULL) {
+    memcpy(chars, s, length);
+  }
+  chars[length] = '\0';
+
+  return chars;
+}
+
+/**
+ * @brief str_copy: duplicates an existing RAM string
+ * 
+ * The length is already known, so the copy is a single memcpy;
+ * the cached hash (if any) carries over to the copy.
+ * 
+ * @param s Pointer to the RAM string to copy
+ * @return Pointer to the first char of the new RAM string, NULL if
+ *         out of memory
+ */
+static char* str_copy(char* s)
+{
+  struct RAM_STR* header = str_header(s);
+  char* copy = str_new(s, header->length);
+
+  if (copy != NULL) {
+    str_header(copy)->hash = header->hash;
+  }
+
+  return copy;
+}
+
+/**
+ * @brief str_grow: moves a RAM string to a larger block
+ * 
+ * The contents, length and cached hash carry over; the old block
+ * is freed.
+ * 
+ * @param s Pointer to the RAM string
+ * @param capacity New capacity (>= length)
+ * @return Pointer to the first char of the moved string, NULL if out
+ *         of memory (s is left as it was)
+ */
+static char* str_grow(char* s, int capacity)
+{
+  struct RAM_STR* old = str_header(s);
+  struct RAM_STR* header = (struct RAM_STR*) ram_slab_alloc(sizeof(struct RAM_STR) + capacity + 1);
+
+  if (header == NULL) {
+    return NULL;
+  }
+
+  *header = *old;
+  header->capacity = capacity;
+  memcpy(header + 1, s, old->length + 1);
+
+  ram_slab_free(old, sizeof(struct RAM_STR) + old->capacity + 1);
+
+  return (char*) (header + 1);
+}
+
+/**
+ * @brief str_free: frees a RAM string along with its header
+ * 
+ * @param s Pointer to the RAM string, may be NULL
+ */
+static void str_free(char* s)
+{
+  if (s != NULL) {
+    struct RAM_STR* header = str_header(s);
+
+    ram_slab_free(header, sizeof(struct RAM_STR) + header->capacity + 1);
+  }
+}
+
+/**
+ * @brief array_elem_size: size in bytes of one array element
+ * 
+ * @param elem_type enum RAM_ARRAY_TYPES
+ * @return size of element, 0 if elem_type is invalid
+ */
+static int array_elem_size(int elem_type)
+{
+  if (elem_type == RAM_ARRAY_INT) {
+    return sizeof(int);
+  }
+  else if (elem_type == RAM_ARRAY_REAL) {
+    return sizeof(double);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief array_new: allocates an array holding a copy of the given elements
+ * 
+ * @param elem_type enum RAM_ARRAY_TYPES (must be valid)
+ * @param elems Pointer to the elements to copy, or NULL to leave them
+ *              uninitialized (for the caller to fill in)
+ * @param length Number of elements
+ * @return Pointer to the new array, NULL if out of memory
+ */
+static struct RAM_ARRAY* array_new(int elem_type, void* elems, int length)
+{
+  struct RAM_ARRAY* a = (struct RAM_ARRAY*) malloc(sizeof(struct RAM_ARRAY));
+  int capacity = (length > 0) ? length : 1;
+  int elem_size = array_elem_size(elem_type);
+
+  if (a == NULL) {
+    return NULL;
+  }
+
+  a->elem_type = elem_type;
+  a->length = length;
+  a->capacity = capacity;
+  a->elems.i = (int*) malloc((size_t) capacity * elem_size);
+
+  if (a->elems.i == NULL) {
+    free(a);
+    return NULL;
+  }
+
+  if (elems != NULL && length > 0) {
+    memcpy(a->elems.i, elems, (size_t) length * elem_size);
+  }
+
+  return a;
+}
+
+/**
+ * @brief array_free: frees an array and its elements
+ * 
+ * @param a Pointer to the array, may be NULL
+ */
+static void array_free(struct RAM_ARRAY* a)
+{
+  if (a != NULL) {
+    free(a->elems.i);
+    free(a);
+  }
+}
+
+/**
+ * @brief array_grow_if_needed: doubles the capacity if the array is full
+ * 
+ * @param memory Pointer to RAM struct that owns the array
+ * @param a Pointer to the array
+ * @return true if there is room for one more element, false if
+ *         growing would exceed the memory budget, or the array is
+ *         as long as it can be, or out of memory
+ */
+static bool array_grow_if_needed(struct RAM* memory, struct RAM_ARRAY* a)
+{
+  if (a->length >= a->capacity) {
+    int elem_size = array_elem_size(a->elem_type);
+    int new_capacity = next_capacity(a->capacity, INT_MAX);
+    long long bytes = (long long) (new_capacity - a->capacity) * elem_size;
+
+    if (new_capacity == a->capacity || (size_t) new_capacity > SIZE_MAX / elem_size ||
+        !within_budget(memory, bytes)) {
+      return false;
+    }
+
+    int* elems = (int*) realloc(a->elems.i, (size_t) new_capacity * elem_size);
+
+    if (elems == NULL) {
+      return false;
+    }
+
+    a->elems.i = elems;
+    a->capacity = new_capacity;
+
+    charge(memory, &memory->usage.arrays, bytes);
+  }
+
+  return true;
+}
+
+/**
+ * @brief array_get: element of an array, converted to double
+ * 
+ * Used by kernels that mix int and real arrays.
+ * 
+ * @param a Pointer to the array
+ * @param k Index of the element
+ * @return the element as a double
+ */
+static double array_get(struct RAM_ARRAY* a, int k)
+{
+  if (a->elem_type == RAM_ARRAY_INT) {
+    return a->elems.i[k];
+  }
+
+  return a->elems.d[k];
+}
+
+/**
+ * @brief cell_array: the array stored at an address, if any
+ * 
+ * @param memory Pointer to RAM struct
+ * @param address Memory cell address
+ * @return Pointer to array, NULL if invalid address or not an array
+ */
+static struct RAM_ARRAY* cell_array(struct RAM* memory, int address)
+{
+  if (address < 0 || address >= memory->size) {
+    return NULL;
+  }
+
+  if (ram_cell(memory, address)->value_type != RAM_TYPE_ARRAY) {
+    return NULL;
+  }
+
+  return ram_cell(memory, address)->types.a;
+}
+
+/**
+ * @brief str_bytes: # of bytes allocated for a RAM string
+ * 
+ * @param capacity Capacity of the string
+ * @return # of bytes, including header and terminating '\0'
+ */
+static long long str_bytes(int capacity)
+{
+  return (long long) sizeof(struct RAM_STR) + capacity + 1;
+}
+
+/**
+ * @brief array_bytes: # of bytes allocated for an array
+ * 
+ * @param elem_type enum RAM_ARRAY_TYPES
+ * @param capacity Capacity of the array
+ * @return # of bytes, including the struct RAM_ARRAY itself
+ */
+static long long array_bytes(int elem_type, int capacity)
+{
+  return (long long) sizeof(struct RAM_ARRAY) + (long long) capacity * array_elem_size(elem_type);
+}
+
+/**
+ * @brief value_bytes: # of bytes owned by a stored value
+ * 
+ * @param value Pointer to a memory cell
+ * @return # of bytes allocated for the value's string or array
+ */
+static long long value_bytes(struct RAM_VALUE* value)
+{
+  if (value->value_type == RAM_TYPE_STR) {
+    return str_bytes(str_header(value->types.s)->capacity);
+  }
+  else if (value->value_type == RAM_TYPE_ARRAY) {
+    return array_bytes(value->types.a->elem_type, value->types.a->capacity);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief incoming_bytes: # of bytes store_value will allocate for a value
+ * 
+ * Only needed for budget checks, so returns 0 without measuring
+ * anything when memory has no budget.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param value Pointer to the value about to be stored
+ * @return # of bytes that will be allocated
+ */
+static long long incoming_bytes(struct RAM* memory, struct RAM_VALUE* value)
+{
+  if (memory->budget <= 0) {
+    return 0;
+  }
+
+  if (value->value_type == RAM_TYPE_STR) {
+    return str_bytes((int) strlen(value->types.s));
+  }
+  else if (value->value_type == RAM_TYPE_ARRAY) {
+    int length = value->types.a->length;
+
+    return array_bytes(value->types.a->elem_type, (length > 0) ? length : 1);
+  }
+
+  return 0;
+}
+
+/**
+ * @brief charge_value: adds (or removes) a cell's value to memory usage
+ * 
+ * @param memory Pointer to RAM struct
+ * @param cell Pointer to the memory cell
+ * @param sign +1 after a value is stored, -1 before it is released
+ */
+static void charge_value(struct RAM* memory, struct RAM_VALUE* cell, int sign)
+{
+  if (cell->value_type == RAM_TYPE_STR) {
+    charge(memory, &memory->usage.strings, sign * value_bytes(cell));
+  }
+  else if (cell->value_type == RAM_TYPE_ARRAY) {
+    charge(memory, &memory->usage.arrays, sign * value_bytes(cell));
+  }
+}
+
+/**
+ * @brief release_value: frees any storage owned by a memory cell
+ * 
+ * Called before a cell is overwritten or destroyed.
+ * 
+ * @param cell Pointer to the memory cell
+ */
+static void release_value(struct RAM_VALUE* cell)
+{
+  if (cell->value_type == RAM_TYPE_STR) {
+    str_free(cell->types.s);
+    cell->types.s = NULL;
+  }
+  else if (cell->value_type == RAM_TYPE_ARRAY) {
+    array_free(cell->types.a);
+    cell->types.a = NULL;
+  }
+}
+
+/**
+ * @brief forget_value: tells the heap a PTR is leaving a cell or the undo log
+ * 
+ * Called before a cell's value is released, overwritten or moved,
+ * and before an undo record's old value is dropped, so a collection
+ * under way still marks what the PTR referred to.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param value Pointer to the value
+ */
+static void forget_value(struct RAM* memory, struct RAM_VALUE* value)
+{
+  if (memory->heap != NULL && value->value_type == RAM_TYPE_PTR) {
+    heap_forget(memory->heap, value->types.i);
+  }
+}
+
+/**
+ * @brief store_value: stores a value into a memory cell
+ * 
+ * The cell must not own a value (it is overwritten). The value
+ * may point into the string or array some cell holds (e.g.
+ * x = x[1:]), so writes store it into a local RAM_VALUE first and
+ * release the cell they replace afterwards. Strings are stored as
+ * RAM strings; a plain C string coming in through a struct
+ * RAM_VALUE is measured with strlen. Arrays are deep copied.
+ * 
+ * @param cell Pointer to the memory cell
+ * @param value Pointer to the value to store
+ * @return true if successful, false if out of memory (the cell is
+ *         then left holding NONE, which owns nothing)
+ */
+static bool store_value(struct RAM_VALUE* cell, struct RAM_VALUE* value)
+{
+  cell->value_type = value->value_type;
+
+  if (value->value_type == RAM_TYPE_STR) {
+    cell->types.s = str_new(value->types.s, (int) strlen(value->types.s));
+    if (cell->types.s == NULL) {
+      cell->value_type = RAM_TYPE_NONE;
+      return false;
+    }
+  }
+  else if (value->value_type == RAM_TYPE_ARRAY) {
+    struct RAM_ARRAY* a = value->types.a;
+
+    cell->types.a = array_new(a->elem_type, a->elems.i, a->length);
+    if (cell->types.a == NULL) {
+      cell->value_type = RAM_TYPE_NONE;
+      return false;
+    }
+  }
+  else {
+    cell->types = value->types;
+  }
+
+  return true;
+}
+
+/**
+ * @brief copy_value: creates a deep copy of a RAM_VALUE
+ * 
+ * Allocates memory for a new RAM_VALUE and copies the contents.
+ * For strings, creates a duplicate of the string of known length;
+ * arrays are deep copied.
+ * 
+ * @param original Pointer to the value to copy
+ * @return Pointer to newly allocated copy, NULL if out of memory
+ */
+static struct RAM_VALUE* copy_value(struct RAM_VALUE* original)
+{
+  struct RAM_VALUE* copy = (struct RAM_VALUE*) ram_slab_alloc(sizeof(struct RAM_VALUE));
+  
+  if (copy == NULL) {
+    return NULL;
+  }
+
+  copy->value_type = original->value_type;
+  
+  if (original->value_type == RAM_TYPE_STR) {
+    copy->types.s = str_copy(original->types.s);
+    if (copy->types.s == NULL) {
+      ram_slab_free(copy, sizeof(struct RAM_VALUE));
+      return NULL;
+    }
+  }
+  else if (original->value_type == RAM_TYPE_ARRAY) {
+    struct RAM_ARRAY* a = original->types.a;
+
+    copy->types.a = array_new(a->elem_type, a->elems.i, a->length);
+    if (copy->types.a == NULL) {
+      ram_slab_free(copy, sizeof(struct RAM_VALUE));
+      return NULL;
+    }
+  }
+  else {
+    copy->types = original->types;
+  }
+  
+  return copy;
+}
+
+/**
+ * @brief undo_reserve: makes room for more records in the undo log
+ * 
+ * Called before a change inside a transaction, so that if the log
+ * cannot grow the change is refused before anything is modified.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param n # of records about to be pushed
+ * @return true if there is room, false if out of memory
+ */
+static bool undo_reserve(struct RAM* memory, int n)
+{
+  struct RAM_TXN* txn = &memory->txn;
+
+  if (n > txn->capacity - txn->size) {
+    long long needed = (long long) txn->size + n;
+    int new_capacity = (txn->capacity > 0) ? txn->capacity : 16;
+
+    while (new_capacity < needed && new_capacity < INT_MAX) {
+      new_capacity = next_capacity(new_capacity, INT_MAX);
+    }
+
+    if (new_capacity < needed || (size_t) new_capacity > SIZE_MAX / sizeof(struct RAM_UNDO)) {
+      return false;
+    }
+
+    struct RAM_UNDO* log = (struct RAM_UNDO*) realloc(txn->log, (size_t) new_capacity * sizeof(struct RAM_UNDO));
+
+    if (log == NULL) {
+      return false;
+    }
+
+    charge(memory, &memory->usage.undo, 
+           (long long) (new_capacity - txn->capacity) * sizeof(struct RAM_UNDO));
+
+    txn->log = log;
+    txn->capacity = new_capacity;
+  }
+
+  return true;
+}
+
+/**
+ * @brief undo_push: appends a record to the undo log
+ * 
+ * Room must have been made by undo_reserve. A reused slot (one past
+ * a rolled-back savepoint) may still own an old value, which is
+ * released here.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param kind enum RAM_UNDO_KINDS
+ * @param cell Memory cell the record applies to
+ * @return Pointer to the new record, whose old value is NONE
+ */
+static struct RAM_UNDO* undo_push(struct RAM* memory, int kind, int cell)
+{
+  struct RAM_TXN* txn = &memory->txn;
+
+  assert(txn->size < txn->capacity);
+
+  struct RAM_UNDO* record = &txn->log[txn->size];
+
+  if (txn->size < txn->owned) {
+    charge(memory, &memory->usage.undo, -value_bytes(&record->old));
+    release_value(&record->old);
+  }
+  else {
+    txn->owned = txn->size + 1;
+  }
+
+  txn->size++;
+
+  record->kind = kind;
+  record->cell = cell;
+  record->old.value_type = RAM_TYPE_NONE;
+
+  return record;
+}
+
+/**
+ * @brief undo_overwrite: logs a cell's value before it is overwritten
+ * 
+ * Moves the cell's current value into the undo log (no copy is
+ * made), leaving the cell empty.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param cell Cell number (must be valid)
+ */
+static void undo_overwrite(struct RAM* memory, int cell)
+{
+  struct RAM_UNDO* record = undo_push(memory, RAM_UNDO_OVERWRITE, cell);
+
+  charge_value(memory, ram_cell(memory, cell), -1);
+  charge(memory, &memory->usage.undo, value_bytes(ram_cell(memory, cell)));
+
+  record->old = *ram_cell(memory, cell);
+  ram_cell(memory, cell)->value_type = RAM_TYPE_NONE;
+}
+
+/**
+ * @brief undo_record: undoes the change described by one undo record
+ * 
+ * Records must be undone newest first, so that when a record is
+ * undone memory is in the state right after its change was made.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param record Pointer to the record
+ */
+static void undo_record(struct RAM* memory, struct RAM_UNDO* record)
+{
+  struct RAM_VALUE* cell = ram_cell(memory, record->cell);
+
+  if (record->kind == RAM_UNDO_OVERWRITE) {
+    forget_value(memory, cell);
+    forget_value(memory, &record->old);
+
+    charge_value(memory, cell, -1);
+    release_value(cell);
+
+    charge(memory, &memory->usage.undo, -value_bytes(&record->old));
+
+    *cell = record->old;
+    record->old.value_type = RAM_TYPE_NONE;
+
+    charge_value(memory, cell, +1);
+    mark_dirty(memory, record->cell);
+  }
+  else if (record->kind == RAM_UNDO_INSERT) {
+    unsigned int name = (unsigned int) record->old.types.i;
+    int map_index = binary_search(memory, name_str(memory, name));
+    struct RAM_DIRTY* dirty = &memory->dirty;
+
+    for (int i = map_index; i < memory->size - 1; i++) {
+      memory->map[i] = memory->map[i+1];
+    }
+
+    //
+    // if the name was added since the last checkpoint, forget it;
+    // either way the next delta has to drop this cell:
+    //
+    if (dirty->num_names > 0 && dirty->names[dirty->num_names - 1] == name) {
+      dirty->num_names--;
+    }
+
+    names_remove(memory, name);
+
+    forget_value(memory, cell);
+    charge_value(memory, cell, -1);
+    release_value(cell);
+    cell->value_type = RAM_TYPE_NONE;
+
+    record->old.value_type = RAM_TYPE_NONE;
+
+    memory->size--;
+    memory->epoch++;
+
+    if (memory->size < dirty->low_size) {
+      dirty->low_size = memory->size;
+    }
+  }
+  else if (record->kind == RAM_UNDO_APPEND && cell->value_type == RAM_TYPE_STR) {
+    struct RAM_STR* header = str_header(cell->types.s);
+
+    header->length = record->old.types.i;
+    header->hash = 0;
+    cell->types.s[header->length] = '\0';
+
+    mark_dirty(memory, record->cell);
+  }
+  else if (record->kind == RAM_UNDO_APPEND) {
+    cell->types.a->length = record->old.types.i;
+    record->old.value_type = RAM_TYPE_NONE;
+
+    mark_dirty(memory, record->cell);
+  }
+}
+
+/**
+ * @brief prepare_cell: makes an existing cell ready for a new value
+ * 
+ * Checks that replacing the cell's current value with one that
+ * needs the given # of bytes fits within the memory budget, and if
+ * so releases the current value (or, inside a transaction, moves
+ * it to the undo log). The caller must then store a new value and
+ * charge it via charge_value().
+ * 
+ * @param memory Pointer to RAM struct
+ * @param cell Cell number (must be valid)
+ * @param bytes # of bytes the new value will need
+ * @return true if the cell was released, false if over budget (or
+ *         out of memory for the undo log)
+ */
+static bool prepare_cell(struct RAM* memory, int cell, long long bytes)
+{
+  if (memory->txn.depth > 0) {
+    if (!within_budget(memory, bytes) || !undo_reserve(memory, 1)) {
+      return false;
+    }
+
+    forget_value(memory, ram_cell(memory, cell));
+    undo_overwrite(memory, cell);
+    mark_dirty(memory, cell);
+
+    return true;
+  }
+
+  if (!within_budget(memory, bytes - value_bytes(ram_cell(memory, cell)))) {
+    return false;
+  }
+
+  forget_value(memory, ram_cell(memory, cell));
+  charge_value(memory, ram_cell(memory, cell), -1);
+  release_value(ram_cell(memory, cell));
+  mark_dirty(memory, cell);
+
+  return true;
+}
+
+/**
+ * @brief find_or_insert: returns the cell for a variable, adding it if needed
+ * 
+ * If the variable already exists, its cell is prepared via
+ * prepare_cell() so the caller can store a new value. Otherwise a
+ * new cell is assigned (growing memory if needed) and the variable
+ * is inserted into the map. Either way, nothing is changed if the
+ * new value would not fit within the memory budget.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param varname Variable name
+ * @param bytes # of bytes the new value will need
+ * @return Cell number assigned to the variable, -1 if over budget or
+ *         out of memory
+ */
+static int find_or_insert(struct RAM* memory, char* varname, long long bytes)
+{
+  int map_index = binary_search(memory, varname);
+
+  if (map_index != -1) {
+    int cell = memory->map[map_index].cell;
+
+    if (!prepare_cell(memory, cell, bytes)) {
+      return -1;
+    }
+
+    return cell;
+  }
+
+  if (memory->budget > 0 && 
+      !within_budget(memory, bytes + growth_bytes(memory) + names_growth(memory, strlen(varname) + 1))) {
+    return -1;
+  }
+
+  if ((memory->txn.depth > 0 && !undo_reserve(memory, 1)) || !grow_if_needed(memory)) {
+    return -1;
+  }
+
+  int cell = memory->size;
+
+  map_index = insert_into_map(memory, varname, cell);
+
+  if (map_index == -1) {
+    return -1;
+  }
+
+  memory->size++;
+
+  mark_dirty(memory, cell);
+
+  if (memory->dirty.bits != NULL) {
+    memory->dirty.names[memory->dirty.num_names] = memory->map[map_index].name;
+    memory->dirty.num_names++;
+  }
+
+  if (memory->txn.depth > 0) {
+    struct RAM_UNDO* record = undo_push(memory, RAM_UNDO_INSERT, cell);
+
+    record->old.types.i = (int) memory->map[map_index].name;
+  }
+
+  return cell;
+}
+
+//
+// ram_bulk_load sorts its names on several threads once there are
+// this many (and at most this many threads):
+//
+#define RAM_BULK_PARALLEL_MIN 65536
+#define RAM_BULK_MAX_THREADS  8
+
+//
+// One name given to ram_bulk_load, and where it came from:
+//
+struct RAM_BULK_ENTRY
+{
+  char* varname;
+  int   index;  // position in the caller's arrays
+};
+
+//
+// One distinct name given to ram_bulk_load:
+//
+struct RAM_BULK_NAME
+{
+  char* varname;  // the caller's name
+  unsigned int name;  // its offset in memory->names, once added (if new)
+  int   last;     // index of its last occurrence, whose value wins
+  int   cell;     // cell assigned to it, -1 => not yet assigned
+  bool  is_new;   // not already in memory?
+};
+
+//
+// A run of entries sorted by one thread:
+//
+struct RAM_BULK_RUN
+{
+  struct RAM_BULK_ENTRY* entries;
+  int n;
+};
+
+/**
+ * @brief bulk_compare: orders entries by name, then by index
+ *
+ * Ordering by index as well keeps the occurrences of a name in the
+ * order given, as qsort is not stable.
+ */
+static int bulk_compare(const void* a, const void* b)
+{
+  const struct RAM_BULK_ENTRY* x = (const struct RAM_BULK_ENTRY*) a;
+  const struct RAM_BULK_ENTRY* y = (const struct RAM_BULK_ENTRY*) b;
+  int cmp = strcmp(x->varname, y->varname);
+
+  if (cmp != 0) {
+    return cmp;
+  }
+
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+/**
+ * @brief bulk_sort_run: thread that sorts one run of entries
+ *
+ * @param arg Pointer to the struct RAM_BULK_RUN
+ * @return NULL
+ */
+static void* bulk_sort_run(void* arg)
+{
+  struct RAM_BULK_RUN* run = (struct RAM_BULK_RUN*) arg;
+
+  qsort(run->entries, run->n, sizeof(struct RAM_BULK_ENTRY), bulk_compare);
+
+  return NULL;
+}
+
+/**
+ * @brief bulk_sort: sorts entries by name, then by index
+ *
+ * Large arrays are cut into one run per processor (up to
+ * RAM_BULK_MAX_THREADS), the runs sorted in parallel, and then
+ * merged pairwise. If there is no memory for the merge buffer, the
+ * array is sorted on this thread instead.
+ *
+ * @param entries Entries to sort
+ * @param n # of entries
+ */
+static void bulk_sort(struct RAM_BULK_ENTRY* entries, int n)
+{
+  int num_threads = 1;
+  struct RAM_BULK_ENTRY* buffer = NULL;
+
+  if (n >= RAM_BULK_PARALLEL_MIN) {
+    num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (num_threads > RAM_BULK_MAX_THREADS) {
+      num_threads = RAM_BULK_MAX_THREADS;
+    }
+  }
+
+  if (num_threads > 1) {
+    buffer = (struct RAM_BULK_ENTRY*) malloc(n * sizeof(struct RAM_BULK_ENTRY));
+  }
+
+  if (buffer == NULL) {
+    qsort(entries, n, sizeof(struct RAM_BULK_ENTRY), bulk_compare);
+    return;
+  }
+
+  pthread_t threads[RAM_BULK_MAX_THREADS];
+  bool started[RAM_BULK_MAX_THREADS];
+  struct RAM_BULK_RUN runs[RAM_BULK_MAX_THREADS];
+  int width = (n + num_threads - 1) / num_threads;
+
+  for (int t = 0; t < num_threads; t++) {
+    int lo = (t * width < n) ? t * width : n;
+    int hi = (lo + width < n) ? lo + width : n;
+
+    runs[t].entries = entries + lo;
+    runs[t].n = hi - lo;
+    started[t] = (pthread_create(&threads[t], NULL, bulk_sort_run, &runs[t]) == 0);
+
+    if (!started[t]) {
+      bulk_sort_run(&runs[t]);  // sort it on this thread instead
+    }
+  }
+
+  for (int t = 0; t < num_threads; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    }
+  }
+
+  //
+  // merge runs of width entries into runs of 2*width, until one is left:
+  //
+  struct RAM_BULK_ENTRY* from = entries;
+  struct RAM_BULK_ENTRY* to = buffer;
+
+  for (; width < n; width *= 2) {
+    for (int lo = 0; lo < n; lo += 2 * width) {
+      int mid = (lo + width < n) ? lo + width : n;
+      int hi = (mid + width < n) ? mid + width : n;
+      int i = lo;
+      int j = mid;
+      int k = lo;
+
+      while (i < mid && j < hi) {
+        if (bulk_compare(&from[j], &from[i]) < 0) {
+          to[k++] = from[j++];
+        }
+        else {
+          to[k++] = from[i++];
+        }
+      }
+
+      while (i < mid) {
+        to[k++] = from[i++];
+      }
+
+      while (j < hi) {
+        to[k++] = from[j++];
+      }
+    }
+
+    struct RAM_BULK_ENTRY* swap = from;
+    from = to;
+    to = swap;
+  }
+
+  if (from != entries) {
+    memcpy(entries, from, n * sizeof(struct RAM_BULK_ENTRY));
+  }
+
+  free(buffer);
+}
+
+/**
+ * @brief bulk_bytes: # of additional bytes ram_bulk_load will need
+ *
+ * Only needed for budget checks.
+ *
+ * @param memory Pointer to RAM struct
+ * @param names Distinct names, with is_new and (if not new) cell set
+ * @param num_names # of distinct names
+ * @param values Values being written, NULL => None for new names only
+ * @param new_capacity Capacity memory will have afterwards
+ * @param new_chars # of chars the new names need
+ * @return # of bytes (negative if values being replaced are larger)
+ */
+static long long bulk_bytes(struct RAM* memory, struct RAM_BULK_NAME* names, int num_names,
+                            struct RAM_VALUE* values, int new_capacity, long long new_chars)
+{
+  int old_capacity = (memory->segments == NULL) ? 0 : memory->capacity;
+  long long bytes = (long long) (new_capacity - old_capacity) * (sizeof(struct RAM_VALUE) + sizeof(struct RAM_MAP)) +
+                    names_growth(memory, new_chars);
+
+  for (int g = 0; g < num_names; g++) {
+    if (values == NULL) {
+      continue;
+    }
+
+    bytes += incoming_bytes(memory, &values[names[g].last]);
+
+    if (!names[g].is_new && memory->txn.depth == 0) {
+      bytes -= value_bytes(ram_cell(memory, names[g].cell));
+    }
+  }
+
+  return bytes;
+}
+
+/**
+ * @brief bulk_written: tells the journal and trace about a bulk write
+ *
+ * @param memory Pointer to RAM struct
+ * @param varname Variable name
+ * @param cell Cell the variable's value was written to
+ */
+static void bulk_written(struct RAM* memory, char* varname, int cell)
+{
+  if (memory->trace != NULL) {
+    trace_value(memory->trace, varname, -1, ram_cell(memory, cell));
+  }
+
+  if (memory->journal != NULL) {
+    journal_write_by_name(memory->journal, varname, ram_cell(memory, cell));
+  }
+}
+
+
+//
+// Checkpoint files are a sequence of native-endian ints, doubles and
+// raw chars. An image holds every variable; a delta holds the
+// variables added and cells changed since the previous checkpoint.
+//
+#define RAM_IMAGE_MAGIC 0x494D4152  // "RAMI"
+#define RAM_DELTA_MAGIC 0x444D4152  // "RAMD"
+
+/**
+ * @brief write_int: writes an int to a file
+ * 
+ * @param out File to write to
+ * @param x Value to write
+ * @return true if successful, false if not
+ */
+static bool write_int(FILE* out, int x)
+{
+  return fwrite(&x, sizeof(int), 1, out) == 1;
+}
+
+/**
+ * @brief read_int: reads an int from a file
+ * 
+ * @param in File to read from
+ * @param x Set to the value read
+ * @return true if successful, false if not
+ */
+static bool read_int(FILE* in, int* x)
+{
+  return fread(x, sizeof(int), 1, in) == 1;
+}
+
+/**
+ * @brief write_name: writes a variable name (length, then chars)
+ * 
+ * @param out File to write to
+ * @param varname Variable name
+ * @return true if successful, false if not
+ */
+static bool write_name(FILE* out, char* varname)
+{
+  int length = (int) strlen(varname);
+
+  return write_int(out, length) && 
+         fwrite(varname, 1, length, out) == (size_t) length;
+}
+
+/**
+ * @brief read_name: reads a variable name written by write_name
+ * 
+ * @param in File to read from
+ * @return '\0'-terminated name to be freed by name_free(), or NULL on failure
+ */
+static char* read_name(FILE* in)
+{
+  int length;
+
+  if (!read_int(in, &length) || length < 0) {
+    return NULL;
+  }
+
+  char* varname = (char*) ram_slab_alloc((size_t) length + 1);
+
+  if (varname == NULL) {
+    return NULL;
+  }
+
+  if (fread(varname, 1, length, in) != (size_t) length || memchr(varname, '\0', length) != NULL) {
+    ram_slab_free(varname, (size_t) length + 1);
+    return NULL;
+  }
+
+  varname[length] = '\0';
+
+  return varname;
+}
+
+/**
+ * @brief write_value: writes a value (type, then contents)
+ * 
+ * @param out File to write to
+ * @param value Pointer to the value
+ * @return true if successful, false if not
+ */
+static bool write_value(FILE* out, struct RAM_VALUE* value)
+{
+  if (!write_int(out, value->value_type)) {
+    return false;
+  }
+
+  switch (value->value_type) {
+    case RAM_TYPE_INT:
+    case RAM_TYPE_PTR:
+    case RAM_TYPE_BOOLEAN:
+      return write_int(out, value->types.i);
+    case RAM_TYPE_REAL:
+      return fwrite(&value->types.d, sizeof(double), 1, out) == 1;
+    case RAM_TYPE_STR: {
+      int length = str_header(value->types.s)->length;
+
+      return write_int(out, length) && 
+             fwrite(value->types.s, 1, length, out) == (size_t) length;
+    }
+    case RAM_TYPE_ARRAY: {
+      struct RAM_ARRAY* a = value->types.a;
+      size_t length = a->length;
+
+      return write_int(out, a->elem_type) && write_int(out, a->length) && 
+             fwrite(a->elems.i, array_elem_size(a->elem_type), length, out) == length;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * @brief read_value: reads a value written by write_value
+ * 
+ * Strings and arrays are allocated as if by store_value. On
+ * failure, nothing is left allocated and the value is None.
+ * 
+ * @param in File to read from
+ * @param value Set to the value read
+ * @return true if successful, false if not
+ */
+static bool read_value(FILE* in, struct RAM_VALUE* value)
+{
+  int type;
+  int length;
+  int elem_type;
+  bool success = true;
+
+  value->value_type = RAM_TYPE_NONE;
+
+  if (!read_int(in, &type)) {
+    return false;
+  }
+
+  switch (type) {
+    case RAM_TYPE_INT:
+    case RAM_TYPE_PTR:
+    case RAM_TYPE_BOOLEAN:
+      success = read_int(in, &value->types.i);
+      break;
+    case RAM_TYPE_REAL:
+      success = fread(&value->types.d, sizeof(double), 1, in) == 1;
+      break;
+    case RAM_TYPE_NONE:
+      break;
+    case RAM_TYPE_STR:
+      if (!read_int(in, &length) || length < 0) {
+        return false;
+      }
+      value->types.s = str_new(NULL, length);
+      if (value->types.s == NULL) {
+        return false;
+      }
+      success = fread(value->types.s, 1, length, in) == (size_t) length;
+      break;
+    case RAM_TYPE_ARRAY:
+      if (!read_int(in, &elem_type) || !read_int(in, &length) || 
+          array_elem_size(elem_type) == 0 || length < 0) {
+        return false;
+      }
+      value->types.a = array_new(elem_type, NULL, length);
+      if (value->types.a == NULL) {
+        return false;
+      }
+      success = fread(value->types.a->elems.i, array_elem_size(elem_type), length, in) == (size_t) length;
+      break;
+    default:
+      return false;
+  }
+
+  value->value_type = type;
+
+  if (!success) {
+    release_value(value);
+    value->value_type = RAM_TYPE_NONE;
+  }
+
+  return success;
+}
+
+/**
+ * @brief write_image: writes an image of memory to a file
+ * 
+ * The image holds every variable and its value; see load_image.
+ * 
+ * @param memory Pointer to RAM struct
+ * @param path file to write, overwriting it
+ * @return true if successful, false if not
+ */
+static bool write_image(struct RAM* memory, char* path)
+{
+  FILE* out = fopen(path, "wb");
+
+  if (out == NULL) {
+    return false;
+  }
+
+  bool success = write_int(out, RAM_IMAGE_MAGIC) && write_int(out, memory->size);
+
+  for (int i = 0; success && i < memory->size; i++) {
+    success = write_int(out, memory->map[i].cell) && write_name(out, name_str(memory, memory->map[i].name));
+  }
+
+  for (int i = 0; success && i < memory->size; i++) {
+    success = write_value(out, ram_cell(memory, i));
+  }
+
+  return fclose(out) == 0 && success;
+}
+
+/**
+ * @brief load_image: reads an image written by ram_checkpoint_full
+ * 
+ * @param memory Pointer to a newly initialized RAM struct
+ * @param in File to read from
+ * @return true if successful, false if malformed
+ */
+static bool load_image(struct RAM* memory, FILE* in)
+{
+  int magic;
+  int size;
+
+  if (!read_int(in, &magic) || magic != RAM_IMAGE_MAGIC || 
+      !read_int(in, &size) || size < 0 || size > RAM_MAX_CAPACITY) {
+    return false;
+  }
+
+  int new_capacity = memory->capacity;
+
+  while (new_capacity < size) {
+    new_capacity = next_capacity(new_capacity, RAM_MAX_CAPACITY);
+  }
+
+  if (!resize(memory, new_capacity)) {
+    return false;
+  }
+
+  //
+  // names were written in map order, so they are already sorted; the
+  // file is checked for that, and for each cell appearing once, as
+  // the map's binary search depends on both:
+  //
+  unsigned char* seen = (unsigned char*) calloc((size_t) size + 1, 1);
+
+  if (seen == NULL) {
+    return false;
+  }
+
+  for (int i = 0; i < size; i++) {
+    int cell;
+
+    if (!read_int(in, &cell) || cell < 0 || cell >= size || seen[cell]) {
+      free(seen);
+      return false;
+    }
+
+    char* varname = read_name(in);
+    int length = (varname == NULL) ? 0 : (int) strlen(varname);
+
+    if (varname == NULL || 
+        (i > 0 && name_compare(memory, memory->map[i - 1].name, varname) >= 0) ||
+        !names_reserve(memory, length + 1)) {
+      name_free(varname);
+      free(seen);
+      return false;
+    }
+
+    memory->map[i].name = names_append(memory, varname, length);
+    memory->map[i].cell = cell;
+    memory->size++;
+    seen[cell] = 1;
+
+    name_free(varname);
+  }
+
+  free(seen);
+
+  for (int i = 0; i < size; i++) {
+    if (!read_value(in, ram_cell(memory, i))) {
+      return false;
+    }
+
+    charge_value(memory, ram_cell(memory, i), +1);
+  }
+
+  return true;
+}
+
+/**
+ * @brief apply_delta: applies a delta written by ram_checkpoint_delta
+ * 
+ * Drops the variables that were removed (by a rollback) since the
+ * previous checkpoint, adds the new ones, then stores the changed
+ * cells.
+ * 
+ * @param memory Pointer to RAM struct holding the previous checkpoint
+ * @param in File to read from
+ * @return true if successful, false if malformed
+ */
+static bool apply_delta(struct RAM* memory, FILE* in)
+{
+  int magic;
+  int low_size;
+  int size;
+  int num_names;
+  int num_cells;
+
+  if (!read_int(in, &magic) || magic != RAM_DELTA_MAGIC || 
+      !read_int(in, &low_size) || !read_int(in, &size) || 
+      low_size < 0 || low_size > memory->size || size < low_size) {
+    return false;
+  }
+
+  //
+  // drop vars in cells >= low_size:
+  //
+  int kept = 0;
+
+  for (int i = 0; i < memory->size; i++) {
+    if (memory->map[i].cell < low_size) {
+      memory->map[kept] = memory->map[i];
+      kept++;
+    }
+    else {
+      names_remove(memory, memory->map[i].name);
+    }
+  }
+
+  for (int cell = low_size; cell < memory->size; cell++) {
+    charge_value(memory, ram_cell(memory, cell), -1);
+    release_value(ram_cell(memory, cell));
+    ram_cell(memory, cell)->value_type = RAM_TYPE_NONE;
+  }
+
+  memory->size = low_size;
+
+  //
+  // add the new vars, which fill cells low_size..size-1 in order:
+  //
+  if (!read_int(in, &num_names) || num_names != size - low_size) {
+    return false;
+  }
+
+  for (int i = 0; i < num_names; i++) {
+    int cell;
+
+    if (!read_int(in, &cell) || cell != memory->size) {
+      return false;
+    }
+
+    char* varname = read_name(in);
+
+    if (varname == NULL || binary_search(memory, varname) != -1) {
+      name_free(varname);
+      return false;
+    }
+
+    if (!grow_if_needed(memory) || insert_into_map(memory, varname, cell) == -1) {
+      name_free(varname);
+      return false;
+    }
+
+    memory->size++;
+
+    name_free(varname);
+  }
+
+  //
+  // and finally the changed cells:
+  //
+  if (!read_int(in, &num_cells)) {
+    return false;
+  }
+
+  for (int i = 0; i < num_cells; i++) {
+    int cell;
+    struct RAM_VALUE value;
+
+    if (!read_int(in, &cell) || cell < 0 || cell >= memory->size || 
+        !read_value(in, &value)) {
+      return false;
+    }
+
+    charge_value(memory, ram_cell(memory, cell), -1);
+    release_value(ram_cell(memory, cell));
+
+    *ram_cell(memory, cell) = value;
+    charge_value(memory, ram_cell(memory, cell), +1);
+  }
+
+  return true;
+}
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_init: initialize memory unit
+  *
+  * Returns a pointer to a dynamically-allocated memory
+  * for storing nuPython variables and their values. All
+  * memory cells are initialized to the value None. You
+  * take ownership of the returned memory and must call
+  * ram_destroy() when you are done.
+  *
+  * NOTE: only the struct itself is allocated here; the cell
+  * segments and map array are allocated by the first write.
+  *
+  * @return pointer to struct denoting memory unit, or NULL if out
+  *         of memory
+  */
+struct RAM* ram_init(void)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_INIT);
+
+  struct RAM* memory = (struct RAM*) malloc(sizeof(struct RAM));
+
+  if (memory == NULL) {
+    return NULL;
+  }
+
+  //
+  // the cell segments and map array are allocated by the first write:
+  //
+  memory->capacity = 4;
+  memory->size = 0;
+
+  memory->segments = NULL;
+  memory->num_segments = 0;
+  memory->max_segments = 0;
+  memory->map = NULL;
+
+  memory->names.chars = NULL;
+  memory->names.used = 0;
+  memory->names.capacity = 0;
+  memory->names.garbage = 0;
+  memory->names.scratch = NULL;
+  memory->names.scratch_capacity = 0;
+
+  memory->usage.total = 0;
+  memory->usage.header = 0;
+  memory->usage.cells = 0;
+  memory->usage.map = 0;
+  memory->usage.names = 0;
+  memory->usage.strings = 0;
+  memory->usage.arrays = 0;
+  memory->usage.undo = 0;
+  memory->usage.dirty = 0;
+  memory->usage.bloom = 0;
+  memory->usage.heap = 0;
+  memory->budget = 0;
+
+  memory->txn.log = NULL;
+  memory->txn.size = 0;
+  memory->txn.capacity = 0;
+  memory->txn.owned = 0;
+  memory->txn.savepoints = NULL;
+  memory->txn.depth = 0;
+  memory->txn.max_depth = 0;
+
+  memory->dirty.bits = NULL;
+  memory->dirty.cells = NULL;
+  memory->dirty.num_cells = 0;
+  memory->dirty.names = NULL;
+  memory->dirty.num_names = 0;
+  memory->dirty.low_size = 0;
+
+  memory->journal = NULL;
+  memory->epoch = 0;
+
+  memory->bloom.words = NULL;
+  memory->bloom.num_words = 0;
+
+  memory->trace = NULL;
+  memory->heap = NULL;
+  memory->layout = NULL;
+  memory->observed = false;
+
+  charge(memory, &memory->usage.header, sizeof(struct RAM));
+
+  return memory;
+}
+
+
+/**
+  * @brief ram_destroy: frees memory associated with memory unit
+  * 
+  * Frees the dynamically-allocated memory associated with
+  * the given memory. After the call returns, you cannot
+  * use the memory.
+  *
+  * @return void
+  */
+void ram_destroy(struct RAM* memory)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_DESTROY);
+
+  if (memory == NULL) {
+    return;
+  }
+
+  if (memory->journal != NULL) {
+    journal_close(memory->journal);
+  }
+
+  if (memory->trace != NULL) {
+    trace_close(memory->trace);
+  }
+
+  if (memory->heap != NULL) {
+    heap_close(memory->heap);
+  }
+
+  if (memory->layout != NULL) {
+    layout_close(memory->layout);
+  }
+
+  for (int i = 0; i < memory->size; i++) {
+    release_value(ram_cell(memory, i));
+  }
+
+  for (int i = 0; i < memory->txn.owned; i++) {
+    release_value(&memory->txn.log[i].old);
+  }
+
+  free(memory->txn.log);
+  free(memory->txn.savepoints);
+
+  free(memory->dirty.bits);
+  free(memory->dirty.cells);
+  free(memory->dirty.names);
+
+  free(memory->bloom.words);
+
+  segments_free(memory);
+  free(memory->map);
+  free(memory->names.chars);
+  free(memory->names.scratch);
+  free(memory);
+
+
+}
+
+
+/**
+  * @brief ram_reset: removes all variables, keeping the allocated cells
+  *
+  * Returns memory to the empty state of a new memory unit, except
+  * that the cells and map arrays keep their current capacity, so
+  * refilling memory does not have to allocate and grow them again.
+  * Open transactions are discarded, dirty tracking is stopped, and
+  * every object in memory's heap (if any) is freed; the memory
+  * budget is kept.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_reset(struct RAM* memory)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_RESET);
+
+  if (memory->trace != NULL) {
+    trace_op(memory->trace, RAM_TRACE_RESET);
+  }
+
+  struct RAM_TXN* txn = &memory->txn;
+
+  for (int i = 0; i < txn->owned; i++) {
+    charge(memory, &memory->usage.undo, -value_bytes(&txn->log[i].old));
+    release_value(&txn->log[i].old);
+  }
+
+  txn->size = 0;
+  txn->owned = 0;
+  txn->depth = 0;
+
+  for (int i = 0; i < memory->size; i++) {
+    charge_value(memory, ram_cell(memory, i), -1);
+    release_value(ram_cell(memory, i));
+    ram_cell(memory, i)->value_type = RAM_TYPE_NONE;
+  }
+
+  names_free(memory);
+
+  memory->size = 0;
+  memory->epoch++;
+
+  if (memory->bloom.words != NULL) {
+    memset(memory->bloom.words, 0, memory->bloom.num_words * sizeof(unsigned long long));
+  }
+
+  dirty_stop(memory);
+
+  if (memory->heap != NULL) {
+    heap_reset(memory->heap);
+  }
+
+  if (memory->layout != NULL) {
+    layout_reset(memory->layout);
+  }
+
+  if (memory->journal != NULL) {
+    journal_op(memory->journal, RAM_JOURNAL_RESET);
+  }
+}
+
+
+/**
+  * @brief ram_reserve: makes room for a # of variables up front
+  *
+  * Grows the cells and map arrays (allocating them if needed) so
+  * that memory can hold at least the given # of variables without
+  * growing again; more than RAM_SEGMENT_CELLS is rounded up to
+  * whole segments. Does nothing if there is already room. Returns
+  * false, leaving memory as it was, if the arrays cannot be
+  * allocated (or capacity exceeds RAM_MAX_CAPACITY).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param capacity # of variables to make room for
+  * @return true if successful, false if out of memory
+  */
+bool ram_reserve(struct RAM* memory, int capacity)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_RESIZE);
+
+  if (capacity > RAM_MAX_CAPACITY) {
+    return false;
+  }
+
+  if (memory->segments == NULL || capacity > memory->capacity) {
+    return resize(memory, (capacity > memory->capacity) ? capacity : memory->capacity);
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_trim: shrinks an empty memory's allocated cells
+  *
+  * If memory is empty (e.g. right after ram_reset) and its capacity
+  * exceeds the given maximum, shrinks the cells and map arrays to
+  * that capacity (which stops dirty tracking). Also frees the undo
+  * log if no transaction is open. Returns false, doing nothing, if
+  * memory is not empty.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param max_capacity capacity to shrink to (>= 1)
+  * @return true if memory is empty (trimmed if needed), false if not
+  */
+bool ram_trim(struct RAM* memory, int max_capacity)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_RESIZE);
+
+  if (memory->size > 0) {
+    return false;
+  }
+
+  if (memory->segments != NULL && memory->capacity > max_capacity && max_capacity >= 1) {
+    dirty_stop(memory);
+    resize(memory, max_capacity);
+  }
+
+  //
+  // the undo log can only go if no transaction still needs it:
+  //
+  struct RAM_TXN* txn = &memory->txn;
+
+  if (txn->depth == 0) {
+    for (int i = 0; i < txn->owned; i++) {
+      release_value(&txn->log[i].old);
+    }
+
+    charge(memory, &memory->usage.undo, -memory->usage.undo);
+
+    free(txn->log);
+    free(txn->savepoints);
+
+    txn->log = NULL;
+    txn->size = 0;
+    txn->capacity = 0;
+    txn->owned = 0;
+    txn->savepoints = NULL;
+    txn->max_depth = 0;
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_renumber_hot_first: renumbers the cells, most-used first
+  *
+  * Using the access counts sampled since ram_layout_sample_start
+  * (see ram_layout.h), gives the cells that were sampled the
+  * lowest addresses, most-used first, so they share cache lines;
+  * the rest keep their order after them.
+  *
+  * NOTE: this is the one operation that changes addresses, and it
+  * is never done implicitly. Variables keep their names and values
+  * but may get new addresses, so memory->epoch is bumped, and
+  * addresses cached before must be looked up again (or mapped with
+  * new_addrs). A full checkpoint has to be taken before the next
+  * delta. Returns false, moving nothing, if not sampling, a
+  * transaction is open, memory is journaled or traced (their
+  * records hold addresses), or out of memory.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param new_addrs set to each old address's new address, if not NULL
+  *   (ram_size entries)
+  * @return true if successful, false if not
+  */
+bool ram_renumber_hot_first(struct RAM* memory, int* new_addrs)
+{
+  if (memory->layout == NULL || memory->txn.depth > 0 || memory->journal != NULL ||
+      memory->trace != NULL) {
+    return false;
+  }
+
+  int size = memory->size;
+  int* order = (int*) malloc((size_t) size * sizeof(int) + 1);     // order[new] = old
+  int* moved_to = (int*) malloc((size_t) size * sizeof(int) + 1);  // moved_to[old] = new
+  struct RAM_VALUE* cells = (struct RAM_VALUE*) malloc((size_t) size * sizeof(struct RAM_VALUE) + 1);
+
+  if (order == NULL || moved_to == NULL || cells == NULL) {
+    free(order);
+    free(moved_to);
+    free(cells);
+    return false;
+  }
+
+  layout_hot_order(memory->layout, size, order);
+
+  bool moved = false;
+
+  for (int i = 0; i < size; i++) {
+    cells[i] = *ram_cell(memory, order[i]);
+    moved_to[order[i]] = i;
+    moved = moved || (order[i] != i);
+  }
+
+  if (moved) {
+    for (int i = 0; i < size; i++) {
+      *ram_cell(memory, i) = cells[i];
+    }
+
+    for (int i = 0; i < size; i++) {
+      memory->map[i].cell = moved_to[memory->map[i].cell];
+    }
+
+    layout_moved(memory->layout, order, size);
+
+    //
+    // while the collector marks, a PTR moved to a cell it has
+    // already scanned has to be shaded, like a PTR being removed:
+    //
+    if (memory->heap != NULL) {
+      for (int i = 0; i < size; i++) {
+        forget_value(memory, ram_cell(memory, i));
+      }
+    }
+
+    //
+    // deltas name cells by address, so the next one can't follow
+    // the last checkpoint:
+    //
+    dirty_stop(memory);
+
+    memory->epoch++;
+  }
+
+  if (new_addrs != NULL) {
+    memcpy(new_addrs, moved_to, (size_t) size * sizeof(int));
+  }
+
+  free(order);
+  free(moved_to);
+  free(cells);
+
+  return true;
+}
+
+
+/**
+  * @brief ram_compact_names: rewrites the names block, dropping garbage
+  *
+  * Copies the names into a new block of just the right size, in map
+  * (i.e. sorted) order, leaving out the names rollbacks removed.
+  * With front_code, a name that shares 3 or more leading chars with
+  * a recent name is stored as the # of chars shared and the rest,
+  * so runs like "v00001000", "v00001001", ... take about 5 bytes a
+  * name instead of 10. A lookup compares the shared part (read from
+  * the other name) and the rest separately, so it stays O(log n),
+  * but may miss cache twice as often. Without front_code, every
+  * name is stored whole again. Names added later are stored whole.
+  * Addresses do not change. Returns false, changing nothing, if a
+  * transaction is open (its undo log holds offsets of names), over
+  * budget or out of memory.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param front_code front-code runs of names with a common prefix?
+  * @return true if successful, false if not
+  */
+bool ram_compact_names(struct RAM* memory, bool front_code)
+{
+  if (memory->txn.depth > 0) {
+    return false;
+  }
+
+  struct RAM_NAMES* names = &memory->names;
+  struct RAM_DIRTY* dirty = &memory->dirty;
+  int size = memory->size;
+
+  //
+  // the new block is sized for every name stored whole, which
+  // front-coding can only shrink, and trimmed at the end:
+  //
+  long long chars = 0;
+  int longest = 0;
+
+  for (int i = 0; i < size; i++) {
+    int length = (int) strlen(name_str(memory, memory->map[i].name));
+
+    chars += length + 1;
+
+    if (length > longest) {
+      longest = length;
+    }
+  }
+
+  long long bytes = chars + (front_code ? longest + 1 : 0);
+
+  if (chars > RAM_NAMES_MAX_CAPACITY || !within_budget(memory, bytes - memory->usage.names)) {
+    return false;
+  }
+
+  char* block = (char*) malloc((size_t) chars + 1);
+  char* scratch = front_code ? (char*) malloc((size_t) longest + 1) : NULL;
+
+  if (block == NULL || (front_code && scratch == NULL)) {
+    free(block);
+    free(scratch);
+    return false;
+  }
+
+  //
+  // each name is front-coded against the last name stored whole (its
+  // anchor) if they share enough and the anchor is near enough, else
+  // it is stored whole and becomes the anchor:
+  //
+  unsigned int used = 0;
+  unsigned int anchor = 0;
+  bool coded = false;
+
+  for (int i = 0; i < size; i++) {
+    char* varname = name_str(memory, memory->map[i].name);
+    int length = (int) strlen(varname);
+    int shared = 0;
+
+    if (front_code && i > 0 && used - anchor <= RAM_NAME_MAX_BACK) {
+      char* prefix = block + anchor;
+
+      while (shared < RAM_NAME_MAX_SHARED && shared < length && prefix[shared] == varname[shared]) {
+        shared++;
+      }
+    }
+
+    unsigned int name = used;
+
+    if (shared >= RAM_NAME_MIN_SHARED) {
+      block[used] = (char) shared;
+      block[used + 1] = (char) (used - anchor);
+      memcpy(block + used + 2, varname + shared, length - shared + 1);
+
+      used += 2 + (length - shared) + 1;
+      name |= RAM_NAME_CODED;
+      coded = true;
+    }
+    else {
+      memcpy(block + used, varname, length + 1);
+
+      anchor = used;
+      used += length + 1;
+    }
+
+    //
+    // names added since the last checkpoint are listed by cell:
+    //
+    int k = memory->map[i].cell - dirty->low_size;
+
+    if (dirty->bits != NULL && k >= 0 && k < dirty->num_names) {
+      dirty->names[k] = name;
+    }
+
+    memory->map[i].name = name;
+  }
+
+  free(names->chars);
+  free(names->scratch);
+
+  if (!coded) {
+    free(scratch);
+    scratch = NULL;
+  }
+
+  if (used == 0) {
+    free(block);
+    block = NULL;
+  }
+  else {
+    char* trimmed = (char*) realloc(block, used);
+
+    block = (trimmed != NULL) ? trimmed : block;
+  }
+
+  names->chars = block;
+  names->used = used;
+  names->capacity = used;
+  names->garbage = 0;
+  names->scratch = scratch;
+  names->scratch_capacity = (scratch != NULL) ? longest + 1 : 0;
+
+  charge(memory, &memory->usage.names, (long long) used + names->scratch_capacity - memory->usage.names);
+
+  return true;
+}
+
+
+/**
+  * @brief ram_size: # of vars in memory
+  *
+  * Returns the # of variables currently stored in memory.
+  *
+  * @return # of vars in memory
+  */
+int ram_size(struct RAM* memory)
+{
+  return memory->size;
+}
+
+
+/**
+  * @brief ram_capacity: # of cells available in memory
+  *
+  * Returns the # of cells currently available in memory.
+  *
+  * @return # of cells available in memory
+  */
+int ram_capacity(struct RAM* memory)
+{
+  return memory->capacity;
+}
+
+
+/**
+  * @brief ram_map_name: name of the variable at a given map index
+  *
+  * The map is in name order, so indexes 0..ram_size-1 visit the
+  * variables alphabetically; memory->map[index].cell is the
+  * variable's address. The name is only good until memory changes
+  * (the names block moves as it grows) or, if it was front-coded
+  * (see ram_compact_names), until the next call.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param index map index, 0..ram_size-1
+  * @return '\0'-terminated name, NULL if index is out of range
+  */
+char* ram_map_name(struct RAM* memory, int index)
+{
+  if (index < 0 || index >= memory->size) {
+    return NULL;
+  }
+
+  return name_str(memory, memory->map[index].name);
+}
+
+
+/**
+  * @brief ram_memory_usage: # of bytes allocated by memory
+  *
+  * Returns a breakdown of the bytes currently allocated by the
+  * memory unit: the struct itself, the cells and map arrays, and
+  * all variable names, strings and arrays it owns. The breakdown is
+  * maintained as memory changes, so this call is O(1).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return breakdown of bytes allocated
+  */
+struct RAM_USAGE ram_memory_usage(struct RAM* memory)
+{
+  return memory->usage;
+}
+
+
+/**
+  * @brief ram_set_memory_budget: limits the # of bytes memory may allocate
+  *
+  * Once a budget is set, any write that would push the total bytes
+  * allocated (see ram_memory_usage) above the budget fails and
+  * returns false, leaving memory unchanged. Writes that do not
+  * increase the total always succeed. Pass 0 to remove the budget.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param budget max # of bytes, 0 => unlimited
+  * @return void
+  */
+void ram_set_memory_budget(struct RAM* memory, long long budget)
+{
+  memory->budget = budget;
+}
+
+
+/**
+  * @brief ram_get_addr: address of memory cell occupied by variable
+  *
+  * If the given variable (e.g. "x") has been written to 
+  * memory, returns the address of this variable --- an integer
+  * in the range 0..N-1 where N is the number of vars currently 
+  * stored in memory. Returns -1 if no such variable exists 
+  * in memory. 
+  *
+  * NOTE: a variable has to be written to memory before you can
+  * get its address. Once a variable is written to memory, its
+  * address never changes, unless memory is renumbered (see
+  * ram_renumber_hot_first).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varname variable name
+  * @return address of variable or -1 if doesn't exist
+  */
+int ram_get_addr(struct RAM* memory, char* varname)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_GET_ADDR);
+
+  if (memory->trace != NULL) {
+    trace_name(memory->trace, RAM_TRACE_GET_ADDR, varname, (int) strlen(varname));
+  }
+
+  int map_index = binary_search(memory, varname);
+
+  if (map_index == -1) {
+    return -1;
+  }
+
+  return memory->map[map_index].cell;
+}
+
+
+/**
+  * @brief ram_get_addr_n: address of variable, given a name of known length
+  *
+  * Same as ram_get_addr, but the name is the given # of chars and
+  * need not be '\0'-terminated (e.g. a slice of a larger buffer).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varname pointer to the chars of the variable name
+  * @param length # of chars in the name
+  * @return address of variable or -1 if doesn't exist
+  */
+int ram_get_addr_n(struct RAM* memory, char* varname, int length)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_GET_ADDR);
+
+  //
+  // names in memory never contain '\0', and one in varname would
+  // stop the comparison short:
+  //
+  if (length < 0 || memchr(varname, '\0', length) != NULL) {
+    return -1;
+  }
+
+  if (memory->trace != NULL) {
+    trace_name(memory->trace, RAM_TRACE_GET_ADDR, varname, length);
+  }
+
+  int map_index = binary_search_n(memory, varname, length);
+
+  if (map_index == -1) {
+    return -1;
+  }
+
+  return memory->map[map_index].cell;
+}
+
+
+/**
+  * @brief ram_get_addrs: addresses of many variables at once
+  *
+  * Same as calling ram_get_addr for each name, but faster when there
+  * are many names and memory is large: several lookups are run at
+  * once, interleaved, so that while one waits for its next map entry
+  * or name to arrive from memory (which is prefetched), the others
+  * make progress.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varnames n variable names
+  * @param n # of names
+  * @param addrs set to the n addresses, -1 for each name that doesn't exist
+  * @return # of names found
+  */
+int ram_get_addrs(struct RAM* memory, char** varnames, int n, int* addrs)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_GET_ADDRS);
+
+  if (memory->trace != NULL) {
+    for (int i = 0; i < n; i++) {
+      trace_name(memory->trace, RAM_TRACE_GET_ADDR, varnames[i], (int) strlen(varnames[i]));
+    }
+  }
+
+  struct RAM_PROBE probes[RAM_BATCH_WIDTH];
+  int next = 0;    // next query to start
+  int active = 0;  // # of probes in flight
+  int found = 0;
+
+  if (memory->size < RAM_BATCH_MIN_SIZE) {
+    for (int i = 0; i < n; i++) {
+      int map_index = binary_search(memory, varnames[i]);
+
+      addrs[i] = (map_index == -1) ? -1 : memory->map[map_index].cell;
+
+      if (map_index != -1) {
+        found++;
+      }
+    }
+
+    return found;
+  }
+
+  for (int p = 0; p < RAM_BATCH_WIDTH; p++) {
+    if (next < n) {
+      probe_start(memory, &probes[p], next);
+      next++;
+      active++;
+    }
+    else {
+      probes[p].query = -1;
+    }
+  }
+
+  //
+  // Round-robin over the probes; each visit does one step of its
+  // binary search, and ends by prefetching what the next step needs,
+  // which then has the other probes' steps to arrive:
+  //
+  while (active > 0) {
+    for (int p = 0; p < RAM_BATCH_WIDTH; p++) {
+      struct RAM_PROBE* probe = &probes[p];
+
+      if (probe->query == -1) {
+        continue;
+      }
+
+      if (probe->stage == 0) {
+        probe->name = memory->names.chars + (memory->map[probe->mid].name & ~RAM_NAME_CODED);
+        probe->stage = 1;
+
+        RAM_PREFETCH(probe->name);
+        continue;
+      }
+
+      int cmp = name_compare(memory, memory->map[probe->mid].name, varnames[probe->query]);
+
+      if (cmp < 0) {
+        probe->left = probe->mid + 1;
+      }
+      else if (cmp > 0) {
+        probe->right = probe->mid - 1;
+      }
+
+      if (cmp != 0 && probe->left <= probe->right) {
+        probe->mid = (probe->left + probe->right) / 2;
+        probe->stage = 0;
+
+        RAM_PREFETCH(&memory->map[probe->mid]);
+        continue;
+      }
+
+      //
+      // this lookup is done, start the next one in its place:
+      //
+      if (cmp == 0) {
+        addrs[probe->query] = memory->map[probe->mid].cell;
+        found++;
+      }
+      else {
+        addrs[probe->query] = -1;
+      }
+
+      if (next < n) {
+        probe_start(memory, probe, next);
+        next++;
+      }
+      else {
+        probe->query = -1;
+        active--;
+      }
+    }
+  }
+
+  return found;
+}
+
+
+/**
+  * @brief ram_name_hash: hash of a variable name
+  *
+  * Returns the 32-bit FNV-1a hash of the name (the same hash as
+  * ram_str_hash), for use with ram_may_contain. Computing it once
+  * lets a name be checked against several memory units.
+  *
+  * @param varname variable name
+  * @return hash of the name (never 0)
+  */
+unsigned int ram_name_hash(char* varname)
+{
+  unsigned int hash = 2166136261u;
+
+  for (char* p = varname; *p != '\0'; p++) {
+    hash ^= (unsigned char) *p;
+    hash *= 16777619u;
+  }
+
+  return (hash == 0) ? 1 : hash;
+}
+
+
+/**
+  * @brief ram_bloom_enable: keeps a Bloom filter of memory's names
+  *
+  * From now on memory keeps a small filter of its variable names,
+  * updated as variables are added, so that ram_may_contain can rule
+  * out most names that are not in memory without searching. Does
+  * nothing if already enabled. The filter is freed by ram_destroy.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_bloom_enable(struct RAM* memory)
+{
+  if (memory->bloom.words == NULL) {
+    bloom_build(memory);
+  }
+}
+
+
+/**
+  * @brief ram_may_contain: could memory contain a variable with this name?
+  *
+  * Checks the name's hash (see ram_name_hash) against memory's Bloom
+  * filter. false means the name is definitely not in memory; true
+  * means it may be, and ram_get_addr has to be called to find out.
+  * Always true if the filter is not enabled.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param hash hash of the variable name, from ram_name_hash
+  * @return false if the name is definitely not in memory, true if it may be
+  */
+bool ram_may_contain(struct RAM* memory, unsigned int hash)
+{
+  struct RAM_BLOOM* bloom = &memory->bloom;
+
+  if (bloom->words == NULL) {
+    return true;
+  }
+
+  unsigned long long mask = bloom_mask(hash);
+
+  return (bloom->words[hash & (bloom->num_words - 1)] & mask) == mask;
+}
+
+
+/**
+  * @brief ram_observe: tells the trace and layout sampling about a typed read
+  *
+  * Called by ram_type_by_addr when memory->observed; not meant to be
+  * called directly.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address, may be invalid
+  * @return void
+  */
+void ram_observe(struct RAM* memory, int address)
+{
+  if (memory->trace != NULL) {
+    trace_typed_read(memory->trace, address);
+  }
+
+  if (memory->layout != NULL && address >= 0 && address < memory->size) {
+    layout_touch(memory->layout, address);
+  }
+}
+
+
+/**
+  * @brief ram_read_cell_by_addr: returns value in memory cell at this address
+  *
+  * Given a memory address (an integer in the range 0..N-1), 
+  * returns a COPY of the value contained in that memory cell.
+  * Returns NULL if the address is not valid. Also returns NULL
+  * if there is no memory for the copy.
+  * 
+  * NOTE: this function allocates memory for the value that
+  * is returned. The caller takes ownership of the copy and 
+  * must eventually free this memory via ram_free_value().
+  *
+  * NOTE: a variable has to be written to memory before its
+  * address becomes valid. Once a variable is written to memory,
+  * its address never changes, unless memory is renumbered
+  * (see ram_renumber_hot_first).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @return pointer to struct containing value or NULL if doesn't exist
+  */
+struct RAM_VALUE* ram_read_cell_by_addr(struct RAM* memory, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_READ_BY_ADDR);
+
+  if (memory->trace != NULL) {
+    trace_addr(memory->trace, RAM_TRACE_READ_BY_ADDR, address);
+  }
+
+  if (address < 0 || address >= memory->size) {
+    return NULL;
+  }
+
+  if (memory->layout != NULL) {
+    layout_touch(memory->layout, address);
+  }
+
+  return copy_value(ram_cell(memory, address));
+}
+
+
+/**
+  * @brief ram_read_cell_by_name: returns value in memory cell for this variable
+  *
+  * If the given variable (e.g. "x") has been written to 
+  * memory, returns a COPY of the value contained in memory.
+  * Returns NULL if no such name exists in memory. Also returns
+  * NULL if there is no memory for the copy.
+  *
+  * NOTE: this function allocates memory for the value that
+  * is returned. The caller takes ownership of the copy and 
+  * must eventually free this memory via ram_free_value().
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varname variable name
+  * @return pointer to struct containing value or NULL if doesn't exist
+  */
+struct RAM_VALUE* ram_read_cell_by_name(struct RAM* memory, char* varname)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_READ_BY_NAME);
+
+  if (memory->trace != NULL) {
+    trace_name(memory->trace, RAM_TRACE_READ_BY_NAME, varname, (int) strlen(varname));
+  }
+
+  int map_index = binary_search(memory, varname);
+
+  if (map_index == -1) {
+    return NULL;
+  }
+
+  int cell = memory->map[map_index].cell;
+
+  if (memory->layout != NULL) {
+    layout_touch(memory->layout, cell);
+  }
+
+  return copy_value(ram_cell(memory, cell));
+}
+
+
+/**
+  * @brief ram_free_value: free value returned by read_cell() functions
+  *
+  * Frees the memory value returned by ram_read_cell_by_name and
+  * ram_read_cell_by_addr.
+  *
+  * @param value Pointer to struct containing value
+  * @return void
+  */
+void ram_free_value(struct RAM_VALUE* value)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_FREE_VALUE);
+
+  if (value == NULL) {
+    return;
+  }
+
+  release_value(value);
+
+  ram_slab_free(value, sizeof(struct RAM_VALUE));
+}
+
+
+/**
+  * @brief ram_write_cell_by_addr: writes a value to memory cell at this address
+  *
+  * Writes the given value to the memory cell at the given 
+  * address. If a value already exists at this address, that
+  * value is overwritten by this new value. Returns true if 
+  * the value was successfully written, false if not (which 
+  * implies the memory address is invalid, or the write would
+  * exceed the memory budget).
+  *
+  * NOTE: if the value being written is a string, it will
+  * be duplicated and stored, up to its first '\0' (the length
+  * is taken with strlen). A string with embedded '\0' chars,
+  * e.g. one read from memory, must be written with
+  * ram_write_str_by_addr or ram_write_str_by_name and its
+  * ram_str_length; those also skip the strlen when the length
+  * is already known.
+  * 
+  * NOTE: a variable has to be written to memory before its
+  * address becomes valid. Once a variable is written to memory,
+  * its address never changes, unless memory is renumbered
+  * (see ram_renumber_hot_first).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value value to be written to memory
+  * @param address memory cell address
+  * @return true if successful, false if not (invalid address)
+  */
+bool ram_write_cell_by_addr(struct RAM* memory, struct RAM_VALUE value, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_WRITE_BY_ADDR);
+
+  if (memory->trace != NULL) {
+    trace_value(memory->trace, NULL, address, &value);
+  }
+
+  if (address < 0 || address >= memory->size) {
+    return false;
+  }
+
+  if (memory->layout != NULL) {
+    layout_touch(memory->layout, address);
+  }
+
+  struct RAM_VALUE copy;
+
+  if (!store_value(&copy, &value)) {
+    return false;
+  }
+
+  if (!prepare_cell(memory, address, incoming_bytes(memory, &value))) {
+    release_value(&copy);
+    return false;
+  }
+
+  *ram_cell(memory, address) = copy;
+  charge_value(memory, ram_cell(memory, address), +1);
+
+  if (memory->journal != NULL) {
+    journal_write_by_addr(memory->journal, address, ram_cell(memory, address));
+  }
+
+  return true;
+}
+
+
+/**
+  * ram_write_cell_by_name
+  *
+  * Writes the given value to a memory cell named by the given
+  * variable. If a memory cell already exists with this name,
+  * the existing value is overwritten by this new value. Returns
+  * true unless a memory budget is set and the write would
+  * exceed it (see ram_set_memory_budget).
+  *
+  * NOTE: if the value being written is a string, it will
+  * be duplicated and stored, up to its first '\0' (the length
+  * is taken with strlen). A string with embedded '\0' chars,
+  * e.g. one read from memory, must be written with
+  * ram_write_str_by_addr or ram_write_str_by_name and its
+  * ram_str_length; those also skip the strlen when the length
+  * is already known.
+  *
+  * NOTE: a variable has to be written to memory before its
+  * address becomes valid. Once a variable is written to memory,
+  * its address never changes, unless memory is renumbered
+  * (see ram_renumber_hot_first).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value value to be written to memory
+  * @param varname variable name
+  * @return true if successful, false if over budget
+  */
+bool ram_write_cell_by_name(struct RAM* memory, struct RAM_VALUE value, char* varname)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_WRITE_BY_NAME);
+
+  if (memory->trace != NULL) {
+    trace_value(memory->trace, varname, -1, &value);
+  }
+
+  struct RAM_VALUE copy;
+
+  if (!store_value(&copy, &value)) {
+    return false;
+  }
+
+  int cell = find_or_insert(memory, varname, incoming_bytes(memory, &value));
+
+  if (cell == -1) {
+    release_value(&copy);
+    return false;
+  }
+
+  if (memory->layout != NULL) {
+    layout_touch(memory->layout, cell);
+  }
+
+  *ram_cell(memory, cell) = copy;
+  charge_value(memory, ram_cell(memory, cell), +1);
+
+  if (memory->journal != NULL) {
+    journal_write_by_name(memory->journal, varname, ram_cell(memory, cell));
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_write_str_by_addr: writes a string of known length by address
+  *
+  * Writes a copy of the given length chars to the memory cell at
+  * the given address, overwriting whatever value was there. The
+  * chars may contain embedded '\0' chars; the stored string is
+  * also '\0'-terminated. Returns false if the address is invalid.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param s pointer to the chars to write
+  * @param length number of chars to write
+  * @param address memory cell address
+  * @return true if successful, false if not (invalid address)
+  */
+bool ram_write_str_by_addr(struct RAM* memory, char* s, int length, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_WRITE_BY_ADDR);
+
+  if (memory->trace != NULL) {
+    trace_write(memory->trace, NULL, 0, address, RAM_TYPE_STR, length, 0);
+  }
+
+  if (address < 0 || address >= memory->size || length < 0) {
+    return false;
+  }
+
+  //
+  // s may point into the string being replaced, so copy it first:
+  //
+  char* copy = str_new(s, length);
+
+  if (copy == NULL) {
+    return false;
+  }
+
+  if (!prepare_cell(memory, address, str_bytes(length))) {
+    str_free(copy);
+    return false;
+  }
+
+  ram_cell(memory, address)->value_type = RAM_TYPE_STR;
+  ram_cell(memory, address)->types.s = copy;
+  charge_value(memory, ram_cell(memory, address), +1);
+
+  if (memory->journal != NULL) {
+    journal_write_by_addr(memory->journal, address, ram_cell(memory, address));
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_write_str_by_name: writes a string of known length by name
+  *
+  * Writes a copy of the given length chars to the memory cell
+  * named by the given variable, creating the variable if needed.
+  * The chars may contain embedded '\0' chars; the stored string
+  * is also '\0'-terminated. Returns false if length < 0 or the
+  * write would exceed the memory budget.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param s pointer to the chars to write
+  * @param length number of chars to write
+  * @param varname variable name
+  * @return true if successful, false if not
+  */
+bool ram_write_str_by_name(struct RAM* memory, char* s, int length, char* varname)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_WRITE_BY_NAME);
+
+  if (memory->trace != NULL) {
+    trace_write(memory->trace, varname, (int) strlen(varname), -1, RAM_TYPE_STR, length, 0);
+  }
+
+  if (length < 0) {
+    return false;
+  }
+
+  //
+  // s may point into the string being replaced, so copy it first:
+  //
+  char* copy = str_new(s, length);
+
+  if (copy == NULL) {
+    return false;
+  }
+
+  int cell = find_or_insert(memory, varname, str_bytes(length));
+
+  if (cell == -1) {
+    str_free(copy);
+    return false;
+  }
+
+  ram_cell(memory, cell)->value_type = RAM_TYPE_STR;
+  ram_cell(memory, cell)->types.s = copy;
+  charge_value(memory, ram_cell(memory, cell), +1);
+
+  if (memory->journal != NULL) {
+    journal_write_by_name(memory->journal, varname, ram_cell(memory, cell));
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_append_str_by_addr: appends chars to a string in place
+  *
+  * Extends the string stored at the given address by the given
+  * length chars (which may contain embedded '\0' chars), without
+  * copying what is already there: capacity doubles as needed, so
+  * repeated appends are amortized O(1). The string stays
+  * '\0'-terminated. s may point into the string itself. Returns
+  * false if the address is invalid, the cell does not hold a
+  * string, or the growth would exceed the memory budget.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param s pointer to the chars to append
+  * @param length number of chars to append
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_append_str_by_addr(struct RAM* memory, char* s, int length, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_APPEND);
+
+  if (memory->trace != NULL) {
+    trace_append_str(memory->trace, address, length);
+  }
+
+  if (address < 0 || address >= memory->size || length < 0 ||
+      ram_cell(memory, address)->value_type != RAM_TYPE_STR) {
+    return false;
+  }
+
+  struct RAM_VALUE* cell = ram_cell(memory, address);
+  struct RAM_STR* header = str_header(cell->types.s);
+  int old_length = header->length;
+
+  if (length > INT_MAX - 1 - (int) sizeof(struct RAM_STR) - old_length ||
+      (memory->txn.depth > 0 && !undo_reserve(memory, 1))) {
+    return false;
+  }
+
+  if (old_length + length > header->capacity) {
+    long long new_capacity = 2LL * header->capacity;
+
+    if (new_capacity < old_length + length) {
+      new_capacity = old_length + length;
+    }
+
+    if (new_capacity > INT_MAX - 1 - (long long) sizeof(struct RAM_STR)) {
+      new_capacity = old_length + length;
+    }
+
+    long long bytes = str_bytes((int) new_capacity) - str_bytes(header->capacity);
+
+    if (!within_budget(memory, bytes)) {
+      return false;
+    }
+
+    //
+    // s may be (part of) the string about to move:
+    //
+    char* old_chars = cell->types.s;
+    bool aliased = (s >= old_chars && s <= old_chars + old_length);
+    long long offset = s - old_chars;
+    char* grown = str_grow(old_chars, (int) new_capacity);
+
+    if (grown == NULL) {
+      return false;
+    }
+
+    cell->types.s = grown;
+    header = str_header(grown);
+
+    if (aliased) {
+      s = cell->types.s + offset;
+    }
+
+    charge(memory, &memory->usage.strings, bytes);
+  }
+
+  if (memory->txn.depth > 0) {
+    undo_push(memory, RAM_UNDO_APPEND, address)->old.types.i = old_length;
+  }
+
+  mark_dirty(memory, address);
+
+  memmove(cell->types.s + old_length, s, length);
+  header->length = old_length + length;
+  header->hash = 0;
+  cell->types.s[header->length] = '\0';
+
+  if (memory->journal != NULL) {
+    journal_append_str(memory->journal, address, cell->types.s + old_length, length);
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_append_str_by_name: appends chars to a string in place, by name
+  *
+  * Same as ram_append_str_by_addr, for the variable with the given
+  * name. Returns false if there is no such variable.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param s pointer to the chars to append
+  * @param length number of chars to append
+  * @param varname variable name
+  * @return true if successful, false if not
+  */
+bool ram_append_str_by_name(struct RAM* memory, char* s, int length, char* varname)
+{
+  int map_index = binary_search(memory, varname);
+
+  if (map_index == -1) {
+    return false;
+  }
+
+  return ram_append_str_by_addr(memory, s, length, memory->map[map_index].cell);
+}
+
+/**
+  * @brief ram_bulk_load: writes many variables by name at once
+  *
+  * Same as calling ram_write_cell_by_name(memory, values[i],
+  * varnames[i]) for i = 0..n-1, but in O(n log n + size) time rather
+  * than O(n * size): the names are sorted (on several threads when
+  * there are many), merged into memory in one pass, and memory grows
+  * at most once. New variables get addresses in the order their
+  * names first appear. A name may appear more than once; the last
+  * value wins. Nothing is changed if the writes would exceed the
+  * memory budget or memory cannot be allocated.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varnames n variable names, in any order
+  * @param values n values to write, NULL => see ram_declare
+  * @param n # of names
+  * @param addrs set to the n addresses, may be NULL
+  * @return true if successful, false if n < 0, over budget or out of memory
+  */
+bool ram_bulk_load(struct RAM* memory, char** varnames, struct RAM_VALUE* values, int n, int* addrs)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_BULK_LOAD);
+
+  if (n <= 0) {
+    return (n == 0);
+  }
+
+  //
+  // sort, then collapse repeated names into one struct RAM_BULK_NAME
+  // each (names[] is then in map order):
+  //
+  struct RAM_BULK_ENTRY* entries = (struct RAM_BULK_ENTRY*) malloc(n * sizeof(struct RAM_BULK_ENTRY));
+  struct RAM_BULK_NAME* names = (struct RAM_BULK_NAME*) malloc(n * sizeof(struct RAM_BULK_NAME));
+  int* name_of = (int*) malloc(n * sizeof(int));  // index => its name in names[]
+  int num_names = 0;
+
+  if (entries == NULL || names == NULL || name_of == NULL) {
+    free(entries);
+    free(names);
+    free(name_of);
+    return false;
+  }
+
+  for (int i = 0; i < n; i++) {
+    entries[i].varname = varnames[i];
+    entries[i].index = i;
+  }
+
+  bulk_sort(entries, n);
+
+  for (int k = 0; k < n; k++) {
+    if (k == 0 || strcmp(entries[k].varname, entries[k - 1].varname) != 0) {
+      names[num_names].varname = entries[k].varname;
+      names[num_names].cell = -1;
+      num_names++;
+    }
+
+    names[num_names - 1].last = entries[k].index;
+    name_of[entries[k].index] = num_names - 1;
+  }
+
+  free(entries);
+
+  //
+  // walk the map alongside the names to find the ones that exist:
+  //
+  int num_new = 0;
+  long long new_chars = 0;  // # of chars the new names need
+
+  for (int g = 0, m = 0; g < num_names; g++) {
+    while (m < memory->size && name_compare(memory, memory->map[m].name, names[g].varname) < 0) {
+      m++;
+    }
+
+    names[g].is_new = (m == memory->size || name_compare(memory, memory->map[m].name, names[g].varname) != 0);
+
+    if (names[g].is_new) {
+      num_new++;
+      new_chars += strlen(names[g].varname) + 1;
+    }
+    else {
+      names[g].cell = memory->map[m].cell;
+    }
+  }
+
+  if ((long long) memory->size + num_new > RAM_MAX_CAPACITY) {
+    free(names);
+    free(name_of);
+    return false;
+  }
+
+  int new_capacity = (memory->capacity > 0) ? memory->capacity : 1;
+
+  while (new_capacity < memory->size + num_new) {
+    new_capacity = next_capacity(new_capacity, RAM_MAX_CAPACITY);
+  }
+
+  if (memory->budget > 0 && 
+      !within_budget(memory, bulk_bytes(memory, names, num_names, values, new_capacity, new_chars))) {
+    free(names);
+    free(name_of);
+    return false;
+  }
+
+  //
+  // allocate everything before changing anything, so running out of
+  // memory leaves memory as it was (if it grew, it just has room to
+  // spare); room for the new names is made now, too:
+  //
+  bool ok = (memory->txn.depth == 0 || undo_reserve(memory, (values != NULL) ? num_names : num_new));
+
+  if (ok && (memory->segments == NULL || new_capacity > memory->capacity)) {
+    ok = resize(memory, new_capacity);
+  }
+
+  if (ok) {
+    ok = names_reserve(memory, new_chars);
+  }
+
+  int* new_names = ok ? (int*) malloc((num_new > 0 ? num_new : 1) * sizeof(int)) : NULL;
+  struct RAM_VALUE* copies = (ok && values != NULL) ? 
+                             (struct RAM_VALUE*) malloc(num_names * sizeof(struct RAM_VALUE)) : NULL;
+
+  if (new_names == NULL || (values != NULL && copies == NULL)) {
+    free(new_names);
+    free(copies);
+    free(names);
+    free(name_of);
+    return false;
+  }
+
+  //
+  // a value may point into a string or array about to be replaced,
+  // so every value is copied before any cell is released:
+  //
+  for (int g = 0; values != NULL && g < num_names; g++) {
+    if (!store_value(&copies[g], &values[names[g].last])) {
+      while (--g >= 0) {
+        release_value(&copies[g]);
+      }
+      free(new_names);
+      free(copies);
+      free(names);
+      free(name_of);
+      return false;
+    }
+  }
+
+  //
+  // new names get cells in the order they first appear; new_names[]
+  // lists them by cell:
+  //
+  int old_size = memory->size;
+
+  for (int i = 0, next = old_size; i < n; i++) {
+    struct RAM_BULK_NAME* name = &names[name_of[i]];
+
+    if (name->is_new && name->cell == -1) {
+      name->cell = next;
+      new_names[next - old_size] = name_of[i];
+      next++;
+    }
+  }
+
+  //
+  // the names go in the names block in the same order, so a rollback
+  // takes them off the end:
+  //
+  for (int c = 0; c < num_new; c++) {
+    struct RAM_BULK_NAME* name = &names[new_names[c]];
+
+    name->name = names_append(memory, name->varname, (int) strlen(name->varname));
+  }
+
+  //
+  // merge the new names into the map, from the back, so each entry
+  // moves at most once:
+  //
+  int w = old_size + num_new - 1;
+  int m = old_size - 1;
+
+  for (int g = num_names - 1; g >= 0; g--) {
+    if (!names[g].is_new) {
+      continue;
+    }
+
+    while (m >= 0 && name_compare(memory, memory->map[m].name, names[g].varname) > 0) {
+      memory->map[w] = memory->map[m];
+      w--;
+      m--;
+    }
+
+    memory->map[w].name = names[g].name;
+    memory->map[w].cell = names[g].cell;
+    w--;
+
+    bloom_add(memory, names[g].varname);
+  }
+
+  memory->size = old_size + num_new;
+
+  //
+  // store the values, new cells first (in order, as the undo log,
+  // dirty tracking and the journal all expect), then existing ones:
+  //
+  for (int c = 0; c < num_new; c++) {
+    struct RAM_BULK_NAME* name = &names[new_names[c]];
+    int cell = old_size + c;
+
+    mark_dirty(memory, cell);
+
+    if (memory->dirty.bits != NULL) {
+      memory->dirty.names[memory->dirty.num_names] = name->name;
+      memory->dirty.num_names++;
+    }
+
+    if (memory->txn.depth > 0) {
+      struct RAM_UNDO* record = undo_push(memory, RAM_UNDO_INSERT, cell);
+
+      record->old.types.i = (int) name->name;
+    }
+
+    if (values != NULL) {
+      *ram_cell(memory, cell) = copies[new_names[c]];
+      charge_value(memory, ram_cell(memory, cell), +1);
+    }
+
+    bulk_written(memory, name->varname, cell);
+  }
+
+  for (int g = 0; values != NULL && g < num_names; g++) {
+    if (names[g].is_new) {
+      continue;
+    }
+
+    prepare_cell(memory, names[g].cell, 0);  // can't fail: the budget was checked above
+    *ram_cell(memory, names[g].cell) = copies[g];
+    charge_value(memory, ram_cell(memory, names[g].cell), +1);
+
+    bulk_written(memory, names[g].varname, names[g].cell);
+  }
+
+  if (addrs != NULL) {
+    for (int i = 0; i < n; i++) {
+      addrs[i] = names[name_of[i]].cell;
+    }
+  }
+
+  free(new_names);
+  free(copies);
+  free(names);
+  free(name_of);
+
+  return true;
+}
+
+
+/**
+  * @brief ram_declare: creates many variables at once
+  *
+  * Same as ram_bulk_load with no values: names not already in memory
+  * are added with the value None; variables that exist keep their
+  * values. Either way their addresses are returned, so they can be
+  * bound before anything is written.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varnames n variable names, in any order
+  * @param n # of names
+  * @param addrs set to the n addresses, may be NULL
+  * @return true if successful, false if n < 0, over budget or out of memory
+  */
+bool ram_declare(struct RAM* memory, char** varnames, int n, int* addrs)
+{
+  return ram_bulk_load(memory, varnames, NULL, n, addrs);
+}
+
+
+/**
+  * @brief ram_str_length: length of a string owned by memory
+  *
+  * Returns the # of chars in a string stored in memory or returned
+  * by one of the read functions, in O(1) time.
+  *
+  * NOTE: only valid for strings produced by memory, not for
+  * arbitrary C strings.
+  *
+  * @param s string from a RAM_TYPE_STR value produced by memory
+  * @return # of chars, not counting the terminating '\0'
+  */
+int ram_str_length(char* s)
+{
+  return str_header(s)->length;
+}
+
+
+/**
+  * @brief ram_str_hash: hash of a string owned by memory
+  *
+  * Returns the 32-bit FNV-1a hash of the string's contents. The
+  * hash is computed on first use and cached in the string's header,
+  * and carries over when the string is copied.
+  *
+  * @param s string from a RAM_TYPE_STR value produced by memory
+  * @return hash of the string's contents (never 0)
+  */
+unsigned int ram_str_hash(char* s)
+{
+  struct RAM_STR* header = str_header(s);
+
+  if (header->hash == 0) {
+    unsigned int hash = 2166136261u;
+
+    for (int i = 0; i < header->length; i++) {
+      hash ^= (unsigned char) s[i];
+      hash *= 16777619u;
+    }
+
+    header->hash = (hash == 0) ? 1 : hash;
+  }
+
+  return header->hash;
+}
+
+
+/**
+  * @brief ram_str_equals: compares two strings owned by memory
+  *
+  * Returns true if both strings have the same contents. Strings of
+  * different lengths, or with different cached hashes, are rejected
+  * without looking at their chars.
+  *
+  * @param s1 string from a RAM_TYPE_STR value produced by memory
+  * @param s2 string from a RAM_TYPE_STR value produced by memory
+  * @return true if equal, false if not
+  */
+bool ram_str_equals(char* s1, char* s2)
+{
+  struct RAM_STR* h1 = str_header(s1);
+  struct RAM_STR* h2 = str_header(s2);
+
+  if (h1->length != h2->length) {
+    return false;
+  }
+
+  if (h1->hash != 0 && h2->hash != 0 && h1->hash != h2->hash) {
+    return false;
+  }
+
+  return memcmp(s1, s2, h1->length) == 0;
+}
+
+
+/**
+  * @brief ram_write_array_by_addr: writes an array value by address
+  *
+  * Writes a copy of the given elements, as a RAM_TYPE_ARRAY value,
+  * to the memory cell at the given address. elems points to length
+  * ints (RAM_ARRAY_INT) or doubles (RAM_ARRAY_REAL), and may be NULL
+  * if length is 0. Returns false if the address is invalid.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param elem_type enum RAM_ARRAY_TYPES
+  * @param elems pointer to the elements to copy
+  * @param length # of elements
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_write_array_by_addr(struct RAM* memory, int elem_type, void* elems, int length, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_WRITE_ARRAY);
+
+  if (memory->trace != NULL) {
+    trace_write(memory->trace, NULL, 0, address, RAM_TYPE_ARRAY, length, elem_type);
+  }
+
+  if (address < 0 || address >= memory->size) {
+    return false;
+  }
+
+  if (array_elem_size(elem_type) == 0 || length < 0) {
+    return false;
+  }
+
+  //
+  // elems may point into the array being replaced, so copy them first:
+  //
+  struct RAM_ARRAY* copy = array_new(elem_type, elems, length);
+
+  if (copy == NULL) {
+    return false;
+  }
+
+  if (!prepare_cell(memory, address, array_bytes(elem_type, (length > 0) ? length : 1))) {
+    array_free(copy);
+    return false;
+  }
+
+  ram_cell(memory, address)->value_type = RAM_TYPE_ARRAY;
+  ram_cell(memory, address)->types.a = copy;
+  charge_value(memory, ram_cell(memory, address), +1);
+
+  if (memory->journal != NULL) {
+    journal_write_by_addr(memory->journal, address, ram_cell(memory, address));
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_write_array_by_name: writes an array value by name
+  *
+  * Writes a copy of the given elements, as a RAM_TYPE_ARRAY value,
+  * to the memory cell named by the given variable, creating the
+  * variable if needed. Returns false if elem_type or length is
+  * invalid.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param elem_type enum RAM_ARRAY_TYPES
+  * @param elems pointer to the elements to copy
+  * @param length # of elements
+  * @param varname variable name
+  * @return true if successful, false if not
+  */
+bool ram_write_array_by_name(struct RAM* memory, int elem_type, void* elems, int length, char* varname)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_WRITE_ARRAY);
+
+  if (memory->trace != NULL) {
+    trace_write(memory->trace, varname, (int) strlen(varname), -1, RAM_TYPE_ARRAY, length, elem_type);
+  }
+
+  if (array_elem_size(elem_type) == 0 || length < 0) {
+    return false;
+  }
+
+  //
+  // elems may point into the array being replaced, so copy them first:
+  //
+  struct RAM_ARRAY* copy = array_new(elem_type, elems, length);
+
+  if (copy == NULL) {
+    return false;
+  }
+
+  int cell = find_or_insert(memory, varname, array_bytes(elem_type, (length > 0) ? length : 1));
+
+  if (cell == -1) {
+    array_free(copy);
+    return false;
+  }
+
+  ram_cell(memory, cell)->value_type = RAM_TYPE_ARRAY;
+  ram_cell(memory, cell)->types.a = copy;
+  charge_value(memory, ram_cell(memory, cell), +1);
+
+  if (memory->journal != NULL) {
+    journal_write_by_name(memory->journal, varname, ram_cell(memory, cell));
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_borrow_array_by_addr: direct access to an array in memory
+  *
+  * Returns a pointer to the array stored in the memory cell at the
+  * given address, without copying it. Returns NULL if the address
+  * is invalid or the cell does not hold an array.
+  *
+  * NOTE: memory keeps ownership. The pointer (and its elems) are
+  * only valid until the cell is next written or appended to, or
+  * memory is destroyed. Do not free it.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @return pointer to array or NULL
+  */
+struct RAM_ARRAY* ram_borrow_array_by_addr(struct RAM* memory, int address)
+{
+  if (memory->trace != NULL) {
+    trace_addr(memory->trace, RAM_TRACE_READ_BY_ADDR, address);
+  }
+
+  return cell_array(memory, address);
+}
+
+
+/**
+  * @brief ram_array_append_int_by_addr: appends an int to an array
+  *
+  * Appends to the int array stored at the given address. Capacity
+  * doubles as needed, so repeated appends are amortized O(1).
+  * Returns false if the address is invalid or the cell does not
+  * hold an int array.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value int to append
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_array_append_int_by_addr(struct RAM* memory, int value, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_APPEND);
+
+  if (memory->trace != NULL) {
+    trace_append(memory->trace, address, RAM_ARRAY_INT);
+  }
+
+  struct RAM_ARRAY* a = cell_array(memory, address);
+
+  if (a == NULL || a->elem_type != RAM_ARRAY_INT) {
+    return false;
+  }
+
+  if ((memory->txn.depth > 0 && !undo_reserve(memory, 1)) || !array_grow_if_needed(memory, a)) {
+    return false;
+  }
+
+  if (memory->txn.depth > 0) {
+    undo_push(memory, RAM_UNDO_APPEND, address)->old.types.i = a->length;
+  }
+
+  mark_dirty(memory, address);
+
+  a->elems.i[a->length] = value;
+  a->length++;
+
+  if (memory->journal != NULL) {
+    struct RAM_VALUE elem;
+
+    elem.value_type = RAM_TYPE_INT;
+    elem.types.i = value;
+
+    journal_append(memory->journal, address, &elem);
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_array_append_real_by_addr: appends a real to an array
+  *
+  * Appends to the real array stored at the given address. Capacity
+  * doubles as needed, so repeated appends are amortized O(1).
+  * Returns false if the address is invalid or the cell does not
+  * hold a real array.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value real to append
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_array_append_real_by_addr(struct RAM* memory, double value, int address)
+{
+  RAM_LATENCY_SCOPE(RAM_LATENCY_APPEND);
+
+  if (memory->trace != NULL) {
+    trace_append(memory->trace, address, RAM_ARRAY_REAL);
+  }
+
+  struct RAM_ARRAY* a = cell_array(memory, address);
+
+  if (a == NULL || a->elem_type != RAM_ARRAY_REAL) {
+    return false;
+  }
+
+  if ((memory->txn.depth > 0 && !undo_reserve(memory, 1)) || !array_grow_if_needed(memory, a)) {
+    return false;
+  }
+
+  if (memory->txn.depth > 0) {
+    undo_push(memory, RAM_UNDO_APPEND, address)->old.types.i = a->length;
+  }
+
+  mark_dirty(memory, address);
+
+  a->elems.d[a->length] = value;
+  a->length++;
+
+  if (memory->journal != NULL) {
+    struct RAM_VALUE elem;
+
+    elem.value_type = RAM_TYPE_REAL;
+    elem.types.d = value;
+
+    journal_append(memory->journal, address, &elem);
+  }
+
+  return true;
+}
+
+
+//
+// Array kernels: the loops below keep 4 independent accumulators
+// and avoid branches in the loop body so the compiler can vectorize
+// them (and so they pipeline well even when it does not).
+//
+
+/**
+  * @brief ram_array_sum: sum of the elements of an array
+  *
+  * Int arrays are summed exactly in 64 bits, then converted.
+  *
+  * @param a array (e.g. from ram_borrow_array_by_addr)
+  * @return sum of elements, 0.0 if empty
+  */
+double ram_array_sum(struct RAM_ARRAY* a)
+{
+  int n = a->length;
+  int k = 0;
+
+  if (a->elem_type == RAM_ARRAY_INT) {
+    int* x = a->elems.i;
+    long long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    for (; k + 4 <= n; k += 4) {
+      s0 += x[k];
+      s1 += x[k + 1];
+      s2 += x[k + 2];
+      s3 += x[k + 3];
+    }
+    for (; k < n; k++) {
+      s0 += x[k];
+    }
+
+    return (double) (s0 + s1 + s2 + s3);
+  }
+
+  double* x = a->elems.d;
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+
+  for (; k + 4 <= n; k += 4) {
+    s0 += x[k];
+    s1 += x[k + 1];
+    s2 += x[k + 2];
+    s3 += x[k + 3];
+  }
+  for (; k < n; k++) {
+    s0 += x[k];
+  }
+
+  return (s0 + s1) + (s2 + s3);
+}
+
+
+/**
+  * @brief ram_array_minmax: smallest and largest element of an array
+  *
+  * @param a array (e.g. from ram_borrow_array_by_addr)
+  * @param min set to the smallest element
+  * @param max set to the largest element
+  * @return true if successful, false if the array is empty
+  */
+bool ram_array_minmax(struct RAM_ARRAY* a, double* min, double* max)
+{
+  int n = a->length;
+
+  if (n == 0) {
+    return false;
+  }
+
+  if (a->elem_type == RAM_ARRAY_INT) {
+    int* x = a->elems.i;
+    int lo[4] = { x[0], x[0], x[0], x[0] };
+    int hi[4] = { x[0], x[0], x[0], x[0] };
+    int k = 0;
+
+    for (; k + 4 <= n; k += 4) {
+      for (int j = 0; j < 4; j++) {
+        lo[j] = (x[k + j] < lo[j]) ? x[k + j] : lo[j];
+        hi[j] = (x[k + j] > hi[j]) ? x[k + j] : hi[j];
+      }
+    }
+    for (; k < n; k++) {
+      lo[0] = (x[k] < lo[0]) ? x[k] : lo[0];
+      hi[0] = (x[k] > hi[0]) ? x[k] : hi[0];
+    }
+    for (int j = 1; j < 4; j++) {
+      lo[0] = (lo[j] < lo[0]) ? lo[j] : lo[0];
+      hi[0] = (hi[j] > hi[0]) ? hi[j] : hi[0];
+    }
+
+    *min = lo[0];
+    *max = hi[0];
+    return true;
+  }
+
+  double* x = a->elems.d;
+  double lo[4] = { x[0], x[0], x[0], x[0] };
+  double hi[4] = { x[0], x[0], x[0], x[0] };
+  int k = 0;
+
+  for (; k + 4 <= n; k += 4) {
+    for (int j = 0; j < 4; j++) {
+      lo[j] = (x[k + j] < lo[j]) ? x[k + j] : lo[j];
+      hi[j] = (x[k + j] > hi[j]) ? x[k + j] : hi[j];
+    }
+  }
+  for (; k < n; k++) {
+    lo[0] = (x[k] < lo[0]) ? x[k] : lo[0];
+    hi[0] = (x[k] > hi[0]) ? x[k] : hi[0];
+  }
+  for (int j = 1; j < 4; j++) {
+    lo[0] = (lo[j] < lo[0]) ? lo[j] : lo[0];
+    hi[0] = (hi[j] > hi[0]) ? hi[j] : hi[0];
+  }
+
+  *min = lo[0];
+  *max = hi[0];
+  return true;
+}
+
+
+/**
+  * @brief ram_array_scale: multiplies every element by a factor, in place
+  *
+  * Int arrays can only be scaled by a whole number.
+  *
+  * @param a array (e.g. from ram_borrow_array_by_addr)
+  * @param factor factor to multiply by
+  * @return true if successful, false if a is an int array and factor
+  *         is not a whole number
+  */
+bool ram_array_scale(struct RAM_ARRAY* a, double factor)
+{
+  int n = a->length;
+
+  if (a->elem_type == RAM_ARRAY_INT) {
+    int f = (int) factor;
+
+    if ((double) f != factor) {
+      return false;
+    }
+
+    int* x = a->elems.i;
+
+    for (int k = 0; k < n; k++) {
+      x[k] *= f;
+    }
+
+    return true;
+  }
+
+  double* x = a->elems.d;
+
+  for (int k = 0; k < n; k++) {
+    x[k] *= factor;
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_array_add: elementwise dst += src, in place
+  *
+  * Both arrays must have the same length. An int array may be added
+  * to a real array, but not the other way around.
+  *
+  * @param dst array that is updated
+  * @param src array that is added
+  * @return true if successful, false if not
+  */
+bool ram_array_add(struct RAM_ARRAY* dst, struct RAM_ARRAY* src)
+{
+  int n = dst->length;
+
+  if (src->length != n) {
+    return false;
+  }
+
+  if (dst->elem_type == RAM_ARRAY_INT) {
+    if (src->elem_type != RAM_ARRAY_INT) {
+      return false;
+    }
+
+    int* x = dst->elems.i;
+    int* y = src->elems.i;
+
+    for (int k = 0; k < n; k++) {
+      x[k] += y[k];
+    }
+
+    return true;
+  }
+
+  double* x = dst->elems.d;
+
+  if (src->elem_type == RAM_ARRAY_INT) {
+    int* y = src->elems.i;
+
+    for (int k = 0; k < n; k++) {
+      x[k] += y[k];
+    }
+  }
+  else {
+    double* y = src->elems.d;
+
+    for (int k = 0; k < n; k++) {
+      x[k] += y[k];
+    }
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_array_dot: dot product of two arrays
+  *
+  * Both arrays must have the same length; element types may differ.
+  *
+  * @param a first array
+  * @param b second array
+  * @param result set to the dot product
+  * @return true if successful, false if the lengths differ
+  */
+bool ram_array_dot(struct RAM_ARRAY* a, struct RAM_ARRAY* b, double* result)
+{
+  int n = a->length;
+  int k = 0;
+
+  if (b->length != n) {
+    return false;
+  }
+
+  if (a->elem_type == RAM_ARRAY_INT && b->elem_type == RAM_ARRAY_INT) {
+    int* x = a->elems.i;
+    int* y = b->elems.i;
+    long long s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    for (; k + 4 <= n; k += 4) {
+      s0 += (long long) x[k] * y[k];
+      s1 += (long long) x[k + 1] * y[k + 1];
+      s2 += (long long) x[k + 2] * y[k + 2];
+      s3 += (long long) x[k + 3] * y[k + 3];
+    }
+    for (; k < n; k++) {
+      s0 += (long long) x[k] * y[k];
+    }
+
+    *result = (double) (s0 + s1 + s2 + s3);
+    return true;
+  }
+
+  double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+
+  if (a->elem_type == RAM_ARRAY_REAL && b->elem_type == RAM_ARRAY_REAL) {
+    double* x = a->elems.d;
+    double* y = b->elems.d;
+
+    for (; k + 4 <= n; k += 4) {
+      s0 += x[k] * y[k];
+      s1 += x[k + 1] * y[k + 1];
+      s2 += x[k + 2] * y[k + 2];
+      s3 += x[k + 3] * y[k + 3];
+    }
+  }
+
+  for (; k < n; k++) {
+    s0 += array_get(a, k) * array_get(b, k);
+  }
+
+  *result = (s0 + s1) + (s2 + s3);
+  return true;
+}
+
+
+/**
+  * @brief ram_txn_begin: starts a transaction (or a nested savepoint)
+  *
+  * From now on, every write to memory is recorded in an undo log
+  * so it can be rolled back: overwritten values, newly added
+  * variables, and array appends. Transactions nest; each call must
+  * be matched by a ram_txn_commit or ram_txn_rollback.
+  *
+  * NOTE: changes made directly through a pointer returned by
+  * ram_borrow_array_by_addr (e.g. ram_array_scale) are not logged.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if out of memory (no
+  *         transaction was started)
   */
-struct RAM* ram_init(void)
+bool ram_txn_begin(struct RAM* memory)
 {
-  struct RAM* memory = (struct RAM*) malloc(sizeof(struct RAM));
+  RAM_LATENCY_SCOPE(RAM_LATENCY_TXN_BEGIN);
 
-  memory->capacity = 4;
-  memory->size = 0;
+  if (memory->trace != NULL) {
+    trace_op(memory->trace, RAM_TRACE_TXN_BEGIN);
+  }
+
+  struct RAM_TXN* txn = &memory->txn;
+
+  if (txn->depth >= txn->max_depth) {
+    int new_max_depth = (txn->max_depth > 0) ? txn->max_depth * 2 : 4;
+    int* savepoints = (int*) realloc(txn->savepoints, new_max_depth * sizeof(int));
+
+    if (savepoints == NULL) {
+      return false;
+    }
+
+    txn->savepoints = savepoints;
 
-  memory->cells = (struct RAM_VALUE*) malloc(memory->capacity * sizeof(struct RAM_VALUE));
+    charge(memory, &memory->usage.undo, (long long) (new_max_depth - txn->max_depth) * sizeof(int));
 
-  for (int i = 0; i < memory->capacity; i++) {
-    memory->cells[i].value_type = RAM_TYPE_NONE;
+    txn->max_depth = new_max_depth;
   }
 
-  memory->map = (struct RAM_MAP*) malloc(memory->capacity * sizeof(struct RAM_MAP));
+  txn->savepoints[txn->depth] = txn->size;
+  txn->depth++;
 
-  return memory;
+  if (memory->journal != NULL) {
+    journal_op(memory->journal, RAM_JOURNAL_TXN_BEGIN);
+  }
+
+  return true;
 }
 
 
 /**
-  * @brief ram_destroy: frees memory associated with memory unit
-  * 
-  * Frees the dynamically-allocated memory associated with
-  * the given memory. After the call returns, you cannot
-  * use the memory.
+  * @brief ram_txn_commit: ends the innermost transaction, keeping its changes
   *
-  * @return void
+  * Committing a nested transaction folds its changes into the
+  * enclosing one, so they are still undone if the enclosing
+  * transaction rolls back. Takes O(1) time, except that the
+  * outermost commit frees the old values its transaction logged
+  * (so it costs as much as the writes made, and they stop counting
+  * against the memory budget). Returns false if no transaction is
+  * open.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if no transaction is open
   */
-void ram_destroy(struct RAM* memory)
+bool ram_txn_commit(struct RAM* memory)
 {
-  if (memory == NULL) {
-    return;
+  RAM_LATENCY_SCOPE(RAM_LATENCY_TXN_COMMIT);
+
+  if (memory->trace != NULL) {
+    trace_op(memory->trace, RAM_TRACE_TXN_COMMIT);
   }
 
-  for (int i = 0; i < memory->capacity; i++) {
-    if (memory->cells[i].value_type == RAM_TYPE_STR && 
-        memory->cells[i].types.s != NULL) {
-      free(memory->cells[i].types.s);
-    }
+  struct RAM_TXN* txn = &memory->txn;
+
+  if (txn->depth == 0) {
+    return false;
   }
 
-  for (int i = 0; i < memory->size; i++) {
-    if (memory->map[i].varname != NULL) {
-      free(memory->map[i].varname);
+  txn->depth--;
+
+  //
+  // once the outermost transaction commits, nothing can be undone,
+  // so the old values in the log are freed (records past size were
+  // rolled back and hold none):
+  //
+  if (txn->depth == 0) {
+    for (int i = 0; i < txn->owned; i++) {
+      if (i < txn->size) {
+        forget_value(memory, &txn->log[i].old);
+      }
+
+      charge(memory, &memory->usage.undo, -value_bytes(&txn->log[i].old));
+      release_value(&txn->log[i].old);
+      txn->log[i].old.value_type = RAM_TYPE_NONE;
     }
-  }
 
-  free(memory->cells);
-  free(memory->map);
-  free(memory);
+    txn->size = 0;
+    txn->owned = 0;
+  }
 
+  if (memory->journal != NULL) {
+    journal_op(memory->journal, RAM_JOURNAL_TXN_COMMIT);
+  }
 
+  return true;
 }
 
 
 /**
-  * @brief ram_size: # of vars in memory
+  * @brief ram_txn_rollback: ends the innermost transaction, undoing its changes
   *
-  * Returns the # of variables currently stored in memory.
+  * Restores memory to its state at the matching ram_txn_begin:
+  * overwritten values come back, and variables added since then
+  * are removed (so their addresses become invalid again). Takes
+  * time proportional to the # of writes being undone. Returns
+  * false if no transaction is open.
   *
-  * @return # of vars in memory
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if no transaction is open
   */
-int ram_size(struct RAM* memory)
+bool ram_txn_rollback(struct RAM* memory)
 {
-  return memory->size;
+  RAM_LATENCY_SCOPE(RAM_LATENCY_TXN_ROLLBACK);
+
+  if (memory->trace != NULL) {
+    trace_op(memory->trace, RAM_TRACE_TXN_ROLLBACK);
+  }
+
+  struct RAM_TXN* txn = &memory->txn;
+
+  if (txn->depth == 0) {
+    return false;
+  }
+
+  txn->depth--;
+
+  int savepoint = txn->savepoints[txn->depth];
+
+  while (txn->size > savepoint) {
+    txn->size--;
+    undo_record(memory, &txn->log[txn->size]);
+  }
+
+  if (memory->journal != NULL) {
+    journal_op(memory->journal, RAM_JOURNAL_TXN_ROLLBACK);
+  }
+
+  return true;
 }
 
 
 /**
-  * @brief ram_capacity: # of cells available in memory
-  *
-  * Returns the # of cells currently available in memory.
+  * @brief ram_txn_depth: # of open transactions
   *
-  * @return # of cells available in memory
+  * @param memory Pointer to struct denoting memory unit
+  * @return nesting depth, 0 if no transaction is open
   */
-int ram_capacity(struct RAM* memory)
+int ram_txn_depth(struct RAM* memory)
 {
-  return memory->capacity;
+  return memory->txn.depth;
 }
 
 
 /**
-  * @brief ram_get_addr: address of memory cell occupied by variable
-  *
-  * If the given variable (e.g. "x") has been written to 
-  * memory, returns the address of this variable --- an integer
-  * in the range 0..N-1 where N is the number of vars currently 
-  * stored in memory. Returns -1 if no such variable exists 
-  * in memory. 
+  * @brief ram_checkpoint_full: saves all of memory to a file
   *
-  * NOTE: a variable has to be written to memory before you can
-  * get its address. Once a variable is written to memory, its
-  * address never changes. 
+  * Writes a binary image of memory (every variable and its value)
+  * to the given file, overwriting it. Also starts (or restarts)
+  * tracking which cells change, so that ram_checkpoint_delta can
+  * later save just the changes. Returns false if the file could
+  * not be written, or there is no memory to track changes with.
   *
   * @param memory Pointer to struct denoting memory unit
-  * @param varname variable name
-  * @return address of variable or -1 if doesn't exist
+  * @param path file to write
+  * @return true if successful, false if not
   */
-int ram_get_addr(struct RAM* memory, char* varname)
+bool ram_checkpoint_full(struct RAM* memory, char* path)
 {
-  int map_index = binary_search(memory, varname);
+  RAM_LATENCY_SCOPE(RAM_LATENCY_CHECKPOINT);
 
-  if (map_index == -1) {
-    return -1;
+  if (!write_image(memory, path)) {
+    return false;
   }
 
-  return memory->map[map_index].cell;
+  struct RAM_DIRTY* dirty = &memory->dirty;
+
+  if (dirty->bits == NULL) {
+    long long bytes = ((long long) memory->capacity + 7) / 8;
+
+    dirty->bits = (unsigned char*) calloc(bytes, 1);
+    dirty->cells = (int*) malloc((size_t) memory->capacity * sizeof(int));
+    dirty->names = (unsigned int*) malloc((size_t) memory->capacity * sizeof(unsigned int));
+
+    //
+    // out of memory: the image is good, but deltas can't follow it:
+    //
+    if (dirty->bits == NULL || dirty->cells == NULL || dirty->names == NULL) {
+      free(dirty->bits);
+      free(dirty->cells);
+      free(dirty->names);
+      dirty->bits = NULL;
+      dirty->cells = NULL;
+      dirty->names = NULL;
+      return false;
+    }
+
+    charge(memory, &memory->usage.dirty, 
+           bytes + (long long) memory->capacity * (sizeof(int) + sizeof(unsigned int)));
+  }
+
+  dirty_clear(memory);
+
+  return true;
 }
 
 
 /**
-  * @brief ram_read_cell_by_addr: returns value in memory cell at this address
-  *
-  * Given a memory address (an integer in the range 0..N-1), 
-  * returns a COPY of the value contained in that memory cell.
-  * Returns NULL if the address is not valid.
-  * 
-  * NOTE: this function allocates memory for the value that
-  * is returned. The caller takes ownership of the copy and 
-  * must eventually free this memory via ram_free_value().
+  * @brief ram_checkpoint_delta: saves the changes since the last checkpoint
   *
-  * NOTE: a variable has to be written to memory before its
-  * address becomes valid. Once a variable is written to memory,
-  * its address never changes.
+  * Writes only the variables added and the cells written since the
+  * last checkpoint (full or delta) to the given file. Takes time
+  * proportional to the # of changes, not the size of memory.
+  * Returns false if no full checkpoint has been taken yet, or the
+  * file could not be written (in which case the changes are kept
+  * for the next delta).
   *
   * @param memory Pointer to struct denoting memory unit
-  * @param address memory cell address
-  * @return pointer to struct containing value or NULL if doesn't exist
+  * @param path file to write
+  * @return true if successful, false if not
   */
-struct RAM_VALUE* ram_read_cell_by_addr(struct RAM* memory, int address)
+bool ram_checkpoint_delta(struct RAM* memory, char* path)
 {
-  if (address < 0 || address >= memory->size) {
-    return NULL;
+  RAM_LATENCY_SCOPE(RAM_LATENCY_CHECKPOINT);
+
+  struct RAM_DIRTY* dirty = &memory->dirty;
+
+  if (dirty->bits == NULL) {
+    return false;
+  }
+
+  FILE* out = fopen(path, "wb");
+
+  if (out == NULL) {
+    return false;
+  }
+
+  bool success = write_int(out, RAM_DELTA_MAGIC) && 
+                 write_int(out, dirty->low_size) && 
+                 write_int(out, memory->size) && 
+                 write_int(out, dirty->num_names);
+
+  for (int i = 0; success && i < dirty->num_names; i++) {
+    success = write_int(out, dirty->low_size + i) && write_name(out, name_str(memory, dirty->names[i]));
+  }
+
+  //
+  // cells beyond size were added and then rolled back:
+  //
+  int num_cells = 0;
+
+  for (int i = 0; i < dirty->num_cells; i++) {
+    if (dirty->cells[i] < memory->size) {
+      num_cells++;
+    }
+  }
+
+  success = success && write_int(out, num_cells);
+
+  for (int i = 0; success && i < dirty->num_cells; i++) {
+    int cell = dirty->cells[i];
+
+    if (cell < memory->size) {
+      success = write_int(out, cell) && write_value(out, ram_cell(memory, cell));
+    }
+  }
+
+  if (fclose(out) != 0 || !success) {
+    return false;
   }
 
-  return copy_value(&memory->cells[address]);
+  dirty_clear(memory);
+
+  return true;
 }
 
 
 /**
-  * @brief ram_read_cell_by_name: returns value in memory cell for this variable
-  *
-  * If the given variable (e.g. "x") has been written to 
-  * memory, returns a COPY of the value contained in memory.
-  * Returns NULL if no such name exists in memory.
+  * @brief ram_load_checkpoint: rebuilds memory from checkpoint files
   *
-  * NOTE: this function allocates memory for the value that
-  * is returned. The caller takes ownership of the copy and 
-  * must eventually free this memory via ram_free_value().
+  * Loads the image written by ram_checkpoint_full, then applies
+  * the given deltas (written by ram_checkpoint_delta) in order.
+  * The deltas must form an unbroken chain following the image.
+  * Returns NULL if a file is missing or malformed. You take
+  * ownership of the returned memory and must call ram_destroy().
   *
-  * @param memory Pointer to struct denoting memory unit
-  * @param varname variable name
-  * @return pointer to struct containing value or NULL if doesn't exist
+  * @param base_path image file written by ram_checkpoint_full
+  * @param delta_paths delta files, oldest first (may be NULL if none)
+  * @param num_deltas # of delta files
+  * @return pointer to struct denoting memory unit, or NULL
   */
-struct RAM_VALUE* ram_read_cell_by_name(struct RAM* memory, char* varname)
+struct RAM* ram_load_checkpoint(char* base_path, char** delta_paths, int num_deltas)
 {
-  int map_index = binary_search(memory, varname);
+  FILE* in = fopen(base_path, "rb");
 
-  if (map_index == -1) {
+  if (in == NULL) {
     return NULL;
   }
 
-  int cell = memory->map[map_index].cell;
+  struct RAM* memory = ram_init();
+  bool success = (memory != NULL) && load_image(memory, in);
 
-  return copy_value(&memory->cells[cell]);
-}
+  fclose(in);
 
+  for (int i = 0; success && i < num_deltas; i++) {
+    in = fopen(delta_paths[i], "rb");
 
-/**
-  * @brief ram_free_value: free value returned by read_cell() functions
-  *
-  * Frees the memory value returned by ram_read_cell_by_name and
-  * ram_read_cell_by_addr.
-  *
-  * @param value Pointer to struct containing value
-  * @return void
-  */
-void ram_free_value(struct RAM_VALUE* value)
-{
-  if (value == NULL) {
-    return;
+    if (in == NULL) {
+      success = false;
+      break;
+    }
+
+    success = apply_delta(memory, in);
+
+    fclose(in);
   }
 
-  if (value->value_type == RAM_TYPE_STR && value->types.s != NULL) {
-    free(value->types.s);
+  if (!success) {
+    ram_destroy(memory);
+    return NULL;
   }
 
-  free(value);
+  return memory;
 }
 
 
+//
+// A snapshot is a child process writing an image of memory as it
+// was when the child was forked; the kernel copies a page the parent
+// writes to only then, so the two don't interfere.
+//
+struct RAM_SNAPSHOT
+{
+  pid_t pid;     // child writing the image
+  int   fd;      // read end of a pipe whose write end only the child holds
+  int   status;  // enum RAM_SNAPSHOT_STATUS
+};
+
 /**
-  * @brief ram_write_cell_by_addr: writes a value to memory cell at this address
+  * @brief ram_snapshot_async: saves all of memory to a file, in the background
   *
-  * Writes the given value to the memory cell at the given 
-  * address. If a value already exists at this address, that
-  * value is overwritten by this new value. Returns true if 
-  * the value was successfully written, false if not (which 
-  * implies the memory address is invalid).
-  *
-  * NOTE: if the value being written is a string, it will
-  * be duplicated and stored.
-  * 
-  * NOTE: a variable has to be written to memory before its
-  * address becomes valid. Once a variable is written to memory,
-  * its address never changes.
+  * Forks a child process that writes the same image as
+  * ram_checkpoint_full, of memory exactly as it is at the time of
+  * the call, while the caller goes on using memory. The image is
+  * written to path + ".tmp" and then renamed to path, so path is
+  * never left half-written. Returns as soon as the child is
+  * started, so the caller pauses only as long as fork() takes.
+  * Unlike ram_checkpoint_full, does not start change tracking
+  * for ram_checkpoint_delta. Call from the only thread using memory.
   *
   * @param memory Pointer to struct denoting memory unit
-  * @param value value to be written to memory
-  * @param address memory cell address
-  * @return true if successful, false if not (invalid address)
+  * @param path file to write
+  * @return handle to poll, and to pass to ram_snapshot_wait, or NULL if
+  *   the child could not be started
   */
-bool ram_write_cell_by_addr(struct RAM* memory, struct RAM_VALUE value, int address)
+struct RAM_SNAPSHOT* ram_snapshot_async(struct RAM* memory, char* path)
 {
-  if (address < 0 || address >= memory->size) {
-    return false;
+  RAM_LATENCY_SCOPE(RAM_LATENCY_CHECKPOINT);
+
+  struct RAM_SNAPSHOT* snapshot = (struct RAM_SNAPSHOT*) malloc(sizeof(struct RAM_SNAPSHOT));
+  int fds[2];
+
+  if (snapshot == NULL) {
+    return NULL;
+  }
+
+  //
+  // close-on-exec, so a process another thread forks and execs can't
+  // hold the write end open and keep the snapshot from ever finishing:
+  //
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    free(snapshot);
+    return NULL;
+  }
+
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    //
+    // child: write the image and leave without running any of the
+    // parent's exit handlers or flushing its stdio buffers:
+    //
+    size_t length = strlen(path);
+    char* temp_path = (char*) malloc(length + 5);
+    bool success = false;
+
+    close(fds[0]);
+
+    if (temp_path != NULL) {
+      memcpy(temp_path, path, length);
+      memcpy(temp_path + length, ".tmp", 5);
+
+      success = write_image(memory, temp_path) && rename(temp_path, path) == 0;
+
+      if (!success) {
+        remove(temp_path);
+      }
+    }
+
+    _exit(success ? 0 : 1);
+  }
+
+  close(fds[1]);
+
+  if (pid < 0) {
+    close(fds[0]);
+    free(snapshot);
+    return NULL;
   }
 
-  if (memory->cells[address].value_type == RAM_TYPE_STR && 
-      memory->cells[address].types.s != NULL) {
-    free(memory->cells[address].types.s);
+  snapshot->pid = pid;
+  snapshot->fd = fds[0];
+  snapshot->status = RAM_SNAPSHOT_RUNNING;
+
+  return snapshot;
+}
+
+/**
+ * @brief snapshot_reap: records how a snapshot's child exited
+ * 
+ * @param snapshot Pointer to the snapshot
+ * @param options 0 to wait for the child, WNOHANG to not
+ * @return void
+ */
+static void snapshot_reap(struct RAM_SNAPSHOT* snapshot, int options)
+{
+  int status;
+  pid_t pid;
+
+  if (snapshot->status != RAM_SNAPSHOT_RUNNING) {
+    return;
   }
 
-  memory->cells[address].value_type = value.value_type;
+  do {
+    pid = waitpid(snapshot->pid, &status, options);
+  } while (pid < 0 && errno == EINTR);
 
-  if (value.value_type == RAM_TYPE_STR) {
-    memory->cells[address].types.s = strdup(value.types.s);
-  } else {
-    memory->cells[address].types = value.types;
+  if (pid == 0) {  // still running
+    return;
   }
 
-  return true;
+  if (pid == snapshot->pid && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+    snapshot->status = RAM_SNAPSHOT_DONE;
+  }
+  else {
+    snapshot->status = RAM_SNAPSHOT_FAILED;
+  }
 }
 
+/**
+  * @brief ram_snapshot_poll: checks on a snapshot, without waiting
+  *
+  * @param snapshot handle returned by ram_snapshot_async
+  * @return enum RAM_SNAPSHOT_STATUS
+  */
+int ram_snapshot_poll(struct RAM_SNAPSHOT* snapshot)
+{
+  snapshot_reap(snapshot, WNOHANG);
+
+  return snapshot->status;
+}
 
 /**
-  * ram_write_cell_by_name
+  * @brief ram_snapshot_fd: a file descriptor to wait on with poll() or select()
   *
-  * Writes the given value to a memory cell named by the given
-  * variable. If a memory cell already exists with this name,
-  * the existing value is overwritten by this new value. Returns
-  * true since this operation always succeeds.
+  * The descriptor becomes readable (at end of file) once the
+  * snapshot's child has finished, successfully or not; then call
+  * ram_snapshot_poll or ram_snapshot_wait for the outcome. Don't
+  * read from or close it.
   *
-  * NOTE: if the value being written is a string, it will
-  * be duplicated and stored.
+  * @param snapshot handle returned by ram_snapshot_async
+  * @return file descriptor
+  */
+int ram_snapshot_fd(struct RAM_SNAPSHOT* snapshot)
+{
+  return snapshot->fd;
+}
+
+/**
+  * @brief ram_snapshot_wait: waits for a snapshot to finish, then frees it
   *
-  * NOTE: a variable has to be written to memory before its
-  * address becomes valid. Once a variable is written to memory,
-  * its address never changes.
+  * Must be called once for every snapshot started, even after
+  * ram_snapshot_poll has reported it done, so the child process
+  * is cleaned up. The handle is no longer valid afterwards.
   *
-  * @param memory Pointer to struct denoting memory unit
-  * @param value value to be written to memory
-  * @param varname variable name
-  * @return true (always successful)
+  * @param snapshot handle returned by ram_snapshot_async
+  * @return true if the image was written, false if not
   */
-bool ram_write_cell_by_name(struct RAM* memory, struct RAM_VALUE value, char* varname)
+bool ram_snapshot_wait(struct RAM_SNAPSHOT* snapshot)
 {
-  int map_index = binary_search(memory, varname);
-
-  if (map_index != -1) {
-    int cell = memory->map[map_index].cell;
-
-    if (memory->cells[cell].value_type == RAM_TYPE_STR && 
-        memory->cells[cell].types.s != NULL) {
-      free(memory->cells[cell].types.s);
-    }
-    
-    memory->cells[cell].value_type = value.value_type;
-    
-    if (value.value_type == RAM_TYPE_STR) {
-      memory->cells[cell].types.s = strdup(value.types.s);
-    } else {
-      memory->cells[cell].types = value.types;
-    }
-
-  } else {
-    grow_if_needed(memory);
+  snapshot_reap(snapshot, 0);
 
-    int cell = memory->size;
+  bool success = (snapshot->status == RAM_SNAPSHOT_DONE);
 
-    memory->cells[cell].value_type = value.value_type;
+  close(snapshot->fd);
+  free(snapshot);
 
-    if (value.value_type == RAM_TYPE_STR) {
-      memory->cells[cell].types.s = strdup(value.types.s);
-    } else {
-      memory->cells[cell].types = value.types;
-    }
-
-    insert_into_map(memory, varname, cell);
-
-    memory->size++;
-  }
-
-  return true;
+  return success;
 }
 
 
@@ -465,9 +5165,9 @@ void ram_print(struct RAM* memory)
   printf("Contents:\n");
 
   for (int i = 0; i < memory->size; i++) {
-    char* varname = memory->map[i].varname;
+    char* varname = name_str(memory, memory->map[i].name);
     int cell = memory->map[i].cell;
-    struct RAM_VALUE* value = &memory->cells[cell];
+    struct RAM_VALUE* value = ram_cell(memory, cell);
     
     printf("%d: %s, ", i, varname);
     switch (value->value_type) {
@@ -489,6 +5189,18 @@ void ram_print(struct RAM* memory)
       case RAM_TYPE_NONE:
         printf("None\n");
         break;
+      case RAM_TYPE_ARRAY:
+        printf("%s array, [", value->types.a->elem_type == RAM_ARRAY_INT ? "int" : "real");
+        for (int k = 0; k < value->types.a->length; k++) {
+          if (value->types.a->elem_type == RAM_ARRAY_INT) {
+            printf("%s%d", k > 0 ? ", " : "", value->types.a->elems.i[k]);
+          }
+          else {
+            printf("%s%lf", k > 0 ? ", " : "", value->types.a->elems.d[k]);
+          }
+        }
+        printf("]\n");
+        break;
     }
   }
 
@@ -510,7 +5222,7 @@ void ram_print_map(struct RAM* memory)
 
   for (int i = 0; i < memory->size; i++)
   {
-    printf("%d: '%s' -> cell %d\n", i, memory->map[i].varname, memory->map[i].cell);
+    printf("%d: '%s' -> cell %d\n", i, name_str(memory, memory->map[i].name), memory->map[i].cell);
   }
 
   printf("**END PRINT**\n");
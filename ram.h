@@ -13,6 +13,7 @@
 #pragma once
 
 #include <stdbool.h>  // true, false
+#include <limits.h>   // INT_MAX
 
 
 //
@@ -25,7 +26,33 @@ enum RAM_VALUE_TYPES
   RAM_TYPE_STR,
   RAM_TYPE_PTR,
   RAM_TYPE_BOOLEAN,
-  RAM_TYPE_NONE
+  RAM_TYPE_NONE,
+  RAM_TYPE_ARRAY
+};
+
+//
+// Element types of a RAM_TYPE_ARRAY value:
+//
+enum RAM_ARRAY_TYPES
+{
+  RAM_ARRAY_INT = 0,
+  RAM_ARRAY_REAL
+};
+
+//
+// A homogeneous array of ints or reals, stored contiguously and
+// owned by the memory cell that holds it.
+//
+struct RAM_ARRAY
+{
+  int elem_type;  // enum RAM_ARRAY_TYPES
+  int length;     // # of elements in use
+  int capacity;   // # of elements allocated
+  union
+  {
+    int*    i;    // RAM_ARRAY_INT
+    double* d;    // RAM_ARRAY_REAL
+  } elems;
 };
 
 struct RAM_VALUE
@@ -43,21 +70,179 @@ struct RAM_VALUE
     int    i; // INT, PTR, BOOLEAN
     double d; // REAL
     char*  s; // STR 
+    struct RAM_ARRAY* a; // ARRAY
   } types;
 };
 
+//
+// Strings stored in memory are length-prefixed: the char* in a
+// RAM_TYPE_STR value points just past this header, so it can still
+// be used as a normal '\0'-terminated C string.
+//
+struct RAM_STR
+{
+  int length;         // # of chars, not counting the terminating '\0'
+  int capacity;       // # of chars that fit, not counting the '\0'
+  unsigned int hash;  // cached hash of contents, 0 => not yet computed
+  int reserved;       // padding, keeps the chars 16-byte aligned
+};
+
+//
+// Variable names are kept one after another, each '\0'-terminated,
+// in a single block of chars rather than allocated one at a time; a
+// map entry holds the offset of its name there (see ram_map_name).
+// Names removed (e.g. by a rollback) leave garbage behind unless
+// they were the last ones added; ram_compact_names reclaims it, and
+// can also front-code runs of names that share a prefix. A
+// front-coded name's offset has RAM_NAME_CODED set.
+//
+#define RAM_NAME_CODED 0x80000000u
+
 struct RAM_MAP
 {
-  char* varname;  // variable name
-  int   cell;     // memory cell assigned to variable
+  unsigned int name;  // offset of variable's name in memory->names
+  int          cell;  // memory cell assigned to variable
+};
+
+struct RAM_NAMES
+{
+  char* chars;            // the names, NULL => not allocated yet
+  unsigned int used;      // # of chars in use, garbage included
+  unsigned int capacity;  // # of chars allocated, < RAM_NAME_CODED
+  unsigned int garbage;   // # of chars used by names no longer in the map
+  char* scratch;          // room to decode the longest front-coded name
+  int scratch_capacity;   // # of chars allocated for scratch
+};
+
+//
+// Bytes currently allocated by a memory unit, by category. Counts
+// the bytes requested from malloc, not the allocator's own overhead.
+//
+struct RAM_USAGE
+{
+  long long total;    // sum of all the categories below
+  long long header;   // the struct RAM itself
+  long long cells;    // the cell segments and their directory
+  long long map;      // the map array
+  long long names;    // variable names
+  long long strings;  // string values, including their headers
+  long long arrays;   // array values, including their elements
+  long long undo;     // undo log, including the old values it holds
+  long long dirty;    // dirty-cell tracking for checkpoints
+  long long bloom;    // Bloom filter of variable names
+  long long heap;     // managed heap for PTR values, if any (see ram_heap.h)
+};
+
+//
+// Transactions: while a transaction is open, every change to memory
+// appends a record to an undo log so it can be rolled back.
+//
+enum RAM_UNDO_KINDS
+{
+  RAM_UNDO_OVERWRITE = 0,  // cell was overwritten, old holds its previous value
+  RAM_UNDO_INSERT,         // variable was added, old.types.i is its name's offset
+  RAM_UNDO_APPEND          // array or string was appended to, old.types.i is its old length
+};
+
+struct RAM_UNDO
+{
+  int kind;              // enum RAM_UNDO_KINDS
+  int cell;              // memory cell the change applies to
+  struct RAM_VALUE old;  // what is needed to undo the change
+};
+
+struct RAM_TXN
+{
+  struct RAM_UNDO* log;  // undo log, oldest change first
+  int size;              // # of records in the log
+  int capacity;          // # of records allocated
+  int owned;             // # of leading records that may still own an old value
+  int* savepoints;       // log size at each ram_txn_begin, innermost last
+  int depth;             // # of open (nested) transactions
+  int max_depth;         // # of savepoints allocated
+};
+
+//
+// Dirty-cell tracking: once the first checkpoint is taken, every
+// change to memory is recorded here so the next delta checkpoint
+// only has to save what changed.
+//
+struct RAM_DIRTY
+{
+  unsigned char* bits;  // 1 bit per cell, set when it changes; NULL => not tracking
+  int*   cells;         // cells whose bit is set, in the order they changed
+  int    num_cells;     // # of cells in the list above
+  unsigned int* names;  // names of vars added since the last checkpoint, in order
+                        // (offsets, like map entries; names[i] is cell low_size + i)
+  int    num_names;     // # of names in the list above
+  int    low_size;      // smallest size of memory since the last checkpoint
+};
+
+//
+// Bloom filter of the names in memory, so a lookup of a name that is
+// not there can usually be answered without searching the map. Each
+// name sets 2 bits in one 64-bit word (a "blocked" filter). Sized at
+// about 8 bits per cell (512 at least), so roughly 5% of misses still
+// search the map.
+// Names removed by a rollback stay in the filter until it is rebuilt,
+// which only costs extra searches.
+//
+struct RAM_BLOOM
+{
+  unsigned long long* words;  // NULL => not enabled
+  int num_words;              // a power of 2
 };
 
+//
+// Cells are stored in segments of RAM_SEGMENT_CELLS cells, found
+// through a directory: the cell at address a is cell
+// a & RAM_SEGMENT_MASK of segment a >> RAM_SEGMENT_SHIFT (see
+// ram_cell). Growing memory adds segments, so it never moves a cell
+// in a full segment, and a pointer to such a cell stays good as long
+// as its variable exists. Only segment 0 starts out smaller (just
+// big enough for memory's capacity) and moves as it grows to full
+// size.
+//
+#define RAM_SEGMENT_SHIFT 10
+#define RAM_SEGMENT_CELLS (1 << RAM_SEGMENT_SHIFT)
+#define RAM_SEGMENT_MASK  (RAM_SEGMENT_CELLS - 1)
+
+//
+// Addresses are ints, so a memory unit holds at most this many
+// variables (the most whole segments an int can address); writes
+// that would need more cells fail, as do writes when the cells
+// cannot be allocated.
+//
+#define RAM_MAX_CAPACITY (INT_MAX - RAM_SEGMENT_MASK)
+
+struct RAM_JOURNAL;  // see ram_journal.h
+struct RAM_TRACE;    // see ram_trace.h
+struct RAM_HEAP;     // see ram_heap.h
+struct RAM_LAYOUT;   // see ram_layout.h
+
 struct RAM
 {
-  struct RAM_VALUE* cells;  // array of memory cells
+  struct RAM_VALUE** segments;  // directory of cell segments, NULL => not allocated yet
+  int num_segments;         // # of segments allocated
+  int max_segments;         // # of entries allocated in the directory
   struct RAM_MAP*   map;    // ordered array to map vars to memory cells
+  struct RAM_NAMES  names;  // the variables' names, found through map
   int size;                 // # of vars currently in memory
   int capacity;             // total # of cells available in memory
+  struct RAM_USAGE usage;   // bytes allocated, kept up to date by every write
+  long long budget;         // max bytes allowed in usage.total, 0 => unlimited
+  struct RAM_TXN txn;       // open transactions and their undo log
+  struct RAM_DIRTY dirty;   // changes since the last checkpoint
+  struct RAM_JOURNAL* journal;  // write-ahead journal, NULL => not journaled
+  struct RAM_BLOOM bloom;   // filter of names, for fast misses (see ram_bloom_enable)
+  struct RAM_TRACE* trace;  // workload trace being recorded, NULL => not recording
+  struct RAM_HEAP* heap;    // objects PTR values refer to, NULL => no heap
+  struct RAM_LAYOUT* layout;  // access counts per cell, NULL => not sampling
+  bool observed;            // trace != NULL or layout != NULL, so the typed ops
+                            // check just this (see ram_type_by_addr, ram_fast_cell)
+  unsigned int epoch;       // bumped whenever vars are removed (reset, rollback)
+                            // or moved (ram_renumber_hot_first), so callers that
+                            // cache addresses can check them
 };
 
 
@@ -74,7 +259,11 @@ struct RAM
   * take ownership of the returned memory and must call
   * ram_destroy() when you are done.
   *
-  * @return pointer to struct denoting memory unit
+  * NOTE: only the struct itself is allocated here; the cell
+  * segments and map array are allocated by the first write.
+  *
+  * @return pointer to struct denoting memory unit, or NULL if out
+  *         of memory
   */
 struct RAM* ram_init(void);
 
@@ -89,6 +278,98 @@ struct RAM* ram_init(void);
   */
 void ram_destroy(struct RAM* memory);
 
+/**
+  * @brief ram_reset: removes all variables, keeping the allocated cells
+  *
+  * Returns memory to the empty state of a new memory unit, except
+  * that the cells and map arrays keep their current capacity, so
+  * refilling memory does not have to allocate and grow them again.
+  * Open transactions are discarded, dirty tracking is stopped, and
+  * every object in memory's heap (if any) is freed; the memory
+  * budget is kept.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_reset(struct RAM* memory);
+
+/**
+  * @brief ram_reserve: makes room for a # of variables up front
+  *
+  * Grows the cells and map arrays (allocating them if needed) so
+  * that memory can hold at least the given # of variables without
+  * growing again; more than RAM_SEGMENT_CELLS is rounded up to
+  * whole segments. Does nothing if there is already room. Returns
+  * false, leaving memory as it was, if the arrays cannot be
+  * allocated (or capacity exceeds RAM_MAX_CAPACITY).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param capacity # of variables to make room for
+  * @return true if successful, false if out of memory
+  */
+bool ram_reserve(struct RAM* memory, int capacity);
+
+/**
+  * @brief ram_trim: shrinks an empty memory's allocated cells
+  *
+  * If memory is empty (e.g. right after ram_reset) and its capacity
+  * exceeds the given maximum, shrinks the cells and map arrays to
+  * that capacity (which stops dirty tracking). Also frees the undo
+  * log if no transaction is open. Returns false, doing nothing, if
+  * memory is not empty.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param max_capacity capacity to shrink to (>= 1)
+  * @return true if memory is empty (trimmed if needed), false if not
+  */
+bool ram_trim(struct RAM* memory, int max_capacity);
+
+/**
+  * @brief ram_renumber_hot_first: renumbers the cells, most-used first
+  *
+  * Using the access counts sampled since ram_layout_sample_start
+  * (see ram_layout.h), gives the cells that were sampled the
+  * lowest addresses, most-used first, so they share cache lines;
+  * the rest keep their order after them.
+  *
+  * NOTE: this is the one operation that changes addresses, and it
+  * is never done implicitly. Variables keep their names and values
+  * but may get new addresses, so memory->epoch is bumped, and
+  * addresses cached before must be looked up again (or mapped with
+  * new_addrs). A full checkpoint has to be taken before the next
+  * delta. Returns false, moving nothing, if not sampling, a
+  * transaction is open, memory is journaled or traced (their
+  * records hold addresses), or out of memory.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param new_addrs set to each old address's new address, if not NULL
+  *   (ram_size entries)
+  * @return true if successful, false if not
+  */
+bool ram_renumber_hot_first(struct RAM* memory, int* new_addrs);
+
+/**
+  * @brief ram_compact_names: rewrites the names block, dropping garbage
+  *
+  * Copies the names into a new block of just the right size, in map
+  * (i.e. sorted) order, leaving out the names rollbacks removed.
+  * With front_code, a name that shares 3 or more leading chars with
+  * a recent name is stored as the # of chars shared and the rest,
+  * so runs like "v00001000", "v00001001", ... take about 5 bytes a
+  * name instead of 10. A lookup compares the shared part (read from
+  * the other name) and the rest separately, so it stays O(log n),
+  * but may miss cache twice as often. Without front_code, every
+  * name is stored whole again. Names added later are stored whole.
+  * Addresses do not change. Returns false, changing nothing, if a
+  * transaction is open (its undo log holds offsets of names), over
+  * budget or out of memory.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param front_code front-code runs of names with a common prefix?
+  * @return true if successful, false if not
+  */
+bool ram_compact_names(struct RAM* memory, bool front_code);
+
 /**
   * @brief ram_size: # of vars in memory
   *
@@ -107,6 +388,48 @@ int ram_size(struct RAM* memory);
   */
 int ram_capacity(struct RAM* memory);
 
+/**
+  * @brief ram_map_name: name of the variable at a given map index
+  *
+  * The map is in name order, so indexes 0..ram_size-1 visit the
+  * variables alphabetically; memory->map[index].cell is the
+  * variable's address. The name is only good until memory changes
+  * (the names block moves as it grows) or, if it was front-coded
+  * (see ram_compact_names), until the next call.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param index map index, 0..ram_size-1
+  * @return '\0'-terminated name, NULL if index is out of range
+  */
+char* ram_map_name(struct RAM* memory, int index);
+
+/**
+  * @brief ram_memory_usage: # of bytes allocated by memory
+  *
+  * Returns a breakdown of the bytes currently allocated by the
+  * memory unit: the struct itself, the cells and map arrays, and
+  * all variable names, strings and arrays it owns. The breakdown is
+  * maintained as memory changes, so this call is O(1).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return breakdown of bytes allocated
+  */
+struct RAM_USAGE ram_memory_usage(struct RAM* memory);
+
+/**
+  * @brief ram_set_memory_budget: limits the # of bytes memory may allocate
+  *
+  * Once a budget is set, any write that would push the total bytes
+  * allocated (see ram_memory_usage) above the budget fails and
+  * returns false, leaving memory unchanged. Writes that do not
+  * increase the total always succeed. Pass 0 to remove the budget.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param budget max # of bytes, 0 => unlimited
+  * @return void
+  */
+void ram_set_memory_budget(struct RAM* memory, long long budget);
+
 /**
   * @brief ram_get_addr: address of memory cell occupied by variable
   *
@@ -118,7 +441,8 @@ int ram_capacity(struct RAM* memory);
   *
   * NOTE: a variable has to be written to memory before you can
   * get its address. Once a variable is written to memory, its
-  * address never changes. 
+  * address never changes, unless memory is renumbered (see
+  * ram_renumber_hot_first).
   *
   * @param memory Pointer to struct denoting memory unit
   * @param varname variable name
@@ -126,12 +450,82 @@ int ram_capacity(struct RAM* memory);
   */
 int ram_get_addr(struct RAM* memory, char* varname);
 
+/**
+  * @brief ram_get_addr_n: address of variable, given a name of known length
+  *
+  * Same as ram_get_addr, but the name is the given # of chars and
+  * need not be '\0'-terminated (e.g. a slice of a larger buffer).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varname pointer to the chars of the variable name
+  * @param length # of chars in the name
+  * @return address of variable or -1 if doesn't exist
+  */
+int ram_get_addr_n(struct RAM* memory, char* varname, int length);
+
+/**
+  * @brief ram_get_addrs: addresses of many variables at once
+  *
+  * Same as calling ram_get_addr for each name, but faster when there
+  * are many names and memory is large: several lookups are run at
+  * once, interleaved, so that while one waits for its next map entry
+  * or name to arrive from memory (which is prefetched), the others
+  * make progress.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varnames n variable names
+  * @param n # of names
+  * @param addrs set to the n addresses, -1 for each name that doesn't exist
+  * @return # of names found
+  */
+int ram_get_addrs(struct RAM* memory, char** varnames, int n, int* addrs);
+
+/**
+  * @brief ram_name_hash: hash of a variable name
+  *
+  * Returns the 32-bit FNV-1a hash of the name (the same hash as
+  * ram_str_hash), for use with ram_may_contain. Computing it once
+  * lets a name be checked against several memory units.
+  *
+  * @param varname variable name
+  * @return hash of the name (never 0)
+  */
+unsigned int ram_name_hash(char* varname);
+
+/**
+  * @brief ram_bloom_enable: keeps a Bloom filter of memory's names
+  *
+  * From now on memory keeps a small filter of its variable names,
+  * updated as variables are added, so that ram_may_contain can rule
+  * out most names that are not in memory without searching. Does
+  * nothing if already enabled. The filter is freed by ram_destroy.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_bloom_enable(struct RAM* memory);
+
+/**
+  * @brief ram_may_contain: could memory contain a variable with this name?
+  *
+  * Checks the name's hash (see ram_name_hash) against memory's Bloom
+  * filter. false means the name is definitely not in memory; true
+  * means it may be, and ram_get_addr has to be called to find out.
+  * Always true if the filter is not enabled.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param hash hash of the variable name, from ram_name_hash
+  * @return false if the name is definitely not in memory, true if it may be
+  */
+bool ram_may_contain(struct RAM* memory, unsigned int hash);
+
 /**
   * @brief ram_read_cell_by_addr: returns value in memory cell at this address
   *
   * Given a memory address (an integer in the range 0..N-1), 
   * returns a COPY of the value contained in that memory cell.
-  * Returns NULL if the address is not valid.
+  * Returns NULL if the address is not valid. Also returns NULL
+  * if there is no memory for the copy.
   * 
   * NOTE: this function allocates memory for the value that
   * is returned. The caller takes ownership of the copy and 
@@ -139,7 +533,8 @@ int ram_get_addr(struct RAM* memory, char* varname);
   *
   * NOTE: a variable has to be written to memory before its
   * address becomes valid. Once a variable is written to memory,
-  * its address never changes.
+  * its address never changes, unless memory is renumbered
+  * (see ram_renumber_hot_first).
   *
   * @param memory Pointer to struct denoting memory unit
   * @param address memory cell address
@@ -152,7 +547,8 @@ struct RAM_VALUE* ram_read_cell_by_addr(struct RAM* memory, int address);
   *
   * If the given variable (e.g. "x") has been written to 
   * memory, returns a COPY of the value contained in memory.
-  * Returns NULL if no such name exists in memory.
+  * Returns NULL if no such name exists in memory. Also returns
+  * NULL if there is no memory for the copy.
   *
   * NOTE: this function allocates memory for the value that
   * is returned. The caller takes ownership of the copy and 
@@ -182,14 +578,21 @@ void ram_free_value(struct RAM_VALUE* value);
   * address. If a value already exists at this address, that
   * value is overwritten by this new value. Returns true if 
   * the value was successfully written, false if not (which 
-  * implies the memory address is invalid).
+  * implies the memory address is invalid, or the write would
+  * exceed the memory budget).
   *
   * NOTE: if the value being written is a string, it will
-  * be duplicated and stored.
+  * be duplicated and stored, up to its first '\0' (the length
+  * is taken with strlen). A string with embedded '\0' chars,
+  * e.g. one read from memory, must be written with
+  * ram_write_str_by_addr or ram_write_str_by_name and its
+  * ram_str_length; those also skip the strlen when the length
+  * is already known.
   * 
   * NOTE: a variable has to be written to memory before its
   * address becomes valid. Once a variable is written to memory,
-  * its address never changes.
+  * its address never changes, unless memory is renumbered
+  * (see ram_renumber_hot_first).
   *
   * @param memory Pointer to struct denoting memory unit
   * @param value value to be written to memory
@@ -204,39 +607,1120 @@ bool ram_write_cell_by_addr(struct RAM* memory, struct RAM_VALUE value, int addr
   * Writes the given value to a memory cell named by the given
   * variable. If a memory cell already exists with this name,
   * the existing value is overwritten by this new value. Returns
-  * true since this operation always succeeds.
+  * true unless a memory budget is set and the write would
+  * exceed it (see ram_set_memory_budget).
   *
   * NOTE: if the value being written is a string, it will
-  * be duplicated and stored.
+  * be duplicated and stored, up to its first '\0' (the length
+  * is taken with strlen). A string with embedded '\0' chars,
+  * e.g. one read from memory, must be written with
+  * ram_write_str_by_addr or ram_write_str_by_name and its
+  * ram_str_length; those also skip the strlen when the length
+  * is already known.
   *
   * NOTE: a variable has to be written to memory before its
   * address becomes valid. Once a variable is written to memory,
-  * its address never changes.
+  * its address never changes, unless memory is renumbered
+  * (see ram_renumber_hot_first).
   *
   * @param memory Pointer to struct denoting memory unit
   * @param value value to be written to memory
   * @param varname variable name
-  * @return true (always successful)
+  * @return true if successful, false if over budget
   */
 bool ram_write_cell_by_name(struct RAM* memory, struct RAM_VALUE value, char* varname);
 
 /**
-  * @brief ram_print: prints the contents of memory
+  * @brief ram_write_str_by_addr: writes a string of known length by address
   *
-  * Prints the contents of RAM to the console, for debugging.
-  * RAM is printed in alphabetical order by variable name.
+  * Writes a copy of the given length chars to the memory cell at
+  * the given address, overwriting whatever value was there. The
+  * chars may contain embedded '\0' chars; the stored string is
+  * also '\0'-terminated. Returns false if the address is invalid.
   *
   * @param memory Pointer to struct denoting memory unit
-  * @return void
+  * @param s pointer to the chars to write
+  * @param length number of chars to write
+  * @param address memory cell address
+  * @return true if successful, false if not (invalid address)
   */
-void ram_print(struct RAM* memory);
+bool ram_write_str_by_addr(struct RAM* memory, char* s, int length, int address);
 
 /**
-  * @brief ram_print_map: prints the contents of memory map
+  * @brief ram_write_str_by_name: writes a string of known length by name
   *
-  * Prints contents of RAM map to the console, for debugging.
+  * Writes a copy of the given length chars to the memory cell
+  * named by the given variable, creating the variable if needed.
+  * The chars may contain embedded '\0' chars; the stored string
+  * is also '\0'-terminated. Returns false if length < 0 or the
+  * write would exceed the memory budget.
   *
   * @param memory Pointer to struct denoting memory unit
-  * @return void
+  * @param s pointer to the chars to write
+  * @param length number of chars to write
+  * @param varname variable name
+  * @return true if successful, false if not
   */
-void ram_print_map(struct RAM* memory);
+bool ram_write_str_by_name(struct RAM* memory, char* s, int length, char* varname);
+
+/**
+  * @brief ram_append_str_by_addr: appends chars to a string in place
+  *
+  * Extends the string stored at the given address by the given
+  * length chars (which may contain embedded '\0' chars), without
+  * copying what is already there: capacity doubles as needed, so
+  * repeated appends are amortized O(1). The string stays
+  * '\0'-terminated. s may point into the string itself. Returns
+  * false if the address is invalid, the cell does not hold a
+  * string, or the growth would exceed the memory budget.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param s pointer to the chars to append
+  * @param length number of chars to append
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_append_str_by_addr(struct RAM* memory, char* s, int length, int address);
+
+/**
+  * @brief ram_append_str_by_name: appends chars to a string in place, by name
+  *
+  * Same as ram_append_str_by_addr, for the variable with the given
+  * name. Returns false if there is no such variable.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param s pointer to the chars to append
+  * @param length number of chars to append
+  * @param varname variable name
+  * @return true if successful, false if not
+  */
+bool ram_append_str_by_name(struct RAM* memory, char* s, int length, char* varname);
+
+/**
+  * @brief ram_bulk_load: writes many variables by name at once
+  *
+  * Same as calling ram_write_cell_by_name(memory, values[i],
+  * varnames[i]) for i = 0..n-1, but in O(n log n + size) time rather
+  * than O(n * size): the names are sorted (on several threads when
+  * there are many), merged into memory in one pass, and memory grows
+  * at most once. New variables get addresses in the order their
+  * names first appear. A name may appear more than once; the last
+  * value wins. Nothing is changed if the writes would exceed the
+  * memory budget or memory cannot be allocated.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varnames n variable names, in any order
+  * @param values n values to write, NULL => see ram_declare
+  * @param n # of names
+  * @param addrs set to the n addresses, may be NULL
+  * @return true if successful, false if n < 0, over budget or out of memory
+  */
+bool ram_bulk_load(struct RAM* memory, char** varnames, struct RAM_VALUE* values, int n, int* addrs);
+
+/**
+  * @brief ram_declare: creates many variables at once
+  *
+  * Same as ram_bulk_load with no values: names not already in memory
+  * are added with the value None; variables that exist keep their
+  * values. Either way their addresses are returned, so they can be
+  * bound before anything is written.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param varnames n variable names, in any order
+  * @param n # of names
+  * @param addrs set to the n addresses, may be NULL
+  * @return true if successful, false if n < 0, over budget or out of memory
+  */
+bool ram_declare(struct RAM* memory, char** varnames, int n, int* addrs);
+
+/**
+  * @brief ram_str_length: length of a string owned by memory
+  *
+  * Returns the # of chars in a string stored in memory or returned
+  * by one of the read functions, in O(1) time.
+  *
+  * NOTE: only valid for strings produced by memory, not for
+  * arbitrary C strings.
+  *
+  * @param s string from a RAM_TYPE_STR value produced by memory
+  * @return # of chars, not counting the terminating '\0'
+  */
+int ram_str_length(char* s);
+
+/**
+  * @brief ram_str_hash: hash of a string owned by memory
+  *
+  * Returns the 32-bit FNV-1a hash of the string's contents. The
+  * hash is computed on first use and cached in the string's header,
+  * and carries over when the string is copied.
+  *
+  * @param s string from a RAM_TYPE_STR value produced by memory
+  * @return hash of the string's contents (never 0)
+  */
+unsigned int ram_str_hash(char* s);
+
+/**
+  * @brief ram_str_equals: compares two strings owned by memory
+  *
+  * Returns true if both strings have the same contents. Strings of
+  * different lengths, or with different cached hashes, are rejected
+  * without looking at their chars.
+  *
+  * @param s1 string from a RAM_TYPE_STR value produced by memory
+  * @param s2 string from a RAM_TYPE_STR value produced by memory
+  * @return true if equal, false if not
+  */
+bool ram_str_equals(char* s1, char* s2);
+
+/**
+  * @brief ram_write_array_by_addr: writes an array value by address
+  *
+  * Writes a copy of the given elements, as a RAM_TYPE_ARRAY value,
+  * to the memory cell at the given address. elems points to length
+  * ints (RAM_ARRAY_INT) or doubles (RAM_ARRAY_REAL), and may be NULL
+  * if length is 0. Returns false if the address is invalid.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param elem_type enum RAM_ARRAY_TYPES
+  * @param elems pointer to the elements to copy
+  * @param length # of elements
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_write_array_by_addr(struct RAM* memory, int elem_type, void* elems, int length, int address);
+
+/**
+  * @brief ram_write_array_by_name: writes an array value by name
+  *
+  * Writes a copy of the given elements, as a RAM_TYPE_ARRAY value,
+  * to the memory cell named by the given variable, creating the
+  * variable if needed. Returns false if elem_type or length is
+  * invalid.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param elem_type enum RAM_ARRAY_TYPES
+  * @param elems pointer to the elements to copy
+  * @param length # of elements
+  * @param varname variable name
+  * @return true if successful, false if not
+  */
+bool ram_write_array_by_name(struct RAM* memory, int elem_type, void* elems, int length, char* varname);
+
+/**
+  * @brief ram_borrow_array_by_addr: direct access to an array in memory
+  *
+  * Returns a pointer to the array stored in the memory cell at the
+  * given address, without copying it. Returns NULL if the address
+  * is invalid or the cell does not hold an array.
+  *
+  * NOTE: memory keeps ownership. The pointer (and its elems) are
+  * only valid until the cell is next written or appended to, or
+  * memory is destroyed. Do not free it.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @return pointer to array or NULL
+  */
+struct RAM_ARRAY* ram_borrow_array_by_addr(struct RAM* memory, int address);
+
+/**
+  * @brief ram_array_append_int_by_addr: appends an int to an array
+  *
+  * Appends to the int array stored at the given address. Capacity
+  * doubles as needed, so repeated appends are amortized O(1).
+  * Returns false if the address is invalid or the cell does not
+  * hold an int array.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value int to append
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_array_append_int_by_addr(struct RAM* memory, int value, int address);
+
+/**
+  * @brief ram_array_append_real_by_addr: appends a real to an array
+  *
+  * Appends to the real array stored at the given address. Capacity
+  * doubles as needed, so repeated appends are amortized O(1).
+  * Returns false if the address is invalid or the cell does not
+  * hold a real array.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value real to append
+  * @param address memory cell address
+  * @return true if successful, false if not
+  */
+bool ram_array_append_real_by_addr(struct RAM* memory, double value, int address);
+
+/**
+  * @brief ram_array_sum: sum of the elements of an array
+  *
+  * Int arrays are summed exactly in 64 bits, then converted.
+  *
+  * @param a array (e.g. from ram_borrow_array_by_addr)
+  * @return sum of elements, 0.0 if empty
+  */
+double ram_array_sum(struct RAM_ARRAY* a);
+
+/**
+  * @brief ram_array_minmax: smallest and largest element of an array
+  *
+  * @param a array (e.g. from ram_borrow_array_by_addr)
+  * @param min set to the smallest element
+  * @param max set to the largest element
+  * @return true if successful, false if the array is empty
+  */
+bool ram_array_minmax(struct RAM_ARRAY* a, double* min, double* max);
+
+/**
+  * @brief ram_array_scale: multiplies every element by a factor, in place
+  *
+  * Int arrays can only be scaled by a whole number.
+  *
+  * @param a array (e.g. from ram_borrow_array_by_addr)
+  * @param factor factor to multiply by
+  * @return true if successful, false if a is an int array and factor
+  *         is not a whole number
+  */
+bool ram_array_scale(struct RAM_ARRAY* a, double factor);
+
+/**
+  * @brief ram_array_add: elementwise dst += src, in place
+  *
+  * Both arrays must have the same length. An int array may be added
+  * to a real array, but not the other way around.
+  *
+  * @param dst array that is updated
+  * @param src array that is added
+  * @return true if successful, false if not
+  */
+bool ram_array_add(struct RAM_ARRAY* dst, struct RAM_ARRAY* src);
+
+/**
+  * @brief ram_array_dot: dot product of two arrays
+  *
+  * Both arrays must have the same length; element types may differ.
+  *
+  * @param a first array
+  * @param b second array
+  * @param result set to the dot product
+  * @return true if successful, false if the lengths differ
+  */
+bool ram_array_dot(struct RAM_ARRAY* a, struct RAM_ARRAY* b, double* result);
+
+/**
+  * @brief ram_txn_begin: starts a transaction (or a nested savepoint)
+  *
+  * From now on, every write to memory is recorded in an undo log
+  * so it can be rolled back: overwritten values, newly added
+  * variables, and array appends. Transactions nest; each call must
+  * be matched by a ram_txn_commit or ram_txn_rollback.
+  *
+  * NOTE: changes made directly through a pointer returned by
+  * ram_borrow_array_by_addr (e.g. ram_array_scale) are not logged.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if out of memory (no
+  *         transaction was started)
+  */
+bool ram_txn_begin(struct RAM* memory);
+
+/**
+  * @brief ram_txn_commit: ends the innermost transaction, keeping its changes
+  *
+  * Committing a nested transaction folds its changes into the
+  * enclosing one, so they are still undone if the enclosing
+  * transaction rolls back. Takes O(1) time, except that the
+  * outermost commit frees the old values its transaction logged
+  * (so it costs as much as the writes made, and they stop counting
+  * against the memory budget). Returns false if no transaction is
+  * open.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if no transaction is open
+  */
+bool ram_txn_commit(struct RAM* memory);
+
+/**
+  * @brief ram_txn_rollback: ends the innermost transaction, undoing its changes
+  *
+  * Restores memory to its state at the matching ram_txn_begin:
+  * overwritten values come back, and variables added since then
+  * are removed (so their addresses become invalid again). Takes
+  * time proportional to the # of writes being undone. Returns
+  * false if no transaction is open.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if no transaction is open
+  */
+bool ram_txn_rollback(struct RAM* memory);
+
+/**
+  * @brief ram_txn_depth: # of open transactions
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return nesting depth, 0 if no transaction is open
+  */
+int ram_txn_depth(struct RAM* memory);
+
+/**
+  * @brief ram_checkpoint_full: saves all of memory to a file
+  *
+  * Writes a binary image of memory (every variable and its value)
+  * to the given file, overwriting it. Also starts (or restarts)
+  * tracking which cells change, so that ram_checkpoint_delta can
+  * later save just the changes. Returns false if the file could
+  * not be written, or there is no memory to track changes with.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param path file to write
+  * @return true if successful, false if not
+  */
+bool ram_checkpoint_full(struct RAM* memory, char* path);
+
+/**
+  * @brief ram_checkpoint_delta: saves the changes since the last checkpoint
+  *
+  * Writes only the variables added and the cells written since the
+  * last checkpoint (full or delta) to the given file. Takes time
+  * proportional to the # of changes, not the size of memory.
+  * Returns false if no full checkpoint has been taken yet, or the
+  * file could not be written (in which case the changes are kept
+  * for the next delta).
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param path file to write
+  * @return true if successful, false if not
+  */
+bool ram_checkpoint_delta(struct RAM* memory, char* path);
+
+/**
+  * @brief ram_load_checkpoint: rebuilds memory from checkpoint files
+  *
+  * Loads the image written by ram_checkpoint_full, then applies
+  * the given deltas (written by ram_checkpoint_delta) in order.
+  * The deltas must form an unbroken chain following the image.
+  * Returns NULL if a file is missing or malformed. You take
+  * ownership of the returned memory and must call ram_destroy().
+  *
+  * @param base_path image file written by ram_checkpoint_full
+  * @param delta_paths delta files, oldest first (may be NULL if none)
+  * @param num_deltas # of delta files
+  * @return pointer to struct denoting memory unit, or NULL
+  */
+struct RAM* ram_load_checkpoint(char* base_path, char** delta_paths, int num_deltas);
+
+struct RAM_SNAPSHOT;  // opaque, see ram.c
+
+enum RAM_SNAPSHOT_STATUS
+{
+  RAM_SNAPSHOT_RUNNING = 0,  // the child is still writing the image
+  RAM_SNAPSHOT_DONE,         // the image was written
+  RAM_SNAPSHOT_FAILED        // it wasn't (e.g. the file could not be written)
+};
+
+/**
+  * @brief ram_snapshot_async: saves all of memory to a file, in the background
+  *
+  * Forks a child process that writes the same image as
+  * ram_checkpoint_full, of memory exactly as it is at the time of
+  * the call, while the caller goes on using memory. The image is
+  * written to path + ".tmp" and then renamed to path, so path is
+  * never left half-written. Returns as soon as the child is
+  * started, so the caller pauses only as long as fork() takes.
+  * Unlike ram_checkpoint_full, does not start change tracking
+  * for ram_checkpoint_delta. Call from the only thread using memory.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param path file to write
+  * @return handle to poll, and to pass to ram_snapshot_wait, or NULL if
+  *   the child could not be started
+  */
+struct RAM_SNAPSHOT* ram_snapshot_async(struct RAM* memory, char* path);
+
+/**
+  * @brief ram_snapshot_poll: checks on a snapshot, without waiting
+  *
+  * @param snapshot handle returned by ram_snapshot_async
+  * @return enum RAM_SNAPSHOT_STATUS
+  */
+int ram_snapshot_poll(struct RAM_SNAPSHOT* snapshot);
+
+/**
+  * @brief ram_snapshot_fd: a file descriptor to wait on with poll() or select()
+  *
+  * The descriptor becomes readable (at end of file) once the
+  * snapshot's child has finished, successfully or not; then call
+  * ram_snapshot_poll or ram_snapshot_wait for the outcome. Don't
+  * read from or close it.
+  *
+  * @param snapshot handle returned by ram_snapshot_async
+  * @return file descriptor
+  */
+int ram_snapshot_fd(struct RAM_SNAPSHOT* snapshot);
+
+/**
+  * @brief ram_snapshot_wait: waits for a snapshot to finish, then frees it
+  *
+  * Must be called once for every snapshot started, even after
+  * ram_snapshot_poll has reported it done, so the child process
+  * is cleaned up. The handle is no longer valid afterwards.
+  *
+  * @param snapshot handle returned by ram_snapshot_async
+  * @return true if the image was written, false if not
+  */
+bool ram_snapshot_wait(struct RAM_SNAPSHOT* snapshot);
+
+/**
+  * @brief ram_print: prints the contents of memory
+  *
+  * Prints the contents of RAM to the console, for debugging.
+  * RAM is printed in alphabetical order by variable name.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_print(struct RAM* memory);
+
+/**
+  * @brief ram_print_map: prints the contents of memory map
+  *
+  * Prints contents of RAM map to the console, for debugging.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_print_map(struct RAM* memory);
+
+
+/**
+  * @brief ram_cell: the memory cell at an address
+  *
+  * A shift and a mask into the segment directory; the address is
+  * not checked.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address (0 <= address < capacity)
+  * @return pointer to the cell
+  */
+static inline struct RAM_VALUE* ram_cell(struct RAM* memory, int address)
+{
+  return &memory->segments[address >> RAM_SEGMENT_SHIFT][address & RAM_SEGMENT_MASK];
+}
+
+//
+// Typed fast paths: for callers that already know a variable's type
+// (e.g. a bytecode interpreter), these read and write ints, reals and
+// booleans by address without building a RAM_VALUE, copying it, or
+// allocating. They are defined here so they can be inlined. A read
+// returns false if the address is invalid or the cell holds a value of
+// another type; nothing is converted. Writes that need bookkeeping
+// (open transaction, dirty tracking, journal, or a string/array, or a
+// PTR into a heap, being overwritten) fall back to ram_write_cell_by_addr.
+//
+
+/**
+  * @brief ram_type_by_addr: type of the value in memory cell at this address
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @return enum RAM_VALUE_TYPES, or -1 if the address is invalid
+  */
+void ram_observe(struct RAM* memory, int address);  // see ram.c
+
+static inline int ram_type_by_addr(struct RAM* memory, int address)
+{
+  if (memory->observed) {
+    ram_observe(memory, address);
+  }
+
+  if ((unsigned) address >= (unsigned) memory->size) {
+    return -1;
+  }
+
+  return ram_cell(memory, address)->value_type;
+}
+
+/**
+  * @brief ram_read_int_by_addr: reads an int by address, without copying
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @param value set to the int if successful
+  * @return true if successful, false if invalid address or not an int
+  */
+static inline bool ram_read_int_by_addr(struct RAM* memory, int address, int* value)
+{
+  if (ram_type_by_addr(memory, address) != RAM_TYPE_INT) {
+    return false;
+  }
+
+  *value = ram_cell(memory, address)->types.i;
+
+  return true;
+}
+
+/**
+  * @brief ram_read_real_by_addr: reads a real by address, without copying
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @param value set to the real if successful
+  * @return true if successful, false if invalid address or not a real
+  */
+static inline bool ram_read_real_by_addr(struct RAM* memory, int address, double* value)
+{
+  if (ram_type_by_addr(memory, address) != RAM_TYPE_REAL) {
+    return false;
+  }
+
+  *value = ram_cell(memory, address)->types.d;
+
+  return true;
+}
+
+/**
+  * @brief ram_read_bool_by_addr: reads a boolean by address, without copying
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @param value set to the boolean if successful
+  * @return true if successful, false if invalid address or not a boolean
+  */
+static inline bool ram_read_bool_by_addr(struct RAM* memory, int address, bool* value)
+{
+  if (ram_type_by_addr(memory, address) != RAM_TYPE_BOOLEAN) {
+    return false;
+  }
+
+  *value = (ram_cell(memory, address)->types.i != 0);
+
+  return true;
+}
+
+/**
+  * @brief ram_fast_cell: cell that a scalar can be stored into directly
+  *
+  * Returns the cell at the given address if a scalar can be written
+  * to it in place: no transaction is open, no checkpoint, journal,
+  * trace or layout sampling needs to hear about it, and the cell does
+  * not own a string or array (so memory usage does not change) or hold
+  * a PTR the heap has to hear about. Returns NULL otherwise. Used by
+  * the typed writes below; not meant to be called directly.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @return pointer to cell, or NULL if the slow path is needed
+  */
+static inline struct RAM_VALUE* ram_fast_cell(struct RAM* memory, int address)
+{
+  if ((unsigned) address >= (unsigned) memory->size ||
+      memory->txn.depth > 0 || memory->dirty.bits != NULL || memory->journal != NULL ||
+      memory->observed) {
+    return NULL;
+  }
+
+  struct RAM_VALUE* cell = ram_cell(memory, address);
+
+  if (cell->value_type == RAM_TYPE_STR || cell->value_type == RAM_TYPE_ARRAY ||
+      (cell->value_type == RAM_TYPE_PTR && memory->heap != NULL)) {
+    return NULL;
+  }
+
+  return cell;
+}
+
+/**
+  * @brief ram_write_int_by_addr: writes an int by address
+  *
+  * Same as ram_write_cell_by_addr with a RAM_TYPE_INT value.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value int to write
+  * @param address memory cell address
+  * @return true if successful, false if not (invalid address)
+  */
+static inline bool ram_write_int_by_addr(struct RAM* memory, int value, int address)
+{
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+
+  if (cell == NULL) {
+    struct RAM_VALUE v;
+    v.value_type = RAM_TYPE_INT;
+    v.types.i = value;
+
+    return ram_write_cell_by_addr(memory, v, address);
+  }
+
+  cell->value_type = RAM_TYPE_INT;
+  cell->types.i = value;
+
+  return true;
+}
+
+/**
+  * @brief ram_write_real_by_addr: writes a real by address
+  *
+  * Same as ram_write_cell_by_addr with a RAM_TYPE_REAL value.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value real to write
+  * @param address memory cell address
+  * @return true if successful, false if not (invalid address)
+  */
+static inline bool ram_write_real_by_addr(struct RAM* memory, double value, int address)
+{
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+
+  if (cell == NULL) {
+    struct RAM_VALUE v;
+    v.value_type = RAM_TYPE_REAL;
+    v.types.d = value;
+
+    return ram_write_cell_by_addr(memory, v, address);
+  }
+
+  cell->value_type = RAM_TYPE_REAL;
+  cell->types.d = value;
+
+  return true;
+}
+
+/**
+  * @brief ram_write_bool_by_addr: writes a boolean by address
+  *
+  * Same as ram_write_cell_by_addr with a RAM_TYPE_BOOLEAN value.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value boolean to write
+  * @param address memory cell address
+  * @return true if successful, false if not (invalid address)
+  */
+static inline bool ram_write_bool_by_addr(struct RAM* memory, bool value, int address)
+{
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+
+  if (cell == NULL) {
+    struct RAM_VALUE v;
+    v.value_type = RAM_TYPE_BOOLEAN;
+    v.types.i = value ? 1 : 0;
+
+    return ram_write_cell_by_addr(memory, v, address);
+  }
+
+  cell->value_type = RAM_TYPE_BOOLEAN;
+  cell->types.i = value ? 1 : 0;
+
+  return true;
+}
+
+
+//
+// Fused read-modify-write: x += 1 and the like in one call, with one
+// lookup and no copies or allocation, instead of a read, the
+// arithmetic, and a write. Like the typed writes above, updates that
+// need bookkeeping fall back to ram_write_cell_by_addr for the store.
+//
+// Types promote as in Python: a boolean counts as an int (0 or 1),
+// int op int gives an int (wrapping on overflow), and anything op a
+// real gives a real.
+//
+enum RAM_UPDATE_OPS
+{
+  RAM_UPDATE_ADD = 0,  // cell + operand
+  RAM_UPDATE_SUB,      // cell - operand
+  RAM_UPDATE_MUL,      // cell * operand
+  RAM_UPDATE_MIN,      // min(cell, operand), keeping the type of the one picked
+  RAM_UPDATE_MAX,      // max(cell, operand), keeping the type of the one picked
+  RAM_UPDATE_NOT       // not cell, a boolean; operand is ignored
+};
+
+/**
+  * @brief ram_is_number: is a value an int, real or boolean?
+  *
+  * Used by the updates below; not meant to be called directly.
+  *
+  * @param value_type enum RAM_VALUE_TYPES
+  * @return true if so, false if not
+  */
+static inline bool ram_is_number(int value_type)
+{
+  return value_type == RAM_TYPE_INT || value_type == RAM_TYPE_REAL || value_type == RAM_TYPE_BOOLEAN;
+}
+
+/**
+  * @brief ram_number_int: an int or boolean value as an int
+  *
+  * Used by the updates below; not meant to be called directly.
+  *
+  * @param value Pointer to an int or boolean value
+  * @return the int, or 0 or 1
+  */
+static inline int ram_number_int(struct RAM_VALUE* value)
+{
+  return (value->value_type == RAM_TYPE_BOOLEAN) ? (value->types.i != 0) : value->types.i;
+}
+
+/**
+  * @brief ram_number_real: an int, real or boolean value as a real
+  *
+  * Used by the updates below; not meant to be called directly.
+  *
+  * @param value Pointer to an int, real or boolean value
+  * @return the value, as a double
+  */
+static inline double ram_number_real(struct RAM_VALUE* value)
+{
+  return (value->value_type == RAM_TYPE_REAL) ? value->types.d : (double) ram_number_int(value);
+}
+
+/**
+  * @brief ram_store_number: stores an int, real or boolean value in a cell
+  *
+  * Used by the updates below; not meant to be called directly.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param value value to store (value_type must be int, real or boolean)
+  * @param address memory cell address, whose cell holds a number
+  * @return true if successful, false if not (see ram_write_cell_by_addr)
+  */
+static inline bool ram_store_number(struct RAM* memory, struct RAM_VALUE value, int address)
+{
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+
+  if (value.value_type == RAM_TYPE_BOOLEAN) {
+    value.types.i = (value.types.i != 0);
+  }
+
+  if (cell == NULL) {
+    return ram_write_cell_by_addr(memory, value, address);
+  }
+
+  *cell = value;
+
+  return true;
+}
+
+/**
+  * @brief ram_update_by_addr: updates a number in place, e.g. x += 1
+  *
+  * Applies op (enum RAM_UPDATE_OPS) to the int, real or boolean in
+  * the memory cell at the given address and the given operand, and
+  * stores the result back in the cell. Returns false, leaving the
+  * cell unchanged, if the address is invalid, the cell or operand
+  * is not an int, real or boolean, or op is unknown.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param op enum RAM_UPDATE_OPS
+  * @param operand int, real or boolean value
+  * @param address memory cell address
+  * @param result set to the new value if successful, may be NULL
+  * @return true if successful, false if not
+  */
+static inline bool ram_update_by_addr(struct RAM* memory, int op, struct RAM_VALUE operand, int address, struct RAM_VALUE* result)
+{
+  if (!ram_is_number(ram_type_by_addr(memory, address)) ||
+      (op != RAM_UPDATE_NOT && !ram_is_number(operand.value_type))) {
+    return false;
+  }
+
+  struct RAM_VALUE x = *ram_cell(memory, address);
+  struct RAM_VALUE r;
+
+  switch (op) {
+    case RAM_UPDATE_ADD:
+    case RAM_UPDATE_SUB:
+    case RAM_UPDATE_MUL:
+      if (x.value_type != RAM_TYPE_REAL && operand.value_type != RAM_TYPE_REAL) {
+        unsigned int a = (unsigned int) ram_number_int(&x);
+        unsigned int b = (unsigned int) ram_number_int(&operand);
+
+        r.value_type = RAM_TYPE_INT;
+        r.types.i = (int) ((op == RAM_UPDATE_ADD) ? a + b : (op == RAM_UPDATE_SUB) ? a - b : a * b);
+      }
+      else {
+        double a = ram_number_real(&x);
+        double b = ram_number_real(&operand);
+
+        r.value_type = RAM_TYPE_REAL;
+        r.types.d = (op == RAM_UPDATE_ADD) ? a + b : (op == RAM_UPDATE_SUB) ? a - b : a * b;
+      }
+      break;
+    case RAM_UPDATE_MIN:
+    case RAM_UPDATE_MAX: {
+      double a = ram_number_real(&x);
+      double b = ram_number_real(&operand);
+
+      r = ((op == RAM_UPDATE_MIN) ? (b < a) : (b > a)) ? operand : x;
+      break;
+    }
+    case RAM_UPDATE_NOT:
+      r.value_type = RAM_TYPE_BOOLEAN;
+      r.types.i = (ram_number_real(&x) == 0.0);
+      break;
+    default:
+      return false;
+  }
+
+  if (!ram_store_number(memory, r, address)) {
+    return false;
+  }
+
+  if (result != NULL) {
+    *result = *ram_cell(memory, address);
+  }
+
+  return true;
+}
+
+/**
+  * @brief ram_update_by_name: updates a number in place, by name
+  *
+  * Same as ram_update_by_addr, for the variable with the given name.
+  * Returns false if there is no such variable.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param op enum RAM_UPDATE_OPS
+  * @param operand int, real or boolean value
+  * @param varname variable name
+  * @param result set to the new value if successful, may be NULL
+  * @return true if successful, false if not
+  */
+static inline bool ram_update_by_name(struct RAM* memory, int op, struct RAM_VALUE operand, char* varname, struct RAM_VALUE* result)
+{
+  return ram_update_by_addr(memory, op, operand, ram_get_addr(memory, varname), result);
+}
+
+/**
+  * @brief ram_compare_and_set_by_addr: writes a number if the cell equals another
+  *
+  * If the memory cell at the given address holds an int, real or
+  * boolean equal to expected (compared as numbers, so 1 == 1.0 ==
+  * True), replaces it with desired. Not atomic: like the rest of the
+  * memory unit, callers on several threads need their own lock.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param expected int, real or boolean value
+  * @param desired int, real or boolean value to write
+  * @param address memory cell address
+  * @return true if desired was written, false if not (invalid address,
+  *   not a number, or not equal)
+  */
+static inline bool ram_compare_and_set_by_addr(struct RAM* memory, struct RAM_VALUE expected, struct RAM_VALUE desired, int address)
+{
+  if (!ram_is_number(ram_type_by_addr(memory, address)) ||
+      !ram_is_number(expected.value_type) || !ram_is_number(desired.value_type)) {
+    return false;
+  }
+
+  if (ram_number_real(ram_cell(memory, address)) != ram_number_real(&expected)) {
+    return false;
+  }
+
+  return ram_store_number(memory, desired, address);
+}
+
+/**
+  * @brief ram_compare_and_set_by_name: writes a number if the cell equals another, by name
+  *
+  * Same as ram_compare_and_set_by_addr, for the variable with the
+  * given name. Returns false if there is no such variable.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param expected int, real or boolean value
+  * @param desired int, real or boolean value to write
+  * @param varname variable name
+  * @return true if desired was written, false if not
+  */
+static inline bool ram_compare_and_set_by_name(struct RAM* memory, struct RAM_VALUE expected, struct RAM_VALUE desired, char* varname)
+{
+  return ram_compare_and_set_by_addr(memory, expected, desired, ram_get_addr(memory, varname));
+}
+
+
+//
+// Atomic ops, for counters and flags shared by threads. Each works
+// on the int or double of a cell in place with a single lock-free
+// instruction (cells are 8-byte aligned, see ram.c), so threads can
+// use them on the same cell at once without a lock, as long as
+// nothing else writes that cell or changes memory's variables
+// meanwhile. They never change a cell's type, and are sequentially
+// consistent. When memory needs to hear about writes (an open
+// transaction, checkpoint, journal, trace or layout sampling; see
+// ram_fast_cell) they cannot be atomic, so they return false and
+// change nothing; ram_atomic_ready tells this apart from the other
+// reasons they fail.
+//
+
+/**
+  * @brief ram_atomic_ready: whether the atomic ops below can work on a cell
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param address memory cell address
+  * @return true if the cell holds an int, real or boolean and nothing
+  *   needs to hear about writes to it, false if not
+  */
+static inline bool ram_atomic_ready(struct RAM* memory, int address)
+{
+  return (unsigned) address < (unsigned) memory->size &&
+         ram_is_number(ram_cell(memory, address)->value_type) &&
+         ram_fast_cell(memory, address) != NULL;
+}
+
+/**
+  * @brief ram_cas_payload: compare-and-swap on a number cell's contents
+  *
+  * Used by the atomic ops below; not meant to be called directly.
+  *
+  * @param cell Pointer to an int, real or boolean cell
+  * @param expected value the cell should hold, set to what it holds on failure
+  * @param desired value to store, of the cell's type
+  * @return true if desired was stored, false if not
+  */
+static inline bool ram_cas_payload(struct RAM_VALUE* cell, struct RAM_VALUE* expected, struct RAM_VALUE desired)
+{
+  if (cell->value_type == RAM_TYPE_REAL) {
+    return __atomic_compare_exchange(&cell->types.d, &expected->types.d, &desired.types.d, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+
+  return __atomic_compare_exchange_n(&cell->types.i, &expected->types.i, desired.types.i, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+  * @brief ram_cas_by_addr: atomically replaces a number if it is the one expected
+  *
+  * If the memory cell at the given address holds exactly expected
+  * (same type and bits, unlike ram_compare_and_set_by_addr, so 0.0
+  * and -0.0 differ), replaces it with desired. Otherwise sets
+  * expected to what the cell holds, ready for a retry. If the cell
+  * cannot be updated atomically (see ram_atomic_ready), changes
+  * neither the cell nor expected, so a retry loop must check for
+  * that.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param expected Pointer to an int, real or boolean value; updated on failure
+  *   if the cell holds an int, real or boolean that can be updated atomically
+  * @param desired value to write, of the same type as expected
+  * @param address memory cell address
+  * @return true if desired was written, false if not (invalid address,
+  *   not a number, not atomic, a different type, or not equal)
+  */
+static inline bool ram_cas_by_addr(struct RAM* memory, struct RAM_VALUE* expected, struct RAM_VALUE desired, int address)
+{
+  int type = ram_type_by_addr(memory, address);
+
+  if (!ram_is_number(type)) {
+    return false;
+  }
+
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+
+  if (cell == NULL) {
+    return false;
+  }
+
+  //
+  // other threads may be storing to the cell, so its contents are
+  // read atomically too (its type doesn't change):
+  //
+  if (type != expected->value_type || type != desired.value_type) {
+    expected->value_type = type;
+
+    if (type == RAM_TYPE_REAL) {
+      __atomic_load(&cell->types.d, &expected->types.d, __ATOMIC_SEQ_CST);
+    }
+    else {
+      expected->types.i = __atomic_load_n(&cell->types.i, __ATOMIC_SEQ_CST);
+    }
+
+    return false;
+  }
+
+  if (type == RAM_TYPE_BOOLEAN) {
+    desired.types.i = (desired.types.i != 0);
+  }
+
+  return ram_cas_payload(cell, expected, desired);
+}
+
+/**
+  * @brief ram_fetch_add_int_by_addr: atomically adds to an int, e.g. a shared counter
+  *
+  * Adds delta to the int in the memory cell at the given address,
+  * wrapping on overflow.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param delta amount to add, may be negative
+  * @param address memory cell address
+  * @param old set to the int before the add if successful, may be NULL
+  * @return true if successful, false if invalid address, not an int,
+  *   or not atomic (see ram_atomic_ready)
+  */
+static inline bool ram_fetch_add_int_by_addr(struct RAM* memory, int delta, int address, int* old)
+{
+  if (ram_type_by_addr(memory, address) != RAM_TYPE_INT) {
+    return false;
+  }
+
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+
+  if (cell == NULL) {
+    return false;
+  }
+
+  int before = __atomic_fetch_add(&cell->types.i, delta, __ATOMIC_SEQ_CST);
+
+  if (old != NULL) {
+    *old = before;
+  }
+
+  return true;
+}
+
+/**
+  * @brief ram_exchange_by_addr: atomically replaces a number, returning the old one
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param desired int, real or boolean value to write, of the cell's type
+  * @param address memory cell address
+  * @param old set to the value before the write if successful, may be NULL
+  * @return true if successful, false if invalid address, not a number,
+  *   a different type, or not atomic (see ram_atomic_ready)
+  */
+static inline bool ram_exchange_by_addr(struct RAM* memory, struct RAM_VALUE desired, int address, struct RAM_VALUE* old)
+{
+  int type = ram_type_by_addr(memory, address);
+
+  if (!ram_is_number(type) || type != desired.value_type) {
+    return false;
+  }
+
+  if (type == RAM_TYPE_BOOLEAN) {
+    desired.types.i = (desired.types.i != 0);
+  }
+
+  struct RAM_VALUE* cell = ram_fast_cell(memory, address);
+  struct RAM_VALUE before;
+
+  if (cell == NULL) {
+    return false;
+  }
+
+  before.value_type = type;
+
+  if (type == RAM_TYPE_REAL) {
+    __atomic_exchange(&cell->types.d, &desired.types.d, &before.types.d, __ATOMIC_SEQ_CST);
+  }
+  else {
+    before.types.i = __atomic_exchange_n(&cell->types.i, desired.types.i, __ATOMIC_SEQ_CST);
+  }
+
+  if (old != NULL) {
+    *old = before;
+  }
+
+  return true;
+}
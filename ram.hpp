@@ -0,0 +1,459 @@
+/*ram.hpp*/
+
+/**
+  * @brief C++ interface to nuPython's memory unit
+  *
+  * A header-only wrapper around ram.h for C++ code:
+  *
+  *   nupython::Ram memory;
+  *   using namespace nupython::literals;
+  *
+  *   memory.set("x"_var, 42);
+  *   memory.set(std::string_view("name"), std::string_view("value"));
+  *   std::optional<int> x = memory.get<int>("x"_var);
+  *
+  * Ram owns its memory unit (RAII, move-only). Names are taken as
+  * std::string_view and looked up without building a '\0'-terminated
+  * copy; a copy is only made the first time a variable is created.
+  * get<T> and set<T> for int, double and bool go straight to the
+  * typed inline functions in ram.h. Names written as "x"_var have
+  * their hash computed at compile time, and Ram uses it to cache
+  * the variable's address, so repeated accesses skip the lookup.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "ram.h"
+
+
+namespace nupython
+{
+
+class Var;
+
+namespace literals
+{
+  consteval Var operator""_var(const char* name, std::size_t length);
+}
+
+
+//
+// A variable name known at compile time, with its 32-bit FNV-1a hash
+// (same hash as ram_str_hash). Only created by the _var literal, so
+// the name always has static storage.
+//
+class Var
+{
+public:
+  constexpr std::string_view name() const noexcept { return name_; }
+  constexpr unsigned int hash() const noexcept { return hash_; }
+
+private:
+  constexpr Var(std::string_view name, unsigned int hash) noexcept
+    : name_(name), hash_(hash) {}
+
+  friend consteval Var literals::operator""_var(const char* name, std::size_t length);
+
+  std::string_view name_;
+  unsigned int hash_;
+};
+
+
+namespace literals
+{
+  /**
+    * @brief operator""_var: variable name with a precomputed hash
+    *
+    * @return "x"_var denotes the variable x
+    */
+  consteval Var operator""_var(const char* name, std::size_t length)
+  {
+    unsigned int hash = 2166136261u;
+
+    for (std::size_t i = 0; i < length; i++) {
+      hash ^= (unsigned char) name[i];
+      hash *= 16777619u;
+    }
+
+    return Var(std::string_view(name, length), (hash == 0) ? 1 : hash);
+  }
+}
+
+
+class Ram
+{
+public:
+  /**
+    * @brief Ram: creates a new, empty memory unit (see ram_init)
+    */
+  Ram() : memory_(ram_init()) {}
+
+  /**
+    * @brief Ram: takes ownership of an existing memory unit
+    *
+    * e.g. one returned by ram_load_checkpoint or ram_init_journaled;
+    * it is destroyed with the Ram. memory may be NULL.
+    */
+  explicit Ram(struct RAM* memory) noexcept : memory_(memory) {}
+
+  ~Ram()
+  {
+    if (memory_ != nullptr) {
+      ram_destroy(memory_);
+    }
+  }
+
+  Ram(const Ram&) = delete;
+  Ram& operator=(const Ram&) = delete;
+
+  Ram(Ram&& other) noexcept
+    : memory_(std::exchange(other.memory_, nullptr)), cache_(other.cache_) {}
+
+  Ram& operator=(Ram&& other) noexcept
+  {
+    if (this != &other) {
+      if (memory_ != nullptr) {
+        ram_destroy(memory_);
+      }
+
+      memory_ = std::exchange(other.memory_, nullptr);
+      cache_ = other.cache_;
+    }
+
+    return *this;
+  }
+
+  /**
+    * @brief get: the underlying memory unit, for calling the C API
+    */
+  struct RAM* get() const noexcept { return memory_; }
+
+  /**
+    * @brief release: gives up ownership of the memory unit
+    *
+    * @return the memory unit, which the caller must ram_destroy
+    */
+  struct RAM* release() noexcept { return std::exchange(memory_, nullptr); }
+
+  explicit operator bool() const noexcept { return memory_ != nullptr; }
+
+  int size() const { return ram_size(memory_); }
+  int capacity() const { return ram_capacity(memory_); }
+
+  /**
+    * @brief addr: address of a variable, -1 if it doesn't exist
+    */
+  int addr(std::string_view name) const
+  {
+    return ram_get_addr_n(memory_, const_cast<char*>(name.data()), (int) name.size());
+  }
+
+  /**
+    * @brief addr: address of a variable, -1 if it doesn't exist
+    *
+    * Addresses found are cached by the name's hash. Since an address
+    * never changes while its variable exists, a cached address stays
+    * good until memory->epoch says variables were removed or moved.
+    */
+  int addr(Var var) const
+  {
+    Slot& slot = cache_[var.hash() % cache_.size()];
+
+    if (slot.address >= 0 && slot.epoch == memory_->epoch && slot.name == var.name()) {
+      return slot.address;
+    }
+
+    int address = addr(var.name());
+
+    if (address >= 0) {
+      slot.name = var.name();
+      slot.address = address;
+      slot.epoch = memory_->epoch;
+    }
+
+    return address;
+  }
+
+  /**
+    * @brief get: reads a value by address, without allocating
+    *
+    * T may be int, double or bool (see ram_read_int_by_addr etc.),
+    * std::string_view (borrowed from memory: valid until the cell is
+    * next written, or memory is destroyed), or std::string (a copy).
+    * No conversions are done: returns nullopt if the address is
+    * invalid or the cell holds a value of another type.
+    */
+  template <typename T>
+  std::optional<T> get(int address) const
+  {
+    if constexpr (std::is_same_v<T, bool>) {
+      bool value;
+      return ram_read_bool_by_addr(memory_, address, &value) ? std::optional<T>(value) : std::nullopt;
+    }
+    else if constexpr (std::is_same_v<T, int>) {
+      int value;
+      return ram_read_int_by_addr(memory_, address, &value) ? std::optional<T>(value) : std::nullopt;
+    }
+    else if constexpr (std::is_same_v<T, double>) {
+      double value;
+      return ram_read_real_by_addr(memory_, address, &value) ? std::optional<T>(value) : std::nullopt;
+    }
+    else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+      if (ram_type_by_addr(memory_, address) != RAM_TYPE_STR) {
+        return std::nullopt;
+      }
+
+      char* s = ram_cell(memory_, address)->types.s;
+
+      return T(s, ram_str_length(s));
+    }
+    else {
+      static_assert(!sizeof(T), "get<T>: T must be int, double, bool, std::string_view or std::string");
+    }
+  }
+
+  template <typename T>
+  std::optional<T> get(std::string_view name) const { return get<T>(addr(name)); }
+
+  template <typename T>
+  std::optional<T> get(Var var) const { return get<T>(addr(var)); }
+
+  /**
+    * @brief set: writes a value by address
+    *
+    * value may be an int (or other integer type that fits), double,
+    * bool, or anything convertible to std::string_view, which is
+    * copied into memory once. Returns false if the address is
+    * invalid or the write would exceed the memory budget.
+    */
+  template <typename T>
+  bool set(int address, const T& value)
+  {
+    if constexpr (std::is_same_v<T, bool>) {
+      return ram_write_bool_by_addr(memory_, value, address);
+    }
+    else if constexpr (std::is_integral_v<T>) {
+      return ram_write_int_by_addr(memory_, (int) value, address);
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+      return ram_write_real_by_addr(memory_, (double) value, address);
+    }
+    else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+      std::string_view s = value;
+      return ram_write_str_by_addr(memory_, const_cast<char*>(s.data()), (int) s.size(), address);
+    }
+    else {
+      static_assert(!sizeof(T), "set<T>: T must be an integer, floating point, bool or string type");
+    }
+  }
+
+  /**
+    * @brief set: writes a value by name, creating the variable if needed
+    *
+    * If the variable exists this is set(addr(name), value); otherwise
+    * the name is copied once to create it. Returns false if the write
+    * would exceed the memory budget (or name contains a '\0').
+    */
+  template <typename T>
+  bool set(std::string_view name, const T& value)
+  {
+    int address = addr(name);
+
+    if (address >= 0) {
+      return set(address, value);
+    }
+
+    if (name.find('\0') != std::string_view::npos) {
+      return false;
+    }
+
+    std::string varname(name);
+
+    return create(varname.data(), value);
+  }
+
+  template <typename T>
+  bool set(Var var, const T& value)
+  {
+    int address = addr(var);
+
+    if (address >= 0) {
+      return set(address, value);
+    }
+
+    std::string varname(var.name());
+
+    return create(varname.data(), value);
+  }
+
+  /**
+    * @brief update: applies an op to a number in place (see ram_update_by_addr)
+    *
+    * op is one of enum RAM_UPDATE_OPS; operand may be an integer,
+    * floating point or bool. Returns the new value, or nullopt if the
+    * address is invalid or the cell doesn't hold an int, real or bool.
+    */
+  template <typename T>
+  std::optional<struct RAM_VALUE> update(int address, int op, T operand)
+  {
+    struct RAM_VALUE result;
+
+    if (!ram_update_by_addr(memory_, op, number(operand), address, &result)) {
+      return std::nullopt;
+    }
+
+    return result;
+  }
+
+  template <typename T>
+  std::optional<struct RAM_VALUE> update(std::string_view name, int op, T operand) { return update(addr(name), op, operand); }
+
+  template <typename T>
+  std::optional<struct RAM_VALUE> update(Var var, int op, T operand) { return update(addr(var), op, operand); }
+
+  /**
+    * @brief compare_and_set: writes desired if the cell equals expected
+    *
+    * See ram_compare_and_set_by_addr; both may be an integer,
+    * floating point or bool. Returns true if desired was written.
+    */
+  template <typename T, typename U>
+  bool compare_and_set(int address, T expected, U desired)
+  {
+    return ram_compare_and_set_by_addr(memory_, number(expected), number(desired), address);
+  }
+
+  template <typename T, typename U>
+  bool compare_and_set(std::string_view name, T expected, U desired) { return compare_and_set(addr(name), expected, desired); }
+
+  template <typename T, typename U>
+  bool compare_and_set(Var var, T expected, U desired) { return compare_and_set(addr(var), expected, desired); }
+
+  /**
+    * @brief fetch_add: atomically adds to an int, returning the old one
+    *
+    * See ram_fetch_add_int_by_addr. Returns nothing if the address
+    * is invalid, the cell doesn't hold an int, or it can't be
+    * updated atomically (see ram_atomic_ready).
+    */
+  std::optional<int> fetch_add(int address, int delta)
+  {
+    int old;
+
+    if (!ram_fetch_add_int_by_addr(memory_, delta, address, &old)) {
+      return std::nullopt;
+    }
+
+    return old;
+  }
+
+  std::optional<int> fetch_add(std::string_view name, int delta) { return fetch_add(addr(name), delta); }
+  std::optional<int> fetch_add(Var var, int delta) { return fetch_add(addr(var), delta); }
+
+  /**
+    * @brief exchange: atomically replaces a number, returning the old one
+    *
+    * See ram_exchange_by_addr; desired must have the cell's type.
+    * Returns nothing if the address is invalid, the types differ, or
+    * the cell can't be updated atomically (see ram_atomic_ready).
+    */
+  template <typename T>
+  std::optional<struct RAM_VALUE> exchange(int address, T desired)
+  {
+    struct RAM_VALUE old;
+
+    if (!ram_exchange_by_addr(memory_, number(desired), address, &old)) {
+      return std::nullopt;
+    }
+
+    return old;
+  }
+
+  template <typename T>
+  std::optional<struct RAM_VALUE> exchange(std::string_view name, T desired) { return exchange(addr(name), desired); }
+
+  template <typename T>
+  std::optional<struct RAM_VALUE> exchange(Var var, T desired) { return exchange(addr(var), desired); }
+
+  //
+  // Transactions, see ram_txn_begin etc.:
+  //
+  bool txn_begin() { return ram_txn_begin(memory_); }
+  bool txn_commit() { return ram_txn_commit(memory_); }
+  bool txn_rollback() { return ram_txn_rollback(memory_); }
+
+  /**
+    * @brief reset: removes all variables (see ram_reset)
+    */
+  void reset() { ram_reset(memory_); }
+
+private:
+  //
+  // one entry of the address cache used by addr(Var):
+  //
+  struct Slot
+  {
+    std::string_view name;  // a _var name, so static storage
+    int address = -1;       // -1 => empty
+    unsigned int epoch = 0; // memory->epoch when cached
+  };
+
+  /**
+    * @brief create: writes a new variable with a '\0'-terminated name
+    */
+  template <typename T>
+  bool create(char* varname, const T& value)
+  {
+    if constexpr (std::is_convertible_v<const T&, std::string_view> && !std::is_arithmetic_v<T>) {
+      std::string_view s = value;
+      return ram_write_str_by_name(memory_, const_cast<char*>(s.data()), (int) s.size(), varname);
+    }
+    else {
+      return ram_write_cell_by_name(memory_, number(value), varname);
+    }
+  }
+
+  /**
+    * @brief number: an integer, floating point or bool as a RAM_VALUE
+    */
+  template <typename T>
+  static struct RAM_VALUE number(const T& value)
+  {
+    struct RAM_VALUE v;
+
+    if constexpr (std::is_same_v<T, bool>) {
+      v.value_type = RAM_TYPE_BOOLEAN;
+      v.types.i = value ? 1 : 0;
+    }
+    else if constexpr (std::is_integral_v<T>) {
+      v.value_type = RAM_TYPE_INT;
+      v.types.i = (int) value;
+    }
+    else if constexpr (std::is_floating_point_v<T>) {
+      v.value_type = RAM_TYPE_REAL;
+      v.types.d = (double) value;
+    }
+    else {
+      static_assert(!sizeof(T), "T must be an integer, floating point, bool (or, for set, string) type");
+    }
+
+    return v;
+  }
+
+  struct RAM* memory_;
+  mutable std::array<Slot, 32> cache_{};
+};
+
+}  // namespace nupython
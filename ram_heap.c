@@ -0,0 +1,1126 @@
+/*ram_heap.c*/
+
+/**
+  * @brief Managed heap for nuPython's memory unit
+  *
+  * An object is a 16-byte header followed by its slots, bump-
+  * allocated from a chunk; objects bigger than a quarter of a chunk
+  * are malloc'd by themselves instead. A handle indexes the objects
+  * table, which points to the object's header wherever it is now.
+  *
+  * The collector is an incremental mark-sweep with a snapshot-at-
+  * the-beginning write barrier: every object reachable when marking
+  * starts gets marked, even if the mutator unlinks it part way
+  * through, because a PTR removed from a cell, slot or the undo log
+  * while marking is shaded first (see heap_forget). Objects
+  * allocated during a collection start out marked. A mark is the
+  * epoch of the collection that made it, so starting a collection
+  * unmarks every object at once. Gray objects wait on a stack with
+  * room for every handle, since an object turns gray at most once
+  * per collection.
+  *
+  * Sweeping goes chunk by chunk. A chunk whose marked objects fill
+  * at most half of it is evacuated: its live objects are copied to
+  * the chunk being allocated from, and then it is empty and can be
+  * reused. Other chunks are swept in place; the space of their dead
+  * objects comes back once the chunk gets sparse enough to evacuate.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "ram.h"
+#include "ram_heap.h"
+
+#define HEAP_CHUNK_BYTES    (256 * 1024)  // defaults, see struct RAM_HEAP_CONFIG
+#define HEAP_STEP_BYTES     (64 * 1024)
+#define HEAP_GROWTH_PERCENT 100
+#define HEAP_MIN_CHUNK      1024
+#define HEAP_MAX_SLOTS      ((INT_MAX - 16) / 16)
+#define HEAP_TOUCH          64            // work charged for each object marked, freed
+                                          // or moved, which is likely a cache miss
+
+enum HEAP_PHASES
+{
+  HEAP_IDLE = 0,
+  HEAP_MARK,
+  HEAP_SWEEP
+};
+
+struct HEAP_OBJECT
+{
+  int handle;         // the object's handle, 0 => dead or moved away
+  int num_slots;      // # of RAM_VALUEs following the header
+  int chunk;          // chunk it is in, -1 => allocated by itself
+  unsigned int mark;  // == heap->epoch => marked
+};
+
+struct HEAP_CHUNK
+{
+  char* base;          // NULL => this descriptor is unused
+  int used;            // # of bytes allocated from the chunk
+  unsigned int epoch;  // heap->epoch when allocation from it started
+  long long live;      // bytes of its marked objects, counted while marking
+};
+
+struct RAM_HEAP
+{
+  struct RAM* memory;
+  struct RAM_HEAP_CONFIG config;
+
+  struct HEAP_OBJECT** objects;  // by handle, NULL => free (0 is never used)
+  int* free_handles;             // free handles, a stack
+  int* gray;                     // marked objects not yet scanned, a stack
+  int max_handles;               // # of entries in the 3 arrays above
+  int num_free;
+  int num_gray;
+  int scan_ptr;                  // object whose slots are being scanned, 0 => none
+  int scan_slot;                 // ... next slot to scan
+
+  struct HEAP_CHUNK* chunks;
+  int num_chunks;
+  int max_chunks;
+  int current;                   // chunk being allocated from, -1 => none
+
+  struct HEAP_OBJECT** large;    // objects allocated by themselves
+  int num_large;
+  int max_large;
+
+  int phase;                     // enum HEAP_PHASES
+  unsigned int epoch;            // current (or last) collection
+  int root_cell;                 // marking: next cell to scan
+  int root_undo;                 // marking: next undo record to scan
+  int sweep_chunk;               // sweeping: chunk being swept
+  int sweep_offset;              // ... offset of the next object in it
+  bool evacuating;               // ... are its live objects being moved out?
+  int sweep_large;               // sweeping large objects: next one
+  int kept_large;                // ... # kept so far
+
+  long long threshold;           // start a collection once stats.bytes reaches this
+  long long since_step;          // bytes allocated since the last step
+  struct RAM_HEAP_STATS stats;
+};
+
+
+/**
+ * @brief now_ns: current time in nanoseconds
+ *
+ * @return nanoseconds since an arbitrary fixed point
+ */
+static long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief charge: adjusts memory's usage for bytes the heap allocated
+ *
+ * @param heap Pointer to the heap
+ * @param bytes # of bytes to add (negative when freed)
+ */
+static void charge(struct RAM_HEAP* heap, long long bytes)
+{
+  heap->memory->usage.heap += bytes;
+  heap->memory->usage.total += bytes;
+}
+
+/**
+ * @brief within_budget: can the heap allocate this many more bytes?
+ *
+ * @param heap Pointer to the heap
+ * @param bytes # of bytes needed
+ * @return true if memory has no budget or the bytes fit, false if not
+ */
+static bool within_budget(struct RAM_HEAP* heap, long long bytes)
+{
+  struct RAM* memory = heap->memory;
+
+  return memory->budget <= 0 || memory->usage.total + bytes <= memory->budget;
+}
+
+/**
+ * @brief object_bytes: size of an object, including its header
+ *
+ * @param num_slots # of slots
+ * @return # of bytes
+ */
+static long long object_bytes(int num_slots)
+{
+  return (long long) sizeof(struct HEAP_OBJECT) + (long long) num_slots * sizeof(struct RAM_VALUE);
+}
+
+/**
+ * @brief slots_of: an object's slots
+ *
+ * @param object Pointer to the object's header
+ * @return pointer to its first slot
+ */
+static struct RAM_VALUE* slots_of(struct HEAP_OBJECT* object)
+{
+  return (struct RAM_VALUE*) (object + 1);
+}
+
+/**
+ * @brief object_of: the live object with a handle
+ *
+ * @param memory Pointer to RAM struct
+ * @param ptr handle
+ * @return pointer to the object's header, NULL if no heap or not a live object
+ */
+static struct HEAP_OBJECT* object_of(struct RAM* memory, int ptr)
+{
+  struct RAM_HEAP* heap = memory->heap;
+
+  if (heap == NULL || ptr <= 0 || ptr >= heap->max_handles) {
+    return NULL;
+  }
+
+  return heap->objects[ptr];
+}
+
+/**
+ * @brief handles_grow: doubles the # of handles
+ *
+ * @param heap Pointer to the heap
+ * @return true if successful, false if over budget or out of memory
+ */
+static bool handles_grow(struct RAM_HEAP* heap)
+{
+  int old_max = heap->max_handles;
+  int new_max = (old_max == 0) ? 256 : (old_max > INT_MAX / 2) ? INT_MAX : old_max * 2;
+  long long entry = sizeof(struct HEAP_OBJECT*) + 2 * sizeof(int);
+
+  if (new_max == old_max || !within_budget(heap, (long long) (new_max - old_max) * entry)) {
+    return false;
+  }
+
+  struct HEAP_OBJECT** objects = (struct HEAP_OBJECT**) realloc(heap->objects,
+                                                                (size_t) new_max * sizeof(struct HEAP_OBJECT*));
+
+  if (objects == NULL) {
+    return false;
+  }
+
+  heap->objects = objects;
+
+  int* handles = (int*) realloc(heap->free_handles, (size_t) new_max * sizeof(int));
+
+  if (handles == NULL) {
+    return false;
+  }
+
+  heap->free_handles = handles;
+
+  int* gray = (int*) realloc(heap->gray, (size_t) new_max * sizeof(int));
+
+  if (gray == NULL) {
+    return false;
+  }
+
+  heap->gray = gray;
+
+  //
+  // hand out the lowest handles first (and never handle 0):
+  //
+  for (int h = new_max - 1; h >= old_max; h--) {
+    heap->objects[h] = NULL;
+
+    if (h > 0) {
+      heap->free_handles[heap->num_free] = h;
+      heap->num_free++;
+    }
+  }
+
+  charge(heap, (long long) (new_max - old_max) * entry);
+
+  heap->max_handles = new_max;
+
+  return true;
+}
+
+/**
+ * @brief chunk_new: finds an empty chunk to allocate from
+ *
+ * Reuses an empty chunk if there is one, otherwise allocates one.
+ *
+ * @param heap Pointer to the heap
+ * @return index of the chunk, -1 if over budget or out of memory
+ */
+static int chunk_new(struct RAM_HEAP* heap)
+{
+  int unused = -1;
+
+  for (int c = 0; c < heap->num_chunks; c++) {
+    struct HEAP_CHUNK* chunk = &heap->chunks[c];
+
+    if (chunk->base != NULL && chunk->used == 0 && c != heap->current) {
+      chunk->epoch = heap->epoch;
+      chunk->live = 0;
+      return c;
+    }
+
+    if (chunk->base == NULL && unused == -1) {
+      unused = c;
+    }
+  }
+
+  if (unused == -1) {
+    if (heap->num_chunks == heap->max_chunks) {
+      int max_chunks = (heap->max_chunks == 0) ? 16 : heap->max_chunks * 2;
+      long long bytes = (long long) (max_chunks - heap->max_chunks) * sizeof(struct HEAP_CHUNK);
+
+      if (!within_budget(heap, bytes)) {
+        return -1;
+      }
+
+      struct HEAP_CHUNK* chunks = (struct HEAP_CHUNK*) realloc(heap->chunks,
+                                                               max_chunks * sizeof(struct HEAP_CHUNK));
+
+      if (chunks == NULL) {
+        return -1;
+      }
+
+      charge(heap, bytes);
+
+      heap->chunks = chunks;
+      heap->max_chunks = max_chunks;
+    }
+
+    unused = heap->num_chunks;
+    heap->chunks[unused].base = NULL;
+    heap->num_chunks++;
+  }
+
+  if (!within_budget(heap, heap->config.chunk_bytes)) {
+    return -1;
+  }
+
+  char* base = (char*) malloc(heap->config.chunk_bytes);
+
+  if (base == NULL) {
+    return -1;
+  }
+
+  charge(heap, heap->config.chunk_bytes);
+  heap->stats.chunk_bytes += heap->config.chunk_bytes;
+
+  struct HEAP_CHUNK* chunk = &heap->chunks[unused];
+
+  chunk->base = base;
+  chunk->used = 0;
+  chunk->epoch = heap->epoch;
+  chunk->live = 0;
+
+  return unused;
+}
+
+/**
+ * @brief chunk_free: gives an empty chunk's memory back
+ *
+ * @param heap Pointer to the heap
+ * @param c index of the chunk
+ */
+static void chunk_free(struct RAM_HEAP* heap, int c)
+{
+  free(heap->chunks[c].base);
+  heap->chunks[c].base = NULL;
+
+  charge(heap, -(long long) heap->config.chunk_bytes);
+  heap->stats.chunk_bytes -= heap->config.chunk_bytes;
+}
+
+/**
+ * @brief alloc_small: bump-allocates space for an object from a chunk
+ *
+ * Sets the header's chunk; the rest of the header is up to the caller.
+ *
+ * @param heap Pointer to the heap
+ * @param bytes size of the object (<= chunk_bytes / 4)
+ * @return pointer to the space, NULL if over budget or out of memory
+ */
+static struct HEAP_OBJECT* alloc_small(struct RAM_HEAP* heap, int bytes)
+{
+  if (heap->current == -1 || heap->chunks[heap->current].used + bytes > heap->config.chunk_bytes) {
+    int c = chunk_new(heap);
+
+    if (c == -1) {
+      return NULL;
+    }
+
+    heap->current = c;
+  }
+
+  struct HEAP_CHUNK* chunk = &heap->chunks[heap->current];
+  struct HEAP_OBJECT* object = (struct HEAP_OBJECT*) (chunk->base + chunk->used);
+
+  chunk->used += bytes;
+  object->chunk = heap->current;
+
+  return object;
+}
+
+/**
+ * @brief alloc_large: allocates space for an object by itself
+ *
+ * @param heap Pointer to the heap
+ * @param bytes size of the object
+ * @return pointer to the space, NULL if over budget or out of memory
+ */
+static struct HEAP_OBJECT* alloc_large(struct RAM_HEAP* heap, long long bytes)
+{
+  if (heap->num_large == heap->max_large) {
+    int max_large = (heap->max_large == 0) ? 16 : heap->max_large * 2;
+    long long list_bytes = (long long) (max_large - heap->max_large) * sizeof(struct HEAP_OBJECT*);
+
+    if (!within_budget(heap, list_bytes)) {
+      return NULL;
+    }
+
+    struct HEAP_OBJECT** large = (struct HEAP_OBJECT**) realloc(heap->large,
+                                                                max_large * sizeof(struct HEAP_OBJECT*));
+
+    if (large == NULL) {
+      return NULL;
+    }
+
+    charge(heap, list_bytes);
+
+    heap->large = large;
+    heap->max_large = max_large;
+  }
+
+  if (!within_budget(heap, bytes)) {
+    return NULL;
+  }
+
+  struct HEAP_OBJECT* object = (struct HEAP_OBJECT*) malloc(bytes);
+
+  if (object == NULL) {
+    return NULL;
+  }
+
+  charge(heap, bytes);
+  heap->stats.chunk_bytes += bytes;
+
+  object->chunk = -1;
+
+  heap->large[heap->num_large] = object;
+  heap->num_large++;
+
+  return object;
+}
+
+/**
+ * @brief shade: marks an object, if not already marked
+ *
+ * A newly marked object with slots is pushed on the gray stack so
+ * its slots get scanned. Anything that is not a live object is
+ * ignored.
+ *
+ * @param heap Pointer to the heap
+ * @param ptr handle
+ * @return true if the object was just marked, false if not
+ */
+static bool shade(struct RAM_HEAP* heap, int ptr)
+{
+  if (ptr <= 0 || ptr >= heap->max_handles) {
+    return false;
+  }
+
+  struct HEAP_OBJECT* object = heap->objects[ptr];
+
+  if (object == NULL || object->mark == heap->epoch) {
+    return false;
+  }
+
+  object->mark = heap->epoch;
+
+  if (object->chunk >= 0) {
+    heap->chunks[object->chunk].live += object_bytes(object->num_slots);
+  }
+
+  if (object->num_slots > 0) {
+    heap->gray[heap->num_gray] = ptr;
+    heap->num_gray++;
+  }
+
+  return true;
+}
+
+/**
+ * @brief free_object: frees a dead object's handle
+ *
+ * The object's space is left to the caller.
+ *
+ * @param heap Pointer to the heap
+ * @param object Pointer to the object's header
+ */
+static void free_object(struct RAM_HEAP* heap, struct HEAP_OBJECT* object)
+{
+  heap->objects[object->handle] = NULL;
+  heap->free_handles[heap->num_free] = object->handle;
+  heap->num_free++;
+
+  object->handle = 0;
+
+  heap->stats.objects--;
+  heap->stats.bytes -= object_bytes(object->num_slots);
+  heap->stats.freed++;
+}
+
+/**
+ * @brief start_collection: starts marking
+ *
+ * @param heap Pointer to the heap
+ */
+static void start_collection(struct RAM_HEAP* heap)
+{
+  heap->epoch++;
+  heap->phase = HEAP_MARK;
+
+  heap->root_cell = 0;
+  heap->root_undo = 0;
+  heap->num_gray = 0;
+  heap->scan_ptr = 0;
+
+  for (int c = 0; c < heap->num_chunks; c++) {
+    heap->chunks[c].live = 0;
+  }
+}
+
+/**
+ * @brief finish_collection: wraps up after sweeping
+ *
+ * Sets when the next collection starts, and frees the empty chunks
+ * beyond those needed until then. Keeping those saves faulting in
+ * fresh pages for them, which costs more than the allocations.
+ *
+ * @param heap Pointer to the heap
+ */
+static void finish_collection(struct RAM_HEAP* heap)
+{
+  heap->phase = HEAP_IDLE;
+  heap->stats.cycles++;
+
+  heap->threshold = heap->stats.bytes + heap->stats.bytes / 100 * heap->config.growth_percent;
+
+  if (heap->threshold < heap->config.chunk_bytes) {
+    heap->threshold = heap->config.chunk_bytes;
+  }
+
+  long long keep = (heap->threshold - heap->stats.bytes) / heap->config.chunk_bytes + 1;
+
+  for (int c = 0; c < heap->num_chunks; c++) {
+    if (heap->chunks[c].base != NULL && heap->chunks[c].used == 0 && c != heap->current) {
+      if (keep > 0) {
+        keep--;
+      }
+      else {
+        chunk_free(heap, c);
+      }
+    }
+  }
+}
+
+/**
+ * @brief mark: does some marking
+ *
+ * Scans the roots (memory's cells, then its undo log), then the
+ * slots of gray objects. Moves on to sweeping once nothing is left
+ * to scan.
+ *
+ * @param heap Pointer to the heap
+ * @param work # of bytes of cells and slots to scan, at most
+ * @return work left over
+ */
+static long long mark(struct RAM_HEAP* heap, long long work)
+{
+  struct RAM* memory = heap->memory;
+
+  while (work > 0 && heap->root_cell < memory->size) {
+    struct RAM_VALUE* cell = ram_cell(memory, heap->root_cell);
+
+    if (cell->value_type == RAM_TYPE_PTR && shade(heap, cell->types.i)) {
+      work -= HEAP_TOUCH;
+    }
+
+    heap->root_cell++;
+    work -= sizeof(struct RAM_VALUE);
+  }
+
+  while (work > 0 && heap->root_undo < memory->txn.size) {
+    struct RAM_UNDO* record = &memory->txn.log[heap->root_undo];
+
+    if (record->kind == RAM_UNDO_OVERWRITE && record->old.value_type == RAM_TYPE_PTR &&
+        shade(heap, record->old.types.i)) {
+      work -= HEAP_TOUCH;
+    }
+
+    heap->root_undo++;
+    work -= sizeof(struct RAM_UNDO);
+  }
+
+  while (work > 0 && (heap->scan_ptr != 0 || heap->num_gray > 0)) {
+    if (heap->scan_ptr == 0) {
+      heap->num_gray--;
+      heap->scan_ptr = heap->gray[heap->num_gray];
+      heap->scan_slot = 0;
+    }
+
+    //
+    // a big object is scanned a piece at a time:
+    //
+    struct HEAP_OBJECT* object = heap->objects[heap->scan_ptr];
+    struct RAM_VALUE* slots = slots_of(object);
+    long long n = work / (long long) sizeof(struct RAM_VALUE) + 1;
+    int end = (n < object->num_slots - heap->scan_slot) ? heap->scan_slot + (int) n : object->num_slots;
+
+    for (int s = heap->scan_slot; s < end; s++) {
+      if (slots[s].value_type == RAM_TYPE_PTR && shade(heap, slots[s].types.i)) {
+        work -= HEAP_TOUCH;
+      }
+    }
+
+    work -= (long long) (end - heap->scan_slot) * sizeof(struct RAM_VALUE);
+
+    heap->scan_slot = end;
+
+    if (end == object->num_slots) {
+      heap->scan_ptr = 0;
+    }
+  }
+
+  if (heap->root_cell >= memory->size && heap->root_undo >= memory->txn.size &&
+      heap->scan_ptr == 0 && heap->num_gray == 0) {
+    heap->phase = HEAP_SWEEP;
+    heap->sweep_chunk = 0;
+    heap->sweep_offset = 0;
+    heap->sweep_large = 0;
+    heap->kept_large = 0;
+  }
+
+  return work;
+}
+
+/**
+ * @brief sweep: does some sweeping
+ *
+ * Frees unmarked objects, chunk by chunk (evacuating the sparse
+ * ones), then the large objects. Finishes the collection once
+ * everything has been swept.
+ *
+ * @param heap Pointer to the heap
+ * @param work # of bytes of objects to visit or move, at most
+ * @return work left over
+ */
+static long long sweep(struct RAM_HEAP* heap, long long work)
+{
+  while (work > 0 && heap->sweep_chunk < heap->num_chunks) {
+    int c = heap->sweep_chunk;
+    struct HEAP_CHUNK* chunk = &heap->chunks[c];
+
+    if (heap->sweep_offset == 0) {
+      //
+      // chunks started during this collection hold only marked
+      // objects, so there is nothing to sweep:
+      //
+      if (chunk->base == NULL || chunk->used == 0 || chunk->epoch == heap->epoch) {
+        heap->sweep_chunk++;
+        continue;
+      }
+
+      heap->evacuating = (c != heap->current && chunk->live * 2 <= heap->config.chunk_bytes);
+    }
+
+    if (heap->sweep_offset >= chunk->used) {
+      if (heap->evacuating) {
+        chunk->used = 0;
+      }
+
+      heap->sweep_chunk++;
+      heap->sweep_offset = 0;
+      continue;
+    }
+
+    struct HEAP_OBJECT* object = (struct HEAP_OBJECT*) (chunk->base + heap->sweep_offset);
+    int bytes = (int) object_bytes(object->num_slots);
+
+    heap->sweep_offset += bytes;
+    work -= sizeof(struct HEAP_OBJECT);
+
+    if (object->handle == 0) {
+      continue;
+    }
+
+    if (object->mark != heap->epoch) {
+      free_object(heap, object);
+      work -= HEAP_TOUCH;
+      continue;
+    }
+
+    if (heap->evacuating) {
+      //
+      // may allocate a chunk, moving heap->chunks, but not the
+      // object; if it can't, the rest of the chunk stays put:
+      //
+      struct HEAP_OBJECT* moved = alloc_small(heap, bytes);
+
+      if (moved == NULL) {
+        heap->evacuating = false;
+        continue;
+      }
+
+      int to = moved->chunk;
+
+      memcpy(moved, object, bytes);
+      moved->chunk = to;
+      heap->chunks[to].live += bytes;
+
+      heap->objects[object->handle] = moved;
+      object->handle = 0;
+
+      heap->stats.moved++;
+      work -= bytes + HEAP_TOUCH;
+    }
+  }
+
+  while (work > 0 && heap->sweep_large < heap->num_large) {
+    struct HEAP_OBJECT* object = heap->large[heap->sweep_large];
+
+    heap->sweep_large++;
+    work -= sizeof(struct HEAP_OBJECT);
+
+    if (object->mark == heap->epoch) {
+      heap->large[heap->kept_large] = object;
+      heap->kept_large++;
+      continue;
+    }
+
+    long long bytes = object_bytes(object->num_slots);
+
+    free_object(heap, object);
+    free(object);
+    work -= HEAP_TOUCH;
+
+    charge(heap, -bytes);
+    heap->stats.chunk_bytes -= bytes;
+  }
+
+  if (heap->sweep_chunk >= heap->num_chunks && heap->sweep_large >= heap->num_large) {
+    heap->num_large = heap->kept_large;
+    finish_collection(heap);
+  }
+
+  return work;
+}
+
+/**
+ * @brief collect: does collection work until it runs out or the collection finishes
+ *
+ * @param heap Pointer to the heap
+ * @param work # of bytes of work to do, at most
+ */
+static void collect(struct RAM_HEAP* heap, long long work)
+{
+  while (work > 0 && heap->phase != HEAP_IDLE) {
+    if (heap->phase == HEAP_MARK) {
+      work = mark(heap, work);
+    }
+    else {
+      work = sweep(heap, work);
+    }
+  }
+}
+
+
+//
+// Called by ram.c:
+//
+
+void heap_forget(struct RAM_HEAP* heap, int ptr)
+{
+  if (heap->phase == HEAP_MARK) {
+    shade(heap, ptr);
+  }
+}
+
+void heap_reset(struct RAM_HEAP* heap)
+{
+  for (int i = 0; i < heap->num_large; i++) {
+    long long bytes = object_bytes(heap->large[i]->num_slots);
+
+    free(heap->large[i]);
+
+    charge(heap, -bytes);
+    heap->stats.chunk_bytes -= bytes;
+  }
+
+  heap->num_large = 0;
+
+  for (int c = 0; c < heap->num_chunks; c++) {
+    heap->chunks[c].used = 0;
+  }
+
+  heap->current = -1;
+
+  heap->num_free = 0;
+
+  for (int h = heap->max_handles - 1; h > 0; h--) {
+    heap->objects[h] = NULL;
+    heap->free_handles[heap->num_free] = h;
+    heap->num_free++;
+  }
+
+  heap->num_gray = 0;
+  heap->scan_ptr = 0;
+
+  heap->phase = HEAP_IDLE;
+  heap->threshold = heap->config.chunk_bytes;
+  heap->since_step = 0;
+
+  heap->stats.objects = 0;
+  heap->stats.bytes = 0;
+}
+
+void heap_close(struct RAM_HEAP* heap)
+{
+  for (int i = 0; i < heap->num_large; i++) {
+    free(heap->large[i]);
+  }
+
+  for (int c = 0; c < heap->num_chunks; c++) {
+    free(heap->chunks[c].base);
+  }
+
+  free(heap->large);
+  free(heap->chunks);
+  free(heap->objects);
+  free(heap->free_handles);
+  free(heap->gray);
+  free(heap);
+}
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_heap_enable: gives memory a managed heap for PTR values
+  *
+  * Chunks, large objects and the heap's tables count toward
+  * memory's usage (usage.heap) and budget. The heap lasts until
+  * ram_destroy; ram_reset frees every object in it.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param config heap settings, values <= 0 => defaults
+  * @return true if successful, false if memory already has a heap
+  */
+bool ram_heap_enable(struct RAM* memory, struct RAM_HEAP_CONFIG config)
+{
+  if (memory->heap != NULL) {
+    return false;
+  }
+
+  if (config.chunk_bytes <= 0) {
+    config.chunk_bytes = HEAP_CHUNK_BYTES;
+  }
+  else if (config.chunk_bytes < HEAP_MIN_CHUNK) {
+    config.chunk_bytes = HEAP_MIN_CHUNK;
+  }
+  else {
+    config.chunk_bytes = (config.chunk_bytes > INT_MAX - 15) ? INT_MAX - 15 : config.chunk_bytes;
+    config.chunk_bytes = (config.chunk_bytes + 15) & ~15;
+  }
+
+  if (config.step_bytes <= 0) {
+    config.step_bytes = HEAP_STEP_BYTES;
+  }
+
+  if (config.growth_percent <= 0) {
+    config.growth_percent = HEAP_GROWTH_PERCENT;
+  }
+
+  struct RAM_HEAP* heap = (struct RAM_HEAP*) calloc(1, sizeof(struct RAM_HEAP));
+
+  if (heap == NULL) {
+    return false;
+  }
+
+  heap->memory = memory;
+  heap->config = config;
+  heap->current = -1;
+  heap->phase = HEAP_IDLE;
+  heap->epoch = 1;
+  heap->threshold = config.chunk_bytes;
+
+  memory->heap = heap;
+
+  charge(heap, sizeof(struct RAM_HEAP));
+
+  return true;
+}
+
+
+/**
+  * @brief ram_heap_alloc: allocates an object
+  *
+  * Every slot of the new object is None. Never collects; see
+  * ram_heap_step.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param num_slots # of slots, >= 0
+  * @return the object's handle (> 0), or 0 if no heap, num_slots < 0,
+  *   over budget or out of memory
+  */
+int ram_heap_alloc(struct RAM* memory, int num_slots)
+{
+  struct RAM_HEAP* heap = memory->heap;
+
+  if (heap == NULL || num_slots < 0 || num_slots > HEAP_MAX_SLOTS) {
+    return 0;
+  }
+
+  if (heap->num_free == 0 && !handles_grow(heap)) {
+    return 0;
+  }
+
+  long long bytes = object_bytes(num_slots);
+  struct HEAP_OBJECT* object = (bytes > heap->config.chunk_bytes / 4) ? alloc_large(heap, bytes)
+                                                                      : alloc_small(heap, (int) bytes);
+
+  if (object == NULL) {
+    return 0;
+  }
+
+  heap->num_free--;
+
+  int ptr = heap->free_handles[heap->num_free];
+
+  //
+  // marked from the start, so an object allocated during a
+  // collection survives it:
+  //
+  object->handle = ptr;
+  object->num_slots = num_slots;
+  object->mark = heap->epoch;
+
+  if (heap->phase != HEAP_IDLE && object->chunk >= 0) {
+    heap->chunks[object->chunk].live += bytes;
+  }
+
+  struct RAM_VALUE* slots = slots_of(object);
+
+  for (int s = 0; s < num_slots; s++) {
+    slots[s].value_type = RAM_TYPE_NONE;
+    slots[s].types.i = 0;
+  }
+
+  heap->objects[ptr] = object;
+
+  heap->stats.objects++;
+  heap->stats.bytes += bytes;
+  heap->stats.allocated++;
+  heap->since_step += bytes;
+
+  return ptr;
+}
+
+
+/**
+  * @brief ram_heap_num_slots: # of slots in an object
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @return # of slots, or -1 if ptr is not a live object
+  */
+int ram_heap_num_slots(struct RAM* memory, int ptr)
+{
+  struct HEAP_OBJECT* object = object_of(memory, ptr);
+
+  return (object == NULL) ? -1 : object->num_slots;
+}
+
+
+/**
+  * @brief ram_heap_read: reads a slot of an object
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @param slot slot #, 0..num_slots-1
+  * @param value set to the slot's value if successful
+  * @return true if successful, false if ptr is not a live object or slot is out of range
+  */
+bool ram_heap_read(struct RAM* memory, int ptr, int slot, struct RAM_VALUE* value)
+{
+  struct HEAP_OBJECT* object = object_of(memory, ptr);
+
+  if (object == NULL || slot < 0 || slot >= object->num_slots) {
+    return false;
+  }
+
+  *value = slots_of(object)[slot];
+
+  return true;
+}
+
+
+/**
+  * @brief ram_heap_write: writes a slot of an object
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @param slot slot #, 0..num_slots-1
+  * @param value int, real, boolean, None or PTR value to write
+  * @return true if successful, false if ptr is not a live object, slot is
+  *   out of range, or value is a string or array
+  */
+bool ram_heap_write(struct RAM* memory, int ptr, int slot, struct RAM_VALUE value)
+{
+  struct HEAP_OBJECT* object = object_of(memory, ptr);
+
+  if (object == NULL || slot < 0 || slot >= object->num_slots ||
+      value.value_type == RAM_TYPE_STR || value.value_type == RAM_TYPE_ARRAY) {
+    return false;
+  }
+
+  struct RAM_VALUE* old = &slots_of(object)[slot];
+
+  if (old->value_type == RAM_TYPE_PTR) {
+    heap_forget(memory->heap, old->types.i);
+  }
+
+  *old = value;
+
+  return true;
+}
+
+
+/**
+  * @brief ram_heap_slots: an object's slots, for reading in place
+  *
+  * The pointer is valid until the next ram_heap_alloc, ram_heap_step
+  * or ram_heap_collect (which may move the object). Write slots with
+  * ram_heap_write, which the collector needs to hear about.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @return pointer to the slots, or NULL if ptr is not a live object
+  */
+struct RAM_VALUE* ram_heap_slots(struct RAM* memory, int ptr)
+{
+  struct HEAP_OBJECT* object = object_of(memory, ptr);
+
+  return (object == NULL) ? NULL : slots_of(object);
+}
+
+
+/**
+  * @brief ram_heap_step: lets the collector do a bounded amount of work
+  *
+  * Call at a safe point, i.e. when every object still needed can be
+  * reached from memory's cells. Starts a collection once the heap has
+  * grown enough (see struct RAM_HEAP_CONFIG), and does one step of
+  * the one under way, if any; otherwise returns right away.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if a collection is still under way, false if not
+  */
+bool ram_heap_step(struct RAM* memory)
+{
+  struct RAM_HEAP* heap = memory->heap;
+
+  if (heap == NULL || (heap->phase == HEAP_IDLE && heap->stats.bytes < heap->threshold)) {
+    return false;
+  }
+
+  long long start = now_ns();
+
+  if (heap->phase == HEAP_IDLE) {
+    start_collection(heap);
+    heap->since_step = 0;
+  }
+
+  //
+  // pay for what was allocated since the last step, so the
+  // collection keeps up with the mutator:
+  //
+  long long work = 2 * heap->since_step;
+
+  if (work < heap->config.step_bytes) {
+    work = heap->config.step_bytes;
+  }
+
+  heap->since_step = 0;
+
+  collect(heap, work);
+
+  long long ns = now_ns() - start;
+
+  heap->stats.steps++;
+
+  if (ns > heap->stats.max_step_ns) {
+    heap->stats.max_step_ns = ns;
+  }
+
+  return heap->phase != HEAP_IDLE;
+}
+
+
+/**
+  * @brief ram_heap_collect: collects everything that is garbage now
+  *
+  * Finishes the collection under way (if any), then runs a whole
+  * one, without pausing in between. Call at a safe point.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_heap_collect(struct RAM* memory)
+{
+  struct RAM_HEAP* heap = memory->heap;
+
+  if (heap == NULL) {
+    return;
+  }
+
+  collect(heap, LLONG_MAX);
+
+  start_collection(heap);
+  collect(heap, LLONG_MAX);
+
+  heap->since_step = 0;
+}
+
+
+/**
+  * @brief ram_heap_stats: statistics about memory's heap
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return heap statistics, all 0 if memory has no heap
+  */
+struct RAM_HEAP_STATS ram_heap_stats(struct RAM* memory)
+{
+  struct RAM_HEAP_STATS stats;
+
+  if (memory->heap == NULL) {
+    memset(&stats, 0, sizeof(stats));
+    return stats;
+  }
+
+  stats = memory->heap->stats;
+  stats.collecting = (memory->heap->phase != HEAP_IDLE);
+
+  return stats;
+}
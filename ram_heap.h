@@ -0,0 +1,178 @@
+/*ram_heap.h*/
+
+/**
+  * @brief Managed heap for nuPython's memory unit
+  *
+  * Gives RAM_TYPE_PTR values something to point to. An object is a
+  * fixed # of slots, each holding an int, real, boolean, None or PTR
+  * value, and a PTR value is an object's handle (an int > 0, so a
+  * PTR of 0 can stand for null). Objects are bump-allocated from
+  * large chunks and freed by a garbage collector whose roots are
+  * memory's PTR cells, plus the old values in its undo log: an object
+  * lives as long as it can be reached from them, directly or through
+  * the slots of other objects.
+  *
+  * Collection is incremental. The interpreter calls ram_heap_step at
+  * its safe points (e.g. between statements), and each call does a
+  * bounded amount of marking or sweeping, so no pause is longer than
+  * one step. Collection only ever happens in ram_heap_step and
+  * ram_heap_collect, so an object held only in a C variable is safe
+  * until the next of those calls; store it in a cell or a slot
+  * before then. Sweeping also compacts: the live objects of a
+  * mostly-empty chunk are moved out so the whole chunk can be reused.
+  * An object's handle stays the same when it moves.
+  *
+  * The heap is not journaled, traced or checkpointed; PTR values
+  * are saved as plain ints.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+struct RAM_HEAP_CONFIG
+{
+  int chunk_bytes;     // size of the chunks objects are allocated from;
+                       // an object bigger than 1/4 of that gets its own block
+  int step_bytes;      // least work each ram_heap_step does, in bytes of objects
+                       // (or cells) visited, plus 64 for each object marked, freed
+                       // or moved; a step also does 2 bytes of work for every
+                       // byte allocated since the previous step
+  int growth_percent;  // start a collection once the objects' bytes have grown
+                       // this much since the last one (e.g. 100 => doubled)
+};
+
+struct RAM_HEAP_STATS
+{
+  long long objects;      // # of objects allocated and not yet freed
+  long long bytes;        // bytes in those objects, including their headers
+  long long chunk_bytes;  // bytes allocated for chunks and large objects
+  long long allocated;    // # of objects allocated since the heap was enabled
+  long long freed;        // # of objects freed by the collector
+  long long moved;        // # of objects moved while compacting
+  long long cycles;       // # of collections completed
+  long long steps;        // # of ram_heap_step calls that did some work
+  long long max_step_ns;  // longest of those steps, in ns
+  bool collecting;        // is a collection under way?
+};
+
+
+/**
+  * @brief ram_heap_enable: gives memory a managed heap for PTR values
+  *
+  * Chunks, large objects and the heap's tables count toward
+  * memory's usage (usage.heap) and budget. The heap lasts until
+  * ram_destroy; ram_reset frees every object in it.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param config heap settings, values <= 0 => defaults
+  * @return true if successful, false if memory already has a heap
+  */
+bool ram_heap_enable(struct RAM* memory, struct RAM_HEAP_CONFIG config);
+
+/**
+  * @brief ram_heap_alloc: allocates an object
+  *
+  * Every slot of the new object is None. Never collects; see
+  * ram_heap_step.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param num_slots # of slots, >= 0
+  * @return the object's handle (> 0), or 0 if no heap, num_slots < 0,
+  *   over budget or out of memory
+  */
+int ram_heap_alloc(struct RAM* memory, int num_slots);
+
+/**
+  * @brief ram_heap_num_slots: # of slots in an object
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @return # of slots, or -1 if ptr is not a live object
+  */
+int ram_heap_num_slots(struct RAM* memory, int ptr);
+
+/**
+  * @brief ram_heap_read: reads a slot of an object
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @param slot slot #, 0..num_slots-1
+  * @param value set to the slot's value if successful
+  * @return true if successful, false if ptr is not a live object or slot is out of range
+  */
+bool ram_heap_read(struct RAM* memory, int ptr, int slot, struct RAM_VALUE* value);
+
+/**
+  * @brief ram_heap_write: writes a slot of an object
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @param slot slot #, 0..num_slots-1
+  * @param value int, real, boolean, None or PTR value to write
+  * @return true if successful, false if ptr is not a live object, slot is
+  *   out of range, or value is a string or array
+  */
+bool ram_heap_write(struct RAM* memory, int ptr, int slot, struct RAM_VALUE value);
+
+/**
+  * @brief ram_heap_slots: an object's slots, for reading in place
+  *
+  * The pointer is valid until the next ram_heap_alloc, ram_heap_step
+  * or ram_heap_collect (which may move the object). Write slots with
+  * ram_heap_write, which the collector needs to hear about.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param ptr the object's handle
+  * @return pointer to the slots, or NULL if ptr is not a live object
+  */
+struct RAM_VALUE* ram_heap_slots(struct RAM* memory, int ptr);
+
+/**
+  * @brief ram_heap_step: lets the collector do a bounded amount of work
+  *
+  * Call at a safe point, i.e. when every object still needed can be
+  * reached from memory's cells. Starts a collection once the heap has
+  * grown enough (see struct RAM_HEAP_CONFIG), and does one step of
+  * the one under way, if any; otherwise returns right away.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if a collection is still under way, false if not
+  */
+bool ram_heap_step(struct RAM* memory);
+
+/**
+  * @brief ram_heap_collect: collects everything that is garbage now
+  *
+  * Finishes the collection under way (if any), then runs a whole
+  * one, without pausing in between. Call at a safe point.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_heap_collect(struct RAM* memory);
+
+/**
+  * @brief ram_heap_stats: statistics about memory's heap
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return heap statistics, all 0 if memory has no heap
+  */
+struct RAM_HEAP_STATS ram_heap_stats(struct RAM* memory);
+
+
+//
+// Called by ram.c when memory->heap != NULL; not meant to be called
+// directly. heap_forget must be called whenever a PTR value is
+// removed from a cell or the undo log (while the collector marks,
+// what was reachable when it started must stay reachable):
+//
+void heap_forget(struct RAM_HEAP* heap, int ptr);
+void heap_reset(struct RAM_HEAP* heap);
+void heap_close(struct RAM_HEAP* heap);
@@ -0,0 +1,834 @@
+/*ram_journal.c*/
+
+/**
+  * @brief Write-ahead journal for nuPython's memory unit
+  *
+  * Every change to a journaled memory is encoded as one record and
+  * appended to a buffer, which is written to the journal file when
+  * it fills or when a group of records is synced. Each record is
+  * framed as:
+  *
+  *   u32 payload length | u32 checksum of payload | payload
+  *
+  * so that a record torn by a crash is detected (and discarded) on
+  * replay. The payload is an op byte followed by its operands;
+  * lengths and addresses are varints, values are a type byte and
+  * their raw contents.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <limits.h>  // INT_MAX
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ram.h"
+#include "ram_journal.h"
+
+#define JOURNAL_BUFFER_SIZE 65536  // flush the buffer once it holds this many bytes
+#define JOURNAL_FRAME_SIZE  8      // length + checksum in front of each record
+
+struct RAM_JOURNAL
+{
+  int   fd;                          // journal file
+  struct RAM_JOURNAL_CONFIG config;  // when to fsync
+  char* buffer;                      // records not yet written to the file
+  int   used;                        // # of bytes in buffer
+  int   written;                     // # of bytes at the front of buffer already
+                                     // in the file (after a partial write)
+  int   capacity;                    // # of bytes allocated for buffer
+  int   pending;                     // # of records since the last fsync
+  long long last_sync_ms;            // time of the last fsync
+  bool  failed;                      // a write, fsync or allocation failed; sticky,
+                                     // reported by ram_journal_sync/close
+  bool  stopped;                     // a record was lost, so no more are appended
+                                     // (the file stays a valid prefix)
+  struct RAM_JOURNAL_STATS stats;
+};
+
+
+/**
+ * @brief now_ms: current time in milliseconds, for group commit
+ *
+ * @return milliseconds since an arbitrary fixed point
+ */
+static long long now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief checksum: 32-bit FNV-1a checksum of a record's payload
+ *
+ * @param bytes Pointer to the payload
+ * @param length # of bytes in the payload
+ * @return checksum
+ */
+static unsigned int checksum(unsigned char* bytes, int length)
+{
+  unsigned int hash = 2166136261u;
+
+  for (int i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ * @brief reserve: makes room for n more bytes in the buffer
+ *
+ * If the buffer cannot grow, the journal stops: the record being
+ * built is dropped by end_record, and so is every one after it.
+ *
+ * @param journal Pointer to the journal
+ * @param n # of bytes needed
+ * @return true if successful, false if out of memory
+ */
+static bool reserve(struct RAM_JOURNAL* journal, int n)
+{
+  if (journal->stopped) {
+    return false;
+  }
+
+  if ((long long) journal->used + n > journal->capacity) {
+    long long capacity = journal->capacity;
+
+    while ((long long) journal->used + n > capacity) {
+      capacity *= 2;
+    }
+
+    char* buffer = (capacity <= INT_MAX) ? (char*) realloc(journal->buffer, (size_t) capacity) : NULL;
+
+    if (buffer == NULL) {
+      journal->failed = true;
+      journal->stopped = true;
+      return false;
+    }
+
+    journal->buffer = buffer;
+    journal->capacity = (int) capacity;
+  }
+
+  return true;
+}
+
+/**
+ * @brief put_bytes: appends raw bytes to the current record
+ *
+ * @param journal Pointer to the journal
+ * @param bytes Pointer to the bytes
+ * @param n # of bytes
+ */
+static void put_bytes(struct RAM_JOURNAL* journal, void* bytes, int n)
+{
+  if (!reserve(journal, n)) {
+    return;
+  }
+
+  memcpy(journal->buffer + journal->used, bytes, n);
+  journal->used += n;
+}
+
+/**
+ * @brief put_u8: appends one byte to the current record
+ *
+ * @param journal Pointer to the journal
+ * @param x Byte to append
+ */
+static void put_u8(struct RAM_JOURNAL* journal, int x)
+{
+  if (!reserve(journal, 1)) {
+    return;
+  }
+
+  journal->buffer[journal->used] = (char) x;
+  journal->used++;
+}
+
+/**
+ * @brief put_varint: appends a non-negative int, 7 bits per byte
+ *
+ * @param journal Pointer to the journal
+ * @param x Value to append (>= 0)
+ */
+static void put_varint(struct RAM_JOURNAL* journal, int x)
+{
+  unsigned int u = (unsigned int) x;
+
+  while (u >= 0x80) {
+    put_u8(journal, (int) ((u & 0x7F) | 0x80));
+    u >>= 7;
+  }
+
+  put_u8(journal, (int) u);
+}
+
+/**
+ * @brief put_value: appends a value (type byte, then contents)
+ *
+ * @param journal Pointer to the journal
+ * @param value Pointer to a value stored in memory
+ */
+static void put_value(struct RAM_JOURNAL* journal, struct RAM_VALUE* value)
+{
+  put_u8(journal, value->value_type);
+
+  switch (value->value_type) {
+    case RAM_TYPE_INT:
+    case RAM_TYPE_PTR:
+    case RAM_TYPE_BOOLEAN:
+      put_bytes(journal, &value->types.i, sizeof(int));
+      break;
+    case RAM_TYPE_REAL:
+      put_bytes(journal, &value->types.d, sizeof(double));
+      break;
+    case RAM_TYPE_STR: {
+      int length = ram_str_length(value->types.s);
+
+      put_varint(journal, length);
+      put_bytes(journal, value->types.s, length);
+      break;
+    }
+    case RAM_TYPE_ARRAY: {
+      struct RAM_ARRAY* a = value->types.a;
+      int elem_size = (a->elem_type == RAM_ARRAY_INT) ? sizeof(int) : sizeof(double);
+
+      put_u8(journal, a->elem_type);
+      put_varint(journal, a->length);
+      put_bytes(journal, a->elems.i, a->length * elem_size);
+      break;
+    }
+  }
+}
+
+/**
+ * @brief begin_record: starts a new record in the buffer
+ *
+ * @param journal Pointer to the journal
+ * @param op enum RAM_JOURNAL_OPS
+ * @return offset of the record's frame in the buffer
+ */
+static int begin_record(struct RAM_JOURNAL* journal, int op)
+{
+  int start = journal->used;
+
+  if (reserve(journal, JOURNAL_FRAME_SIZE)) {
+    journal->used += JOURNAL_FRAME_SIZE;
+  }
+
+  put_u8(journal, op);
+
+  return start;
+}
+
+/**
+ * @brief flush: writes the buffer to the journal file
+ *
+ * Picks up after the bytes already written, so a write that failed
+ * part way through is retried from where it stopped and the file
+ * never holds part of a record twice.
+ *
+ * @param journal Pointer to the journal
+ * @return true if successful, false if the write failed
+ */
+static bool flush(struct RAM_JOURNAL* journal)
+{
+  while (journal->written < journal->used) {
+    ssize_t n = write(journal->fd, journal->buffer + journal->written, journal->used - journal->written);
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n <= 0) {
+      journal->failed = true;
+      return false;
+    }
+
+    journal->written += (int) n;
+  }
+
+  journal->used = 0;
+  journal->written = 0;
+
+  return true;
+}
+
+/**
+ * @brief sync_journal: writes the buffer and forces the file to disk
+ *
+ * If either step fails the records stay pending, so the next
+ * record tries again.
+ *
+ * @param journal Pointer to the journal
+ * @return true if successful, false if not
+ */
+static bool sync_journal(struct RAM_JOURNAL* journal)
+{
+  if (!flush(journal)) {
+    return false;
+  }
+
+  journal->stats.syncs++;
+
+  if (fsync(journal->fd) != 0) {
+    journal->failed = true;
+    return false;
+  }
+
+  journal->pending = 0;
+  journal->last_sync_ms = now_ms();
+
+  return true;
+}
+
+/**
+ * @brief end_record: finishes a record and applies the sync policy
+ *
+ * Fills in the record's frame, then syncs if the group of records
+ * since the last sync is big (or old) enough; otherwise only
+ * writes the buffer out once it is full. A record that didn't fit
+ * in the buffer is dropped. A failed write or sync is kept in
+ * journal->failed for ram_journal_sync and ram_journal_close to
+ * report; the buffered records are retried with the next record.
+ *
+ * @param journal Pointer to the journal
+ * @param start offset returned by begin_record
+ */
+static void end_record(struct RAM_JOURNAL* journal, int start)
+{
+  if (journal->stopped) {
+    journal->used = start;
+    return;
+  }
+
+  unsigned char* payload = (unsigned char*) journal->buffer + start + JOURNAL_FRAME_SIZE;
+  unsigned int length = journal->used - start - JOURNAL_FRAME_SIZE;
+  unsigned int sum = checksum(payload, length);
+
+  memcpy(journal->buffer + start, &length, sizeof(unsigned int));
+  memcpy(journal->buffer + start + sizeof(unsigned int), &sum, sizeof(unsigned int));
+
+  journal->pending++;
+  journal->stats.records++;
+  journal->stats.bytes += journal->used - start;
+
+  struct RAM_JOURNAL_CONFIG* config = &journal->config;
+
+  if ((config->sync_every_records > 0 && journal->pending >= config->sync_every_records) ||
+      (config->sync_every_ms > 0 && now_ms() - journal->last_sync_ms >= config->sync_every_ms)) {
+    sync_journal(journal);
+  }
+  else if (journal->used >= JOURNAL_BUFFER_SIZE) {
+    flush(journal);
+  }
+}
+
+/**
+ * @brief get_varint: decodes a varint written by put_varint
+ *
+ * @param p Pointer to the current position, advanced past the varint
+ * @param end Pointer just past the end of the payload
+ * @param x Set to the value decoded
+ * @return true if successful, false if malformed
+ */
+static bool get_varint(unsigned char** p, unsigned char* end, int* x)
+{
+  unsigned int u = 0;
+
+  for (int shift = 0; shift < 32; shift += 7) {
+    if (*p >= end) {
+      return false;
+    }
+
+    unsigned char byte = **p;
+    (*p)++;
+
+    u |= (unsigned int) (byte & 0x7F) << shift;
+
+    if ((byte & 0x80) == 0) {
+      *x = (int) u;
+      return *x >= 0;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief replay_value: decodes a value and writes it to memory
+ *
+ * Writes by name if varname is not NULL, else by address.
+ *
+ * @param memory Pointer to RAM struct
+ * @param p Pointer to the current position, advanced past the value
+ * @param end Pointer just past the end of the payload
+ * @param varname Variable name, or NULL
+ * @param address Memory cell address, if varname is NULL
+ * @return true if successful, false if malformed
+ */
+static bool replay_value(struct RAM* memory, unsigned char** p, unsigned char* end,
+                         char* varname, int address)
+{
+  if (*p >= end) {
+    return false;
+  }
+
+  struct RAM_VALUE value;
+  int type = **p;
+  int length;
+
+  (*p)++;
+
+  value.value_type = type;
+
+  switch (type) {
+    case RAM_TYPE_INT:
+    case RAM_TYPE_PTR:
+    case RAM_TYPE_BOOLEAN:
+      if (end - *p < (long) sizeof(int)) {
+        return false;
+      }
+      memcpy(&value.types.i, *p, sizeof(int));
+      *p += sizeof(int);
+      break;
+    case RAM_TYPE_REAL:
+      if (end - *p < (long) sizeof(double)) {
+        return false;
+      }
+      memcpy(&value.types.d, *p, sizeof(double));
+      *p += sizeof(double);
+      break;
+    case RAM_TYPE_NONE:
+      break;
+    case RAM_TYPE_STR: {
+      if (!get_varint(p, end, &length) || end - *p < length) {
+        return false;
+      }
+
+      char* s = (char*) *p;
+      *p += length;
+
+      if (varname != NULL) {
+        return ram_write_str_by_name(memory, s, length, varname);
+      }
+      return ram_write_str_by_addr(memory, s, length, address);
+    }
+    case RAM_TYPE_ARRAY: {
+      if (*p >= end) {
+        return false;
+      }
+
+      int elem_type = **p;
+      (*p)++;
+
+      if (!get_varint(p, end, &length)) {
+        return false;
+      }
+
+      long bytes = (long) length * ((elem_type == RAM_ARRAY_INT) ? sizeof(int) : sizeof(double));
+
+      if (end - *p < bytes) {
+        return false;
+      }
+
+      void* elems = *p;
+      *p += bytes;
+
+      if (varname != NULL) {
+        return ram_write_array_by_name(memory, elem_type, elems, length, varname);
+      }
+      return ram_write_array_by_addr(memory, elem_type, elems, length, address);
+    }
+    default:
+      return false;
+  }
+
+  if (varname != NULL) {
+    return ram_write_cell_by_name(memory, value, varname);
+  }
+  return ram_write_cell_by_addr(memory, value, address);
+}
+
+/**
+ * @brief replay_record: applies one journal record to memory
+ *
+ * @param memory Pointer to RAM struct (not journaled while replaying)
+ * @param p Pointer to the record's payload
+ * @param length # of bytes in the payload
+ * @return true if successful, false if malformed
+ */
+static bool replay_record(struct RAM* memory, unsigned char* p, int length)
+{
+  unsigned char* end = p + length;
+  int address;
+  int name_length;
+
+  if (length < 1) {
+    return false;
+  }
+
+  int op = *p;
+  p++;
+
+  switch (op) {
+    case RAM_JOURNAL_WRITE_BY_NAME: {
+      if (!get_varint(&p, end, &name_length) || end - p < name_length) {
+        return false;
+      }
+
+      char* varname = (char*) malloc((size_t) name_length + 1);
+
+      if (varname == NULL) {
+        return false;
+      }
+
+      memcpy(varname, p, name_length);
+      varname[name_length] = '\0';
+      p += name_length;
+
+      bool success = replay_value(memory, &p, end, varname, -1);
+
+      free(varname);
+      return success;
+    }
+    case RAM_JOURNAL_WRITE_BY_ADDR:
+      return get_varint(&p, end, &address) && replay_value(memory, &p, end, NULL, address);
+    case RAM_JOURNAL_APPEND: {
+      if (!get_varint(&p, end, &address) || end - p < 1) {
+        return false;
+      }
+
+      int type = *p;
+      p++;
+
+      if (type == RAM_TYPE_INT && end - p >= (long) sizeof(int)) {
+        int x;
+        memcpy(&x, p, sizeof(int));
+        return ram_array_append_int_by_addr(memory, x, address);
+      }
+      if (type == RAM_TYPE_REAL && end - p >= (long) sizeof(double)) {
+        double x;
+        memcpy(&x, p, sizeof(double));
+        return ram_array_append_real_by_addr(memory, x, address);
+      }
+      if (type == RAM_TYPE_STR) {
+        int length;
+        return get_varint(&p, end, &length) && end - p >= length &&
+               ram_append_str_by_addr(memory, (char*) p, length, address);
+      }
+      return false;
+    }
+    case RAM_JOURNAL_TXN_BEGIN:
+      return ram_txn_begin(memory);
+    case RAM_JOURNAL_TXN_COMMIT:
+      return ram_txn_commit(memory);
+    case RAM_JOURNAL_TXN_ROLLBACK:
+      return ram_txn_rollback(memory);
+    case RAM_JOURNAL_RESET:
+      ram_reset(memory);
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief replay: applies every complete record in the journal file
+ *
+ * A record with a good checksum that cannot be applied means
+ * memory ran out, not that the record is torn, so it fails the
+ * replay instead of being discarded with everything after it.
+ *
+ * @param memory Pointer to RAM struct (not journaled while replaying)
+ * @param fd Journal file, positioned at the start
+ * @param replayed Set to the # of records applied
+ * @return # of bytes of the file holding complete, valid records,
+ *         or -1 if out of memory
+ */
+static long replay(struct RAM* memory, int fd, long long* replayed)
+{
+  struct stat st;
+
+  *replayed = 0;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    return 0;
+  }
+
+  unsigned char* bytes = (unsigned char*) malloc(st.st_size);
+  long size = 0;
+
+  if (bytes == NULL) {
+    return -1;
+  }
+
+  while (size < st.st_size) {
+    ssize_t n = read(fd, bytes + size, st.st_size - size);
+
+    if (n <= 0) {
+      break;
+    }
+
+    size += (long) n;
+  }
+
+  long pos = 0;
+
+  while (size - pos >= JOURNAL_FRAME_SIZE) {
+    unsigned int length;
+    unsigned int sum;
+
+    memcpy(&length, bytes + pos, sizeof(unsigned int));
+    memcpy(&sum, bytes + pos + sizeof(unsigned int), sizeof(unsigned int));
+
+    unsigned char* payload = bytes + pos + JOURNAL_FRAME_SIZE;
+
+    if ((unsigned long) (size - pos - JOURNAL_FRAME_SIZE) < length ||
+        checksum(payload, length) != sum) {
+      break;
+    }
+
+    if (!replay_record(memory, payload, length)) {
+      pos = -1;
+      break;
+    }
+
+    pos += JOURNAL_FRAME_SIZE + length;
+    (*replayed)++;
+  }
+
+  free(bytes);
+
+  return pos;
+}
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_init_journaled: initialize memory unit backed by a journal
+  *
+  * Like ram_init, but if the given journal file exists its records
+  * are replayed first, rebuilding memory as of the last record that
+  * made it to disk. Transactions left open by a crash are rolled
+  * back, and a torn record at the end of the file is discarded.
+  * From then on every change to memory is appended to the file.
+  * Returns NULL if the file cannot be opened, or there is not
+  * enough memory to replay it (the file is then left as it was).
+  * Call ram_destroy() when done, which syncs and closes the
+  * journal, or ram_journal_close() to find out whether every
+  * record made it to disk.
+  *
+  * NOTE: changes made directly through a pointer returned by
+  * ram_borrow_array_by_addr (e.g. ram_array_scale) are not journaled.
+  *
+  * @param path journal file
+  * @param config when to force records to disk
+  * @return pointer to struct denoting memory unit, or NULL
+  */
+struct RAM* ram_init_journaled(char* path, struct RAM_JOURNAL_CONFIG config)
+{
+  int fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct RAM* memory = ram_init();
+
+  if (memory == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  long long replayed;
+  long valid = replay(memory, fd, &replayed);
+  struct RAM_JOURNAL* journal = (valid >= 0) ? (struct RAM_JOURNAL*) malloc(sizeof(struct RAM_JOURNAL)) : NULL;
+  char* buffer = (journal != NULL) ? (char*) malloc(JOURNAL_BUFFER_SIZE) : NULL;
+
+  //
+  // drop a torn record at the end, and continue after the last good one:
+  //
+  if (buffer == NULL || ftruncate(fd, valid) != 0 || lseek(fd, valid, SEEK_SET) != valid) {
+    close(fd);
+    free(journal);
+    free(buffer);
+    ram_destroy(memory);
+    return NULL;
+  }
+
+  journal->fd = fd;
+  journal->config = config;
+  journal->capacity = JOURNAL_BUFFER_SIZE;
+  journal->buffer = buffer;
+  journal->used = 0;
+  journal->written = 0;
+  journal->pending = 0;
+  journal->last_sync_ms = now_ms();
+  journal->failed = false;
+  journal->stopped = false;
+  journal->stats.records = 0;
+  journal->stats.bytes = 0;
+  journal->stats.syncs = 0;
+  journal->stats.replayed = replayed;
+
+  memory->journal = journal;
+
+  //
+  // transactions the crash left open never committed; roll them back
+  // (journaling the rollbacks, so the next replay agrees):
+  //
+  while (ram_txn_depth(memory) > 0) {
+    ram_txn_rollback(memory);
+  }
+
+  return memory;
+}
+
+
+/**
+  * @brief ram_journal_sync: forces all journal records to disk
+  *
+  * A failure is sticky: once a write or fsync of the journal has
+  * failed (here or as records were written), every later call
+  * returns false, since records may have been lost.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if not journaled or a write failed
+  */
+bool ram_journal_sync(struct RAM* memory)
+{
+  if (memory->journal == NULL) {
+    return false;
+  }
+
+  return sync_journal(memory->journal) && !memory->journal->failed;
+}
+
+
+/**
+  * @brief ram_journal_close: syncs and closes memory's journal
+  *
+  * Memory stays as it is, but is no longer journaled. Like
+  * ram_journal_sync, reports any write or fsync of the journal
+  * that has failed since it was opened.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if every record made it to disk, false if not
+  *         journaled or a write failed
+  */
+bool ram_journal_close(struct RAM* memory)
+{
+  if (memory->journal == NULL) {
+    return false;
+  }
+
+  bool success = journal_close(memory->journal);
+
+  memory->journal = NULL;
+
+  return success;
+}
+
+
+/**
+  * @brief ram_journal_stats: statistics about memory's journal
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return journal statistics, all 0 if memory is not journaled
+  */
+struct RAM_JOURNAL_STATS ram_journal_stats(struct RAM* memory)
+{
+  if (memory->journal == NULL) {
+    struct RAM_JOURNAL_STATS none = { 0, 0, 0, 0 };
+
+    return none;
+  }
+
+  return memory->journal->stats;
+}
+
+
+//
+// Hooks called by ram.c:
+//
+
+void journal_write_by_name(struct RAM_JOURNAL* journal, char* varname, struct RAM_VALUE* value)
+{
+  int start = begin_record(journal, RAM_JOURNAL_WRITE_BY_NAME);
+  int length = (int) strlen(varname);
+
+  put_varint(journal, length);
+  put_bytes(journal, varname, length);
+  put_value(journal, value);
+
+  end_record(journal, start);
+}
+
+void journal_write_by_addr(struct RAM_JOURNAL* journal, int address, struct RAM_VALUE* value)
+{
+  int start = begin_record(journal, RAM_JOURNAL_WRITE_BY_ADDR);
+
+  put_varint(journal, address);
+  put_value(journal, value);
+
+  end_record(journal, start);
+}
+
+void journal_append(struct RAM_JOURNAL* journal, int address, struct RAM_VALUE* elem)
+{
+  int start = begin_record(journal, RAM_JOURNAL_APPEND);
+
+  put_varint(journal, address);
+  put_value(journal, elem);
+
+  end_record(journal, start);
+}
+
+void journal_append_str(struct RAM_JOURNAL* journal, int address, char* s, int length)
+{
+  int start = begin_record(journal, RAM_JOURNAL_APPEND);
+
+  put_varint(journal, address);
+  put_u8(journal, RAM_TYPE_STR);
+  put_varint(journal, length);
+  put_bytes(journal, s, length);
+
+  end_record(journal, start);
+}
+
+void journal_op(struct RAM_JOURNAL* journal, int op)
+{
+  end_record(journal, begin_record(journal, op));
+}
+
+bool journal_close(struct RAM_JOURNAL* journal)
+{
+  bool success = sync_journal(journal) && !journal->failed;
+
+  if (close(journal->fd) != 0) {
+    success = false;
+  }
+
+  free(journal->buffer);
+  free(journal);
+
+  return success;
+}
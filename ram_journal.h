@@ -0,0 +1,123 @@
+/*ram_journal.h*/
+
+/**
+  * @brief Write-ahead journal for nuPython's memory unit
+  *
+  * A journaled memory appends a compact binary record of every
+  * change (writes, appends, transactions, resets) to a file, so that its
+  * state survives a crash: the next ram_init_journaled on the same
+  * file replays the records to rebuild memory. How often the file
+  * is forced to disk (fsync) is configurable, trading durability
+  * for speed.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+//
+// When to force journal records to disk. A group of records is
+// synced once either limit is reached (0 => that limit is off);
+// with both off, records are only synced by ram_journal_sync and
+// ram_destroy, and otherwise reach the file when the buffer fills.
+//
+struct RAM_JOURNAL_CONFIG
+{
+  int sync_every_records;  // fsync after this many records, 0 => never
+  int sync_every_ms;       // fsync once this many ms have passed (checked as
+                           // each record is written), 0 => never
+};
+
+struct RAM_JOURNAL_STATS
+{
+  long long records;   // # of records written since the journal was opened
+  long long bytes;     // # of bytes written since the journal was opened
+  long long syncs;     // # of fsync calls
+  long long replayed;  // # of records replayed when the journal was opened
+};
+
+
+/**
+  * @brief ram_init_journaled: initialize memory unit backed by a journal
+  *
+  * Like ram_init, but if the given journal file exists its records
+  * are replayed first, rebuilding memory as of the last record that
+  * made it to disk. Transactions left open by a crash are rolled
+  * back, and a torn record at the end of the file is discarded.
+  * From then on every change to memory is appended to the file.
+  * Returns NULL if the file cannot be opened, or there is not
+  * enough memory to replay it (the file is then left as it was).
+  * Call ram_destroy() when done, which syncs and closes the
+  * journal, or ram_journal_close() to find out whether every
+  * record made it to disk.
+  *
+  * NOTE: changes made directly through a pointer returned by
+  * ram_borrow_array_by_addr (e.g. ram_array_scale) are not journaled.
+  *
+  * @param path journal file
+  * @param config when to force records to disk
+  * @return pointer to struct denoting memory unit, or NULL
+  */
+struct RAM* ram_init_journaled(char* path, struct RAM_JOURNAL_CONFIG config);
+
+/**
+  * @brief ram_journal_sync: forces all journal records to disk
+  *
+  * A failure is sticky: once a write or fsync of the journal has
+  * failed (here or as records were written), every later call
+  * returns false, since records may have been lost.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if not journaled or a write failed
+  */
+bool ram_journal_sync(struct RAM* memory);
+
+/**
+  * @brief ram_journal_close: syncs and closes memory's journal
+  *
+  * Memory stays as it is, but is no longer journaled. Like
+  * ram_journal_sync, reports any write or fsync of the journal
+  * that has failed since it was opened.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if every record made it to disk, false if not
+  *         journaled or a write failed
+  */
+bool ram_journal_close(struct RAM* memory);
+
+/**
+  * @brief ram_journal_stats: statistics about memory's journal
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return journal statistics, all 0 if memory is not journaled
+  */
+struct RAM_JOURNAL_STATS ram_journal_stats(struct RAM* memory);
+
+
+//
+// Called by ram.c after each successful change to a journaled
+// memory; not meant to be called directly:
+//
+enum RAM_JOURNAL_OPS
+{
+  RAM_JOURNAL_WRITE_BY_NAME = 1,
+  RAM_JOURNAL_WRITE_BY_ADDR,
+  RAM_JOURNAL_APPEND,
+  RAM_JOURNAL_TXN_BEGIN,
+  RAM_JOURNAL_TXN_COMMIT,
+  RAM_JOURNAL_TXN_ROLLBACK,
+  RAM_JOURNAL_RESET
+};
+
+void journal_write_by_name(struct RAM_JOURNAL* journal, char* varname, struct RAM_VALUE* value);
+void journal_write_by_addr(struct RAM_JOURNAL* journal, int address, struct RAM_VALUE* value);
+void journal_append(struct RAM_JOURNAL* journal, int address, struct RAM_VALUE* elem);
+void journal_append_str(struct RAM_JOURNAL* journal, int address, char* s, int length);
+void journal_op(struct RAM_JOURNAL* journal, int op);
+bool journal_close(struct RAM_JOURNAL* journal);
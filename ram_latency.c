@@ -0,0 +1,313 @@
+/*ram_latency.c*/
+
+/**
+  * @brief Latency histograms for nuPython's memory unit
+  *
+  * Each thread's histograms are a thread-local struct RAM_LATENCY,
+  * so recording a call is a few adds to memory no other thread
+  * touches. Durations are in ticks of latency_ticks (cycles on x86
+  * and ARM), converted to ns only when percentiles are computed.
+  *
+  * Bucket b < 4 counts durations of exactly b ticks. Above that,
+  * each power of 2 [2^m, 2^(m+1)) is split into 4 equal buckets by
+  * the 2 bits after the leading 1: bucket 4*(m-1) + those bits.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ram_latency.h"
+
+
+bool latency_on = false;
+
+static __thread struct RAM_LATENCY local;
+
+static pthread_once_t calibrate_once = PTHREAD_ONCE_INIT;
+static double ns_per_tick = 1.0;
+
+static char* op_names[RAM_LATENCY_NUM_OPS] = {
+  "get_addr",
+  "get_addrs",
+  "read_by_addr",
+  "read_by_name",
+  "write_by_addr",
+  "write_by_name",
+  "write_array",
+  "bulk_load",
+  "append",
+  "free_value",
+  "txn_begin",
+  "txn_commit",
+  "txn_rollback",
+  "init",
+  "destroy",
+  "reset",
+  "resize",
+  "checkpoint",
+};
+
+
+/**
+ * @brief now_ns: current time in nanoseconds
+ *
+ * @return nanoseconds since an arbitrary fixed point
+ */
+static long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief calibrate: measures ns_per_tick over about 10 ms
+ */
+static void calibrate(void)
+{
+  long long start_ns = now_ns();
+  unsigned long long start_ticks = latency_ticks();
+  long long end_ns;
+
+  do {
+    end_ns = now_ns();
+  } while (end_ns - start_ns < 10000000);
+
+  unsigned long long ticks = latency_ticks() - start_ticks;
+
+  if (ticks > 0) {
+    ns_per_tick = (double) (end_ns - start_ns) / (double) ticks;
+  }
+}
+
+/**
+ * @brief bucket_of: the bucket that counts a duration
+ *
+ * @param ticks Duration
+ * @return bucket, 0..RAM_LATENCY_BUCKETS-1
+ */
+static int bucket_of(unsigned long long ticks)
+{
+  if (ticks < 4) {
+    return (int) ticks;
+  }
+
+  int m = 63 - __builtin_clzll(ticks);
+
+  return 4 * (m - 1) + (int) ((ticks >> (m - 2)) & 3);
+}
+
+/**
+ * @brief bucket_high: longest duration counted by a bucket
+ *
+ * @param b Bucket
+ * @return duration in ticks
+ */
+static unsigned long long bucket_high(int b)
+{
+  if (b < 3) {
+    return b;
+  }
+
+  int next = b + 1;
+  int m = next / 4 + 1;
+
+  if (m > 63) {
+    return ~0ULL;
+  }
+
+  return ((unsigned long long) (4 + next % 4) << (m - 2)) - 1;
+}
+
+
+/**
+ * @brief latency_record: counts one call of a timed function
+ *
+ * Called by ram.c; not meant to be called directly.
+ *
+ * @param op enum RAM_LATENCY_OPS
+ * @param ticks Duration of the call
+ */
+void latency_record(int op, unsigned long long ticks)
+{
+  struct RAM_LATENCY_HIST* hist = &local.ops[op];
+
+  hist->count++;
+  hist->total += (long long) ticks;
+
+  if ((long long) ticks > hist->max) {
+    hist->max = (long long) ticks;
+  }
+
+  hist->buckets[bucket_of(ticks)]++;
+}
+
+
+/**
+  * @brief ram_latency_enable: turns timing on or off, for every thread
+  *
+  * Off by default; when off, each public function pays one
+  * predictable branch. The first call measures the cycle counter
+  * against the clock (about 10 ms), so ticks can be shown as ns.
+  *
+  * @param on true to start timing, false to stop
+  * @return void
+  */
+void ram_latency_enable(bool on)
+{
+  pthread_once(&calibrate_once, calibrate);
+
+  __atomic_store_n(&latency_on, on, __ATOMIC_RELAXED);
+}
+
+
+/**
+  * @brief ram_latency_snapshot: copies the calling thread's histograms
+  *
+  * @param snapshot set to the histograms of the calls made by this thread
+  * @return void
+  */
+void ram_latency_snapshot(struct RAM_LATENCY* snapshot)
+{
+  *snapshot = local;
+}
+
+
+/**
+  * @brief ram_latency_clear: empties the calling thread's histograms
+  *
+  * @return void
+  */
+void ram_latency_clear(void)
+{
+  memset(&local, 0, sizeof(local));
+}
+
+
+/**
+  * @brief ram_latency_merge: adds one set of histograms into another
+  *
+  * e.g. to combine snapshots taken on several threads.
+  *
+  * @param into histograms to add to
+  * @param from histograms to add
+  * @return void
+  */
+void ram_latency_merge(struct RAM_LATENCY* into, struct RAM_LATENCY* from)
+{
+  for (int op = 0; op < RAM_LATENCY_NUM_OPS; op++) {
+    struct RAM_LATENCY_HIST* a = &into->ops[op];
+    struct RAM_LATENCY_HIST* b = &from->ops[op];
+
+    a->count += b->count;
+    a->total += b->total;
+
+    if (b->max > a->max) {
+      a->max = b->max;
+    }
+
+    for (int i = 0; i < RAM_LATENCY_BUCKETS; i++) {
+      a->buckets[i] += b->buckets[i];
+    }
+  }
+}
+
+
+/**
+  * @brief ram_latency_percentile: latency below which p% of calls fall
+  *
+  * @param hist histogram of one function
+  * @param p percentile, 0..100
+  * @return latency in ns (the upper bound of the bucket the percentile
+  *   falls in, capped at the slowest call), 0 if there were no calls
+  */
+double ram_latency_percentile(struct RAM_LATENCY_HIST* hist, double p)
+{
+  if (hist->count == 0) {
+    return 0.0;
+  }
+
+  pthread_once(&calibrate_once, calibrate);
+
+  long long rank = (long long) ceil(p / 100.0 * (double) hist->count);
+
+  if (rank < 1) {
+    rank = 1;
+  }
+
+  long long seen = 0;
+  int b = 0;
+
+  for (b = 0; b < RAM_LATENCY_BUCKETS - 1; b++) {
+    seen += hist->buckets[b];
+
+    if (seen >= rank) {
+      break;
+    }
+  }
+
+  unsigned long long ticks = bucket_high(b);
+
+  if (ticks > (unsigned long long) hist->max) {
+    ticks = (unsigned long long) hist->max;
+  }
+
+  return (double) ticks * ns_per_tick;
+}
+
+
+/**
+  * @brief ram_latency_op_name: name of a timed function
+  *
+  * @param op enum RAM_LATENCY_OPS
+  * @return name, e.g. "write_by_name"
+  */
+char* ram_latency_op_name(int op)
+{
+  if (op < 0 || op >= RAM_LATENCY_NUM_OPS) {
+    return (char*) "?";
+  }
+
+  return op_names[op];
+}
+
+
+/**
+  * @brief ram_latency_print: prints a table of percentiles to the console
+  *
+  * One line per function that was called: # of calls, mean, p50,
+  * p90, p99, p99.9 and max, in ns.
+  *
+  * @param snapshot histograms to print
+  * @return void
+  */
+void ram_latency_print(struct RAM_LATENCY* snapshot)
+{
+  pthread_once(&calibrate_once, calibrate);
+
+  printf("%-14s %10s %9s %9s %9s %9s %9s %11s\n", "op", "calls", "mean", "p50", "p90", "p99", "p99.9", "max");
+
+  for (int op = 0; op < RAM_LATENCY_NUM_OPS; op++) {
+    struct RAM_LATENCY_HIST* hist = &snapshot->ops[op];
+
+    if (hist->count == 0) {
+      continue;
+    }
+
+    printf("%-14s %10lld %9.0f %9.0f %9.0f %9.0f %9.0f %11.0f\n", op_names[op], hist->count,
+           (double) hist->total / (double) hist->count * ns_per_tick,
+           ram_latency_percentile(hist, 50), ram_latency_percentile(hist, 90),
+           ram_latency_percentile(hist, 99), ram_latency_percentile(hist, 99.9),
+           (double) hist->max * ns_per_tick);
+  }
+}
@@ -0,0 +1,186 @@
+/*ram_latency.h*/
+
+/**
+  * @brief Latency histograms for nuPython's memory unit
+  *
+  * When enabled, every call to one of memory's public functions
+  * (lookups, reads, writes, appends, transactions, resets,
+  * checkpoints) is timed with the CPU's cycle counter and counted in
+  * a histogram for that function. Histograms are log-bucketed, with
+  * 4 buckets per power of 2, so percentiles are within 25% at any
+  * scale: a 20 ns lookup and a 200 ms realloc land in the same
+  * histogram. Each thread records into its own histograms, without
+  * locking; take a snapshot on each thread and merge them to see the
+  * whole program.
+  *
+  * The typed inline functions in ram.h (ram_read_int_by_addr etc.)
+  * are not timed, since timing would cost more than the call.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+
+//
+// The timed functions:
+//
+enum RAM_LATENCY_OPS
+{
+  RAM_LATENCY_GET_ADDR = 0,       // ram_get_addr, ram_get_addr_n
+  RAM_LATENCY_GET_ADDRS,          // ram_get_addrs
+  RAM_LATENCY_READ_BY_ADDR,       // ram_read_cell_by_addr
+  RAM_LATENCY_READ_BY_NAME,       // ram_read_cell_by_name
+  RAM_LATENCY_WRITE_BY_ADDR,      // ram_write_cell_by_addr, ram_write_str_by_addr
+  RAM_LATENCY_WRITE_BY_NAME,      // ram_write_cell_by_name, ram_write_str_by_name
+  RAM_LATENCY_WRITE_ARRAY,        // ram_write_array_by_addr/_by_name
+  RAM_LATENCY_BULK_LOAD,          // ram_bulk_load, ram_declare
+  RAM_LATENCY_APPEND,             // ram_array_append_int/real_by_addr
+  RAM_LATENCY_FREE_VALUE,         // ram_free_value
+  RAM_LATENCY_TXN_BEGIN,          // ram_txn_begin
+  RAM_LATENCY_TXN_COMMIT,         // ram_txn_commit
+  RAM_LATENCY_TXN_ROLLBACK,       // ram_txn_rollback
+  RAM_LATENCY_INIT,               // ram_init
+  RAM_LATENCY_DESTROY,            // ram_destroy
+  RAM_LATENCY_RESET,              // ram_reset
+  RAM_LATENCY_RESIZE,             // ram_reserve, ram_trim
+  RAM_LATENCY_CHECKPOINT,         // ram_checkpoint_full/_delta, ram_snapshot_async
+  RAM_LATENCY_NUM_OPS
+};
+
+#define RAM_LATENCY_BUCKETS 256  // 4 per power of 2, enough for 64-bit tick counts
+
+struct RAM_LATENCY_HIST
+{
+  long long count;                         // # of calls
+  long long total;                         // sum of their ticks
+  long long max;                           // slowest call, in ticks
+  long long buckets[RAM_LATENCY_BUCKETS];  // # of calls by duration, see ram_latency.c
+};
+
+//
+// Histograms for every timed function:
+//
+struct RAM_LATENCY
+{
+  struct RAM_LATENCY_HIST ops[RAM_LATENCY_NUM_OPS];
+};
+
+
+/**
+  * @brief ram_latency_enable: turns timing on or off, for every thread
+  *
+  * Off by default; when off, each public function pays one
+  * predictable branch. The first call measures the cycle counter
+  * against the clock (about 10 ms), so ticks can be shown as ns.
+  *
+  * @param on true to start timing, false to stop
+  * @return void
+  */
+void ram_latency_enable(bool on);
+
+/**
+  * @brief ram_latency_snapshot: copies the calling thread's histograms
+  *
+  * @param snapshot set to the histograms of the calls made by this thread
+  * @return void
+  */
+void ram_latency_snapshot(struct RAM_LATENCY* snapshot);
+
+/**
+  * @brief ram_latency_clear: empties the calling thread's histograms
+  *
+  * @return void
+  */
+void ram_latency_clear(void);
+
+/**
+  * @brief ram_latency_merge: adds one set of histograms into another
+  *
+  * e.g. to combine snapshots taken on several threads.
+  *
+  * @param into histograms to add to
+  * @param from histograms to add
+  * @return void
+  */
+void ram_latency_merge(struct RAM_LATENCY* into, struct RAM_LATENCY* from);
+
+/**
+  * @brief ram_latency_percentile: latency below which p% of calls fall
+  *
+  * @param hist histogram of one function
+  * @param p percentile, 0..100
+  * @return latency in ns (the upper bound of the bucket the percentile
+  *   falls in, capped at the slowest call), 0 if there were no calls
+  */
+double ram_latency_percentile(struct RAM_LATENCY_HIST* hist, double p);
+
+/**
+  * @brief ram_latency_op_name: name of a timed function
+  *
+  * @param op enum RAM_LATENCY_OPS
+  * @return name, e.g. "write_by_name"
+  */
+char* ram_latency_op_name(int op);
+
+/**
+  * @brief ram_latency_print: prints a table of percentiles to the console
+  *
+  * One line per function that was called: # of calls, mean, p50,
+  * p90, p99, p99.9 and max, in ns.
+  *
+  * @param snapshot histograms to print
+  * @return void
+  */
+void ram_latency_print(struct RAM_LATENCY* snapshot);
+
+
+//
+// Used by ram.c to time its functions; not meant to be called
+// directly. latency_on is read with a relaxed atomic load, so a
+// thread may time a few calls more or less after it changes.
+//
+extern bool latency_on;
+
+void latency_record(int op, unsigned long long ticks);
+
+/**
+  * @brief latency_ticks: the CPU's cycle counter, or ns where there is none
+  */
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <x86intrin.h>
+
+static inline unsigned long long latency_ticks(void)
+{
+  return __rdtsc();
+}
+
+#elif defined(__aarch64__)
+
+static inline unsigned long long latency_ticks(void)
+{
+  unsigned long long ticks;
+
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+
+  return ticks;
+}
+
+#else
+
+#include <time.h>
+
+static inline unsigned long long latency_ticks(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
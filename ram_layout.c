@@ -0,0 +1,397 @@
+/*ram_layout.c*/
+
+/**
+  * @brief Hot/cold cell layout for nuPython's memory unit
+  *
+  * Sampling keeps one count per cell, grown as cells are touched.
+  * The gap until the next sample is random (1 to 2*period - 1
+  * accesses), so a loop over a few variables can't line up with it
+  * and always sample the same one.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <limits.h>  // INT_MAX, UINT_MAX
+
+#include "ram.h"
+#include "ram_layout.h"
+
+#define LAYOUT_DEFAULT_PERIOD 64
+#define LAYOUT_MIN_COUNTS     1024  // cells counted at first
+#define LAYOUT_CELLS_PER_LINE 4     // 64-byte cache line / 16-byte cell
+
+struct RAM_LAYOUT
+{
+  unsigned int* counts;  // # of samples of each cell, NULL => none yet
+  int num_counts;        // # of cells counts has room for
+  int period;            // mean # of accesses between samples
+  int countdown;         // # of accesses until the next sample
+  unsigned int random;   // xorshift state, for the gaps between samples
+  long long samples;     // # of accesses sampled
+};
+
+//
+// A cell and its count, for sorting:
+//
+struct LAYOUT_ENTRY
+{
+  unsigned int count;
+  int cell;
+};
+
+
+/**
+ * @brief next_gap: # of accesses until the next sample
+ *
+ * @param layout Pointer to the layout
+ * @return 1 to 2*period - 1, period on average
+ */
+static int next_gap(struct RAM_LAYOUT* layout)
+{
+  unsigned int x = layout->random;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  layout->random = x;
+
+  return 1 + (int) (x % (unsigned int) (2 * layout->period - 1));
+}
+
+/**
+ * @brief grow: makes room to count the given cell
+ *
+ * @param layout Pointer to the layout
+ * @param cell cell # (>= layout->num_counts)
+ * @return true if successful, false if out of memory
+ */
+static bool grow(struct RAM_LAYOUT* layout, int cell)
+{
+  long long n = (layout->num_counts > 0) ? layout->num_counts : LAYOUT_MIN_COUNTS;
+
+  while (n <= cell) {
+    n *= 2;
+  }
+
+  if (n > INT_MAX) {
+    n = INT_MAX;
+  }
+
+  unsigned int* counts = (unsigned int*) realloc(layout->counts, (size_t) n * sizeof(unsigned int));
+
+  if (counts == NULL) {
+    return false;
+  }
+
+  memset(counts + layout->num_counts, 0, (size_t) (n - layout->num_counts) * sizeof(unsigned int));
+
+  layout->counts = counts;
+  layout->num_counts = (int) n;
+
+  return true;
+}
+
+/**
+ * @brief count_of: # of samples of a cell
+ *
+ * @param layout Pointer to the layout
+ * @param cell cell #
+ * @return the count, 0 if the cell was never counted
+ */
+static unsigned int count_of(struct RAM_LAYOUT* layout, int cell)
+{
+  return (cell < layout->num_counts) ? layout->counts[cell] : 0;
+}
+
+/**
+ * @brief compare_entries: qsort order of cells, most samples first
+ *
+ * Cells with the same count stay in address order.
+ *
+ * @param a Pointer to a struct LAYOUT_ENTRY
+ * @param b Pointer to another
+ * @return < 0 if a goes first, > 0 if b does
+ */
+static int compare_entries(const void* a, const void* b)
+{
+  const struct LAYOUT_ENTRY* x = (const struct LAYOUT_ENTRY*) a;
+  const struct LAYOUT_ENTRY* y = (const struct LAYOUT_ENTRY*) b;
+
+  if (x->count != y->count) {
+    return (x->count > y->count) ? -1 : 1;
+  }
+
+  return (x->cell > y->cell) - (x->cell < y->cell);
+}
+
+/**
+ * @brief sorted_entries: memory's cells, most samples first
+ *
+ * @param layout Pointer to the layout
+ * @param size # of cells
+ * @return array of size entries to be freed, or NULL if out of memory
+ */
+static struct LAYOUT_ENTRY* sorted_entries(struct RAM_LAYOUT* layout, int size)
+{
+  struct LAYOUT_ENTRY* entries = (struct LAYOUT_ENTRY*) malloc((size_t) size * sizeof(struct LAYOUT_ENTRY) + 1);
+
+  if (entries == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < size; i++) {
+    entries[i].count = count_of(layout, i);
+    entries[i].cell = i;
+  }
+
+  qsort(entries, size, sizeof(struct LAYOUT_ENTRY), compare_entries);
+
+  return entries;
+}
+
+
+/**
+  * @brief ram_layout_sample_start: starts counting accesses to each cell
+  *
+  * Sampling lasts until ram_layout_sample_stop, ram_destroy or
+  * ram_reset (which forgets the counts). While it is on, every read
+  * and write makes a call, and 1 in every period of them counts;
+  * like a trace, it sends the typed inline writes down their slower
+  * path.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param period sample about 1 of this many accesses, <= 0 => default (64)
+  * @return true if successful, false if already sampling or out of memory
+  */
+bool ram_layout_sample_start(struct RAM* memory, int period)
+{
+  if (memory->layout != NULL) {
+    return false;
+  }
+
+  struct RAM_LAYOUT* layout = (struct RAM_LAYOUT*) malloc(sizeof(struct RAM_LAYOUT));
+
+  if (layout == NULL) {
+    return false;
+  }
+
+  layout->counts = NULL;
+  layout->num_counts = 0;
+  layout->period = (period > 0 && period <= INT_MAX / 2) ? period : LAYOUT_DEFAULT_PERIOD;
+  layout->random = 2463534242u;
+  layout->countdown = next_gap(layout);
+  layout->samples = 0;
+
+  memory->layout = layout;
+  memory->observed = true;
+
+  return true;
+}
+
+
+/**
+  * @brief ram_layout_sample_stop: stops sampling and forgets the counts
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if not sampling
+  */
+bool ram_layout_sample_stop(struct RAM* memory)
+{
+  if (memory->layout == NULL) {
+    return false;
+  }
+
+  layout_close(memory->layout);
+  memory->layout = NULL;
+  memory->observed = (memory->trace != NULL);
+
+  return true;
+}
+
+
+/**
+  * @brief ram_layout_report: how skewed the accesses sampled so far are
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return the report, all 0 if not sampling
+  */
+struct RAM_LAYOUT_REPORT ram_layout_report(struct RAM* memory)
+{
+  struct RAM_LAYOUT_REPORT report;
+  struct RAM_LAYOUT* layout = memory->layout;
+  int size = memory->size;
+
+  memset(&report, 0, sizeof(report));
+
+  if (layout == NULL) {
+    return report;
+  }
+
+  report.samples = layout->samples;
+  report.cells = size;
+
+  struct LAYOUT_ENTRY* entries = sorted_entries(layout, size);
+  unsigned char* lines = (unsigned char*) calloc(size / LAYOUT_CELLS_PER_LINE + 1, 1);
+
+  if (entries == NULL || lines == NULL) {
+    free(entries);
+    free(lines);
+    return report;
+  }
+
+  long long total = 0;
+
+  for (int i = 0; i < size && entries[i].count > 0; i++) {
+    total += entries[i].count;
+    report.touched++;
+  }
+
+  long long sum = 0;
+
+  for (int i = 0; i < report.touched; i++) {
+    if (sum * 2 < total) {
+      report.cells_for_50++;
+    }
+
+    if (sum * 10 < total * 9) {
+      report.cells_for_90++;
+
+      int line = entries[i].cell / LAYOUT_CELLS_PER_LINE;
+
+      if (!lines[line]) {
+        lines[line] = 1;
+        report.lines_for_90++;
+      }
+    }
+
+    if (sum * 100 < total * 99) {
+      report.cells_for_99++;
+    }
+
+    sum += entries[i].count;
+  }
+
+  for (int d = 0; d < RAM_LAYOUT_DECILES && total > 0; d++) {
+    long long first = (long long) size * d / RAM_LAYOUT_DECILES;
+    long long last = (long long) size * (d + 1) / RAM_LAYOUT_DECILES;
+    long long share = 0;
+
+    for (long long i = first; i < last; i++) {
+      share += entries[i].count;
+    }
+
+    report.deciles[d] = (double) share / total;
+  }
+
+  free(entries);
+  free(lines);
+
+  return report;
+}
+
+
+//
+// Called by ram.c:
+//
+
+void layout_touch(struct RAM_LAYOUT* layout, int address)
+{
+  layout->countdown--;
+
+  if (layout->countdown > 0) {
+    return;
+  }
+
+  layout->countdown = next_gap(layout);
+
+  if (address < 0 || (address >= layout->num_counts && !grow(layout, address))) {
+    return;
+  }
+
+  if (layout->counts[address] < UINT_MAX) {
+    layout->counts[address]++;
+  }
+
+  layout->samples++;
+}
+
+void layout_hot_order(struct RAM_LAYOUT* layout, int size, int* order)
+{
+  struct LAYOUT_ENTRY* entries = sorted_entries(layout, size);
+
+  //
+  // out of memory: leave every cell where it is:
+  //
+  if (entries == NULL) {
+    for (int i = 0; i < size; i++) {
+      order[i] = i;
+    }
+    return;
+  }
+
+  //
+  // the cells sampled, hottest first, then the rest in address order:
+  //
+  int hot = 0;
+
+  while (hot < size && entries[hot].count > 0) {
+    order[hot] = entries[hot].cell;
+    hot++;
+  }
+
+  int next = hot;
+
+  for (int i = 0; i < size; i++) {
+    if (count_of(layout, i) == 0) {
+      order[next] = i;
+      next++;
+    }
+  }
+
+  free(entries);
+}
+
+void layout_moved(struct RAM_LAYOUT* layout, int* order, int size)
+{
+  if (layout->counts == NULL) {
+    return;
+  }
+
+  unsigned int* counts = (unsigned int*) calloc(layout->num_counts + 1, sizeof(unsigned int));
+
+  //
+  // out of memory: start counting again:
+  //
+  if (counts == NULL) {
+    memset(layout->counts, 0, (size_t) layout->num_counts * sizeof(unsigned int));
+    layout->samples = 0;
+    return;
+  }
+
+  for (int i = 0; i < size && i < layout->num_counts; i++) {
+    counts[i] = count_of(layout, order[i]);
+  }
+
+  free(layout->counts);
+  layout->counts = counts;
+}
+
+void layout_reset(struct RAM_LAYOUT* layout)
+{
+  free(layout->counts);
+
+  layout->counts = NULL;
+  layout->num_counts = 0;
+  layout->samples = 0;
+}
+
+void layout_close(struct RAM_LAYOUT* layout)
+{
+  free(layout->counts);
+  free(layout);
+}
@@ -0,0 +1,93 @@
+/*ram_layout.h*/
+
+/**
+  * @brief Hot/cold cell layout for nuPython's memory unit
+  *
+  * Cells are in the order their variables were created, so in a big
+  * namespace the few variables that get nearly all the accesses are
+  * usually spread over as many cache lines as there are of them.
+  * While sampling is on, memory counts a random 1 in every N reads
+  * and writes of each cell; ram_renumber_hot_first (see ram.h) then
+  * moves the cells that were sampled to the front, hottest first,
+  * so they share cache lines (4 cells to a 64-byte line), and
+  * ram_layout_report describes how skewed the accesses were.
+  *
+  * Moving cells changes their addresses, which otherwise never
+  * change, so it is only done when ram_renumber_hot_first is
+  * called. A variable's name still leads to its cell (the map is
+  * the indirection), so lookups by name cost the same as before,
+  * and reads and writes by address still cost a shift and a mask;
+  * callers that keep addresses refresh them once, from
+  * memory->epoch or the table ram_renumber_hot_first fills in.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+#define RAM_LAYOUT_DECILES 10
+
+struct RAM_LAYOUT_REPORT
+{
+  long long samples;   // # of accesses sampled
+  int cells;           // # of cells in memory
+  int touched;         // # of cells sampled at least once
+  int cells_for_50;    // fewest cells that got 50% of the samples
+  int cells_for_90;    // ... 90%
+  int cells_for_99;    // ... 99%
+  int lines_for_90;    // # of 64-byte lines those 90% cells are spread over
+  double deciles[RAM_LAYOUT_DECILES];  // share of the samples that went to each
+                                       // tenth of the cells, hottest tenth first
+};
+
+
+/**
+  * @brief ram_layout_sample_start: starts counting accesses to each cell
+  *
+  * Sampling lasts until ram_layout_sample_stop, ram_destroy or
+  * ram_reset (which forgets the counts). While it is on, every read
+  * and write makes a call, and 1 in every period of them counts;
+  * like a trace, it sends the typed inline writes down their slower
+  * path.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param period sample about 1 of this many accesses, <= 0 => default (64)
+  * @return true if successful, false if already sampling or out of memory
+  */
+bool ram_layout_sample_start(struct RAM* memory, int period);
+
+/**
+  * @brief ram_layout_sample_stop: stops sampling and forgets the counts
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if not sampling
+  */
+bool ram_layout_sample_stop(struct RAM* memory);
+
+/**
+  * @brief ram_layout_report: how skewed the accesses sampled so far are
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return the report, all 0 if not sampling
+  */
+struct RAM_LAYOUT_REPORT ram_layout_report(struct RAM* memory);
+
+
+//
+// Called by ram.c when memory->layout != NULL; not meant to be
+// called directly. layout_touch is told of each read or write of a
+// cell; layout_hot_order fills order[new address] = old address for
+// memory's first size cells, and layout_moved is told once they
+// have been moved:
+//
+void layout_touch(struct RAM_LAYOUT* layout, int address);
+void layout_hot_order(struct RAM_LAYOUT* layout, int size, int* order);
+void layout_moved(struct RAM_LAYOUT* layout, int* order, int size);
+void layout_reset(struct RAM_LAYOUT* layout);
+void layout_close(struct RAM_LAYOUT* layout);
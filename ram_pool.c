@@ -0,0 +1,223 @@
+/*ram_pool.c*/
+
+/**
+  * @brief Pool of reusable memory units for nuPython
+  *
+  * Idle memory units are kept on a stack protected by a mutex;
+  * the mutex is only held to push or pop, never while memory is
+  * being reset, trimmed, created or destroyed.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <pthread.h>
+
+#include "ram.h"
+#include "ram_pool.h"
+
+struct RAM_POOL
+{
+  pthread_mutex_t lock;           // protects everything below
+  struct RAM_POOL_CONFIG config;
+  struct RAM** idle;              // stack of idle memory units
+  int num_idle;                   // # of units on the stack
+  struct RAM_POOL_STATS stats;
+};
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_pool_create: creates a pool of memory units
+  *
+  * Creates the pool and config.prewarm memory units, each with
+  * room for config.warm_capacity variables. You take ownership of
+  * the pool and must call ram_pool_destroy() when you are done.
+  * Returns NULL if out of memory; if only some of the prewarmed
+  * units can be created, the pool starts with those.
+  *
+  * @param config pool settings
+  * @return pointer to the pool, or NULL if out of memory
+  */
+struct RAM_POOL* ram_pool_create(struct RAM_POOL_CONFIG config)
+{
+  if (config.max_idle < config.prewarm) {
+    config.max_idle = config.prewarm;
+  }
+
+  struct RAM_POOL* pool = (struct RAM_POOL*) malloc(sizeof(struct RAM_POOL));
+  struct RAM** idle = (struct RAM**) malloc((size_t) (config.max_idle > 0 ? config.max_idle : 1) * sizeof(struct RAM*));
+
+  if (pool == NULL || idle == NULL || pthread_mutex_init(&pool->lock, NULL) != 0) {
+    free(pool);
+    free(idle);
+    return NULL;
+  }
+
+  pool->config = config;
+  pool->idle = idle;
+  pool->num_idle = 0;
+
+  pool->stats.acquired = 0;
+  pool->stats.reused = 0;
+  pool->stats.released = 0;
+  pool->stats.trimmed = 0;
+  pool->stats.destroyed = 0;
+  pool->stats.idle = 0;
+
+  for (int i = 0; i < config.prewarm; i++) {
+    struct RAM* memory = ram_init();
+
+    if (memory == NULL) {
+      break;
+    }
+
+    ram_reserve(memory, config.warm_capacity);
+
+    pool->idle[pool->num_idle] = memory;
+    pool->num_idle++;
+  }
+
+  return pool;
+}
+
+
+/**
+  * @brief ram_pool_destroy: destroys a pool and its idle memory units
+  *
+  * Memory units still acquired from the pool are not affected;
+  * they can be freed with ram_destroy().
+  *
+  * @param pool Pointer to the pool
+  * @return void
+  */
+void ram_pool_destroy(struct RAM_POOL* pool)
+{
+  if (pool == NULL) {
+    return;
+  }
+
+  for (int i = 0; i < pool->num_idle; i++) {
+    ram_destroy(pool->idle[i]);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+
+  free(pool->idle);
+  free(pool);
+}
+
+
+/**
+  * @brief ram_pool_acquire: takes an empty memory unit from the pool
+  *
+  * Returns an idle memory unit if there is one, otherwise a new
+  * one from ram_init. Either way it is empty and has no budget.
+  * Give it back with ram_pool_release (or free it with ram_destroy).
+  *
+  * @param pool Pointer to the pool
+  * @return pointer to struct denoting memory unit, or NULL if out of memory
+  */
+struct RAM* ram_pool_acquire(struct RAM_POOL* pool)
+{
+  struct RAM* memory = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+
+  pool->stats.acquired++;
+
+  if (pool->num_idle > 0) {
+    pool->num_idle--;
+    memory = pool->idle[pool->num_idle];
+    pool->stats.reused++;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  if (memory == NULL) {
+    memory = ram_init();
+  }
+
+  return memory;
+}
+
+
+/**
+  * @brief ram_pool_release: gives a memory unit back to the pool
+  *
+  * Clears the memory with ram_reset, trims it if it grew beyond
+  * config.max_capacity, and keeps it for reuse, unless the pool
+  * already holds config.max_idle units, in which case it is
+  * destroyed. Memory with something attached that ram_reset keeps
+  * (a journal, trace, heap or layout sampling) is destroyed too,
+  * so every unit acquired from the pool starts out plain. The
+  * memory must not be used after this call.
+  *
+  * @param pool Pointer to the pool
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_pool_release(struct RAM_POOL* pool, struct RAM* memory)
+{
+  bool keep = (memory->journal == NULL && memory->trace == NULL && 
+               memory->heap == NULL && memory->layout == NULL);
+  bool trimmed = false;
+
+  if (keep) {
+    ram_reset(memory);
+    ram_set_memory_budget(memory, 0);
+
+    if (pool->config.max_capacity > 0 && ram_capacity(memory) > pool->config.max_capacity) {
+      ram_trim(memory, pool->config.max_capacity);
+      trimmed = true;
+    }
+  }
+
+  pthread_mutex_lock(&pool->lock);
+
+  pool->stats.released++;
+
+  if (trimmed) {
+    pool->stats.trimmed++;
+  }
+
+  if (keep && pool->num_idle < pool->config.max_idle) {
+    pool->idle[pool->num_idle] = memory;
+    pool->num_idle++;
+    memory = NULL;
+  }
+  else {
+    pool->stats.destroyed++;
+  }
+
+  pthread_mutex_unlock(&pool->lock);
+
+  if (memory != NULL) {
+    ram_destroy(memory);
+  }
+}
+
+
+/**
+  * @brief ram_pool_stats: statistics about a pool
+  *
+  * @param pool Pointer to the pool
+  * @return pool statistics
+  */
+struct RAM_POOL_STATS ram_pool_stats(struct RAM_POOL* pool)
+{
+  pthread_mutex_lock(&pool->lock);
+
+  struct RAM_POOL_STATS stats = pool->stats;
+  stats.idle = pool->num_idle;
+
+  pthread_mutex_unlock(&pool->lock);
+
+  return stats;
+}
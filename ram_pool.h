@@ -0,0 +1,106 @@
+/*ram_pool.h*/
+
+/**
+  * @brief Pool of reusable memory units for nuPython
+  *
+  * A server that runs one script per request can take a memory
+  * unit from a pool instead of calling ram_init, and give it back
+  * instead of calling ram_destroy. Returned memory is cleared with
+  * ram_reset, so the next script reuses its already-grown cells
+  * and map instead of allocating them again. The pool is safe to
+  * use from multiple threads; a memory unit itself is not.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+struct RAM_POOL_CONFIG
+{
+  int prewarm;         // # of memory units created when the pool is
+  int warm_capacity;   // ... each with room for this many variables
+  int max_idle;        // max # of idle units kept; extra ones are destroyed
+  int max_capacity;    // units returned with a larger capacity are trimmed to it
+};
+
+struct RAM_POOL_STATS
+{
+  long long acquired;  // # of calls to ram_pool_acquire
+  long long reused;    // # of those that got an idle unit (vs. ram_init)
+  long long released;  // # of calls to ram_pool_release
+  long long trimmed;   // # of returned units that were trimmed
+  long long destroyed; // # of returned units destroyed (pool full, or with a
+                       // journal, trace, heap or layout sampling)
+  int       idle;      // # of units currently idle in the pool
+};
+
+struct RAM_POOL;  // opaque, see ram_pool.c
+
+
+/**
+  * @brief ram_pool_create: creates a pool of memory units
+  *
+  * Creates the pool and config.prewarm memory units, each with
+  * room for config.warm_capacity variables. You take ownership of
+  * the pool and must call ram_pool_destroy() when you are done.
+  * Returns NULL if out of memory; if only some of the prewarmed
+  * units can be created, the pool starts with those.
+  *
+  * @param config pool settings
+  * @return pointer to the pool, or NULL if out of memory
+  */
+struct RAM_POOL* ram_pool_create(struct RAM_POOL_CONFIG config);
+
+/**
+  * @brief ram_pool_destroy: destroys a pool and its idle memory units
+  *
+  * Memory units still acquired from the pool are not affected;
+  * they can be freed with ram_destroy().
+  *
+  * @param pool Pointer to the pool
+  * @return void
+  */
+void ram_pool_destroy(struct RAM_POOL* pool);
+
+/**
+  * @brief ram_pool_acquire: takes an empty memory unit from the pool
+  *
+  * Returns an idle memory unit if there is one, otherwise a new
+  * one from ram_init. Either way it is empty and has no budget.
+  * Give it back with ram_pool_release (or free it with ram_destroy).
+  *
+  * @param pool Pointer to the pool
+  * @return pointer to struct denoting memory unit, or NULL if out of memory
+  */
+struct RAM* ram_pool_acquire(struct RAM_POOL* pool);
+
+/**
+  * @brief ram_pool_release: gives a memory unit back to the pool
+  *
+  * Clears the memory with ram_reset, trims it if it grew beyond
+  * config.max_capacity, and keeps it for reuse, unless the pool
+  * already holds config.max_idle units, in which case it is
+  * destroyed. Memory with something attached that ram_reset keeps
+  * (a journal, trace, heap or layout sampling) is destroyed too,
+  * so every unit acquired from the pool starts out plain. The
+  * memory must not be used after this call.
+  *
+  * @param pool Pointer to the pool
+  * @param memory Pointer to struct denoting memory unit
+  * @return void
+  */
+void ram_pool_release(struct RAM_POOL* pool, struct RAM* memory);
+
+/**
+  * @brief ram_pool_stats: statistics about a pool
+  *
+  * @param pool Pointer to the pool
+  * @return pool statistics
+  */
+struct RAM_POOL_STATS ram_pool_stats(struct RAM_POOL* pool);
@@ -0,0 +1,184 @@
+/*ram_scope.c*/
+
+/**
+  * @brief Scope chains for nuPython's memory unit
+  *
+  * The chain is an array of memory units, outermost first, that
+  * grows by doubling like the cells of a memory unit.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+
+#include "ram.h"
+#include "ram_scope.h"
+
+struct RAM_SCOPE
+{
+  struct RAM** levels;  // memory unit of each scope, outermost first
+  int depth;            // # of scopes in use
+  int capacity;         // # of scopes allocated
+  struct RAM_SCOPE_STATS stats;
+};
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_scope_create: creates an empty scope chain
+  *
+  * You take ownership of the chain and must call ram_scope_destroy()
+  * when you are done.
+  *
+  * @return pointer to the scope chain
+  */
+struct RAM_SCOPE* ram_scope_create(void)
+{
+  struct RAM_SCOPE* scope = (struct RAM_SCOPE*) malloc(sizeof(struct RAM_SCOPE));
+
+  scope->capacity = 4;
+  scope->depth = 0;
+  scope->levels = (struct RAM**) malloc(scope->capacity * sizeof(struct RAM*));
+
+  scope->stats.lookups = 0;
+  scope->stats.probes = 0;
+  scope->stats.skipped = 0;
+
+  return scope;
+}
+
+
+/**
+  * @brief ram_scope_destroy: destroys a scope chain
+  *
+  * The memory units in the chain are not destroyed.
+  *
+  * @param scope Pointer to the scope chain
+  * @return void
+  */
+void ram_scope_destroy(struct RAM_SCOPE* scope)
+{
+  if (scope == NULL) {
+    return;
+  }
+
+  free(scope->levels);
+  free(scope);
+}
+
+
+/**
+  * @brief ram_scope_push: adds an innermost scope to the chain
+  *
+  * Push the outermost scope (e.g. builtins) first, and the local
+  * scope last. Enables memory's Bloom filter (see ram_bloom_enable).
+  * The chain does not take ownership of memory.
+  *
+  * @param scope Pointer to the scope chain
+  * @param memory memory unit holding the scope's variables
+  * @return void
+  */
+void ram_scope_push(struct RAM_SCOPE* scope, struct RAM* memory)
+{
+  if (scope->depth >= scope->capacity) {
+    scope->capacity *= 2;
+    scope->levels = (struct RAM**) realloc(scope->levels, scope->capacity * sizeof(struct RAM*));
+  }
+
+  ram_bloom_enable(memory);
+
+  scope->levels[scope->depth] = memory;
+  scope->depth++;
+}
+
+
+/**
+  * @brief ram_scope_pop: removes the innermost scope from the chain
+  *
+  * e.g. when a function returns.
+  *
+  * @param scope Pointer to the scope chain
+  * @return the memory unit removed, or NULL if the chain is empty
+  */
+struct RAM* ram_scope_pop(struct RAM_SCOPE* scope)
+{
+  if (scope->depth == 0) {
+    return NULL;
+  }
+
+  scope->depth--;
+
+  return scope->levels[scope->depth];
+}
+
+
+/**
+  * @brief ram_scope_depth: # of scopes in the chain
+  *
+  * @param scope Pointer to the scope chain
+  * @return # of scopes
+  */
+int ram_scope_depth(struct RAM_SCOPE* scope)
+{
+  return scope->depth;
+}
+
+
+/**
+  * @brief ram_scope_resolve: finds a variable in the innermost scope holding it
+  *
+  * Searches the scopes from innermost to outermost, and returns the
+  * first memory unit that contains the variable, along with the
+  * variable's address there. Returns NULL if no scope contains it.
+  *
+  * @param scope Pointer to the scope chain
+  * @param varname variable name
+  * @param address set to the variable's address, -1 if not found
+  * @return memory unit containing the variable, or NULL
+  */
+struct RAM* ram_scope_resolve(struct RAM_SCOPE* scope, char* varname, int* address)
+{
+  unsigned int hash = ram_name_hash(varname);
+
+  scope->stats.lookups++;
+
+  for (int level = scope->depth - 1; level >= 0; level--) {
+    struct RAM* memory = scope->levels[level];
+
+    if (!ram_may_contain(memory, hash)) {
+      scope->stats.skipped++;
+      continue;
+    }
+
+    scope->stats.probes++;
+
+    int addr = ram_get_addr(memory, varname);
+
+    if (addr != -1) {
+      *address = addr;
+      return memory;
+    }
+  }
+
+  *address = -1;
+
+  return NULL;
+}
+
+
+/**
+  * @brief ram_scope_stats: statistics about a scope chain's lookups
+  *
+  * @param scope Pointer to the scope chain
+  * @return lookup statistics
+  */
+struct RAM_SCOPE_STATS ram_scope_stats(struct RAM_SCOPE* scope)
+{
+  return scope->stats;
+}
@@ -0,0 +1,106 @@
+/*ram_scope.h*/
+
+/**
+  * @brief Scope chains for nuPython's memory unit
+  *
+  * Python looks a name up in the local scope, then each enclosing
+  * scope, then globals, then builtins. When each scope is its own
+  * memory unit, a scope chain links them and resolves a name in one
+  * call. Most probes of the outer scopes are misses, so every memory
+  * in a chain keeps a Bloom filter of its names (ram_bloom_enable);
+  * scopes that cannot contain the name are skipped without searching
+  * their map, and the name is hashed only once per lookup.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+struct RAM_SCOPE_STATS
+{
+  long long lookups;  // # of calls to ram_scope_resolve
+  long long probes;   // # of scopes whose map was searched
+  long long skipped;  // # of scopes ruled out by their Bloom filter
+};
+
+struct RAM_SCOPE;  // opaque, see ram_scope.c
+
+
+/**
+  * @brief ram_scope_create: creates an empty scope chain
+  *
+  * You take ownership of the chain and must call ram_scope_destroy()
+  * when you are done.
+  *
+  * @return pointer to the scope chain
+  */
+struct RAM_SCOPE* ram_scope_create(void);
+
+/**
+  * @brief ram_scope_destroy: destroys a scope chain
+  *
+  * The memory units in the chain are not destroyed.
+  *
+  * @param scope Pointer to the scope chain
+  * @return void
+  */
+void ram_scope_destroy(struct RAM_SCOPE* scope);
+
+/**
+  * @brief ram_scope_push: adds an innermost scope to the chain
+  *
+  * Push the outermost scope (e.g. builtins) first, and the local
+  * scope last. Enables memory's Bloom filter (see ram_bloom_enable).
+  * The chain does not take ownership of memory.
+  *
+  * @param scope Pointer to the scope chain
+  * @param memory memory unit holding the scope's variables
+  * @return void
+  */
+void ram_scope_push(struct RAM_SCOPE* scope, struct RAM* memory);
+
+/**
+  * @brief ram_scope_pop: removes the innermost scope from the chain
+  *
+  * e.g. when a function returns.
+  *
+  * @param scope Pointer to the scope chain
+  * @return the memory unit removed, or NULL if the chain is empty
+  */
+struct RAM* ram_scope_pop(struct RAM_SCOPE* scope);
+
+/**
+  * @brief ram_scope_depth: # of scopes in the chain
+  *
+  * @param scope Pointer to the scope chain
+  * @return # of scopes
+  */
+int ram_scope_depth(struct RAM_SCOPE* scope);
+
+/**
+  * @brief ram_scope_resolve: finds a variable in the innermost scope holding it
+  *
+  * Searches the scopes from innermost to outermost, and returns the
+  * first memory unit that contains the variable, along with the
+  * variable's address there. Returns NULL if no scope contains it.
+  *
+  * @param scope Pointer to the scope chain
+  * @param varname variable name
+  * @param address set to the variable's address, -1 if not found
+  * @return memory unit containing the variable, or NULL
+  */
+struct RAM* ram_scope_resolve(struct RAM_SCOPE* scope, char* varname, int* address);
+
+/**
+  * @brief ram_scope_stats: statistics about a scope chain's lookups
+  *
+  * @param scope Pointer to the scope chain
+  * @return lookup statistics
+  */
+struct RAM_SCOPE_STATS ram_scope_stats(struct RAM_SCOPE* scope);
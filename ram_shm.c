@@ -0,0 +1,733 @@
+/*ram_shm.c*/
+
+/**
+  * @brief Shared-memory images of nuPython's memory unit
+  *
+  * A namespace "/name" is a small control segment holding the
+  * generation of the latest image, plus one segment per image,
+  * "/name.<generation>". To publish, the writer builds the next
+  * image in a new segment, then stores its generation in the
+  * control segment (release) and unlinks the previous image's
+  * segment. Processes that still have the previous image mapped
+  * keep it until they unmap it, so it is never changed under a
+  * reader, and no locks are needed.
+  *
+  * An image is laid out as
+  *
+  *   struct SHM_IMAGE    header
+  *   struct SHM_MAP      map[size]    sorted by name, like memory->map
+  *   struct SHM_CELL     cells[size]
+  *   heap                names, strings, arrays
+  *
+  * where every reference is a byte offset from the start of the
+  * image. Strings keep their struct RAM_STR header (with the hash
+  * already computed, since the image is read-only), so a string's
+  * chars can be handed out as is.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ram.h"
+#include "ram_shm.h"
+
+#define SHM_CONTROL_MAGIC 0x434D4152  // "RAMC"
+#define SHM_IMAGE_MAGIC   0x534D4152  // "RAMS"
+#define SHM_VERSION       1
+#define SHM_ALIGN         16          // heap objects start on this boundary
+#define SHM_ATTACH_TRIES  100         // times to retry if an image is replaced while mapping it
+
+struct SHM_CONTROL
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long generation;  // latest image, 0 => none yet
+};
+
+struct SHM_IMAGE
+{
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long generation;
+  int size;                       // # of variables
+  int reserved;
+  long long bytes;                // size of the whole image
+};
+
+struct SHM_MAP
+{
+  long long name;                 // offset of the '\0'-terminated name
+  int cell;
+  int reserved;
+};
+
+struct SHM_CELL
+{
+  int value_type;                 // enum RAM_VALUE_TYPES
+  int reserved;
+  union
+  {
+    int i;                        // INT, PTR, BOOLEAN
+    double d;                     // REAL
+    long long offset;             // STR: offset of the chars; ARRAY: of the struct SHM_ARRAY
+  } types;
+};
+
+struct SHM_ARRAY
+{
+  int elem_type;                  // enum RAM_ARRAY_TYPES
+  int length;
+  long long reserved;             // elements follow, SHM_ALIGN aligned
+};
+
+struct RAM_SHM
+{
+  char* name;                     // control segment's name
+  bool writer;                    // created (and so publishes and removes) the namespace?
+  struct SHM_CONTROL* control;
+  struct SHM_IMAGE* image;        // mapped image, NULL => none yet
+  unsigned long long generation;  // its generation, 0 => none
+};
+
+
+/**
+ * @brief align: rounds a size up to SHM_ALIGN
+ */
+static long long align(long long bytes)
+{
+  return (bytes + SHM_ALIGN - 1) / SHM_ALIGN * SHM_ALIGN;
+}
+
+/**
+ * @brief image_name: name of the segment holding one generation's image
+ *
+ * @param shm Pointer to the namespace
+ * @param generation Generation of the image
+ * @return malloc'd name, e.g. "/globals.3", NULL if out of memory
+ */
+static char* image_name(struct RAM_SHM* shm, unsigned long long generation)
+{
+  int length = (int) strlen(shm->name) + 24;
+  char* name = (char*) malloc(length);
+
+  if (name == NULL) {
+    return NULL;
+  }
+
+  snprintf(name, length, "%s.%llu", shm->name, generation);
+
+  return name;
+}
+
+/**
+ * @brief map_image: maps one generation's image, read-only
+ *
+ * @param shm Pointer to the namespace
+ * @param generation Generation of the image
+ * @return pointer to the image, NULL if its segment is gone or invalid
+ */
+static struct SHM_IMAGE* map_image(struct RAM_SHM* shm, unsigned long long generation)
+{
+  char* name = image_name(shm, generation);
+
+  if (name == NULL) {
+    return NULL;
+  }
+
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  free(name);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat info;
+  void* p = MAP_FAILED;
+
+  if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(struct SHM_IMAGE)) {
+    p = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+
+  close(fd);
+
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  struct SHM_IMAGE* image = (struct SHM_IMAGE*) p;
+
+  if (image->magic != SHM_IMAGE_MAGIC || image->version != SHM_VERSION ||
+      image->generation != generation || image->bytes != (long long) info.st_size) {
+    munmap(p, info.st_size);
+    return NULL;
+  }
+
+  return image;
+}
+
+/**
+ * @brief unmap_image: unmaps the image shm has mapped, if any
+ *
+ * @param shm Pointer to the namespace
+ */
+static void unmap_image(struct RAM_SHM* shm)
+{
+  if (shm->image != NULL) {
+    munmap(shm->image, shm->image->bytes);
+  }
+
+  shm->image = NULL;
+  shm->generation = 0;
+}
+
+/**
+ * @brief map_latest: maps the latest image, if newer than the one mapped
+ *
+ * An image can be replaced (and its segment unlinked) between
+ * reading the generation and opening the segment, so this retries
+ * with the new generation.
+ *
+ * @param shm Pointer to the namespace
+ * @return true if a newer image was mapped
+ */
+static bool map_latest(struct RAM_SHM* shm)
+{
+  for (int tries = 0; tries < SHM_ATTACH_TRIES; tries++) {
+    unsigned long long generation = __atomic_load_n(&shm->control->generation, __ATOMIC_ACQUIRE);
+
+    if (generation == 0 || generation == shm->generation) {
+      return false;
+    }
+
+    struct SHM_IMAGE* image = map_image(shm, generation);
+
+    if (image != NULL) {
+      unmap_image(shm);
+
+      shm->image = image;
+      shm->generation = generation;
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @brief image_cell: a cell of the mapped image
+ *
+ * @param shm Pointer to the namespace
+ * @param address Cell address
+ * @return pointer to the cell, NULL if none mapped or invalid address
+ */
+static struct SHM_CELL* image_cell(struct RAM_SHM* shm, int address)
+{
+  if (shm->image == NULL || address < 0 || address >= shm->image->size) {
+    return NULL;
+  }
+
+  struct SHM_MAP* map = (struct SHM_MAP*) (shm->image + 1);
+  struct SHM_CELL* cells = (struct SHM_CELL*) (map + shm->image->size);
+
+  return &cells[address];
+}
+
+/**
+ * @brief new_shm: allocates a namespace handle
+ *
+ * @param name Control segment's name
+ * @param writer Created by this process?
+ * @return pointer to the handle, NULL if out of memory
+ */
+static struct RAM_SHM* new_shm(char* name, bool writer)
+{
+  struct RAM_SHM* shm = (struct RAM_SHM*) malloc(sizeof(struct RAM_SHM));
+  char* copy = strdup(name);
+
+  if (shm == NULL || copy == NULL) {
+    free(shm);
+    free(copy);
+    return NULL;
+  }
+
+  shm->name = copy;
+  shm->writer = writer;
+  shm->control = NULL;
+  shm->image = NULL;
+  shm->generation = 0;
+
+  return shm;
+}
+
+
+/**
+  * @brief ram_shm_create: creates a shared-memory namespace to publish to
+  *
+  * Called by the writer. Any namespace left with the same name
+  * (e.g. by a writer that crashed) is replaced. Nothing can be read
+  * until the first ram_shm_publish. Call ram_shm_detach when done,
+  * which removes the namespace.
+  *
+  * @param name POSIX shared-memory name, e.g. "/globals"
+  * @return pointer to the namespace, or NULL if it cannot be created
+  */
+struct RAM_SHM* ram_shm_create(char* name)
+{
+  shm_unlink(name);
+
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  void* p = MAP_FAILED;
+
+  if (ftruncate(fd, sizeof(struct SHM_CONTROL)) == 0) {
+    p = mmap(NULL, sizeof(struct SHM_CONTROL), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  close(fd);
+
+  if (p == MAP_FAILED) {
+    shm_unlink(name);
+    return NULL;
+  }
+
+  struct RAM_SHM* shm = new_shm(name, true);
+
+  if (shm == NULL) {
+    munmap(p, sizeof(struct SHM_CONTROL));
+    shm_unlink(name);
+    return NULL;
+  }
+
+  shm->control = (struct SHM_CONTROL*) p;
+  shm->control->magic = SHM_CONTROL_MAGIC;
+  shm->control->version = SHM_VERSION;
+  shm->control->generation = 0;
+
+  return shm;
+}
+
+
+/**
+  * @brief ram_shm_publish: publishes memory's current contents
+  *
+  * Copies every variable into a new image, then makes it the one
+  * readers get when they attach or refresh. Only the process that
+  * created the namespace can publish.
+  *
+  * @param shm Pointer to the namespace
+  * @param memory Pointer to struct denoting memory unit to publish
+  * @return true if successful, false if not the writer or out of (shared) memory
+  */
+bool ram_shm_publish(struct RAM_SHM* shm, struct RAM* memory)
+{
+  if (!shm->writer) {
+    return false;
+  }
+
+  int size = memory->size;
+
+  //
+  // size the image:
+  //
+  long long bytes = align(sizeof(struct SHM_IMAGE)) +
+                    align((long long) size * sizeof(struct SHM_MAP)) +
+                    align((long long) size * sizeof(struct SHM_CELL));
+
+  for (int i = 0; i < size; i++) {
+    struct RAM_VALUE* cell = ram_cell(memory, i);
+
+    bytes += align(strlen(ram_map_name(memory, i)) + 1);
+
+    if (cell->value_type == RAM_TYPE_STR) {
+      bytes += align(sizeof(struct RAM_STR) + ram_str_length(cell->types.s) + 1);
+    }
+    else if (cell->value_type == RAM_TYPE_ARRAY) {
+      struct RAM_ARRAY* a = cell->types.a;
+      int elem_size = (a->elem_type == RAM_ARRAY_INT) ? sizeof(int) : sizeof(double);
+
+      bytes += align(sizeof(struct SHM_ARRAY)) + align((long long) a->length * elem_size);
+    }
+  }
+
+  //
+  // create the next generation's segment:
+  //
+  unsigned long long generation = shm->control->generation + 1;
+  char* name = image_name(shm, generation);
+  char* previous = (generation > 1) ? image_name(shm, generation - 1) : NULL;
+
+  if (name == NULL || (generation > 1 && previous == NULL)) {
+    free(name);
+    free(previous);
+    return false;
+  }
+
+  shm_unlink(name);  // left over from a crashed writer?
+
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+  void* p = MAP_FAILED;
+
+  if (fd >= 0) {
+    if (ftruncate(fd, bytes) == 0) {
+      p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+  }
+
+  if (p == MAP_FAILED) {
+    shm_unlink(name);
+    free(name);
+    free(previous);
+    return false;
+  }
+
+  free(name);
+
+  //
+  // fill it in:
+  //
+  char* base = (char*) p;
+  struct SHM_IMAGE* image = (struct SHM_IMAGE*) base;
+  long long map_offset = align(sizeof(struct SHM_IMAGE));
+  long long cells_offset = map_offset + align((long long) size * sizeof(struct SHM_MAP));
+  long long heap = cells_offset + align((long long) size * sizeof(struct SHM_CELL));
+  struct SHM_MAP* map = (struct SHM_MAP*) (base + map_offset);
+  struct SHM_CELL* cells = (struct SHM_CELL*) (base + cells_offset);
+
+  image->magic = SHM_IMAGE_MAGIC;
+  image->version = SHM_VERSION;
+  image->generation = generation;
+  image->size = size;
+  image->reserved = 0;
+  image->bytes = bytes;
+
+  for (int i = 0; i < size; i++) {
+    char* varname = ram_map_name(memory, i);
+    long long length = strlen(varname);
+
+    memcpy(base + heap, varname, length + 1);
+
+    map[i].name = heap;
+    map[i].cell = memory->map[i].cell;
+    map[i].reserved = 0;
+
+    heap += align(length + 1);
+  }
+
+  for (int i = 0; i < size; i++) {
+    struct RAM_VALUE* cell = ram_cell(memory, i);
+
+    cells[i].value_type = cell->value_type;
+    cells[i].reserved = 0;
+    cells[i].types.offset = 0;
+
+    if (cell->value_type == RAM_TYPE_STR) {
+      char* s = cell->types.s;
+      struct RAM_STR* header = (struct RAM_STR*) (base + heap);
+      int length = ram_str_length(s);
+
+      header->length = length;
+      header->capacity = length;
+      header->hash = ram_str_hash(s);  // the image is read-only, so no caching later
+      header->reserved = 0;
+      memcpy(header + 1, s, length + 1);
+
+      cells[i].types.offset = heap + sizeof(struct RAM_STR);
+      heap += align(sizeof(struct RAM_STR) + length + 1);
+    }
+    else if (cell->value_type == RAM_TYPE_ARRAY) {
+      struct RAM_ARRAY* a = cell->types.a;
+      struct SHM_ARRAY* array = (struct SHM_ARRAY*) (base + heap);
+      int elem_size = (a->elem_type == RAM_ARRAY_INT) ? sizeof(int) : sizeof(double);
+
+      array->elem_type = a->elem_type;
+      array->length = a->length;
+      array->reserved = 0;
+
+      cells[i].types.offset = heap;
+      heap += align(sizeof(struct SHM_ARRAY));
+
+      memcpy(base + heap, a->elems.i, (size_t) a->length * elem_size);
+      heap += align((long long) a->length * elem_size);
+    }
+    else if (cell->value_type == RAM_TYPE_REAL) {
+      cells[i].types.d = cell->types.d;
+    }
+    else {
+      cells[i].types.i = cell->types.i;
+    }
+  }
+
+  //
+  // switch readers over, then retire the previous image:
+  //
+  unmap_image(shm);
+
+  shm->image = image;
+  shm->generation = generation;
+
+  __atomic_store_n(&shm->control->generation, generation, __ATOMIC_RELEASE);
+
+  if (previous != NULL) {
+    shm_unlink(previous);
+    free(previous);
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_shm_attach: attaches to a namespace, read-only
+  *
+  * Called by readers, in any process. Maps the latest published
+  * image, if any. Call ram_shm_detach when done.
+  *
+  * @param name POSIX shared-memory name given to ram_shm_create
+  * @return pointer to the namespace, or NULL if there is no such namespace
+  *         or out of memory
+  */
+struct RAM_SHM* ram_shm_attach(char* name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat info;
+  void* p = MAP_FAILED;
+
+  if (fstat(fd, &info) == 0 && info.st_size >= (off_t) sizeof(struct SHM_CONTROL)) {
+    p = mmap(NULL, sizeof(struct SHM_CONTROL), PROT_READ, MAP_SHARED, fd, 0);
+  }
+
+  close(fd);
+
+  if (p == MAP_FAILED) {
+    return NULL;
+  }
+
+  struct SHM_CONTROL* control = (struct SHM_CONTROL*) p;
+
+  if (control->magic != SHM_CONTROL_MAGIC || control->version != SHM_VERSION) {
+    munmap(p, sizeof(struct SHM_CONTROL));
+    return NULL;
+  }
+
+  struct RAM_SHM* shm = new_shm(name, false);
+
+  if (shm == NULL) {
+    munmap(p, sizeof(struct SHM_CONTROL));
+    return NULL;
+  }
+
+  shm->control = control;
+
+  map_latest(shm);
+
+  return shm;
+}
+
+
+/**
+  * @brief ram_shm_refresh: switches to the latest published image
+  *
+  * Addresses, strings and arrays obtained from the previous image
+  * are no longer valid after a successful refresh.
+  *
+  * @param shm Pointer to the namespace
+  * @return true if a newer image was mapped, false if already the latest
+  */
+bool ram_shm_refresh(struct RAM_SHM* shm)
+{
+  return map_latest(shm);
+}
+
+
+/**
+  * @brief ram_shm_detach: unmaps the namespace
+  *
+  * When called by the writer, also removes the namespace; readers
+  * still attached keep the image they have.
+  *
+  * @param shm Pointer to the namespace
+  * @return void
+  */
+void ram_shm_detach(struct RAM_SHM* shm)
+{
+  if (shm == NULL) {
+    return;
+  }
+
+  if (shm->writer && shm->generation > 0) {
+    char* name = image_name(shm, shm->generation);
+
+    if (name != NULL) {
+      shm_unlink(name);
+      free(name);
+    }
+  }
+
+  unmap_image(shm);
+  munmap(shm->control, sizeof(struct SHM_CONTROL));
+
+  if (shm->writer) {
+    shm_unlink(shm->name);
+  }
+
+  free(shm->name);
+  free(shm);
+}
+
+
+/**
+  * @brief ram_shm_generation: which publish the mapped image came from
+  *
+  * @param shm Pointer to the namespace
+  * @return 1 for the first publish, 2 for the next, ..., 0 if none mapped
+  */
+unsigned long long ram_shm_generation(struct RAM_SHM* shm)
+{
+  return shm->generation;
+}
+
+
+/**
+  * @brief ram_shm_size: # of variables in the mapped image
+  *
+  * @param shm Pointer to the namespace
+  * @return # of variables, 0 if none mapped
+  */
+int ram_shm_size(struct RAM_SHM* shm)
+{
+  return (shm->image == NULL) ? 0 : shm->image->size;
+}
+
+
+/**
+  * @brief ram_shm_get_addr: address of a variable in the mapped image
+  *
+  * Addresses are the same as in the memory unit that was published.
+  *
+  * @param shm Pointer to the namespace
+  * @param varname variable name
+  * @return address of variable or -1 if doesn't exist
+  */
+int ram_shm_get_addr(struct RAM_SHM* shm, char* varname)
+{
+  if (shm->image == NULL) {
+    return -1;
+  }
+
+  char* base = (char*) shm->image;
+  struct SHM_MAP* map = (struct SHM_MAP*) (shm->image + 1);
+  int left = 0;
+  int right = shm->image->size - 1;
+
+  while (left <= right) {
+    int mid = (left + right) / 2;
+    int cmp = strcmp(base + map[mid].name, varname);
+
+    if (cmp == 0) {
+      return map[mid].cell;
+    }
+    else if (cmp < 0) {
+      left = mid + 1;
+    }
+    else {
+      right = mid - 1;
+    }
+  }
+
+  return -1;
+}
+
+
+/**
+  * @brief ram_shm_read: reads a value from the mapped image, without copying
+  *
+  * Scalars are copied into *value. A string is not: value->types.s
+  * points into the image, which is read-only, and is valid until the
+  * next refresh or detach; ram_str_length, ram_str_hash and
+  * ram_str_equals work on it. Do NOT pass the value to
+  * ram_free_value.
+  *
+  * @param shm Pointer to the namespace
+  * @param address memory cell address
+  * @param value set to the value if successful
+  * @return true if successful, false if invalid address or the cell holds
+  *   an array (see ram_shm_read_array)
+  */
+bool ram_shm_read(struct RAM_SHM* shm, int address, struct RAM_VALUE* value)
+{
+  struct SHM_CELL* cell = image_cell(shm, address);
+
+  if (cell == NULL || cell->value_type == RAM_TYPE_ARRAY) {
+    return false;
+  }
+
+  value->value_type = cell->value_type;
+
+  if (cell->value_type == RAM_TYPE_STR) {
+    value->types.s = (char*) shm->image + cell->types.offset;
+  }
+  else if (cell->value_type == RAM_TYPE_REAL) {
+    value->types.d = cell->types.d;
+  }
+  else {
+    value->types.i = cell->types.i;
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_shm_read_array: reads an array from the mapped image, without copying
+  *
+  * Sets *array to describe the array in place: its elements are in
+  * the image, read-only and valid until the next refresh or detach.
+  * The ram_array_* functions that only read (sum, minmax, dot) work
+  * on it. Do NOT free or modify it.
+  *
+  * @param shm Pointer to the namespace
+  * @param address memory cell address
+  * @param array set to the array if successful
+  * @return true if successful, false if invalid address or not an array
+  */
+bool ram_shm_read_array(struct RAM_SHM* shm, int address, struct RAM_ARRAY* array)
+{
+  struct SHM_CELL* cell = image_cell(shm, address);
+
+  if (cell == NULL || cell->value_type != RAM_TYPE_ARRAY) {
+    return false;
+  }
+
+  char* base = (char*) shm->image;
+  struct SHM_ARRAY* a = (struct SHM_ARRAY*) (base + cell->types.offset);
+
+  array->elem_type = a->elem_type;
+  array->length = a->length;
+  array->capacity = a->length;
+  array->elems.i = (int*) (base + cell->types.offset + align(sizeof(struct SHM_ARRAY)));
+
+  return true;
+}
@@ -0,0 +1,150 @@
+/*ram_shm.h*/
+
+/**
+  * @brief Shared-memory images of nuPython's memory unit
+  *
+  * Lets many worker processes share one read-mostly namespace
+  * instead of each holding its own copy. A writer process publishes
+  * a memory unit as an image in a POSIX shared-memory segment;
+  * readers attach to it and look variables up in place, with no
+  * copying: the segment is mapped read-only into every process, and
+  * all of its cells, map entries and strings refer to each other by
+  * offsets, so it works wherever it is mapped.
+  *
+  * Each publish writes a new image to a new segment and then
+  * switches the name over, so readers never see a half-written
+  * image. A reader keeps using the image it has (even after a newer
+  * one is published) until it calls ram_shm_refresh.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+struct RAM_SHM;  // opaque, see ram_shm.c
+
+
+/**
+  * @brief ram_shm_create: creates a shared-memory namespace to publish to
+  *
+  * Called by the writer. Any namespace left with the same name
+  * (e.g. by a writer that crashed) is replaced. Nothing can be read
+  * until the first ram_shm_publish. Call ram_shm_detach when done,
+  * which removes the namespace.
+  *
+  * @param name POSIX shared-memory name, e.g. "/globals"
+  * @return pointer to the namespace, or NULL if it cannot be created
+  */
+struct RAM_SHM* ram_shm_create(char* name);
+
+/**
+  * @brief ram_shm_publish: publishes memory's current contents
+  *
+  * Copies every variable into a new image, then makes it the one
+  * readers get when they attach or refresh. Only the process that
+  * created the namespace can publish.
+  *
+  * @param shm Pointer to the namespace
+  * @param memory Pointer to struct denoting memory unit to publish
+  * @return true if successful, false if not the writer or out of (shared) memory
+  */
+bool ram_shm_publish(struct RAM_SHM* shm, struct RAM* memory);
+
+/**
+  * @brief ram_shm_attach: attaches to a namespace, read-only
+  *
+  * Called by readers, in any process. Maps the latest published
+  * image, if any. Call ram_shm_detach when done.
+  *
+  * @param name POSIX shared-memory name given to ram_shm_create
+  * @return pointer to the namespace, or NULL if there is no such namespace
+  *         or out of memory
+  */
+struct RAM_SHM* ram_shm_attach(char* name);
+
+/**
+  * @brief ram_shm_refresh: switches to the latest published image
+  *
+  * Addresses, strings and arrays obtained from the previous image
+  * are no longer valid after a successful refresh.
+  *
+  * @param shm Pointer to the namespace
+  * @return true if a newer image was mapped, false if already the latest
+  */
+bool ram_shm_refresh(struct RAM_SHM* shm);
+
+/**
+  * @brief ram_shm_detach: unmaps the namespace
+  *
+  * When called by the writer, also removes the namespace; readers
+  * still attached keep the image they have.
+  *
+  * @param shm Pointer to the namespace
+  * @return void
+  */
+void ram_shm_detach(struct RAM_SHM* shm);
+
+/**
+  * @brief ram_shm_generation: which publish the mapped image came from
+  *
+  * @param shm Pointer to the namespace
+  * @return 1 for the first publish, 2 for the next, ..., 0 if none mapped
+  */
+unsigned long long ram_shm_generation(struct RAM_SHM* shm);
+
+/**
+  * @brief ram_shm_size: # of variables in the mapped image
+  *
+  * @param shm Pointer to the namespace
+  * @return # of variables, 0 if none mapped
+  */
+int ram_shm_size(struct RAM_SHM* shm);
+
+/**
+  * @brief ram_shm_get_addr: address of a variable in the mapped image
+  *
+  * Addresses are the same as in the memory unit that was published.
+  *
+  * @param shm Pointer to the namespace
+  * @param varname variable name
+  * @return address of variable or -1 if doesn't exist
+  */
+int ram_shm_get_addr(struct RAM_SHM* shm, char* varname);
+
+/**
+  * @brief ram_shm_read: reads a value from the mapped image, without copying
+  *
+  * Scalars are copied into *value. A string is not: value->types.s
+  * points into the image, which is read-only, and is valid until the
+  * next refresh or detach; ram_str_length, ram_str_hash and
+  * ram_str_equals work on it. Do NOT pass the value to
+  * ram_free_value.
+  *
+  * @param shm Pointer to the namespace
+  * @param address memory cell address
+  * @param value set to the value if successful
+  * @return true if successful, false if invalid address or the cell holds
+  *   an array (see ram_shm_read_array)
+  */
+bool ram_shm_read(struct RAM_SHM* shm, int address, struct RAM_VALUE* value);
+
+/**
+  * @brief ram_shm_read_array: reads an array from the mapped image, without copying
+  *
+  * Sets *array to describe the array in place: its elements are in
+  * the image, read-only and valid until the next refresh or detach.
+  * The ram_array_* functions that only read (sum, minmax, dot) work
+  * on it. Do NOT free or modify it.
+  *
+  * @param shm Pointer to the namespace
+  * @param address memory cell address
+  * @param array set to the array if successful
+  * @return true if successful, false if invalid address or not an array
+  */
+bool ram_shm_read_array(struct RAM_SHM* shm, int address, struct RAM_ARRAY* array);
@@ -0,0 +1,372 @@
+/*ram_slab.c*/
+
+/**
+  * @brief Slab allocator for nuPython's memory unit
+  *
+  * Free blocks are kept on singly-linked lists threaded through the
+  * blocks themselves: one list per size class in each thread's
+  * cache, and one per size class in the shared depot (protected by
+  * a mutex). Each thread's cache is also on a registry, so stats
+  * can total the counters of running threads.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <pthread.h>
+
+#include "ram_slab.h"
+
+#define SLAB_GRAIN   16                          // size classes are multiples of this
+#define SLAB_CLASSES (RAM_SLAB_MAX / SLAB_GRAIN)
+#define SLAB_BYTES   (64 * 1024)                 // size of each slab
+#define SLAB_BATCH   64                          // # of blocks moved to/from the depot at once
+
+//
+// Counters are only written by their own thread, but read by stats
+// from any thread:
+//
+#define SLAB_COUNT(counter) __atomic_store_n(&(counter), (counter) + 1, __ATOMIC_RELAXED)
+#define SLAB_READ(counter)  __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+struct SLAB_BLOCK
+{
+  struct SLAB_BLOCK* next;  // next free block on the same list
+};
+
+struct SLAB_CACHE
+{
+  struct SLAB_BLOCK* lists[SLAB_CLASSES];  // free blocks, per size class
+  int counts[SLAB_CLASSES];                // # of blocks on each list
+  long long allocs;
+  long long frees;
+  long long large;
+  long long refills;
+  bool registered;                         // on the registry?
+  struct SLAB_CACHE* prev;                 // registry links
+  struct SLAB_CACHE* next;
+};
+
+struct SLAB_DEPOT
+{
+  pthread_mutex_t lock;                    // protects everything below
+  struct SLAB_BLOCK* lists[SLAB_CLASSES];  // free blocks, per size class
+  void* slabs;                             // every slab, linked through its first word
+  struct SLAB_CACHE* caches;               // registry of running threads' caches
+  struct RAM_SLAB_STATS retired;           // counters of threads that have exited
+  struct RAM_SLAB_STATS totals;            // slabs and slab_bytes
+};
+
+static struct SLAB_DEPOT depot = { PTHREAD_MUTEX_INITIALIZER, { NULL }, NULL, NULL, { 0, 0, 0, 0, 0, 0 }, { 0, 0, 0, 0, 0, 0 } };
+
+#ifndef RAM_NO_SLAB
+
+static __thread struct SLAB_CACHE cache;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t key;
+
+/**
+ * @brief give_back: moves up to n blocks from the cache to the depot
+ * 
+ * The depot must be locked by the caller.
+ * 
+ * @param c Cache to take blocks from
+ * @param k Size class
+ * @param n Max # of blocks to move
+ */
+static void give_back(struct SLAB_CACHE* c, int k, int n)
+{
+  for (int i = 0; i < n && c->lists[k] != NULL; i++) {
+    struct SLAB_BLOCK* block = c->lists[k];
+
+    c->lists[k] = block->next;
+    c->counts[k]--;
+
+    block->next = depot.lists[k];
+    depot.lists[k] = block;
+  }
+}
+
+/**
+ * @brief thread_exit: returns an exiting thread's cache to the depot
+ * 
+ * Registered as the destructor of the thread-specific key, so it
+ * runs when a thread that used the allocator exits.
+ * 
+ * @param arg The thread's cache
+ */
+static void thread_exit(void* arg)
+{
+  struct SLAB_CACHE* c = (struct SLAB_CACHE*) arg;
+
+  pthread_mutex_lock(&depot.lock);
+
+  for (int k = 0; k < SLAB_CLASSES; k++) {
+    give_back(c, k, c->counts[k]);
+  }
+
+  depot.retired.allocs += c->allocs;
+  depot.retired.frees += c->frees;
+  depot.retired.large += c->large;
+  depot.retired.refills += c->refills;
+
+  if (c->prev != NULL) {
+    c->prev->next = c->next;
+  }
+  else {
+    depot.caches = c->next;
+  }
+
+  if (c->next != NULL) {
+    c->next->prev = c->prev;
+  }
+
+  c->registered = false;
+
+  pthread_mutex_unlock(&depot.lock);
+}
+
+static void make_key(void)
+{
+  pthread_key_create(&key, thread_exit);
+}
+
+/**
+ * @brief register_cache: adds the calling thread's cache to the registry
+ * 
+ * Done on the thread's first allocation, so its counters show up in
+ * stats and its blocks are given back when it exits.
+ */
+static void register_cache(void)
+{
+  pthread_once(&key_once, make_key);
+
+  pthread_mutex_lock(&depot.lock);
+
+  cache.prev = NULL;
+  cache.next = depot.caches;
+
+  if (depot.caches != NULL) {
+    depot.caches->prev = &cache;
+  }
+
+  depot.caches = &cache;
+  cache.registered = true;
+
+  pthread_mutex_unlock(&depot.lock);
+
+  pthread_setspecific(key, &cache);
+}
+
+/**
+ * @brief refill: gives the calling thread's cache a batch of blocks
+ * 
+ * Takes the batch from the depot if it has enough free blocks of
+ * the size class, otherwise carves up a new slab. The cache stays
+ * empty if there are no free blocks and no memory for a new slab.
+ * 
+ * @param k Size class (which must be empty in the cache)
+ */
+static void refill(int k)
+{
+  int block_bytes = (k + 1) * SLAB_GRAIN;
+
+  pthread_mutex_lock(&depot.lock);
+
+  while (depot.lists[k] != NULL && cache.counts[k] < SLAB_BATCH) {
+    struct SLAB_BLOCK* block = depot.lists[k];
+
+    depot.lists[k] = block->next;
+
+    block->next = cache.lists[k];
+    cache.lists[k] = block;
+    cache.counts[k]++;
+  }
+
+  char* slab = (cache.counts[k] == 0) ? (char*) malloc(SLAB_BYTES) : NULL;
+
+  if (slab != NULL) {
+    //
+    // the first grain links the slab into the list of all slabs; the
+    // rest is cut into blocks, a batch for this thread and the others
+    // for the depot:
+    //
+    *(void**) slab = depot.slabs;
+    depot.slabs = slab;
+
+    for (char* p = slab + SLAB_GRAIN; p + block_bytes <= slab + SLAB_BYTES; p += block_bytes) {
+      struct SLAB_BLOCK* block = (struct SLAB_BLOCK*) p;
+
+      if (cache.counts[k] < SLAB_BATCH) {
+        block->next = cache.lists[k];
+        cache.lists[k] = block;
+        cache.counts[k]++;
+      }
+      else {
+        block->next = depot.lists[k];
+        depot.lists[k] = block;
+      }
+    }
+
+    depot.totals.slabs++;
+    depot.totals.slab_bytes += SLAB_BYTES;
+  }
+
+  pthread_mutex_unlock(&depot.lock);
+
+  SLAB_COUNT(cache.refills);
+}
+
+#endif  // RAM_NO_SLAB
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_slab_alloc: allocates a block of memory
+  *
+  * @param bytes size of the block
+  * @return pointer to the block, 16-byte aligned, NULL if out of memory
+  */
+void* ram_slab_alloc(size_t bytes)
+{
+#ifdef RAM_NO_SLAB
+  return malloc(bytes);
+#else
+  if (!cache.registered) {
+    register_cache();
+  }
+
+  if (bytes > RAM_SLAB_MAX || bytes == 0) {
+    SLAB_COUNT(cache.large);
+    return malloc(bytes);
+  }
+
+  int k = (int) ((bytes - 1) / SLAB_GRAIN);
+
+  if (cache.lists[k] == NULL) {
+    refill(k);
+
+    if (cache.lists[k] == NULL) {
+      return NULL;
+    }
+  }
+
+  struct SLAB_BLOCK* block = cache.lists[k];
+
+  cache.lists[k] = block->next;
+  cache.counts[k]--;
+
+  SLAB_COUNT(cache.allocs);
+
+  return block;
+#endif
+}
+
+
+/**
+  * @brief ram_slab_free: frees a block allocated by ram_slab_alloc
+  *
+  * The block may be freed by a different thread than allocated it.
+  *
+  * @param block pointer to the block, may be NULL
+  * @param bytes size the block was allocated with
+  * @return void
+  */
+void ram_slab_free(void* block, size_t bytes)
+{
+#ifdef RAM_NO_SLAB
+  free(block);
+#else
+  if (block == NULL) {
+    return;
+  }
+
+  if (bytes > RAM_SLAB_MAX || bytes == 0) {
+    free(block);
+    return;
+  }
+
+  if (!cache.registered) {
+    register_cache();
+  }
+
+  int k = (int) ((bytes - 1) / SLAB_GRAIN);
+  struct SLAB_BLOCK* b = (struct SLAB_BLOCK*) block;
+
+  b->next = cache.lists[k];
+  cache.lists[k] = b;
+  cache.counts[k]++;
+
+  SLAB_COUNT(cache.frees);
+
+  //
+  // a thread that frees more than it allocates (e.g. a consumer)
+  // passes the surplus on:
+  //
+  if (cache.counts[k] > 2 * SLAB_BATCH) {
+    pthread_mutex_lock(&depot.lock);
+    give_back(&cache, k, SLAB_BATCH);
+    pthread_mutex_unlock(&depot.lock);
+  }
+#endif
+}
+
+
+/**
+  * @brief ram_slab_flush: returns the calling thread's cached blocks
+  *
+  * Moves every free block in the calling thread's cache to the
+  * shared depot, where other threads can reuse them. Done
+  * automatically when a thread exits.
+  *
+  * @return void
+  */
+void ram_slab_flush(void)
+{
+#ifndef RAM_NO_SLAB
+  pthread_mutex_lock(&depot.lock);
+
+  for (int k = 0; k < SLAB_CLASSES; k++) {
+    give_back(&cache, k, cache.counts[k]);
+  }
+
+  pthread_mutex_unlock(&depot.lock);
+#endif
+}
+
+
+/**
+  * @brief ram_slab_stats: statistics about the slab allocator
+  *
+  * Totals over all threads, past and present.
+  *
+  * @return allocator statistics
+  */
+struct RAM_SLAB_STATS ram_slab_stats(void)
+{
+  pthread_mutex_lock(&depot.lock);
+
+  struct RAM_SLAB_STATS stats = depot.retired;
+
+  stats.slabs = depot.totals.slabs;
+  stats.slab_bytes = depot.totals.slab_bytes;
+
+  for (struct SLAB_CACHE* c = depot.caches; c != NULL; c = c->next) {
+    stats.allocs += SLAB_READ(c->allocs);
+    stats.frees += SLAB_READ(c->frees);
+    stats.large += SLAB_READ(c->large);
+    stats.refills += SLAB_READ(c->refills);
+  }
+
+  pthread_mutex_unlock(&depot.lock);
+
+  return stats;
+}
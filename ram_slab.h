@@ -0,0 +1,79 @@
+/*ram_slab.h*/
+
+/**
+  * @brief Slab allocator for nuPython's memory unit
+  *
+  * Memory allocates many small blocks: a RAM_VALUE for every read,
+  * names being loaded from a checkpoint, and mostly short strings
+  * (the names in memory share one block; see struct RAM_NAMES). Instead
+  * of going to malloc for each, ram.c gets blocks of up to
+  * RAM_SLAB_MAX bytes from size classes (multiples of 16 bytes)
+  * carved out of larger slabs. Each thread keeps its own cache of
+  * free blocks per class, so the common case takes no lock; caches
+  * trade blocks in batches with a shared depot when they run dry or
+  * grow too large, and give them back when the thread exits. Larger
+  * blocks go to malloc. Slabs are kept for the life of the program.
+  *
+  * Compile with -DRAM_NO_SLAB to send every block to malloc (e.g.
+  * so memory checkers see each block individually).
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stddef.h>   // size_t
+
+
+#define RAM_SLAB_MAX 256  // largest block served from a size class
+
+struct RAM_SLAB_STATS
+{
+  long long allocs;      // # of blocks allocated from size classes
+  long long frees;       // # of blocks freed back to size classes
+  long long large;       // # of blocks too large for a size class (malloc'd)
+  long long refills;     // # of times a thread's cache took a batch from the depot
+  long long slabs;       // # of slabs allocated
+  long long slab_bytes;  // total bytes in those slabs
+};
+
+
+/**
+  * @brief ram_slab_alloc: allocates a block of memory
+  *
+  * @param bytes size of the block
+  * @return pointer to the block, 16-byte aligned, NULL if out of memory
+  */
+void* ram_slab_alloc(size_t bytes);
+
+/**
+  * @brief ram_slab_free: frees a block allocated by ram_slab_alloc
+  *
+  * The block may be freed by a different thread than allocated it.
+  *
+  * @param block pointer to the block, may be NULL
+  * @param bytes size the block was allocated with
+  * @return void
+  */
+void ram_slab_free(void* block, size_t bytes);
+
+/**
+  * @brief ram_slab_flush: returns the calling thread's cached blocks
+  *
+  * Moves every free block in the calling thread's cache to the
+  * shared depot, where other threads can reuse them. Done
+  * automatically when a thread exits.
+  *
+  * @return void
+  */
+void ram_slab_flush(void);
+
+/**
+  * @brief ram_slab_stats: statistics about the slab allocator
+  *
+  * Totals over all threads, past and present.
+  *
+  * @return allocator statistics
+  */
+struct RAM_SLAB_STATS ram_slab_stats(void);
@@ -0,0 +1,456 @@
+/*ram_trace.c*/
+
+/**
+  * @brief Workload traces for nuPython's memory unit
+  *
+  * A trace file starts with a magic number and version, followed by
+  * one record per call: an op byte and its operands. Names are a
+  * varint length and their chars; addresses and lengths are varints;
+  * a value's shape is its type byte, plus a varint length for a
+  * string, or an elem type byte and varint length for an array.
+  * Records are buffered and written in large blocks.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+
+#include "ram.h"
+#include "ram_trace.h"
+
+#define TRACE_MAGIC       0x544D4152  // "RAMT"
+#define TRACE_VERSION     1
+#define TRACE_BUFFER_SIZE 65536       // write the buffer once it is this full
+#define TRACE_MAX_RECORD  32          // bytes in a record, not counting its name
+
+struct RAM_TRACE
+{
+  FILE* out;           // trace file
+  unsigned char* buffer;  // records not yet written to the file
+  int used;            // # of bytes in buffer
+  bool failed;         // a write to the file failed
+  struct RAM_TRACE_STATS stats;
+};
+
+struct RAM_TRACE_READER
+{
+  FILE* in;
+  char* varname;       // name of the last record read
+  int capacity;        // # of chars allocated for varname
+};
+
+
+/**
+ * @brief flush: writes the buffered records to the trace file
+ *
+ * @param trace Pointer to the trace
+ */
+static void flush(struct RAM_TRACE* trace)
+{
+  if (trace->used > 0 && fwrite(trace->buffer, 1, trace->used, trace->out) != (size_t) trace->used) {
+    trace->failed = true;
+  }
+
+  trace->stats.bytes += trace->used;
+  trace->used = 0;
+}
+
+/**
+ * @brief begin_record: makes room for a record and writes its op
+ *
+ * @param trace Pointer to the trace
+ * @param op enum RAM_TRACE_OPS
+ * @param name_length # of chars in the record's name, 0 if none
+ */
+static void begin_record(struct RAM_TRACE* trace, int op, int name_length)
+{
+  if (trace->used + TRACE_MAX_RECORD + name_length > TRACE_BUFFER_SIZE) {
+    flush(trace);
+  }
+
+  trace->buffer[trace->used] = (unsigned char) op;
+  trace->used++;
+
+  trace->stats.records++;
+}
+
+/**
+ * @brief put_varint: appends a non-negative int, 7 bits per byte
+ *
+ * @param trace Pointer to the trace
+ * @param x Value to append (>= 0)
+ */
+static void put_varint(struct RAM_TRACE* trace, int x)
+{
+  unsigned int u = (unsigned int) x;
+
+  while (u >= 0x80) {
+    trace->buffer[trace->used] = (unsigned char) ((u & 0x7F) | 0x80);
+    trace->used++;
+    u >>= 7;
+  }
+
+  trace->buffer[trace->used] = (unsigned char) u;
+  trace->used++;
+}
+
+/**
+ * @brief put_name: appends a name (varint length, then its chars)
+ *
+ * @param trace Pointer to the trace
+ * @param varname Variable name
+ * @param length # of chars in the name
+ */
+static void put_name(struct RAM_TRACE* trace, char* varname, int length)
+{
+  //
+  // a name too long for the buffer is cut short; a trace only has
+  // to reproduce the workload, and no real name is 64K chars:
+  //
+  if (length > TRACE_BUFFER_SIZE - TRACE_MAX_RECORD - 1) {
+    length = TRACE_BUFFER_SIZE - TRACE_MAX_RECORD - 1;
+  }
+
+  put_varint(trace, length);
+
+  memcpy(trace->buffer + trace->used, varname, length);
+  trace->used += length;
+}
+
+/**
+ * @brief get_varint: reads a varint written by put_varint
+ *
+ * @param in File to read from
+ * @param x Set to the value read
+ * @return true if successful, false at end of file or if malformed
+ */
+static bool get_varint(FILE* in, int* x)
+{
+  unsigned int u = 0;
+
+  for (int shift = 0; shift < 35; shift += 7) {
+    int c = fgetc(in);
+
+    if (c == EOF) {
+      return false;
+    }
+
+    u |= (unsigned int) (c & 0x7F) << shift;
+
+    if ((c & 0x80) == 0) {
+      *x = (int) u;
+      return *x >= 0;
+    }
+  }
+
+  return false;
+}
+
+
+//
+// Hooks called by ram.c:
+//
+
+void trace_name(struct RAM_TRACE* trace, int op, char* varname, int length)
+{
+  begin_record(trace, op, length);
+  put_name(trace, varname, length);
+}
+
+void trace_addr(struct RAM_TRACE* trace, int op, int address)
+{
+  begin_record(trace, op, 0);
+  put_varint(trace, (address < 0) ? 0x7FFFFFFF : address);  // invalid stays invalid
+}
+
+void trace_append(struct RAM_TRACE* trace, int address, int elem_type)
+{
+  trace_addr(trace, RAM_TRACE_APPEND, address);
+
+  trace->buffer[trace->used] = (unsigned char) elem_type;
+  trace->used++;
+}
+
+void trace_append_str(struct RAM_TRACE* trace, int address, int length)
+{
+  trace_addr(trace, RAM_TRACE_APPEND_STR, address);
+  put_varint(trace, length);
+}
+
+void trace_typed_read(struct RAM_TRACE* trace, int address)
+{
+  trace_addr(trace, RAM_TRACE_READ_BY_ADDR, address);
+}
+
+void trace_write(struct RAM_TRACE* trace, char* varname, int name_length, int address,
+                 int value_type, int length, int elem_type)
+{
+  if (varname != NULL) {
+    begin_record(trace, RAM_TRACE_WRITE_BY_NAME, name_length);
+    put_name(trace, varname, name_length);
+  }
+  else {
+    begin_record(trace, RAM_TRACE_WRITE_BY_ADDR, 0);
+    put_varint(trace, (address < 0) ? 0x7FFFFFFF : address);
+  }
+
+  trace->buffer[trace->used] = (unsigned char) value_type;
+  trace->used++;
+
+  if (value_type == RAM_TYPE_STR) {
+    put_varint(trace, length);
+  }
+  else if (value_type == RAM_TYPE_ARRAY) {
+    trace->buffer[trace->used] = (unsigned char) elem_type;
+    trace->used++;
+    put_varint(trace, length);
+  }
+}
+
+void trace_op(struct RAM_TRACE* trace, int op)
+{
+  begin_record(trace, op, 0);
+}
+
+void trace_close(struct RAM_TRACE* trace)
+{
+  flush(trace);
+
+  fclose(trace->out);
+
+  free(trace->buffer);
+  free(trace);
+}
+
+
+//
+// Public functions:
+//
+
+/**
+  * @brief ram_trace_start: starts recording memory's calls to a trace file
+  *
+  * The file is created (or truncated). Recording continues until
+  * ram_trace_stop or ram_destroy. While recording, the typed inline
+  * writes (ram_write_int_by_addr etc.) take their slower path.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param path trace file
+  * @return true if successful, false if already recording or the file cannot be created
+  */
+bool ram_trace_start(struct RAM* memory, char* path)
+{
+  if (memory->trace != NULL) {
+    return false;
+  }
+
+  FILE* out = fopen(path, "wb");
+
+  if (out == NULL) {
+    return false;
+  }
+
+  struct RAM_TRACE* trace = (struct RAM_TRACE*) malloc(sizeof(struct RAM_TRACE));
+
+  trace->out = out;
+  trace->buffer = (unsigned char*) malloc(TRACE_BUFFER_SIZE);
+  trace->used = 0;
+  trace->failed = false;
+  trace->stats.records = 0;
+  trace->stats.bytes = 0;
+
+  unsigned int header[2] = { TRACE_MAGIC, TRACE_VERSION };
+
+  memcpy(trace->buffer, header, sizeof(header));
+  trace->used = sizeof(header);
+
+  memory->trace = trace;
+  memory->observed = true;
+
+  return true;
+}
+
+
+/**
+  * @brief ram_trace_stop: stops recording and closes the trace file
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if not recording or the file could not be written
+  */
+bool ram_trace_stop(struct RAM* memory)
+{
+  struct RAM_TRACE* trace = memory->trace;
+
+  if (trace == NULL) {
+    return false;
+  }
+
+  flush(trace);
+
+  bool success = !trace->failed && fflush(trace->out) == 0;
+
+  memory->trace = NULL;
+  memory->observed = (memory->layout != NULL);
+  trace_close(trace);
+
+  return success;
+}
+
+
+/**
+  * @brief ram_trace_stats: statistics about memory's trace
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return trace statistics, all 0 if not recording
+  */
+struct RAM_TRACE_STATS ram_trace_stats(struct RAM* memory)
+{
+  struct RAM_TRACE_STATS stats = { 0, 0 };
+
+  if (memory->trace != NULL) {
+    stats = memory->trace->stats;
+    stats.bytes += memory->trace->used;
+  }
+
+  return stats;
+}
+
+
+/**
+  * @brief ram_trace_open: opens a trace file for reading
+  *
+  * @param path trace file written by ram_trace_start
+  * @return pointer to the reader, or NULL if the file is missing or not a trace
+  */
+struct RAM_TRACE_READER* ram_trace_open(char* path)
+{
+  FILE* in = fopen(path, "rb");
+
+  if (in == NULL) {
+    return NULL;
+  }
+
+  unsigned int header[2];
+
+  if (fread(header, sizeof(header), 1, in) != 1 || header[0] != TRACE_MAGIC || header[1] != TRACE_VERSION) {
+    fclose(in);
+    return NULL;
+  }
+
+  struct RAM_TRACE_READER* reader = (struct RAM_TRACE_READER*) malloc(sizeof(struct RAM_TRACE_READER));
+
+  reader->in = in;
+  reader->capacity = 64;
+  reader->varname = (char*) malloc(reader->capacity + 1);
+
+  return reader;
+}
+
+
+/**
+  * @brief ram_trace_next: reads the next call from a trace
+  *
+  * record->varname is only valid until the next call.
+  *
+  * @param reader Pointer to the reader
+  * @param record set to the next call
+  * @return true if a call was read, false at the end of the trace (or a malformed record)
+  */
+bool ram_trace_next(struct RAM_TRACE_READER* reader, struct RAM_TRACE_RECORD* record)
+{
+  FILE* in = reader->in;
+  int op = fgetc(in);
+
+  if (op == EOF || op < RAM_TRACE_GET_ADDR || op >= RAM_TRACE_NUM_OPS) {
+    return false;
+  }
+
+  record->op = op;
+  record->varname = NULL;
+  record->address = -1;
+  record->value_type = RAM_TYPE_NONE;
+  record->length = 0;
+  record->elem_type = RAM_ARRAY_INT;
+
+  switch (op) {
+    case RAM_TRACE_GET_ADDR:
+    case RAM_TRACE_READ_BY_NAME:
+    case RAM_TRACE_WRITE_BY_NAME: {
+      int length;
+
+      if (!get_varint(in, &length)) {
+        return false;
+      }
+
+      if (length > reader->capacity) {
+        reader->capacity = length;
+        reader->varname = (char*) realloc(reader->varname, reader->capacity + 1);
+      }
+
+      if (fread(reader->varname, 1, length, in) != (size_t) length) {
+        return false;
+      }
+
+      reader->varname[length] = '\0';
+      record->varname = reader->varname;
+      break;
+    }
+    case RAM_TRACE_READ_BY_ADDR:
+    case RAM_TRACE_WRITE_BY_ADDR:
+    case RAM_TRACE_APPEND:
+    case RAM_TRACE_APPEND_STR:
+      if (!get_varint(in, &record->address)) {
+        return false;
+      }
+      break;
+  }
+
+  if (op == RAM_TRACE_WRITE_BY_NAME || op == RAM_TRACE_WRITE_BY_ADDR) {
+    record->value_type = fgetc(in);
+
+    if (record->value_type == RAM_TYPE_STR) {
+      return get_varint(in, &record->length);
+    }
+    else if (record->value_type == RAM_TYPE_ARRAY) {
+      record->elem_type = fgetc(in);
+      return record->elem_type != EOF && get_varint(in, &record->length);
+    }
+
+    return record->value_type >= RAM_TYPE_INT && record->value_type <= RAM_TYPE_NONE;
+  }
+
+  if (op == RAM_TRACE_APPEND) {
+    record->elem_type = fgetc(in);
+    return record->elem_type != EOF;
+  }
+
+  if (op == RAM_TRACE_APPEND_STR) {
+    record->value_type = RAM_TYPE_STR;
+    return get_varint(in, &record->length);
+  }
+
+  return true;
+}
+
+
+/**
+  * @brief ram_trace_close: closes a trace opened by ram_trace_open
+  *
+  * @param reader Pointer to the reader
+  * @return void
+  */
+void ram_trace_close(struct RAM_TRACE_READER* reader)
+{
+  if (reader == NULL) {
+    return;
+  }
+
+  fclose(reader->in);
+
+  free(reader->varname);
+  free(reader);
+}
@@ -0,0 +1,132 @@
+/*ram_trace.h*/
+
+/**
+  * @brief Workload traces for nuPython's memory unit
+  *
+  * A memory can record every call that looks up, reads or changes a
+  * variable to a compact binary trace file: the operation, the name
+  * or address, the value's type, and a string's or array's length
+  * (but not the contents, so traces hold no user data). The replay
+  * tool (see replay.c, "make replay") re-executes a trace against
+  * the current build to measure it offline.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+
+#include "ram.h"
+
+
+enum RAM_TRACE_OPS
+{
+  RAM_TRACE_GET_ADDR = 1,    // name
+  RAM_TRACE_READ_BY_NAME,    // name
+  RAM_TRACE_READ_BY_ADDR,    // address
+  RAM_TRACE_WRITE_BY_NAME,   // name, value shape
+  RAM_TRACE_WRITE_BY_ADDR,   // address, value shape
+  RAM_TRACE_APPEND,          // address, elem type
+  RAM_TRACE_TXN_BEGIN,
+  RAM_TRACE_TXN_COMMIT,
+  RAM_TRACE_TXN_ROLLBACK,
+  RAM_TRACE_RESET,
+  RAM_TRACE_APPEND_STR,      // address, length
+  RAM_TRACE_NUM_OPS
+};
+
+//
+// One call, as read back from a trace:
+//
+struct RAM_TRACE_RECORD
+{
+  int   op;           // enum RAM_TRACE_OPS
+  char* varname;      // '\0'-terminated name, NULL if by address (owned by the reader)
+  int   address;      // address, -1 if by name
+  int   value_type;   // writes, string appends: enum RAM_VALUE_TYPES
+  int   length;       // writes: # of chars in a string, or elements in an array;
+                      // string appends: # of chars appended
+  int   elem_type;    // writes of arrays, appends: enum RAM_ARRAY_TYPES
+};
+
+struct RAM_TRACE_STATS
+{
+  long long records;  // # of calls recorded
+  long long bytes;    // # of bytes written to the trace file
+};
+
+struct RAM_TRACE_READER;  // opaque, see ram_trace.c
+
+
+/**
+  * @brief ram_trace_start: starts recording memory's calls to a trace file
+  *
+  * The file is created (or truncated). Recording continues until
+  * ram_trace_stop or ram_destroy. While recording, the typed inline
+  * writes (ram_write_int_by_addr etc.) take their slower path.
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @param path trace file
+  * @return true if successful, false if already recording or the file cannot be created
+  */
+bool ram_trace_start(struct RAM* memory, char* path);
+
+/**
+  * @brief ram_trace_stop: stops recording and closes the trace file
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return true if successful, false if not recording or the file could not be written
+  */
+bool ram_trace_stop(struct RAM* memory);
+
+/**
+  * @brief ram_trace_stats: statistics about memory's trace
+  *
+  * @param memory Pointer to struct denoting memory unit
+  * @return trace statistics, all 0 if not recording
+  */
+struct RAM_TRACE_STATS ram_trace_stats(struct RAM* memory);
+
+/**
+  * @brief ram_trace_open: opens a trace file for reading
+  *
+  * @param path trace file written by ram_trace_start
+  * @return pointer to the reader, or NULL if the file is missing or not a trace
+  */
+struct RAM_TRACE_READER* ram_trace_open(char* path);
+
+/**
+  * @brief ram_trace_next: reads the next call from a trace
+  *
+  * record->varname is only valid until the next call.
+  *
+  * @param reader Pointer to the reader
+  * @param record set to the next call
+  * @return true if a call was read, false at the end of the trace (or a malformed record)
+  */
+bool ram_trace_next(struct RAM_TRACE_READER* reader, struct RAM_TRACE_RECORD* record);
+
+/**
+  * @brief ram_trace_close: closes a trace opened by ram_trace_open
+  *
+  * @param reader Pointer to the reader
+  * @return void
+  */
+void ram_trace_close(struct RAM_TRACE_READER* reader);
+
+
+//
+// Called by ram.c when memory->trace != NULL; not meant to be
+// called directly:
+//
+void trace_name(struct RAM_TRACE* trace, int op, char* varname, int length);
+void trace_addr(struct RAM_TRACE* trace, int op, int address);
+void trace_append(struct RAM_TRACE* trace, int address, int elem_type);
+void trace_append_str(struct RAM_TRACE* trace, int address, int length);
+void trace_write(struct RAM_TRACE* trace, char* varname, int name_length, int address,
+                 int value_type, int length, int elem_type);
+void trace_op(struct RAM_TRACE* trace, int op);
+void trace_typed_read(struct RAM_TRACE* trace, int address);
+void trace_close(struct RAM_TRACE* trace);
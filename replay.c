@@ -0,0 +1,350 @@
+/*replay.c*/
+
+/**
+  * @brief replays a workload trace against nuPython's memory unit
+  *
+  * Build with "make replay", then run
+  *
+  *   ./replay.out <trace file> [# of runs]
+  *
+  * where the trace was recorded by ram_trace_start. The trace is
+  * loaded up front, then executed against a new memory unit: once
+  * untimed, for throughput, and once timing every call, for latency
+  * percentiles by operation. Strings and arrays are written with
+  * filler contents of the recorded lengths. Allocations are counted
+  * with the slab allocator's statistics.
+  *
+  * @note Corey Zhang
+  * @note Northwestern University
+  */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h> // true, false
+#include <string.h>
+#include <time.h>
+
+#include "ram.h"
+#include "ram_slab.h"
+#include "ram_trace.h"
+
+
+static char* op_names[RAM_TRACE_NUM_OPS] = {
+  "",
+  "get_addr",
+  "read_by_name",
+  "read_by_addr",
+  "write_by_name",
+  "write_by_addr",
+  "append",
+  "txn_begin",
+  "txn_commit",
+  "txn_rollback",
+  "reset",
+  "append_str",
+};
+
+//
+// the filler that strings and arrays are written with:
+//
+static char* filler_chars = NULL;
+static double* filler_elems = NULL;
+
+
+/**
+ * @brief now_ns: current time in nanoseconds
+ *
+ * @return nanoseconds since an arbitrary fixed point
+ */
+static long long now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * @brief compare_ns: qsort comparison of two latencies
+ */
+static int compare_ns(const void* a, const void* b)
+{
+  long long x = *(const long long*) a;
+  long long y = *(const long long*) b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ * @brief load: reads every record of a trace into memory
+ *
+ * Names are copied, since the reader reuses its buffer. Also sizes
+ * the filler for the longest string and array in the trace.
+ *
+ * @param path Trace file
+ * @param num_records Set to the # of records read
+ * @return array of records, or NULL if the file cannot be read
+ */
+static struct RAM_TRACE_RECORD* load(char* path, int* num_records)
+{
+  struct RAM_TRACE_READER* reader = ram_trace_open(path);
+
+  if (reader == NULL) {
+    return NULL;
+  }
+
+  int capacity = 1024;
+  int n = 0;
+  int max_length = 1;
+  struct RAM_TRACE_RECORD* records = (struct RAM_TRACE_RECORD*) malloc(capacity * sizeof(struct RAM_TRACE_RECORD));
+  struct RAM_TRACE_RECORD record;
+
+  while (ram_trace_next(reader, &record)) {
+    if (n == capacity) {
+      capacity *= 2;
+      records = (struct RAM_TRACE_RECORD*) realloc(records, capacity * sizeof(struct RAM_TRACE_RECORD));
+    }
+
+    if (record.varname != NULL) {
+      record.varname = strdup(record.varname);
+    }
+
+    if (record.length > max_length) {
+      max_length = record.length;
+    }
+
+    records[n] = record;
+    n++;
+  }
+
+  ram_trace_close(reader);
+
+  filler_chars = (char*) malloc(max_length + 1);
+  memset(filler_chars, 'x', max_length);
+  filler_chars[max_length] = '\0';
+
+  filler_elems = (double*) calloc(max_length, sizeof(double));
+
+  *num_records = n;
+
+  return records;
+}
+
+/**
+ * @brief execute: performs one recorded call
+ *
+ * @param memory Pointer to struct denoting memory unit
+ * @param record Call to perform
+ * @param i Index of the call, used as the value of int writes
+ */
+static void execute(struct RAM* memory, struct RAM_TRACE_RECORD* record, int i)
+{
+  struct RAM_VALUE value;
+
+  switch (record->op) {
+    case RAM_TRACE_GET_ADDR:
+      ram_get_addr(memory, record->varname);
+      break;
+    case RAM_TRACE_READ_BY_NAME:
+      ram_free_value(ram_read_cell_by_name(memory, record->varname));
+      break;
+    case RAM_TRACE_READ_BY_ADDR:
+      ram_free_value(ram_read_cell_by_addr(memory, record->address));
+      break;
+    case RAM_TRACE_WRITE_BY_NAME:
+    case RAM_TRACE_WRITE_BY_ADDR: {
+      bool by_name = (record->op == RAM_TRACE_WRITE_BY_NAME);
+
+      if (record->value_type == RAM_TYPE_STR) {
+        if (by_name) {
+          ram_write_str_by_name(memory, filler_chars, record->length, record->varname);
+        }
+        else {
+          ram_write_str_by_addr(memory, filler_chars, record->length, record->address);
+        }
+        break;
+      }
+
+      if (record->value_type == RAM_TYPE_ARRAY) {
+        if (by_name) {
+          ram_write_array_by_name(memory, record->elem_type, filler_elems, record->length, record->varname);
+        }
+        else {
+          ram_write_array_by_addr(memory, record->elem_type, filler_elems, record->length, record->address);
+        }
+        break;
+      }
+
+      value.value_type = record->value_type;
+
+      if (record->value_type == RAM_TYPE_REAL) {
+        value.types.d = i;
+      }
+      else {
+        value.types.i = i;
+      }
+
+      if (by_name) {
+        ram_write_cell_by_name(memory, value, record->varname);
+      }
+      else {
+        ram_write_cell_by_addr(memory, value, record->address);
+      }
+      break;
+    }
+    case RAM_TRACE_APPEND:
+      if (record->elem_type == RAM_ARRAY_INT) {
+        ram_array_append_int_by_addr(memory, i, record->address);
+      }
+      else {
+        ram_array_append_real_by_addr(memory, i, record->address);
+      }
+      break;
+    case RAM_TRACE_TXN_BEGIN:
+      ram_txn_begin(memory);
+      break;
+    case RAM_TRACE_TXN_COMMIT:
+      ram_txn_commit(memory);
+      break;
+    case RAM_TRACE_TXN_ROLLBACK:
+      ram_txn_rollback(memory);
+      break;
+    case RAM_TRACE_RESET:
+      ram_reset(memory);
+      break;
+    case RAM_TRACE_APPEND_STR:
+      ram_append_str_by_addr(memory, filler_chars, record->length, record->address);
+      break;
+  }
+}
+
+/**
+ * @brief percentile: the latency below which the given % of calls fall
+ *
+ * @param sorted Latencies, sorted
+ * @param n # of latencies (> 0)
+ * @param p Percentile, 0..100
+ * @return latency in ns
+ */
+static long long percentile(long long* sorted, int n, double p)
+{
+  int k = (int) (p / 100.0 * (n - 1) + 0.5);
+
+  return sorted[k];
+}
+
+
+int main(int argc, char* argv[])
+{
+  if (argc < 2) {
+    printf("usage: %s <trace file> [# of runs]\n", argv[0]);
+    return 1;
+  }
+
+  int runs = (argc > 2) ? atoi(argv[2]) : 1;
+  int n = 0;
+  struct RAM_TRACE_RECORD* records = load(argv[1], &n);
+
+  if (records == NULL) {
+    printf("**cannot read trace '%s'\n", argv[1]);
+    return 1;
+  }
+
+  if (n == 0 || runs < 1) {
+    printf("trace '%s' is empty\n", argv[1]);
+    return 0;
+  }
+
+  printf("trace: %s, %d calls, %d run(s)\n", argv[1], n, runs);
+
+  //
+  // throughput: untimed calls
+  //
+  struct RAM_SLAB_STATS before = ram_slab_stats();
+  long long start = now_ns();
+  long long peak_bytes = 0;
+
+  for (int run = 0; run < runs; run++) {
+    struct RAM* memory = ram_init();
+
+    for (int i = 0; i < n; i++) {
+      execute(memory, &records[i], i);
+    }
+
+    if (ram_memory_usage(memory).total > peak_bytes) {
+      peak_bytes = ram_memory_usage(memory).total;
+    }
+
+    ram_destroy(memory);
+  }
+
+  double elapsed = (double) (now_ns() - start);
+  struct RAM_SLAB_STATS after = ram_slab_stats();
+  double calls = (double) n * runs;
+
+  printf("  throughput: %.2f M calls/s (%.1f ns/call)\n", calls / elapsed * 1000.0, elapsed / calls);
+  printf("  allocations: %.2f slab + %.3f malloc'd per call, peak memory %lld bytes\n",
+         (after.allocs - before.allocs) / calls, (after.large - before.large) / calls, peak_bytes);
+
+  //
+  // latency: every call timed, grouped by op
+  //
+  long long timer = now_ns();
+  for (int i = 0; i < 1000; i++) {
+    now_ns();
+  }
+  long long overhead = (now_ns() - timer) / 1000;
+
+  long long* latencies = (long long*) malloc((size_t) n * sizeof(long long));
+  long long* by_op = (long long*) malloc((size_t) n * sizeof(long long));
+  struct RAM* memory = ram_init();
+
+  for (int i = 0; i < n; i++) {
+    long long t = now_ns();
+    execute(memory, &records[i], i);
+    latencies[i] = now_ns() - t - overhead;
+
+    if (latencies[i] < 0) {
+      latencies[i] = 0;
+    }
+  }
+
+  ram_destroy(memory);
+
+  printf("  latency (ns, timer overhead of %lld ns subtracted):\n", overhead);
+  printf("    %-14s %10s %8s %8s %8s %8s %10s\n", "op", "calls", "p50", "p90", "p99", "p99.9", "max");
+
+  for (int op = 0; op < RAM_TRACE_NUM_OPS; op++) {
+    int m = 0;
+
+    for (int i = 0; i < n; i++) {
+      if (op == 0 || records[i].op == op) {
+        by_op[m] = latencies[i];
+        m++;
+      }
+    }
+
+    if (m == 0) {
+      continue;
+    }
+
+    qsort(by_op, m, sizeof(long long), compare_ns);
+
+    printf("    %-14s %10d %8lld %8lld %8lld %8lld %10lld\n", (op == 0) ? "all" : op_names[op], m,
+           percentile(by_op, m, 50), percentile(by_op, m, 90), percentile(by_op, m, 99),
+           percentile(by_op, m, 99.9), by_op[m - 1]);
+  }
+
+  for (int i = 0; i < n; i++) {
+    free(records[i].varname);
+  }
+
+  free(records);
+  free(latencies);
+  free(by_op);
+  free(filler_chars);
+  free(filler_elems);
+
+  return 0;
+}
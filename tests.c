@@ -12,23 +12,52 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>  // INT_MAX, INT_MIN
 #include <gtest/gtest.h>
 
 #include "ram.h"
+#include "ram_heap.h"
+#include "ram_journal.h"
+#include "ram_latency.h"
+#include "ram_layout.h"
+#include "ram_pool.h"
+#include "ram_scope.h"
+#include "ram_shm.h"
+#include "ram_slab.h"
+#include "ram_trace.h"
+#include "ram.hpp"
+
+#include <pthread.h>
+#include <unistd.h>    // fork, pipe
+#include <sys/wait.h>
+#include <poll.h>
+#include <sys/resource.h>  // setrlimit
+#include <signal.h>        // SIGXFSZ
 
 TEST(memory_module, initialization)
 {
   struct RAM* memory = ram_init();
 
   ASSERT_TRUE(memory != NULL);
-  ASSERT_TRUE(memory->cells != NULL);
-  ASSERT_TRUE(memory->map != NULL);
+
+  // cells and map are not allocated until the first write:
+  ASSERT_TRUE(memory->segments == NULL);
+  ASSERT_TRUE(memory->map == NULL);
 
   ASSERT_EQ(ram_size(memory), 0);
   ASSERT_EQ(ram_capacity(memory), 4);
   
-  for (int i=0; i<ram_capacity(memory); i++) {
-    ASSERT_EQ(memory->cells[i].value_type, RAM_TYPE_NONE);
+  struct RAM_VALUE i;
+  i.value_type = RAM_TYPE_INT;
+  i.types.i = 123;
+  ram_write_cell_by_name(memory, i, "x");
+
+  ASSERT_TRUE(memory->segments != NULL);
+  ASSERT_TRUE(memory->map != NULL);
+  ASSERT_EQ(ram_capacity(memory), 4);
+  
+  for (int i=1; i<ram_capacity(memory); i++) {
+    ASSERT_EQ(ram_cell(memory, i)->value_type, RAM_TYPE_NONE);
   }
 
   ram_destroy(memory);
@@ -47,9 +76,9 @@ TEST(memory_module, write_one_int)
 
   ASSERT_EQ(ram_size(memory), 1);
 
-  ASSERT_EQ(memory->cells[0].value_type, RAM_TYPE_INT);
-  ASSERT_EQ(memory->cells[0].types.i, 123);
-  ASSERT_STREQ(memory->map[0].varname, "x");
+  ASSERT_EQ(ram_cell(memory, 0)->value_type, RAM_TYPE_INT);
+  ASSERT_EQ(ram_cell(memory, 0)->types.i, 123);
+  ASSERT_STREQ(ram_map_name(memory, 0), "x");
   ASSERT_EQ(memory->map[0].cell, 0);
 
   ram_destroy(memory);
@@ -94,8 +123,8 @@ TEST(memory_module, write_two_variables_reverse_alphabetical)
     
     ASSERT_EQ(ram_size(memory), 2);
     
-    ASSERT_STREQ(memory->map[0].varname, "a");
-    ASSERT_STREQ(memory->map[1].varname, "z");
+    ASSERT_STREQ(ram_map_name(memory, 0), "a");
+    ASSERT_STREQ(ram_map_name(memory, 1), "z");
     
     ASSERT_EQ(memory->map[0].cell, 1);
     ASSERT_EQ(memory->map[1].cell, 0);
@@ -121,9 +150,9 @@ TEST(memory_module, write_three_variables_mixed_order)
     
     ASSERT_EQ(ram_size(memory), 3);
     
-    ASSERT_STREQ(memory->map[0].varname, "a");
-    ASSERT_STREQ(memory->map[1].varname, "m");
-    ASSERT_STREQ(memory->map[2].varname, "y");
+    ASSERT_STREQ(ram_map_name(memory, 0), "a");
+    ASSERT_STREQ(ram_map_name(memory, 1), "m");
+    ASSERT_STREQ(ram_map_name(memory, 2), "y");
     
     ASSERT_EQ(memory->map[0].cell, 1);
     ASSERT_EQ(memory->map[1].cell, 2);
@@ -525,11 +554,11 @@ TEST(memory_module, alphabetical_ordering_many_vars)
     ram_write_cell_by_name(memory, val, "banana");
     ram_write_cell_by_name(memory, val, "cherry");
     
-    ASSERT_STREQ(memory->map[0].varname, "apple");
-    ASSERT_STREQ(memory->map[1].varname, "banana");
-    ASSERT_STREQ(memory->map[2].varname, "cherry");
-    ASSERT_STREQ(memory->map[3].varname, "donkey");
-    ASSERT_STREQ(memory->map[4].varname, "elephant");
+    ASSERT_STREQ(ram_map_name(memory, 0), "apple");
+    ASSERT_STREQ(ram_map_name(memory, 1), "banana");
+    ASSERT_STREQ(ram_map_name(memory, 2), "cherry");
+    ASSERT_STREQ(ram_map_name(memory, 3), "donkey");
+    ASSERT_STREQ(ram_map_name(memory, 4), "elephant");
     
     ram_destroy(memory);
 }
@@ -557,8 +586,13 @@ TEST(memory_module, none_type_initial)
 {
     struct RAM* memory = ram_init();
     
-    for (int i = 0; i < ram_capacity(memory); i++) {
-        ASSERT_EQ(memory->cells[i].value_type, RAM_TYPE_NONE);
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    for (int i = 1; i < ram_capacity(memory); i++) {
+        ASSERT_EQ(ram_cell(memory, i)->value_type, RAM_TYPE_NONE);
     }
     
     ram_destroy(memory);
@@ -1358,4 +1392,3590 @@ TEST(memory_module, boundary_after_each_growth)
     ASSERT_TRUE(success);
     
     ram_destroy(memory);
-}
\ No newline at end of file
+}
+TEST(memory_module, write_str_with_length)
+{
+    struct RAM* memory = ram_init();
+    
+    bool success = ram_write_str_by_name(memory, "ab\0cd", 5, "s");
+    ASSERT_TRUE(success);
+    ASSERT_EQ(ram_size(memory), 1);
+    
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, "s");
+    ASSERT_TRUE(value != NULL);
+    ASSERT_EQ(value->value_type, RAM_TYPE_STR);
+    ASSERT_EQ(ram_str_length(value->types.s), 5);
+    ASSERT_EQ(memcmp(value->types.s, "ab\0cd", 6), 0);
+    
+    //
+    // writing it back keeps the embedded '\0' only with its length:
+    //
+    ASSERT_TRUE(ram_write_str_by_name(memory, value->types.s, ram_str_length(value->types.s), "t"));
+    ASSERT_TRUE(ram_write_cell_by_name(memory, *value, "u"));
+    
+    ram_free_value(value);
+    
+    value = ram_read_cell_by_name(memory, "t");
+    ASSERT_EQ(ram_str_length(value->types.s), 5);
+    ASSERT_EQ(memcmp(value->types.s, "ab\0cd", 6), 0);
+    ram_free_value(value);
+    
+    value = ram_read_cell_by_name(memory, "u");
+    ASSERT_EQ(ram_str_length(value->types.s), 2);
+    ASSERT_STREQ(value->types.s, "ab");
+    ram_free_value(value);
+    
+    success = ram_write_str_by_addr(memory, "xyz", 2, 0);
+    ASSERT_TRUE(success);
+    
+    value = ram_read_cell_by_addr(memory, 0);
+    ASSERT_EQ(ram_str_length(value->types.s), 2);
+    ASSERT_STREQ(value->types.s, "xy");
+    
+    ram_free_value(value);
+    
+    ASSERT_FALSE(ram_write_str_by_addr(memory, "xyz", 3, 3));
+    ASSERT_FALSE(ram_write_str_by_name(memory, "xyz", -1, "v"));
+    ASSERT_EQ(ram_size(memory), 3);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, str_length_of_plain_write)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_STR;
+    val.types.s = "hello world";
+    ram_write_cell_by_name(memory, val, "s");
+    
+    ASSERT_EQ(ram_str_length(ram_cell(memory, 0)->types.s), 11);
+    
+    struct RAM_VALUE* value = ram_read_cell_by_addr(memory, 0);
+    ASSERT_EQ(ram_str_length(value->types.s), 11);
+    ASSERT_STREQ(value->types.s, "hello world");
+    
+    ram_free_value(value);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, str_hash_cached_and_copied)
+{
+    struct RAM* memory = ram_init();
+    
+    ram_write_str_by_name(memory, "apple", 5, "a");
+    ram_write_str_by_name(memory, "apple", 5, "b");
+    ram_write_str_by_name(memory, "apples", 6, "c");
+    
+    unsigned int hash = ram_str_hash(ram_cell(memory, 0)->types.s);
+    ASSERT_NE(hash, 0u);
+    ASSERT_EQ(hash, ram_str_hash(ram_cell(memory, 1)->types.s));
+    ASSERT_NE(hash, ram_str_hash(ram_cell(memory, 2)->types.s));
+    
+    // the cached hash carries over to copies:
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, "a");
+    ASSERT_EQ(((struct RAM_STR*) value->types.s - 1)->hash, hash);
+    
+    ram_free_value(value);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, str_equals)
+{
+    struct RAM* memory = ram_init();
+    
+    ram_write_str_by_name(memory, "apple", 5, "a");
+    ram_write_str_by_name(memory, "apple", 5, "b");
+    ram_write_str_by_name(memory, "apples", 6, "c");
+    ram_write_str_by_name(memory, "a\0x", 3, "d");
+    ram_write_str_by_name(memory, "a\0y", 3, "e");
+    
+    struct RAM_VALUE* a = ram_read_cell_by_name(memory, "a");
+    struct RAM_VALUE* b = ram_read_cell_by_name(memory, "b");
+    struct RAM_VALUE* c = ram_read_cell_by_name(memory, "c");
+    struct RAM_VALUE* d = ram_read_cell_by_name(memory, "d");
+    struct RAM_VALUE* e = ram_read_cell_by_name(memory, "e");
+    
+    ASSERT_TRUE(ram_str_equals(a->types.s, b->types.s));
+    ASSERT_FALSE(ram_str_equals(a->types.s, c->types.s));
+    ASSERT_FALSE(ram_str_equals(d->types.s, e->types.s));
+    
+    ram_str_hash(a->types.s);
+    ram_str_hash(b->types.s);
+    ASSERT_TRUE(ram_str_equals(a->types.s, b->types.s));
+    
+    ram_free_value(a);
+    ram_free_value(b);
+    ram_free_value(c);
+    ram_free_value(d);
+    ram_free_value(e);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, array_write_read_copy)
+{
+    struct RAM* memory = ram_init();
+    
+    int ints[] = { 1, 2, 3 };
+    bool success = ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 3, "xs");
+    ASSERT_TRUE(success);
+    
+    ints[0] = 100;  // memory owns its own copy
+    
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, "xs");
+    ASSERT_TRUE(value != NULL);
+    ASSERT_EQ(value->value_type, RAM_TYPE_ARRAY);
+    ASSERT_EQ(value->types.a->elem_type, RAM_ARRAY_INT);
+    ASSERT_EQ(value->types.a->length, 3);
+    ASSERT_EQ(value->types.a->elems.i[0], 1);
+    ASSERT_EQ(value->types.a->elems.i[2], 3);
+    
+    // writing the copy back through the generic API deep copies it:
+    ram_write_cell_by_name(memory, *value, "ys");
+    value->types.a->elems.i[0] = -1;
+    ASSERT_EQ(ram_borrow_array_by_addr(memory, 1)->elems.i[0], 1);
+    
+    ram_free_value(value);
+    
+    ASSERT_FALSE(ram_write_array_by_name(memory, 99, ints, 3, "zs"));
+    ASSERT_FALSE(ram_write_array_by_addr(memory, RAM_ARRAY_INT, ints, 3, 2));
+    ASSERT_EQ(ram_size(memory), 2);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, array_borrow_and_append)
+{
+    struct RAM* memory = ram_init();
+    
+    ram_write_array_by_name(memory, RAM_ARRAY_REAL, NULL, 0, "xs");
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 5;
+    ram_write_cell_by_name(memory, val, "n");
+    
+    for (int k = 0; k < 1000; k++) {
+        ASSERT_TRUE(ram_array_append_real_by_addr(memory, k * 0.5, 0));
+    }
+    
+    ASSERT_FALSE(ram_array_append_int_by_addr(memory, 1, 0));  // wrong type
+    ASSERT_FALSE(ram_array_append_real_by_addr(memory, 1.0, 1));  // not an array
+    ASSERT_TRUE(ram_borrow_array_by_addr(memory, 1) == NULL);
+    ASSERT_TRUE(ram_borrow_array_by_addr(memory, 2) == NULL);
+    
+    struct RAM_ARRAY* a = ram_borrow_array_by_addr(memory, 0);
+    ASSERT_TRUE(a != NULL);
+    ASSERT_EQ(a->length, 1000);
+    ASSERT_GE(a->capacity, 1000);
+    ASSERT_LT(a->capacity, 2000);
+    ASSERT_DOUBLE_EQ(a->elems.d[999], 499.5);
+    
+    // overwriting the cell frees the array:
+    ram_write_cell_by_addr(memory, val, 0);
+    ASSERT_TRUE(ram_borrow_array_by_addr(memory, 0) == NULL);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, array_kernels_int)
+{
+    struct RAM* memory = ram_init();
+    
+    int xs[] = { 4, -7, 2, 9, 1, 3, 0 };
+    int ys[] = { 1, 1, 1, 1, 1, 1, 2 };
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, xs, 7, "xs");
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ys, 7, "ys");
+    
+    struct RAM_ARRAY* a = ram_borrow_array_by_addr(memory, 0);
+    struct RAM_ARRAY* b = ram_borrow_array_by_addr(memory, 1);
+    
+    ASSERT_DOUBLE_EQ(ram_array_sum(a), 12.0);
+    
+    double min, max;
+    ASSERT_TRUE(ram_array_minmax(a, &min, &max));
+    ASSERT_DOUBLE_EQ(min, -7.0);
+    ASSERT_DOUBLE_EQ(max, 9.0);
+    
+    double dot;
+    ASSERT_TRUE(ram_array_dot(a, b, &dot));
+    ASSERT_DOUBLE_EQ(dot, 12.0);
+    
+    ASSERT_FALSE(ram_array_scale(a, 1.5));
+    ASSERT_TRUE(ram_array_scale(a, 2));
+    ASSERT_EQ(a->elems.i[1], -14);
+    
+    ASSERT_TRUE(ram_array_add(a, b));
+    ASSERT_EQ(a->elems.i[0], 9);
+    ASSERT_EQ(a->elems.i[6], 2);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, array_kernels_real_and_mixed)
+{
+    struct RAM* memory = ram_init();
+    
+    double xs[] = { 0.5, 1.5, -2.5, 4.0, 10.0 };
+    int ys[] = { 2, 2, 2, 2, 2 };
+    int zs[] = { 1, 2 };
+    ram_write_array_by_name(memory, RAM_ARRAY_REAL, xs, 5, "xs");
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ys, 5, "ys");
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, zs, 2, "zs");
+    ram_write_array_by_name(memory, RAM_ARRAY_REAL, NULL, 0, "empty");
+    
+    struct RAM_ARRAY* x = ram_borrow_array_by_addr(memory, 0);
+    struct RAM_ARRAY* y = ram_borrow_array_by_addr(memory, 1);
+    struct RAM_ARRAY* z = ram_borrow_array_by_addr(memory, 2);
+    struct RAM_ARRAY* empty = ram_borrow_array_by_addr(memory, 3);
+    
+    ASSERT_DOUBLE_EQ(ram_array_sum(x), 13.5);
+    ASSERT_DOUBLE_EQ(ram_array_sum(empty), 0.0);
+    
+    double min, max;
+    ASSERT_FALSE(ram_array_minmax(empty, &min, &max));
+    ASSERT_TRUE(ram_array_minmax(x, &min, &max));
+    ASSERT_DOUBLE_EQ(min, -2.5);
+    ASSERT_DOUBLE_EQ(max, 10.0);
+    
+    double dot;
+    ASSERT_TRUE(ram_array_dot(x, y, &dot));
+    ASSERT_DOUBLE_EQ(dot, 27.0);
+    ASSERT_FALSE(ram_array_dot(x, z, &dot));
+    
+    ASSERT_FALSE(ram_array_add(y, x));  // can't add reals into ints
+    ASSERT_FALSE(ram_array_add(x, z));  // lengths differ
+    ASSERT_TRUE(ram_array_add(x, y));
+    ASSERT_DOUBLE_EQ(x->elems.d[2], -0.5);
+    
+    ASSERT_TRUE(ram_array_scale(x, 0.5));
+    ASSERT_DOUBLE_EQ(x->elems.d[4], 6.0);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, memory_usage_breakdown)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_USAGE usage = ram_memory_usage(memory);
+    ASSERT_EQ(usage.header, (long long) sizeof(struct RAM));
+    ASSERT_EQ(usage.cells, 0);
+    ASSERT_EQ(usage.map, 0);
+    ASSERT_EQ(usage.names, 0);
+    ASSERT_EQ(usage.total, usage.header);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_STR;
+    val.types.s = "hello";
+    ram_write_cell_by_name(memory, val, "abc");
+    
+    usage = ram_memory_usage(memory);
+    ASSERT_EQ(usage.cells, 4 * (long long) sizeof(struct RAM_VALUE) + (long long) sizeof(struct RAM_VALUE*));
+    ASSERT_EQ(usage.map, 4 * (long long) sizeof(struct RAM_MAP));
+    
+    int ints[] = { 1, 2, 3 };
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 3, "xs");
+    
+    usage = ram_memory_usage(memory);
+    ASSERT_EQ(memory->names.used, 4u + 3);  // names share one block
+    ASSERT_EQ(usage.names, (long long) memory->names.capacity);
+    ASSERT_EQ(usage.strings, (long long) sizeof(struct RAM_STR) + 6);
+    ASSERT_EQ(usage.arrays, (long long) sizeof(struct RAM_ARRAY) + 3 * (long long) sizeof(int));
+    
+    // overwriting the string with an int gives its bytes back:
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "abc");
+    
+    for (int i = 0; i < 5; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        ram_write_cell_by_name(memory, val, name);
+    }
+    
+    usage = ram_memory_usage(memory);
+    ASSERT_EQ(usage.strings, 0);
+    ASSERT_EQ(usage.cells, 8 * (long long) sizeof(struct RAM_VALUE) + (long long) sizeof(struct RAM_VALUE*));
+    ASSERT_EQ(usage.map, 8 * (long long) sizeof(struct RAM_MAP));
+    ASSERT_EQ(memory->names.used, 4u + 3 + 5 * 3);
+    ASSERT_EQ(usage.names, (long long) memory->names.capacity);
+    ASSERT_EQ(usage.total, usage.header + usage.cells + usage.map + 
+                           usage.names + usage.strings + usage.arrays);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, memory_budget_rejects_writes)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    long long used = ram_memory_usage(memory).total;
+    ram_set_memory_budget(memory, used + 40);
+    
+    // a string that doesn't fit is rejected and memory is unchanged:
+    char big[100];
+    memset(big, 'a', 99);
+    big[99] = '\0';
+    struct RAM_VALUE str;
+    str.value_type = RAM_TYPE_STR;
+    str.types.s = big;
+    ASSERT_FALSE(ram_write_cell_by_name(memory, str, "x"));
+    ASSERT_FALSE(ram_write_cell_by_addr(memory, str, 0));
+    ASSERT_FALSE(ram_write_cell_by_name(memory, str, "y"));
+    ASSERT_FALSE(ram_write_str_by_name(memory, big, 99, "x"));
+    ASSERT_EQ(ram_size(memory), 1);
+    ASSERT_EQ(ram_memory_usage(memory).total, used);
+    
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, "x");
+    ASSERT_EQ(value->value_type, RAM_TYPE_INT);
+    ram_free_value(value);
+    
+    // small ones still fit:
+    ASSERT_TRUE(ram_write_str_by_name(memory, "hi", 2, "x"));
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, "y"));
+    ASSERT_LE(ram_memory_usage(memory).total, used + 40);
+    
+    // writes that don't need more memory always succeed:
+    ram_set_memory_budget(memory, 1);
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, "x"));
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, "z"));  // a free cell, and room in the names block
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, "w"));
+    ASSERT_FALSE(ram_write_cell_by_name(memory, val, "v"));  // the cells would have to grow
+    
+    ram_set_memory_budget(memory, 0);
+    ASSERT_TRUE(ram_write_cell_by_name(memory, str, "z"));
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, memory_budget_limits_growth)
+{
+    struct RAM* memory = ram_init();
+    
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, NULL, 0, "xs");
+    ram_set_memory_budget(memory, ram_memory_usage(memory).total + 64 * sizeof(int));
+    
+    int appended = 0;
+    while (ram_array_append_int_by_addr(memory, appended, 0)) {
+        appended++;
+    }
+    
+    ASSERT_EQ(appended, 64);
+    ASSERT_EQ(ram_borrow_array_by_addr(memory, 0)->length, 64);
+    ASSERT_LE(ram_memory_usage(memory).total, memory->budget);
+    
+    ram_set_memory_budget(memory, 0);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "a");
+    
+    long long used = ram_memory_usage(memory).total;
+    ram_set_memory_budget(memory, used + 10);
+    
+    // next insert has to grow cells and map, which doesn't fit:
+    ram_write_cell_by_name(memory, val, "b");
+    ram_write_cell_by_name(memory, val, "c");
+    ASSERT_FALSE(ram_write_cell_by_name(memory, val, "d"));
+    ASSERT_EQ(ram_size(memory), 4);
+    ASSERT_EQ(ram_capacity(memory), 4);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, txn_rollback_restores_values)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "x");
+    ram_write_str_by_name(memory, "old", 3, "s");
+    
+    struct RAM_USAGE before = ram_memory_usage(memory);
+    
+    ram_txn_begin(memory);
+    ASSERT_EQ(ram_txn_depth(memory), 1);
+    
+    ram_write_str_by_name(memory, "new", 3, "x");
+    val.types.i = 2;
+    ram_write_cell_by_name(memory, val, "s");
+    ram_write_cell_by_addr(memory, val, 0);
+    
+    // add enough new variables to force growth:
+    for (int i = 0; i < 10; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        ram_write_str_by_name(memory, name, 2, name);
+    }
+    ASSERT_EQ(ram_size(memory), 12);
+    
+    ASSERT_TRUE(ram_txn_rollback(memory));
+    ASSERT_EQ(ram_txn_depth(memory), 0);
+    
+    ASSERT_EQ(ram_size(memory), 2);
+    ASSERT_EQ(ram_get_addr(memory, "v0"), -1);
+    ASSERT_EQ(ram_get_addr(memory, "x"), 0);
+    ASSERT_EQ(ram_get_addr(memory, "s"), 1);
+    ASSERT_TRUE(ram_read_cell_by_addr(memory, 2) == NULL);
+    ASSERT_STREQ(ram_map_name(memory, 0), "s");
+    ASSERT_STREQ(ram_map_name(memory, 1), "x");
+    
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, "x");
+    ASSERT_EQ(value->value_type, RAM_TYPE_INT);
+    ASSERT_EQ(value->types.i, 1);
+    ram_free_value(value);
+    
+    value = ram_read_cell_by_name(memory, "s");
+    ASSERT_EQ(value->value_type, RAM_TYPE_STR);
+    ASSERT_STREQ(value->types.s, "old");
+    ram_free_value(value);
+    
+    struct RAM_USAGE after = ram_memory_usage(memory);
+    ASSERT_EQ(after.names, before.names);
+    ASSERT_EQ(after.strings, before.strings);
+    
+    // memory is fully usable afterwards:
+    ram_write_cell_by_name(memory, val, "v0");
+    ASSERT_EQ(ram_get_addr(memory, "v0"), 2);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, txn_commit_keeps_values)
+{
+    struct RAM* memory = ram_init();
+    
+    ASSERT_FALSE(ram_txn_commit(memory));
+    ASSERT_FALSE(ram_txn_rollback(memory));
+    
+    ram_write_str_by_name(memory, "a", 1, "x");
+    
+    // several committed transactions, so old log entries get reused:
+    for (int round = 0; round < 3; round++) {
+        ram_txn_begin(memory);
+        for (int i = 0; i < 20; i++) {
+            char s[10];
+            sprintf(s, "%d-%d", round, i);
+            ram_write_str_by_name(memory, s, (int) strlen(s), "x");
+        }
+        ASSERT_TRUE(ram_txn_commit(memory));
+    }
+    
+    ASSERT_EQ(ram_txn_depth(memory), 0);
+    
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, "x");
+    ASSERT_STREQ(value->types.s, "2-19");
+    ram_free_value(value);
+    
+    // nothing to roll back once committed:
+    ASSERT_FALSE(ram_txn_rollback(memory));
+    
+    // the old values are freed by the commit, leaving just the log
+    // itself, and stop counting against the budget:
+    long long log_bytes = ram_memory_usage(memory).undo;
+    ASSERT_LT(log_bytes, 1000);
+    
+    char big[100000];
+    memset(big, 'b', sizeof(big));
+    ram_write_str_by_name(memory, big, sizeof(big), "x");
+    ram_txn_begin(memory);
+    ram_write_str_by_name(memory, "small", 5, "x");
+    ASSERT_GT(ram_memory_usage(memory).undo, log_bytes + (long long) sizeof(big));
+    ASSERT_TRUE(ram_txn_commit(memory));
+    ASSERT_EQ(ram_memory_usage(memory).undo, log_bytes);
+    
+    ram_set_memory_budget(memory, ram_memory_usage(memory).total + 50000);
+    ASSERT_TRUE(ram_write_str_by_name(memory, big, 1000, "y"));
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, txn_nested_savepoints)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    ram_txn_begin(memory);
+    val.types.i = 2;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    ram_txn_begin(memory);
+    val.types.i = 3;
+    ram_write_cell_by_name(memory, val, "x");
+    ram_write_cell_by_name(memory, val, "y");
+    ASSERT_EQ(ram_txn_depth(memory), 2);
+    
+    // inner rollback only undoes the inner changes:
+    ASSERT_TRUE(ram_txn_rollback(memory));
+    ASSERT_EQ(ram_size(memory), 1);
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 2);
+    
+    ram_txn_begin(memory);
+    val.types.i = 4;
+    ram_write_cell_by_name(memory, val, "z");
+    ASSERT_TRUE(ram_txn_commit(memory));
+    ASSERT_EQ(ram_size(memory), 2);
+    
+    // outer rollback also undoes the committed inner transaction:
+    ASSERT_TRUE(ram_txn_rollback(memory));
+    ASSERT_EQ(ram_size(memory), 1);
+    ASSERT_EQ(ram_get_addr(memory, "z"), -1);
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 1);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, txn_rollback_array_appends)
+{
+    struct RAM* memory = ram_init();
+    
+    int ints[] = { 1, 2 };
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 2, "xs");
+    
+    ram_txn_begin(memory);
+    for (int i = 0; i < 10; i++) {
+        ram_array_append_int_by_addr(memory, i, 0);
+    }
+    ASSERT_EQ(ram_borrow_array_by_addr(memory, 0)->length, 12);
+    
+    ram_write_str_by_addr(memory, "gone", 4, 0);
+    ASSERT_TRUE(ram_borrow_array_by_addr(memory, 0) == NULL);
+    
+    ram_txn_rollback(memory);
+    
+    struct RAM_ARRAY* a = ram_borrow_array_by_addr(memory, 0);
+    ASSERT_TRUE(a != NULL);
+    ASSERT_EQ(a->length, 2);
+    ASSERT_EQ(a->elems.i[1], 2);
+    
+    ram_destroy(memory);
+}
+
+//
+// checks that two memories hold the same variables at the same
+// addresses with the same values:
+//
+static void assert_same_memory(struct RAM* expected, struct RAM* actual)
+{
+    ASSERT_EQ(ram_size(actual), ram_size(expected));
+    
+    for (int i = 0; i < ram_size(expected); i++) {
+        ASSERT_STREQ(ram_map_name(actual, i), ram_map_name(expected, i));
+        ASSERT_EQ(actual->map[i].cell, expected->map[i].cell);
+        
+        struct RAM_VALUE* e = ram_cell(expected, i);
+        struct RAM_VALUE* a = ram_cell(actual, i);
+        
+        ASSERT_EQ(a->value_type, e->value_type);
+        
+        if (e->value_type == RAM_TYPE_STR) {
+            ASSERT_TRUE(ram_str_equals(a->types.s, e->types.s));
+        }
+        else if (e->value_type == RAM_TYPE_REAL) {
+            ASSERT_DOUBLE_EQ(a->types.d, e->types.d);
+        }
+        else if (e->value_type == RAM_TYPE_ARRAY) {
+            ASSERT_EQ(a->types.a->elem_type, e->types.a->elem_type);
+            ASSERT_EQ(a->types.a->length, e->types.a->length);
+            ASSERT_EQ(memcmp(a->types.a->elems.i, e->types.a->elems.i, 
+                             e->types.a->length * (e->types.a->elem_type == RAM_ARRAY_INT ? sizeof(int) : sizeof(double))), 0);
+        }
+        else if (e->value_type != RAM_TYPE_NONE) {
+            ASSERT_EQ(a->types.i, e->types.i);
+        }
+    }
+}
+
+TEST(memory_module, checkpoint_full_and_deltas)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    
+    for (int i = 0; i < 20; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ram_write_str_by_name(memory, "a\0b", 3, "s");
+    
+    ASSERT_FALSE(ram_checkpoint_delta(memory, "test_ckpt.d1"));  // no base yet
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_ckpt.img"));
+    ASSERT_EQ(memory->dirty.num_cells, 0);
+    
+    // first delta: a couple of overwrites and a new var:
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = 2.5;
+    ram_write_cell_by_name(memory, val, "v3");
+    ram_write_cell_by_name(memory, val, "v3");
+    double reals[] = { 1.5, 2.5 };
+    ram_write_array_by_name(memory, RAM_ARRAY_REAL, reals, 2, "xs");
+    ASSERT_EQ(memory->dirty.num_cells, 2);
+    ASSERT_EQ(memory->dirty.num_names, 1);
+    ASSERT_TRUE(ram_checkpoint_delta(memory, "test_ckpt.d1"));
+    ASSERT_EQ(memory->dirty.num_cells, 0);
+    
+    // second delta: more changes, including an append:
+    ram_array_append_real_by_addr(memory, 3.5, ram_get_addr(memory, "xs"));
+    ram_write_str_by_name(memory, "new", 3, "a_new_var");
+    val.value_type = RAM_TYPE_BOOLEAN;
+    val.types.i = 1;
+    ram_write_cell_by_addr(memory, val, 0);
+    ASSERT_TRUE(ram_checkpoint_delta(memory, "test_ckpt.d2"));
+    
+    char* deltas[] = { "test_ckpt.d1", "test_ckpt.d2" };
+    
+    struct RAM* loaded = ram_load_checkpoint("test_ckpt.img", deltas, 2);
+    ASSERT_TRUE(loaded != NULL);
+    assert_same_memory(memory, loaded);
+    ASSERT_EQ(ram_str_length(ram_cell(loaded, 20)->types.s), 3);
+    ram_destroy(loaded);
+    
+    // base plus only the first delta:
+    loaded = ram_load_checkpoint("test_ckpt.img", deltas, 1);
+    ASSERT_TRUE(loaded != NULL);
+    ASSERT_EQ(ram_size(loaded), 22);
+    ASSERT_EQ(ram_get_addr(loaded, "a_new_var"), -1);
+    ASSERT_EQ(ram_borrow_array_by_addr(loaded, 21)->length, 2);
+    ram_destroy(loaded);
+    
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt.missing", NULL, 0) == NULL);
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt.d1", NULL, 0) == NULL);  // not an image
+    
+    remove("test_ckpt.img");
+    remove("test_ckpt.d1");
+    remove("test_ckpt.d2");
+    ram_destroy(memory);
+}
+
+TEST(memory_module, checkpoint_delta_after_rollback)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "a");
+    ram_write_cell_by_name(memory, val, "b");
+    
+    // "c" is added inside a transaction that is still open when the
+    // base image is taken, then rolled back:
+    ram_txn_begin(memory);
+    ram_write_cell_by_name(memory, val, "c");
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_ckpt2.img"));
+    ram_write_cell_by_name(memory, val, "d");
+    ram_txn_rollback(memory);
+    
+    ASSERT_EQ(ram_size(memory), 2);
+    
+    val.types.i = 7;
+    ram_write_cell_by_name(memory, val, "e");
+    ram_write_cell_by_name(memory, val, "a");
+    ASSERT_TRUE(ram_checkpoint_delta(memory, "test_ckpt2.d1"));
+    
+    char* deltas[] = { "test_ckpt2.d1" };
+    struct RAM* loaded = ram_load_checkpoint("test_ckpt2.img", deltas, 1);
+    ASSERT_TRUE(loaded != NULL);
+    assert_same_memory(memory, loaded);
+    ASSERT_EQ(ram_get_addr(loaded, "c"), -1);
+    ASSERT_EQ(ram_get_addr(loaded, "e"), 2);
+    
+    remove("test_ckpt2.img");
+    remove("test_ckpt2.d1");
+    ram_destroy(loaded);
+    ram_destroy(memory);
+}
+
+//
+// writes a base image (see write_image in ram.c) whose header claims
+// size variables, followed by the n given (cell, name) pairs and n
+// int values:
+//
+static void write_test_image(const char* path, int size, int* cells, const char** names, int n)
+{
+    FILE* out = fopen(path, "wb");
+    int magic = 0x494D4152;  // RAM_IMAGE_MAGIC
+    fwrite(&magic, sizeof(int), 1, out);
+    fwrite(&size, sizeof(int), 1, out);
+    for (int i = 0; i < n; i++) {
+        int length = (int) strlen(names[i]);
+        fwrite(&cells[i], sizeof(int), 1, out);
+        fwrite(&length, sizeof(int), 1, out);
+        fwrite(names[i], 1, length, out);
+    }
+    for (int i = 0; i < n; i++) {
+        int type = RAM_TYPE_INT;
+        fwrite(&type, sizeof(int), 1, out);
+        fwrite(&i, sizeof(int), 1, out);
+    }
+    fclose(out);
+}
+
+TEST(memory_module, checkpoint_rejects_corrupt_image)
+{
+    int cells[] = { 0, 1, 2 };
+    const char* names[] = { "a", "b", "c" };
+    
+    // a well-formed image loads:
+    write_test_image("test_ckpt3.img", 3, cells, names, 3);
+    struct RAM* loaded = ram_load_checkpoint("test_ckpt3.img", NULL, 0);
+    ASSERT_TRUE(loaded != NULL);
+    ASSERT_EQ(ram_get_addr(loaded, "c"), 2);
+    ram_destroy(loaded);
+    
+    // more variables than memory can address:
+    write_test_image("test_ckpt3.img", INT_MAX, cells, names, 0);
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt3.img", NULL, 0) == NULL);
+    write_test_image("test_ckpt3.img", RAM_MAX_CAPACITY + 1, cells, names, 0);
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt3.img", NULL, 0) == NULL);
+    
+    // names out of order or repeated, which the map's binary search
+    // can't cope with:
+    const char* unsorted[] = { "a", "c", "b" };
+    write_test_image("test_ckpt3.img", 3, cells, unsorted, 3);
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt3.img", NULL, 0) == NULL);
+    const char* repeated[] = { "a", "b", "b" };
+    write_test_image("test_ckpt3.img", 3, cells, repeated, 3);
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt3.img", NULL, 0) == NULL);
+    
+    // a cell named twice, leaving another without a name:
+    int twice[] = { 0, 2, 2 };
+    write_test_image("test_ckpt3.img", 3, twice, names, 3);
+    ASSERT_TRUE(ram_load_checkpoint("test_ckpt3.img", NULL, 0) == NULL);
+    
+    // cells in any order are fine, as long as each appears once:
+    int shuffled[] = { 2, 0, 1 };
+    write_test_image("test_ckpt3.img", 3, shuffled, names, 3);
+    loaded = ram_load_checkpoint("test_ckpt3.img", NULL, 0);
+    ASSERT_TRUE(loaded != NULL);
+    ASSERT_EQ(ram_get_addr(loaded, "a"), 2);
+    ram_destroy(loaded);
+    
+    remove("test_ckpt3.img");
+}
+
+TEST(memory_module, snapshot_matches_state_at_call)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    
+    for (int i = 0; i < 5000; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ram_write_str_by_name(memory, "a\0b", 3, "s");
+    int ints[] = { 1, 2, 3 };
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 3, "xs");
+    
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_snap_expected.img"));
+    struct RAM* expected = ram_load_checkpoint("test_snap_expected.img", NULL, 0);
+    ASSERT_TRUE(expected != NULL);
+    
+    struct RAM_SNAPSHOT* snapshot = ram_snapshot_async(memory, "test_snap.img");
+    ASSERT_TRUE(snapshot != NULL);
+    
+    // change everything while the child writes; none of it may show up:
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = -1.0;
+    for (int i = 0; i < 5000; i++) {
+        ram_write_cell_by_addr(memory, val, i);
+    }
+    ram_append_str_by_addr(memory, "cd", 2, ram_get_addr(memory, "s"));
+    ram_array_append_int_by_addr(memory, 4, ram_get_addr(memory, "xs"));
+    ram_write_cell_by_name(memory, val, "added_later");
+    
+    ASSERT_TRUE(ram_snapshot_wait(snapshot));
+    
+    struct RAM* loaded = ram_load_checkpoint("test_snap.img", NULL, 0);
+    ASSERT_TRUE(loaded != NULL);
+    assert_same_memory(expected, loaded);
+    ASSERT_EQ(ram_get_addr(loaded, "added_later"), -1);
+    
+    // and memory itself kept the changes:
+    ASSERT_EQ(ram_cell(memory, 42)->value_type, RAM_TYPE_REAL);
+    ASSERT_EQ(ram_size(memory), 5003);
+    
+    remove("test_snap_expected.img");
+    remove("test_snap.img");
+    ram_destroy(loaded);
+    ram_destroy(expected);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, snapshot_is_pollable)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 7;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    struct RAM_SNAPSHOT* snapshot = ram_snapshot_async(memory, "test_snap2.img");
+    ASSERT_TRUE(snapshot != NULL);
+    
+    // the descriptor becomes readable once the child is done:
+    struct pollfd fd = { ram_snapshot_fd(snapshot), POLLIN, 0 };
+    ASSERT_EQ(poll(&fd, 1, 10000), 1);
+    
+    int status;
+    while ((status = ram_snapshot_poll(snapshot)) == RAM_SNAPSHOT_RUNNING) {
+        usleep(1000);
+    }
+    ASSERT_EQ(status, RAM_SNAPSHOT_DONE);
+    ASSERT_EQ(ram_snapshot_poll(snapshot), RAM_SNAPSHOT_DONE);
+    ASSERT_TRUE(ram_snapshot_wait(snapshot));
+    
+    struct RAM* loaded = ram_load_checkpoint("test_snap2.img", NULL, 0);
+    ASSERT_TRUE(loaded != NULL);
+    assert_same_memory(memory, loaded);
+    ram_destroy(loaded);
+    
+    // no temporary file is left behind:
+    ASSERT_NE(access("test_snap2.img.tmp", F_OK), 0);
+    
+    remove("test_snap2.img");
+    ram_destroy(memory);
+}
+
+TEST(memory_module, snapshot_reports_failure)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 7;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    struct RAM_SNAPSHOT* snapshot = ram_snapshot_async(memory, "no_such_dir/test_snap3.img");
+    ASSERT_TRUE(snapshot != NULL);
+    
+    struct pollfd fd = { ram_snapshot_fd(snapshot), POLLIN, 0 };
+    ASSERT_EQ(poll(&fd, 1, 10000), 1);
+    ASSERT_FALSE(ram_snapshot_wait(snapshot));
+    
+    // the child's exit doesn't disturb the parent's memory:
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 7);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, journal_replay_restores_memory)
+{
+    remove("test_journal.tmp");
+    
+    struct RAM_JOURNAL_CONFIG config = { 0, 0 };
+    struct RAM* memory = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_TRUE(memory != NULL);
+    ASSERT_EQ(ram_size(memory), 0);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 42;
+    ram_write_cell_by_name(memory, val, "x");
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = 1.25;
+    ram_write_cell_by_name(memory, val, "y");
+    ram_write_str_by_name(memory, "a\0b", 3, "s");
+    int ints[] = { 1, 2, 3 };
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 3, "xs");
+    ram_array_append_int_by_addr(memory, 4, 3);
+    val.value_type = RAM_TYPE_BOOLEAN;
+    val.types.i = 1;
+    ram_write_cell_by_addr(memory, val, 0);
+    
+    ram_txn_begin(memory);
+    ram_write_str_by_name(memory, "undone", 6, "x");
+    ram_write_cell_by_name(memory, val, "z");
+    ram_txn_rollback(memory);
+    
+    ASSERT_EQ(ram_journal_stats(memory).records, 10);
+    
+    // keep a copy of the expected state, then "crash" and recover:
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_journal.img"));
+    struct RAM* expected = ram_load_checkpoint("test_journal.img", NULL, 0);
+    ram_destroy(memory);
+    
+    memory = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_TRUE(memory != NULL);
+    ASSERT_EQ(ram_journal_stats(memory).replayed, 10);
+    assert_same_memory(expected, memory);
+    
+    // and new writes go to the end of the journal:
+    ram_write_str_by_name(memory, "more", 4, "t");
+    ram_destroy(memory);
+    
+    memory = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_EQ(ram_size(memory), 5);
+    ASSERT_STREQ(ram_cell(memory, 4)->types.s, "more");
+    
+    remove("test_journal.tmp");
+    remove("test_journal.img");
+    ram_destroy(expected);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, journal_discards_torn_record_and_open_txn)
+{
+    remove("test_journal2.tmp");
+    
+    struct RAM_JOURNAL_CONFIG config = { 1, 0 };
+    struct RAM* memory = ram_init_journaled("test_journal2.tmp", config);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "a");
+    
+    // a transaction that never commits:
+    ram_txn_begin(memory);
+    val.types.i = 2;
+    ram_write_cell_by_name(memory, val, "a");
+    ram_write_cell_by_name(memory, val, "b");
+    
+    ASSERT_EQ(ram_journal_stats(memory).syncs, 4);  // every record
+    
+    // simulate a crash: copy the journal as it is on disk, with half
+    // of a record appended to it:
+    FILE* in = fopen("test_journal2.tmp", "rb");
+    FILE* out = fopen("test_journal2.crash", "wb");
+    char buffer[4096];
+    size_t n = fread(buffer, 1, sizeof(buffer), in);
+    fwrite(buffer, 1, n, out);
+    fwrite(buffer, 1, 10, out);
+    fclose(in);
+    fclose(out);
+    ram_destroy(memory);
+    
+    memory = ram_init_journaled("test_journal2.crash", config);
+    ASSERT_TRUE(memory != NULL);
+    ASSERT_EQ(ram_journal_stats(memory).replayed, 4);
+    ASSERT_EQ(ram_txn_depth(memory), 0);
+    ASSERT_EQ(ram_size(memory), 1);
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 1);
+    
+    val.types.i = 3;
+    ram_write_cell_by_name(memory, val, "c");
+    ram_destroy(memory);
+    
+    // the recovery's rollback was journaled too, so "c" is outside
+    // any transaction on the next replay:
+    memory = ram_init_journaled("test_journal2.crash", config);
+    ASSERT_EQ(ram_size(memory), 2);
+    ASSERT_EQ(ram_get_addr(memory, "c"), 1);
+    ASSERT_EQ(ram_get_addr(memory, "b"), -1);
+    
+    ASSERT_TRUE(ram_init_journaled("no_such_dir/journal.tmp", config) == NULL);
+    
+    remove("test_journal2.tmp");
+    remove("test_journal2.crash");
+    ram_destroy(memory);
+}
+
+//
+// Writes to a journal whose file can't grow past a few records, then
+// lets it grow again. Returns the # of checks that failed.
+//
+static int journal_until_file_full(void)
+{
+    signal(SIGXFSZ, SIG_IGN);  // a write past the limit fails with EFBIG
+    
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_FSIZE, &limit) != 0) {
+        return 100;
+    }
+    rlim_t unlimited = limit.rlim_cur;
+    
+    int failures = 0;
+    struct RAM_JOURNAL_CONFIG config = { 1, 0 };
+    struct RAM* memory = ram_init_journaled((char*) "test_journal3.tmp", config);
+    if (memory == NULL) {
+        return 100;
+    }
+    
+    // each record is ~3000 bytes, so the 4th is written in part:
+    limit.rlim_cur = 10000;
+    if (setrlimit(RLIMIT_FSIZE, &limit) != 0) {
+        return 100;
+    }
+    
+    char s[3000];
+    char name[16];
+    for (int i = 0; i < 5; i++) {
+        memset(s, 'a' + i, sizeof(s));
+        sprintf(name, "s%d", i);
+        failures += !ram_write_str_by_name(memory, s, sizeof(s), name);
+    }
+    failures += ram_journal_sync(memory);
+    
+    // once the file can grow, the rest of the torn record follows
+    // what was written of it, but the failure is still reported:
+    limit.rlim_cur = unlimited;
+    if (setrlimit(RLIMIT_FSIZE, &limit) != 0) {
+        return 100;
+    }
+    
+    for (int i = 5; i < 8; i++) {
+        memset(s, 'a' + i, sizeof(s));
+        sprintf(name, "s%d", i);
+        failures += !ram_write_str_by_name(memory, s, sizeof(s), name);
+    }
+    failures += ram_journal_sync(memory);
+    failures += ram_journal_close(memory);
+    failures += ram_journal_close(memory);  // not journaled anymore
+    ram_destroy(memory);
+    
+    // and every record replays:
+    memory = ram_init_journaled((char*) "test_journal3.tmp", config);
+    failures += (memory == NULL);
+    if (memory != NULL) {
+        failures += (ram_journal_stats(memory).replayed != 8);
+        failures += (ram_size(memory) != 8);
+        for (int i = 0; i < 8 && i < ram_size(memory); i++) {
+            char* value = ram_cell(memory, i)->types.s;
+            failures += (ram_str_length(value) != (int) sizeof(s) || value[0] != 'a' + i || value[sizeof(s) - 1] != 'a' + i);
+        }
+        failures += !ram_journal_close(memory);
+        ram_destroy(memory);
+    }
+    
+    remove("test_journal3.tmp");
+    return failures;
+}
+
+TEST(memory_module, journal_reports_failed_writes_and_resumes_torn_record)
+{
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        _exit(journal_until_file_full());
+    }
+    
+    int status = -1;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST(memory_module, reset_keeps_cells)
+{
+    struct RAM* memory = ram_init();
+    
+    // nothing but the header is allocated until the first write:
+    ASSERT_EQ(ram_memory_usage(memory).total, ram_memory_usage(memory).header);
+    
+    char* s = (char*) "a string value";
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 20; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ram_write_str_by_name(memory, s, (int) strlen(s), (char*) "s");
+    
+    int capacity = ram_capacity(memory);
+    struct RAM_VALUE* cells = ram_cell(memory, 0);
+    long long cells_bytes = ram_memory_usage(memory).cells;
+    
+    ram_reset(memory);
+    
+    ASSERT_EQ(ram_size(memory), 0);
+    ASSERT_EQ(ram_capacity(memory), capacity);
+    ASSERT_TRUE(ram_cell(memory, 0) == cells);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "v3"), -1);
+    ASSERT_EQ(ram_memory_usage(memory).names, 0);
+    ASSERT_EQ(ram_memory_usage(memory).strings, 0);
+    ASSERT_EQ(ram_memory_usage(memory).cells, cells_bytes);
+    
+    // memory is usable again, without reallocating:
+    val.types.i = 42;
+    ram_write_cell_by_name(memory, val, (char*) "x");
+    ASSERT_EQ(ram_get_addr(memory, (char*) "x"), 0);
+    ASSERT_TRUE(ram_cell(memory, 0) == cells);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, reserve_and_trim)
+{
+    struct RAM* memory = ram_init();
+    
+    ram_reserve(memory, 100);
+    ASSERT_EQ(ram_capacity(memory), 100);
+    ASSERT_EQ(ram_size(memory), 0);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, (char*) "x");
+    
+    // only an empty memory can be trimmed:
+    ASSERT_FALSE(ram_trim(memory, 8));
+    ASSERT_EQ(ram_capacity(memory), 100);
+    
+    ram_reset(memory);
+    ASSERT_TRUE(ram_trim(memory, 8));
+    ASSERT_EQ(ram_capacity(memory), 8);
+    
+    for (int i = 0; i < 10; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ASSERT_EQ(ram_size(memory), 10);
+    struct RAM_VALUE* read = ram_read_cell_by_name(memory, (char*) "v9");
+    ASSERT_EQ(read->types.i, 9);
+    ram_free_value(read);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, segments_keep_cells_in_place)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 2 * RAM_SEGMENT_CELLS; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ASSERT_EQ(memory->num_segments, 2);
+    
+    // pointers into full segments, including segment 0 now that it
+    // is full size:
+    struct RAM_VALUE* first = ram_cell(memory, 5);
+    struct RAM_VALUE* second = ram_cell(memory, RAM_SEGMENT_CELLS + 7);
+    
+    // grow across several more segments:
+    for (int i = 2 * RAM_SEGMENT_CELLS; i < 9 * RAM_SEGMENT_CELLS + 3; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ASSERT_EQ(ram_capacity(memory), 16 * RAM_SEGMENT_CELLS);
+    ASSERT_EQ(memory->num_segments, 16);
+    
+    ASSERT_TRUE(ram_cell(memory, 5) == first);
+    ASSERT_TRUE(ram_cell(memory, RAM_SEGMENT_CELLS + 7) == second);
+    ASSERT_EQ(first->types.i, 5);
+    ASSERT_EQ(second->types.i, RAM_SEGMENT_CELLS + 7);
+    
+    // every address still reaches its own cell:
+    for (int i = 0; i < ram_size(memory); i++) {
+        int x = -1;
+        ASSERT_TRUE(ram_read_int_by_addr(memory, i, &x));
+        ASSERT_EQ(x, i);
+    }
+    
+    // writes through an address land in the same cell:
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 99, RAM_SEGMENT_CELLS + 7));
+    ASSERT_EQ(second->types.i, 99);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, segments_reserve_and_trim)
+{
+    struct RAM* memory = ram_init();
+    
+    // more than a segment is rounded up to whole segments:
+    ASSERT_TRUE(ram_reserve(memory, RAM_SEGMENT_CELLS + 1));
+    ASSERT_EQ(ram_capacity(memory), 2 * RAM_SEGMENT_CELLS);
+    ASSERT_EQ(memory->num_segments, 2);
+    
+    ASSERT_FALSE(ram_reserve(memory, RAM_MAX_CAPACITY + 1));
+    ASSERT_EQ(ram_capacity(memory), 2 * RAM_SEGMENT_CELLS);
+    
+    struct RAM_USAGE usage = ram_memory_usage(memory);
+    ASSERT_EQ(usage.cells, 2 * RAM_SEGMENT_CELLS * (long long) sizeof(struct RAM_VALUE) +
+                           memory->max_segments * (long long) sizeof(struct RAM_VALUE*));
+    
+    // trimming frees whole segments, then shrinks segment 0:
+    ASSERT_TRUE(ram_trim(memory, 16));
+    ASSERT_EQ(ram_capacity(memory), 16);
+    ASSERT_EQ(memory->num_segments, 1);
+    usage = ram_memory_usage(memory);
+    ASSERT_EQ(usage.cells, 16 * (long long) sizeof(struct RAM_VALUE) +
+                           memory->max_segments * (long long) sizeof(struct RAM_VALUE*));
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 3 * RAM_SEGMENT_CELLS; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ASSERT_EQ(ram_capacity(memory), 4 * RAM_SEGMENT_CELLS);
+    
+    int x = -1;
+    ASSERT_TRUE(ram_read_int_by_addr(memory, ram_get_addr(memory, (char*) "v3000"), &x));
+    ASSERT_EQ(x, 3000);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, pool_reuses_memory)
+{
+    struct RAM_POOL_CONFIG config = { 1, 16, 2, 32 };
+    struct RAM_POOL* pool = ram_pool_create(config);
+    
+    ASSERT_EQ(ram_pool_stats(pool).idle, 1);
+    
+    struct RAM* memory = ram_pool_acquire(pool);
+    ASSERT_EQ(ram_capacity(memory), 16);
+    ASSERT_EQ(ram_size(memory), 0);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 40; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ram_set_memory_budget(memory, 100000);
+    ram_pool_release(pool, memory);
+    
+    // same memory comes back, empty, trimmed, and without a budget:
+    struct RAM* again = ram_pool_acquire(pool);
+    ASSERT_TRUE(again == memory);
+    ASSERT_EQ(ram_size(again), 0);
+    ASSERT_EQ(ram_capacity(again), 32);
+    ASSERT_EQ(again->budget, 0);
+    
+    // pool is empty, so a new memory is created:
+    struct RAM* other = ram_pool_acquire(pool);
+    struct RAM* third = ram_pool_acquire(pool);
+    ASSERT_TRUE(other != again);
+    
+    ram_pool_release(pool, again);
+    ram_pool_release(pool, other);
+    ram_pool_release(pool, third);  // pool is full, destroyed
+    
+    struct RAM_POOL_STATS stats = ram_pool_stats(pool);
+    ASSERT_EQ(stats.acquired, 4);
+    ASSERT_EQ(stats.reused, 2);
+    ASSERT_EQ(stats.released, 4);
+    ASSERT_EQ(stats.trimmed, 1);
+    ASSERT_EQ(stats.destroyed, 1);
+    ASSERT_EQ(stats.idle, 2);
+    
+    ram_pool_destroy(pool);
+}
+
+TEST(memory_module, pool_destroys_traced_memory)
+{
+    struct RAM_POOL_CONFIG config = { 0, 16, 2, 0 };
+    struct RAM_POOL* pool = ram_pool_create(config);
+    
+    struct RAM* memory = ram_pool_acquire(pool);
+    ASSERT_TRUE(ram_trace_start(memory, (char*) "test_pool_trace.tmp"));
+    ram_pool_release(pool, memory);
+    
+    // the trace is closed with the memory, not handed to the next user:
+    ASSERT_EQ(ram_pool_stats(pool).destroyed, 1);
+    ASSERT_EQ(ram_pool_stats(pool).idle, 0);
+    memory = ram_pool_acquire(pool);
+    ASSERT_TRUE(memory->trace == NULL);
+    ASSERT_FALSE(memory->observed);
+    
+    ram_pool_release(pool, memory);
+    ASSERT_EQ(ram_pool_stats(pool).idle, 1);
+    
+    remove("test_pool_trace.tmp");
+    ram_pool_destroy(pool);
+}
+
+TEST(memory_module, pool_destroys_memory_with_heap)
+{
+    struct RAM_POOL_CONFIG config = { 0, 16, 2, 0 };
+    struct RAM_POOL* pool = ram_pool_create(config);
+    
+    struct RAM* memory = ram_pool_acquire(pool);
+    struct RAM_HEAP_CONFIG heap_config = { 0, 0, 0 };
+    ASSERT_TRUE(ram_heap_enable(memory, heap_config));
+    ASSERT_TRUE(ram_heap_alloc(memory, 2) > 0);
+    ram_pool_release(pool, memory);
+    
+    ASSERT_EQ(ram_pool_stats(pool).destroyed, 1);
+    ASSERT_EQ(ram_pool_stats(pool).idle, 0);
+    memory = ram_pool_acquire(pool);
+    ASSERT_TRUE(memory->heap == NULL);
+    ASSERT_EQ(ram_memory_usage(memory).heap, 0);
+    
+    ram_pool_release(pool, memory);
+    ASSERT_EQ(ram_pool_stats(pool).idle, 1);
+    
+    ram_pool_destroy(pool);
+}
+
+TEST(memory_module, pool_destroys_sampled_memory)
+{
+    struct RAM_POOL_CONFIG config = { 0, 16, 2, 0 };
+    struct RAM_POOL* pool = ram_pool_create(config);
+    
+    struct RAM* memory = ram_pool_acquire(pool);
+    ASSERT_TRUE(ram_layout_sample_start(memory, 1));
+    ram_pool_release(pool, memory);
+    
+    ASSERT_EQ(ram_pool_stats(pool).destroyed, 1);
+    ASSERT_EQ(ram_pool_stats(pool).idle, 0);
+    memory = ram_pool_acquire(pool);
+    ASSERT_TRUE(memory->layout == NULL);
+    ASSERT_FALSE(memory->observed);
+    
+    ram_pool_release(pool, memory);
+    ASSERT_EQ(ram_pool_stats(pool).idle, 1);
+    
+    ram_pool_destroy(pool);
+}
+
+//
+// Creates pools in a process with little memory to spare. Returns
+// the # of checks that failed.
+//
+static int pool_out_of_memory(void)
+{
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL || fscanf(statm, "%ld", &pages) != 1) {
+        return 100;
+    }
+    fclose(statm);
+    
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = (rlim_t) pages * sysconf(_SC_PAGESIZE) + 64 * 1024 * 1024;
+    if (setrlimit(RLIMIT_AS, &limit) != 0) {
+        return 100;
+    }
+    
+    int failures = 0;
+    
+    // room for 2^27 idle units is more than there is memory for:
+    struct RAM_POOL_CONFIG config = { 0, 16, 1 << 27, 0 };
+    failures += (ram_pool_create(config) != NULL);
+    
+    // and a pool that fits still works:
+    config.max_idle = 2;
+    struct RAM_POOL* pool = ram_pool_create(config);
+    failures += (pool == NULL);
+    if (pool != NULL) {
+        struct RAM* memory = ram_pool_acquire(pool);
+        failures += (memory == NULL);
+        ram_pool_release(pool, memory);
+        failures += (ram_pool_stats(pool).idle != 1);
+        ram_pool_destroy(pool);
+    }
+    
+    return failures;
+}
+
+TEST(memory_module, pool_create_reports_out_of_memory)
+{
+#if defined(__SANITIZE_ADDRESS__)
+    GTEST_SKIP() << "ASan's shadow memory doesn't fit under an address-space limit";
+#endif
+    
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        _exit(pool_out_of_memory());
+    }
+    
+    int status = -1;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+static void* pool_worker(void* arg)
+{
+    struct RAM_POOL* pool = (struct RAM_POOL*) arg;
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    
+    for (int i = 0; i < 200; i++) {
+        struct RAM* memory = ram_pool_acquire(pool);
+        
+        if (ram_size(memory) != 0) {
+            return (void*) 1;
+        }
+        
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, (char*) "x");
+        struct RAM_VALUE* read = ram_read_cell_by_name(memory, (char*) "x");
+        bool ok = (read->types.i == i);
+        ram_free_value(read);
+        if (!ok) {
+            return (void*) 1;
+        }
+        
+        ram_pool_release(pool, memory);
+    }
+    
+    return NULL;
+}
+
+TEST(memory_module, pool_is_thread_safe)
+{
+    struct RAM_POOL_CONFIG config = { 2, 8, 4, 64 };
+    struct RAM_POOL* pool = ram_pool_create(config);
+    
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, pool_worker, pool);
+    }
+    for (int t = 0; t < 4; t++) {
+        void* result;
+        pthread_join(threads[t], &result);
+        ASSERT_TRUE(result == NULL);
+    }
+    
+    struct RAM_POOL_STATS stats = ram_pool_stats(pool);
+    ASSERT_EQ(stats.acquired, 800);
+    ASSERT_EQ(stats.released, 800);
+    ASSERT_TRUE(stats.idle <= 4);
+    
+    ram_pool_destroy(pool);
+}
+
+TEST(memory_module, typed_read_write_by_addr)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_NONE;
+    ram_write_cell_by_name(memory, val, (char*) "b");
+    ram_write_cell_by_name(memory, val, (char*) "i");
+    ram_write_cell_by_name(memory, val, (char*) "r");
+    
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 123, 1));
+    ASSERT_TRUE(ram_write_real_by_addr(memory, 2.5, 2));
+    ASSERT_TRUE(ram_write_bool_by_addr(memory, true, 0));
+    ASSERT_FALSE(ram_write_int_by_addr(memory, 1, 3));
+    ASSERT_FALSE(ram_write_real_by_addr(memory, 1.0, -1));
+    
+    int i = 0;
+    double d = 0.0;
+    bool b = false;
+    ASSERT_TRUE(ram_read_int_by_addr(memory, 1, &i));
+    ASSERT_EQ(i, 123);
+    ASSERT_TRUE(ram_read_real_by_addr(memory, 2, &d));
+    ASSERT_DOUBLE_EQ(d, 2.5);
+    ASSERT_TRUE(ram_read_bool_by_addr(memory, 0, &b));
+    ASSERT_TRUE(b);
+    
+    // type mismatches and invalid addresses are reported, not converted:
+    ASSERT_FALSE(ram_read_real_by_addr(memory, 1, &d));
+    ASSERT_FALSE(ram_read_int_by_addr(memory, 0, &i));
+    ASSERT_FALSE(ram_read_int_by_addr(memory, 3, &i));
+    ASSERT_EQ(ram_type_by_addr(memory, 2), RAM_TYPE_REAL);
+    ASSERT_EQ(ram_type_by_addr(memory, 3), -1);
+    
+    // same result as the general-purpose read:
+    struct RAM_VALUE* read = ram_read_cell_by_name(memory, (char*) "i");
+    ASSERT_EQ(read->value_type, RAM_TYPE_INT);
+    ASSERT_EQ(read->types.i, 123);
+    ram_free_value(read);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, typed_write_falls_back_when_needed)
+{
+    struct RAM* memory = ram_init();
+    
+    char* s = (char*) "some string";
+    ram_write_str_by_name(memory, s, (int) strlen(s), (char*) "s");
+    ASSERT_TRUE(ram_memory_usage(memory).strings > 0);
+    
+    // overwriting a string frees it and updates usage:
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 7, 0));
+    ASSERT_EQ(ram_memory_usage(memory).strings, 0);
+    
+    // writes inside a transaction can be rolled back:
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_write_real_by_addr(memory, 1.5, 0));
+    ASSERT_TRUE(ram_write_bool_by_addr(memory, false, 0));
+    ASSERT_TRUE(ram_txn_rollback(memory));
+    
+    int i = 0;
+    ASSERT_TRUE(ram_read_int_by_addr(memory, 0, &i));
+    ASSERT_EQ(i, 7);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, get_addr_n)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, (char*) "ab");
+    ram_write_cell_by_name(memory, val, (char*) "abc");
+    ram_write_cell_by_name(memory, val, (char*) "b");
+    
+    char buffer[] = "abcdef";
+    ASSERT_EQ(ram_get_addr_n(memory, buffer, 2), 0);
+    ASSERT_EQ(ram_get_addr_n(memory, buffer, 3), 1);
+    ASSERT_EQ(ram_get_addr_n(memory, buffer, 1), -1);
+    ASSERT_EQ(ram_get_addr_n(memory, buffer, 4), -1);
+    ASSERT_EQ(ram_get_addr_n(memory, buffer + 1, 1), 2);
+    ASSERT_EQ(ram_get_addr_n(memory, (char*) "ab\0c", 4), -1);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, cpp_wrapper_get_set)
+{
+    using namespace nupython::literals;
+    
+    nupython::Ram memory;
+    
+    ASSERT_TRUE(memory.set("x"_var, 42));
+    ASSERT_TRUE(memory.set(std::string_view("pi"), 3.5));
+    ASSERT_TRUE(memory.set("flag"_var, true));
+    
+    std::string name = "greeting";
+    ASSERT_TRUE(memory.set(name, std::string("hello, world")));
+    
+    ASSERT_EQ(memory.size(), 4);
+    ASSERT_EQ(*memory.get<int>("x"_var), 42);
+    ASSERT_EQ(*memory.get<double>(std::string_view("pi")), 3.5);
+    ASSERT_TRUE(*memory.get<bool>("flag"_var));
+    ASSERT_EQ(*memory.get<std::string_view>("greeting"_var), "hello, world");
+    
+    // no conversions, and missing variables are nullopt:
+    ASSERT_FALSE(memory.get<double>("x"_var).has_value());
+    ASSERT_FALSE(memory.get<int>("y"_var).has_value());
+    
+    // existing variables are overwritten in place:
+    ASSERT_TRUE(memory.set("x"_var, 43));
+    ASSERT_EQ(*memory.get<int>(memory.addr("x"_var)), 43);
+    ASSERT_EQ(memory.addr("x"_var), 0);
+    ASSERT_EQ(memory.size(), 4);
+    
+    // a slice of a larger buffer names a variable without a copy:
+    std::string_view line = "pi = 3.5";
+    ASSERT_EQ(memory.addr(line.substr(0, 2)), 1);
+    
+    struct RAM* raw = memory.release();
+    ASSERT_FALSE(memory);
+    ASSERT_EQ(ram_size(raw), 4);
+    ram_destroy(raw);
+}
+
+TEST(memory_module, cpp_wrapper_cache_survives_rollback)
+{
+    using namespace nupython::literals;
+    
+    nupython::Ram memory;
+    
+    memory.set("a"_var, 1);
+    
+    memory.txn_begin();
+    memory.set("b"_var, 2);
+    ASSERT_EQ(memory.addr("b"_var), 1);  // cached
+    memory.txn_rollback();
+    
+    // "b" is gone, and "c" now occupies its old address:
+    memory.set("c"_var, 3);
+    ASSERT_EQ(memory.addr("b"_var), -1);
+    ASSERT_FALSE(memory.get<int>("b"_var).has_value());
+    ASSERT_EQ(*memory.get<int>("c"_var), 3);
+    
+    nupython::Ram other = std::move(memory);
+    ASSERT_FALSE(memory);
+    ASSERT_EQ(*other.get<int>("a"_var), 1);
+    
+    other.reset();
+    ASSERT_EQ(other.addr("a"_var), -1);
+}
+
+TEST(memory_module, get_addrs_batch)
+{
+    struct RAM* memory = ram_init();
+    
+    char* none[] = { (char*) "x" };
+    int addr = 0;
+    ASSERT_EQ(ram_get_addrs(memory, none, 1, &addr), 0);
+    ASSERT_EQ(addr, -1);
+    
+    // big enough that lookups are interleaved rather than done one
+    // at a time:
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 70000; i++) {
+        char name[16];
+        sprintf(name, "v%06d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    
+    // more names than are in flight at once, found and missing mixed:
+    static char names[100][16];
+    char* varnames[100];
+    int addrs[100];
+    for (int i = 0; i < 100; i++) {
+        if (i % 3 == 0) {
+            sprintf(names[i], "v%06dx", i);
+        }
+        else {
+            sprintf(names[i], "v%06d", (i * 7919) % 70000);
+        }
+        varnames[i] = names[i];
+    }
+    
+    ASSERT_EQ(ram_get_addrs(memory, varnames, 100, addrs), 66);
+    
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ(addrs[i], ram_get_addr(memory, varnames[i]));
+    }
+    
+    ASSERT_EQ(ram_get_addrs(memory, varnames, 0, addrs), 0);
+    ASSERT_EQ(ram_get_addrs(memory, varnames + 1, 1, addrs), 1);
+    ASSERT_EQ(addrs[0], 7919);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, bloom_filter)
+{
+    struct RAM* memory = ram_init();
+    
+    // not enabled: every name may be there
+    ASSERT_TRUE(ram_may_contain(memory, ram_name_hash((char*) "x")));
+    ASSERT_EQ(ram_memory_usage(memory).bloom, 0);
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 0;
+    ram_write_cell_by_name(memory, val, (char*) "before");
+    
+    ram_bloom_enable(memory);
+    ASSERT_TRUE(ram_memory_usage(memory).bloom > 0);
+    ASSERT_TRUE(ram_may_contain(memory, ram_name_hash((char*) "before")));
+    
+    // names added later, including while memory grows:
+    char name[16];
+    for (int i = 0; i < 1000; i++) {
+        sprintf(name, "v%d", i);
+        ram_write_cell_by_name(memory, val, name);
+    }
+    for (int i = 0; i < 1000; i++) {
+        sprintf(name, "v%d", i);
+        ASSERT_TRUE(ram_may_contain(memory, ram_name_hash(name)));
+    }
+    
+    // most names that are not there are ruled out:
+    int maybe = 0;
+    for (int i = 0; i < 1000; i++) {
+        sprintf(name, "w%d", i);
+        if (ram_may_contain(memory, ram_name_hash(name))) {
+            maybe++;
+        }
+    }
+    ASSERT_TRUE(maybe < 150);
+    
+    ASSERT_EQ(ram_name_hash((char*) "abc"), 0x1A47E90B);  // FNV-1a
+    
+    ram_reset(memory);
+    ASSERT_FALSE(ram_may_contain(memory, ram_name_hash((char*) "before")));
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, scope_chain_resolution)
+{
+    struct RAM* builtins = ram_init();
+    struct RAM* globals = ram_init();
+    struct RAM* locals = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(builtins, val, (char*) "len");
+    ram_write_cell_by_name(builtins, val, (char*) "print");
+    ram_write_cell_by_name(globals, val, (char*) "x");
+    ram_write_cell_by_name(globals, val, (char*) "y");
+    ram_write_cell_by_name(locals, val, (char*) "y");
+    
+    struct RAM_SCOPE* scope = ram_scope_create();
+    ram_scope_push(scope, builtins);
+    ram_scope_push(scope, globals);
+    ram_scope_push(scope, locals);
+    ASSERT_EQ(ram_scope_depth(scope), 3);
+    
+    // names added after the push are found too:
+    ram_write_cell_by_name(locals, val, (char*) "z");
+    
+    int address = -2;
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "y", &address) == locals);  // shadows global
+    ASSERT_EQ(address, 0);
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "x", &address) == globals);
+    ASSERT_EQ(address, 0);
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "print", &address) == builtins);
+    ASSERT_EQ(address, 1);
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "z", &address) == locals);
+    ASSERT_EQ(address, 1);
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "nope", &address) == NULL);
+    ASSERT_EQ(address, -1);
+    
+    // leaving the function:
+    ASSERT_TRUE(ram_scope_pop(scope) == locals);
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "y", &address) == globals);
+    ASSERT_EQ(address, 1);
+    ASSERT_TRUE(ram_scope_resolve(scope, (char*) "z", &address) == NULL);
+    
+    // every lookup probes at most the scope it is found in, plus
+    // the occasional false positive:
+    struct RAM_SCOPE_STATS stats = ram_scope_stats(scope);
+    ASSERT_EQ(stats.lookups, 7);
+    ASSERT_TRUE(stats.skipped >= 8);
+    ASSERT_EQ(stats.probes + stats.skipped, 1 + 2 + 3 + 1 + 3 + 1 + 2);
+    
+    ASSERT_TRUE(ram_scope_pop(scope) == globals);
+    ASSERT_TRUE(ram_scope_pop(scope) == builtins);
+    ASSERT_TRUE(ram_scope_pop(scope) == NULL);
+    
+    ram_scope_destroy(scope);
+    ram_destroy(builtins);
+    ram_destroy(globals);
+    ram_destroy(locals);
+}
+
+#ifndef RAM_NO_SLAB  // the slabs are bypassed, so their stats stay 0
+
+TEST(memory_module, slab_alloc_and_free)
+{
+    struct RAM_SLAB_STATS before = ram_slab_stats();
+    
+    // blocks of every size class, and one too large for any:
+    void* blocks[RAM_SLAB_MAX + 2];
+    for (int bytes = 1; bytes <= RAM_SLAB_MAX + 1; bytes++) {
+        blocks[bytes] = ram_slab_alloc(bytes);
+        ASSERT_TRUE(blocks[bytes] != NULL);
+        ASSERT_EQ((unsigned long long) blocks[bytes] % 16, 0);
+        memset(blocks[bytes], 0xAB, bytes);
+    }
+    for (int bytes = 1; bytes <= RAM_SLAB_MAX + 1; bytes++) {
+        ram_slab_free(blocks[bytes], bytes);
+    }
+    
+    // a freed block is the next one handed out for its size class:
+    void* p = ram_slab_alloc(40);
+    ram_slab_free(p, 40);
+    ASSERT_TRUE(ram_slab_alloc(33) == p);
+    ram_slab_free(p, 33);
+    
+    struct RAM_SLAB_STATS after = ram_slab_stats();
+    ASSERT_EQ(after.allocs - before.allocs, RAM_SLAB_MAX + 2);
+    ASSERT_EQ(after.frees - before.frees, RAM_SLAB_MAX + 2);
+    ASSERT_EQ(after.large - before.large, 1);
+    ASSERT_TRUE(after.slab_bytes > 0);
+    
+    // memory's reads and strings come from the slabs (its names share one block):
+    struct RAM* memory = ram_init();
+    before = ram_slab_stats();
+    
+    char* s = (char*) "short";
+    ram_write_str_by_name(memory, s, 5, (char*) "s");
+    struct RAM_VALUE* value = ram_read_cell_by_name(memory, (char*) "s");
+    ASSERT_STREQ(value->types.s, "short");
+    ram_free_value(value);
+    
+    after = ram_slab_stats();
+    ASSERT_EQ(after.allocs - before.allocs, 3);  // string, value + its string
+    ASSERT_EQ(after.frees - before.frees, 2);
+    
+    ram_destroy(memory);
+}
+
+static void* slab_worker(void* arg)
+{
+    void** handoff = (void**) arg;
+    
+    // allocate for another thread to free, and free what it allocated:
+    for (int i = 0; i < 1000; i++) {
+        handoff[i] = ram_slab_alloc(24);
+    }
+    
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 500; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+        ram_free_value(ram_read_cell_by_name(memory, name));
+    }
+    ram_destroy(memory);
+    
+    return NULL;
+}
+
+TEST(memory_module, slab_across_threads)
+{
+    struct RAM_SLAB_STATS before = ram_slab_stats();
+    
+    static void* handoff[4][1000];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, slab_worker, handoff[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    
+    // blocks allocated by threads that have exited:
+    for (int t = 0; t < 4; t++) {
+        for (int i = 0; i < 1000; i++) {
+            ram_slab_free(handoff[t][i], 24);
+        }
+    }
+    ram_slab_flush();
+    
+    struct RAM_SLAB_STATS after = ram_slab_stats();
+    ASSERT_EQ(after.allocs - before.allocs, 4 * (1000 + 500));
+    ASSERT_EQ(after.allocs - before.allocs, after.frees - before.frees);
+}
+
+#endif
+
+TEST(memory_module, trace_records_calls)
+{
+    remove("test_trace.tmp");
+    
+    struct RAM* memory = ram_init();
+    ASSERT_TRUE(ram_trace_start(memory, "test_trace.tmp"));
+    ASSERT_FALSE(ram_trace_start(memory, "test_trace.tmp"));  // already recording
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 42;
+    ram_write_cell_by_name(memory, val, "x");
+    ram_write_str_by_name(memory, "hello", 5, "s");
+    double reals[] = { 1.5, 2.5 };
+    ram_write_array_by_addr(memory, RAM_ARRAY_REAL, reals, 2, 1);
+    ram_array_append_real_by_addr(memory, 3.5, 1);
+    ASSERT_EQ(ram_get_addr(memory, "s"), 1);
+    ram_txn_begin(memory);
+    ram_free_value(ram_read_cell_by_name(memory, "x"));
+    ram_free_value(ram_read_cell_by_addr(memory, 99));
+    ram_txn_commit(memory);
+    ram_reset(memory);
+    
+    ASSERT_EQ(ram_trace_stats(memory).records, 10);
+    ASSERT_TRUE(ram_trace_stop(memory));
+    ASSERT_FALSE(ram_trace_stop(memory));
+    ASSERT_EQ(ram_trace_stats(memory).records, 0);
+    ram_destroy(memory);
+    
+    struct RAM_TRACE_READER* reader = ram_trace_open("test_trace.tmp");
+    ASSERT_TRUE(reader != NULL);
+    struct RAM_TRACE_RECORD record;
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_WRITE_BY_NAME);
+    ASSERT_STREQ(record.varname, "x");
+    ASSERT_EQ(record.value_type, RAM_TYPE_INT);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_WRITE_BY_NAME);
+    ASSERT_STREQ(record.varname, "s");
+    ASSERT_EQ(record.value_type, RAM_TYPE_STR);
+    ASSERT_EQ(record.length, 5);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_WRITE_BY_ADDR);
+    ASSERT_TRUE(record.varname == NULL);
+    ASSERT_EQ(record.address, 1);
+    ASSERT_EQ(record.value_type, RAM_TYPE_ARRAY);
+    ASSERT_EQ(record.elem_type, RAM_ARRAY_REAL);
+    ASSERT_EQ(record.length, 2);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_APPEND);
+    ASSERT_EQ(record.address, 1);
+    ASSERT_EQ(record.elem_type, RAM_ARRAY_REAL);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_GET_ADDR);
+    ASSERT_STREQ(record.varname, "s");
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_TXN_BEGIN);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_READ_BY_NAME);
+    ASSERT_STREQ(record.varname, "x");
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_READ_BY_ADDR);
+    ASSERT_EQ(record.address, 99);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_TXN_COMMIT);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_RESET);
+    
+    ASSERT_FALSE(ram_trace_next(reader, &record));
+    ram_trace_close(reader);
+    
+    remove("test_trace.tmp");
+}
+
+TEST(memory_module, trace_records_typed_calls)
+{
+    remove("test_trace.tmp");
+    
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "x");  // before recording
+    
+    ASSERT_TRUE(ram_trace_start(memory, "test_trace.tmp"));
+    
+    // typed writes take the slow path, so they are recorded too:
+    ASSERT_TRUE(ram_write_real_by_addr(memory, 2.5, 0));
+    double d = 0.0;
+    ASSERT_TRUE(ram_read_real_by_addr(memory, 0, &d));
+    ASSERT_EQ(d, 2.5);
+    ASSERT_FALSE(ram_write_int_by_addr(memory, 3, 5));
+    
+    struct RAM_TRACE_STATS stats = ram_trace_stats(memory);
+    ASSERT_EQ(stats.records, 3);
+    ASSERT_TRUE(stats.bytes > 0);
+    ram_destroy(memory);  // stops recording
+    
+    struct RAM_TRACE_READER* reader = ram_trace_open("test_trace.tmp");
+    ASSERT_TRUE(reader != NULL);
+    struct RAM_TRACE_RECORD record;
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_WRITE_BY_ADDR);
+    ASSERT_EQ(record.address, 0);
+    ASSERT_EQ(record.value_type, RAM_TYPE_REAL);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_READ_BY_ADDR);
+    ASSERT_EQ(record.address, 0);
+    
+    ASSERT_TRUE(ram_trace_next(reader, &record));
+    ASSERT_EQ(record.op, RAM_TRACE_WRITE_BY_ADDR);
+    ASSERT_EQ(record.address, 5);
+    ASSERT_EQ(record.value_type, RAM_TYPE_INT);
+    
+    ASSERT_FALSE(ram_trace_next(reader, &record));
+    ram_trace_close(reader);
+    
+    // not a trace:
+    FILE* f = fopen("test_trace.tmp", "wb");
+    fputs("not a trace", f);
+    fclose(f);
+    ASSERT_TRUE(ram_trace_open("test_trace.tmp") == NULL);
+    ASSERT_TRUE(ram_trace_open("no_such_trace.tmp") == NULL);
+    
+    remove("test_trace.tmp");
+}
+
+TEST(memory_module, latency_histograms)
+{
+    ram_latency_clear();
+    ram_latency_enable(true);
+    
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 100; i++) {
+        char name[16];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    for (int i = 0; i < 50; i++) {
+        ram_free_value(ram_read_cell_by_addr(memory, i));
+    }
+    ASSERT_EQ(ram_get_addr(memory, "nope"), -1);  // early returns are timed too
+    ram_destroy(memory);
+    
+    ram_latency_enable(false);
+    memory = ram_init();  // not timed
+    ram_destroy(memory);
+    
+    struct RAM_LATENCY snapshot;
+    ram_latency_snapshot(&snapshot);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_INIT].count, 1);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_WRITE_BY_NAME].count, 100);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_READ_BY_ADDR].count, 50);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_FREE_VALUE].count, 50);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_GET_ADDR].count, 1);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_DESTROY].count, 1);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_TXN_BEGIN].count, 0);
+    
+    struct RAM_LATENCY_HIST* writes = &snapshot.ops[RAM_LATENCY_WRITE_BY_NAME];
+    long long counted = 0;
+    for (int b = 0; b < RAM_LATENCY_BUCKETS; b++) {
+        counted += writes->buckets[b];
+    }
+    ASSERT_EQ(counted, 100);
+    ASSERT_TRUE(writes->total >= writes->max);
+    
+    double p50 = ram_latency_percentile(writes, 50);
+    double p99 = ram_latency_percentile(writes, 99);
+    double max = ram_latency_percentile(writes, 100);
+    ASSERT_TRUE(p50 > 0.0);
+    ASSERT_TRUE(p50 <= p99);
+    ASSERT_TRUE(p99 <= max);
+    ASSERT_EQ(ram_latency_percentile(&snapshot.ops[RAM_LATENCY_TXN_BEGIN], 50), 0.0);
+    ASSERT_STREQ(ram_latency_op_name(RAM_LATENCY_WRITE_BY_NAME), "write_by_name");
+    
+    ram_latency_clear();
+    ram_latency_snapshot(&snapshot);
+    ASSERT_EQ(snapshot.ops[RAM_LATENCY_WRITE_BY_NAME].count, 0);
+}
+
+static void* latency_worker(void* arg)
+{
+    struct RAM* memory = ram_init();
+    for (int i = 0; i < 10; i++) {
+        ram_txn_begin(memory);
+        ram_txn_commit(memory);
+    }
+    ram_destroy(memory);
+    
+    ram_latency_snapshot((struct RAM_LATENCY*) arg);
+    return NULL;
+}
+
+TEST(memory_module, latency_merge_across_threads)
+{
+    ram_latency_clear();
+    ram_latency_enable(true);
+    
+    static struct RAM_LATENCY snapshots[4];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&threads[t], NULL, latency_worker, &snapshots[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    ram_latency_enable(false);
+    
+    // this thread made no calls:
+    struct RAM_LATENCY total;
+    ram_latency_snapshot(&total);
+    ASSERT_EQ(total.ops[RAM_LATENCY_TXN_BEGIN].count, 0);
+    
+    long long max = 0;
+    for (int t = 0; t < 4; t++) {
+        ASSERT_EQ(snapshots[t].ops[RAM_LATENCY_TXN_COMMIT].count, 10);
+        if (snapshots[t].ops[RAM_LATENCY_TXN_COMMIT].max > max) {
+            max = snapshots[t].ops[RAM_LATENCY_TXN_COMMIT].max;
+        }
+        ram_latency_merge(&total, &snapshots[t]);
+    }
+    ASSERT_EQ(total.ops[RAM_LATENCY_INIT].count, 4);
+    ASSERT_EQ(total.ops[RAM_LATENCY_TXN_BEGIN].count, 40);
+    ASSERT_EQ(total.ops[RAM_LATENCY_TXN_COMMIT].count, 40);
+    ASSERT_EQ(total.ops[RAM_LATENCY_TXN_COMMIT].max, max);
+}
+
+TEST(memory_module, bulk_load)
+{
+    remove("test_bulk.tmp");
+    
+    struct RAM_JOURNAL_CONFIG config = { 0, 0 };
+    struct RAM* memory = ram_init_journaled("test_bulk.tmp", config);
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "m");
+    ram_write_cell_by_name(memory, val, "c");
+    
+    char* names[] = { "z", "a", "m", "q", "a", "b" };
+    struct RAM_VALUE values[6];
+    for (int i = 0; i < 6; i++) {
+        values[i].value_type = RAM_TYPE_INT;
+        values[i].types.i = 10 + i;
+    }
+    values[3].value_type = RAM_TYPE_STR;
+    values[3].types.s = "queue";
+    
+    int addrs[6];
+    ASSERT_TRUE(ram_bulk_load(memory, names, values, 6, addrs));
+    
+    // new names get cells in the order they first appear:
+    ASSERT_EQ(addrs[0], 2);  // z
+    ASSERT_EQ(addrs[1], 3);  // a
+    ASSERT_EQ(addrs[2], 0);  // m already existed
+    ASSERT_EQ(addrs[3], 4);  // q
+    ASSERT_EQ(addrs[4], 3);  // a again
+    ASSERT_EQ(addrs[5], 5);  // b
+    ASSERT_EQ(ram_size(memory), 6);
+    
+    // the map stays sorted, and the last value for a name wins:
+    char* sorted[] = { "a", "b", "c", "m", "q", "z" };
+    for (int i = 0; i < 6; i++) {
+        ASSERT_STREQ(ram_map_name(memory, i), sorted[i]);
+        ASSERT_EQ(ram_get_addr(memory, sorted[i]), memory->map[i].cell);
+    }
+    ASSERT_EQ(ram_cell(memory, 3)->types.i, 14);
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 12);
+    ASSERT_EQ(ram_cell(memory, 1)->types.i, 1);
+    ASSERT_STREQ(ram_cell(memory, 4)->types.s, "queue");
+    ASSERT_EQ(ram_str_length(ram_cell(memory, 4)->types.s), 5);
+    
+    // declare adds Nones, and leaves existing values alone:
+    char* more[] = { "q", "y", "d" };
+    ASSERT_TRUE(ram_declare(memory, more, 3, addrs));
+    ASSERT_EQ(addrs[0], 4);
+    ASSERT_EQ(addrs[1], 6);
+    ASSERT_EQ(addrs[2], 7);
+    ASSERT_EQ(ram_cell(memory, 6)->value_type, RAM_TYPE_NONE);
+    ASSERT_STREQ(ram_cell(memory, 4)->types.s, "queue");
+    ASSERT_EQ(ram_get_addr(memory, "d"), 7);
+    ASSERT_EQ(ram_get_addr(memory, "y"), 6);
+    
+    ASSERT_TRUE(ram_declare(memory, more, 0, NULL));
+    ASSERT_FALSE(ram_declare(memory, more, -1, NULL));
+    
+    // the journal rebuilds the same memory:
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_bulk.img"));
+    struct RAM* expected = ram_load_checkpoint("test_bulk.img", NULL, 0);
+    ram_destroy(memory);
+    
+    struct RAM* replayed = ram_init_journaled("test_bulk.tmp", config);
+    assert_same_memory(expected, replayed);
+    
+    remove("test_bulk.tmp");
+    remove("test_bulk.img");
+    ram_destroy(expected);
+    ram_destroy(replayed);
+}
+
+TEST(memory_module, bulk_load_rollback_and_budget)
+{
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "x");
+    long long before = ram_memory_usage(memory).total;
+    
+    char* names[] = { "w", "x", "y" };
+    struct RAM_VALUE values[3];
+    for (int i = 0; i < 3; i++) {
+        values[i].value_type = RAM_TYPE_STR;
+        values[i].types.s = "a string of some length";
+    }
+    
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_bulk_load(memory, names, values, 3, NULL));
+    ASSERT_EQ(ram_size(memory), 3);
+    ASSERT_TRUE(ram_txn_rollback(memory));
+    
+    ASSERT_EQ(ram_size(memory), 1);
+    ASSERT_EQ(ram_get_addr(memory, "w"), -1);
+    ASSERT_EQ(ram_get_addr(memory, "y"), -1);
+    ASSERT_EQ(ram_cell(memory, 0)->value_type, RAM_TYPE_INT);
+    
+    // all or nothing:
+    ram_set_memory_budget(memory, ram_memory_usage(memory).total + 40);
+    ASSERT_FALSE(ram_bulk_load(memory, names, values, 3, NULL));
+    ASSERT_EQ(ram_size(memory), 1);
+    ASSERT_EQ(ram_cell(memory, 0)->value_type, RAM_TYPE_INT);
+    
+    ram_set_memory_budget(memory, 0);
+    ASSERT_TRUE(ram_bulk_load(memory, names, values, 3, NULL));
+    struct RAM_USAGE usage = ram_memory_usage(memory);
+    ASSERT_EQ(usage.total, usage.header + usage.cells + usage.map + usage.names + usage.strings +
+              usage.arrays + usage.undo + usage.dirty + usage.bloom);
+    ASSERT_TRUE(usage.total > before);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, bulk_load_many_names)
+{
+    // enough names to be sorted in parallel, given in scrambled order:
+    int n = 100000;
+    char** names = (char**) malloc(n * sizeof(char*));
+    struct RAM_VALUE* values = (struct RAM_VALUE*) malloc(n * sizeof(struct RAM_VALUE));
+    int* addrs = (int*) malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        int k = (int) ((i * 7919LL) % n);
+        names[i] = (char*) malloc(16);
+        sprintf(names[i], "v%d", k);
+        values[i].value_type = RAM_TYPE_INT;
+        values[i].types.i = k;
+    }
+    
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = -1;
+    ram_write_cell_by_name(memory, val, "v5");
+    
+    ASSERT_TRUE(ram_bulk_load(memory, names, values, n, addrs));
+    ASSERT_EQ(ram_size(memory), n);
+    
+    for (int i = 1; i < n; i++) {
+        ASSERT_TRUE(strcmp(ram_map_name(memory, i - 1), ram_map_name(memory, i)) < 0);
+    }
+    for (int i = 0; i < n; i++) {
+        ASSERT_EQ(ram_get_addr(memory, names[i]), addrs[i]);
+        ASSERT_EQ(ram_cell(memory, addrs[i])->types.i, values[i].types.i);
+    }
+    ASSERT_EQ(ram_get_addr(memory, "v5"), 0);
+    
+    ram_destroy(memory);
+    for (int i = 0; i < n; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(values);
+    free(addrs);
+}
+
+//
+// Checks made by a reader process (outside of gtest, whose asserts
+// can't be used in a forked child): 0 => all good.
+//
+static int shm_check_reader(char* name, int expected_x)
+{
+    struct RAM_SHM* shm = ram_shm_attach(name);
+    if (shm == NULL) {
+        return 1;
+    }
+    
+    struct RAM_VALUE value;
+    struct RAM_ARRAY array;
+    int failures = 0;
+    
+    failures += (ram_shm_size(shm) != 5);
+    failures += !(ram_shm_read(shm, ram_shm_get_addr(shm, "x"), &value) &&
+                  value.value_type == RAM_TYPE_INT && value.types.i == expected_x);
+    failures += !(ram_shm_read(shm, ram_shm_get_addr(shm, "pi"), &value) &&
+                  value.value_type == RAM_TYPE_REAL && value.types.d == 3.25);
+    failures += !(ram_shm_read(shm, ram_shm_get_addr(shm, "s"), &value) &&
+                  value.value_type == RAM_TYPE_STR && ram_str_length(value.types.s) == 3 &&
+                  memcmp(value.types.s, "a\0b", 4) == 0);
+    failures += (ram_str_hash(value.types.s) == 0);  // precomputed: the image is read-only
+    failures += !(ram_shm_read_array(shm, ram_shm_get_addr(shm, "xs"), &array) &&
+                  array.length == 3 && ram_array_sum(&array) == 6.0);
+    failures += ram_shm_read(shm, ram_shm_get_addr(shm, "xs"), &value);
+    failures += (ram_shm_get_addr(shm, "nope") != -1);
+    
+    ram_shm_detach(shm);
+    return failures;
+}
+
+static struct RAM* shm_memory(int x)
+{
+    struct RAM* memory = ram_init();
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = x;
+    ram_write_cell_by_name(memory, val, "x");
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = 3.25;
+    ram_write_cell_by_name(memory, val, "pi");
+    ram_write_str_by_name(memory, "a\0b", 3, "s");
+    int ints[] = { 1, 2, 3 };
+    ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 3, "xs");
+    val.value_type = RAM_TYPE_BOOLEAN;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "b");
+    return memory;
+}
+
+TEST(memory_module, shm_readers_in_other_processes)
+{
+    char name[64];
+    sprintf(name, "/nupython_test_%d", (int) getpid());
+    
+    struct RAM_SHM* shm = ram_shm_create(name);
+    ASSERT_TRUE(shm != NULL);
+    ASSERT_EQ(ram_shm_size(shm), 0);
+    ASSERT_EQ(ram_shm_generation(shm), 0u);
+    
+    struct RAM* memory = shm_memory(42);
+    ASSERT_TRUE(ram_shm_publish(shm, memory));
+    ASSERT_EQ(ram_shm_generation(shm), 1u);
+    ASSERT_EQ(ram_shm_get_addr(shm, "s"), ram_get_addr(memory, "s"));
+    
+    pid_t children[3];
+    for (int c = 0; c < 3; c++) {
+        children[c] = fork();
+        if (children[c] == 0) {
+            _exit(shm_check_reader(name, 42));
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        int status = -1;
+        ASSERT_EQ(waitpid(children[c], &status, 0), children[c]);
+        ASSERT_TRUE(WIFEXITED(status));
+        ASSERT_EQ(WEXITSTATUS(status), 0);
+    }
+    
+    // readers can't publish:
+    struct RAM_SHM* reader = ram_shm_attach(name);
+    ASSERT_TRUE(reader != NULL);
+    ASSERT_FALSE(ram_shm_publish(reader, memory));
+    ram_shm_detach(reader);
+    
+    ram_shm_detach(shm);
+    ASSERT_TRUE(ram_shm_attach(name) == NULL);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, shm_publish_while_readers_attached)
+{
+    char name[64];
+    sprintf(name, "/nupython_test_%d", (int) getpid());
+    
+    struct RAM_SHM* shm = ram_shm_create(name);
+    struct RAM* memory = shm_memory(1);
+    ASSERT_TRUE(ram_shm_publish(shm, memory));
+    
+    int ready[2], go[2];
+    ASSERT_EQ(pipe(ready), 0);
+    ASSERT_EQ(pipe(go), 0);
+    
+    pid_t children[2];
+    for (int c = 0; c < 2; c++) {
+        children[c] = fork();
+        if (children[c] == 0) {
+            struct RAM_SHM* reader = ram_shm_attach(name);
+            int failures = (reader == NULL);
+            char byte = 0;
+            
+            failures += (write(ready[1], &byte, 1) != 1);
+            failures += (read(go[0], &byte, 1) != 1);
+            
+            // a new image has been published, but this one is untouched:
+            struct RAM_VALUE value;
+            failures += !(ram_shm_read(reader, 0, &value) && value.types.i == 1);
+            failures += (ram_shm_generation(reader) != 1);
+            
+            failures += !ram_shm_refresh(reader);
+            failures += ram_shm_refresh(reader);  // already the latest
+            failures += (ram_shm_generation(reader) != 2);
+            failures += !(ram_shm_read(reader, 0, &value) && value.types.i == 2);
+            failures += (ram_shm_size(reader) != 6);
+            failures += (ram_shm_get_addr(reader, "y") != 5);
+            
+            ram_shm_detach(reader);
+            _exit(failures);
+        }
+    }
+    
+    char byte = 0;
+    for (int c = 0; c < 2; c++) {
+        ASSERT_EQ(read(ready[0], &byte, 1), 1);
+    }
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 2;
+    ram_write_cell_by_addr(memory, val, 0);
+    ram_write_cell_by_name(memory, val, "y");
+    ASSERT_TRUE(ram_shm_publish(shm, memory));
+    
+    for (int c = 0; c < 2; c++) {
+        ASSERT_EQ(write(go[1], &byte, 1), 1);
+    }
+    for (int c = 0; c < 2; c++) {
+        int status = -1;
+        ASSERT_EQ(waitpid(children[c], &status, 0), children[c]);
+        ASSERT_TRUE(WIFEXITED(status));
+        ASSERT_EQ(WEXITSTATUS(status), 0);
+    }
+    
+    for (int i = 0; i < 2; i++) {
+        close(ready[i]);
+        close(go[i]);
+    }
+    ram_shm_detach(shm);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, append_str_in_place)
+{
+    struct RAM* memory = ram_init();
+    
+    ram_write_str_by_name(memory, "ab", 2, "s");
+    ASSERT_TRUE(ram_append_str_by_addr(memory, "c\0d", 3, 0));
+    ram_str_hash(ram_cell(memory, 0)->types.s);
+    ASSERT_TRUE(ram_append_str_by_name(memory, "e", 1, "s"));
+    ASSERT_EQ(ram_str_length(ram_cell(memory, 0)->types.s), 6);
+    ASSERT_EQ(memcmp(ram_cell(memory, 0)->types.s, "abc\0de", 7), 0);
+    
+    // the hash cached before the last append isn't reused:
+    ram_write_str_by_name(memory, "abc\0de", 6, "t");
+    ASSERT_EQ(ram_str_hash(ram_cell(memory, 0)->types.s), ram_str_hash(ram_cell(memory, 1)->types.s));
+    ASSERT_TRUE(ram_str_equals(ram_cell(memory, 0)->types.s, ram_cell(memory, 1)->types.s));
+    
+    // appending part of the string to itself, while it moves:
+    ASSERT_TRUE(ram_append_str_by_addr(memory, ram_cell(memory, 0)->types.s + 4, 2, 0));
+    ASSERT_TRUE(ram_append_str_by_addr(memory, ram_cell(memory, 0)->types.s, 8, 0));
+    ASSERT_EQ(ram_str_length(ram_cell(memory, 0)->types.s), 16);
+    ASSERT_EQ(memcmp(ram_cell(memory, 0)->types.s, "abc\0dedeabc\0dede", 17), 0);
+    
+    // capacity doubles, so the string moves only O(log n) times:
+    int moves = 0;
+    long long strings = ram_memory_usage(memory).strings;
+    for (int i = 0; i < 10000; i++) {
+        ASSERT_TRUE(ram_append_str_by_name(memory, "x", 1, "s"));
+        if (ram_memory_usage(memory).strings != strings) {
+            moves++;
+            strings = ram_memory_usage(memory).strings;
+        }
+    }
+    ASSERT_EQ(ram_str_length(ram_cell(memory, 0)->types.s), 10016);
+    ASSERT_LE(moves, 10);
+    
+    // not a string, no such variable, bad address:
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ram_write_cell_by_name(memory, val, "i");
+    ASSERT_FALSE(ram_append_str_by_name(memory, "x", 1, "i"));
+    ASSERT_FALSE(ram_append_str_by_name(memory, "x", 1, "nope"));
+    ASSERT_FALSE(ram_append_str_by_addr(memory, "x", 1, 3));
+    ASSERT_FALSE(ram_append_str_by_addr(memory, "x", -1, 0));
+    
+    // growth that doesn't fit the budget:
+    ram_set_memory_budget(memory, ram_memory_usage(memory).total + 100);
+    int before = ram_str_length(ram_cell(memory, 0)->types.s);
+    while (ram_append_str_by_addr(memory, "y", 1, 0)) {
+    }
+    ASSERT_LE(ram_memory_usage(memory).total, memory->budget);
+    ASSERT_GT(ram_str_length(ram_cell(memory, 0)->types.s), before);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, append_str_rollback_and_journal)
+{
+    remove("test_journal.tmp");
+    
+    struct RAM_JOURNAL_CONFIG config = { 0, 0 };
+    struct RAM* memory = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_TRUE(memory != NULL);
+    
+    ram_write_str_by_name(memory, "hello", 5, "s");
+    ASSERT_TRUE(ram_append_str_by_addr(memory, ", world", 7, 0));
+    
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_append_str_by_addr(memory, " and more, and more", 19, 0));
+    ASSERT_TRUE(ram_append_str_by_name(memory, "!", 1, "s"));
+    ram_txn_rollback(memory);
+    
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "hello, world");
+    ASSERT_EQ(ram_str_length(ram_cell(memory, 0)->types.s), 12);
+    ram_write_str_by_name(memory, "hello, world", 12, "t");
+    ASSERT_EQ(ram_str_hash(ram_cell(memory, 0)->types.s), ram_str_hash(ram_cell(memory, 1)->types.s));
+    
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_append_str_by_addr(memory, "!", 1, 0));
+    ram_txn_commit(memory);
+    
+    // keep a copy of the expected state, then "crash" and recover:
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_journal.img"));
+    struct RAM* expected = ram_load_checkpoint("test_journal.img", NULL, 0);
+    ram_destroy(memory);
+    
+    memory = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_TRUE(memory != NULL);
+    assert_same_memory(expected, memory);
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "hello, world!");
+    
+    remove("test_journal.tmp");
+    remove("test_journal.img");
+    ram_destroy(expected);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, update_numbers_in_place)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val, result;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 10;
+    ram_write_cell_by_name(memory, val, "x");
+    
+    // int op int stays an int:
+    val.types.i = 5;
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_ADD, val, 0, &result));
+    ASSERT_EQ(result.value_type, RAM_TYPE_INT);
+    ASSERT_EQ(result.types.i, 15);
+    ASSERT_TRUE(ram_update_by_name(memory, RAM_UPDATE_SUB, val, "x", NULL));
+    ASSERT_TRUE(ram_update_by_name(memory, RAM_UPDATE_MUL, val, "x", &result));
+    ASSERT_EQ(result.types.i, 50);
+    
+    // a boolean counts as 0 or 1:
+    val.value_type = RAM_TYPE_BOOLEAN;
+    val.types.i = 1;
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_ADD, val, 0, &result));
+    ASSERT_EQ(result.value_type, RAM_TYPE_INT);
+    ASSERT_EQ(result.types.i, 51);
+    
+    // ints wrap around rather than overflow:
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = INT_MAX;
+    ram_write_cell_by_addr(memory, val, 0);
+    val.types.i = 1;
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_ADD, val, 0, &result));
+    ASSERT_EQ(result.types.i, INT_MIN);
+    
+    // anything op a real is a real:
+    val.types.i = 3;
+    ram_write_cell_by_addr(memory, val, 0);
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = 0.5;
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_MUL, val, 0, &result));
+    ASSERT_EQ(result.value_type, RAM_TYPE_REAL);
+    ASSERT_EQ(result.types.d, 1.5);
+    ASSERT_EQ(ram_cell(memory, 0)->types.d, 1.5);
+    
+    // min and max keep the type of the one picked:
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 1;
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_MIN, val, 0, &result));
+    ASSERT_EQ(result.value_type, RAM_TYPE_INT);
+    ASSERT_EQ(result.types.i, 1);
+    val.types.i = 0;
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_MAX, val, 0, &result));
+    ASSERT_EQ(result.types.i, 1);
+    
+    // not gives a boolean:
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_NOT, val, 0, &result));
+    ASSERT_EQ(result.value_type, RAM_TYPE_BOOLEAN);
+    ASSERT_EQ(result.types.i, 0);
+    ASSERT_TRUE(ram_update_by_addr(memory, RAM_UPDATE_NOT, val, 0, &result));
+    ASSERT_EQ(result.types.i, 1);
+    
+    // compare-and-set compares as numbers, 1 == 1.0 == True:
+    struct RAM_VALUE expected, desired;
+    expected.value_type = RAM_TYPE_REAL;
+    expected.types.d = 1.0;
+    desired.value_type = RAM_TYPE_INT;
+    desired.types.i = 7;
+    ASSERT_TRUE(ram_compare_and_set_by_addr(memory, expected, desired, 0));
+    ASSERT_EQ(ram_cell(memory, 0)->value_type, RAM_TYPE_INT);
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 7);
+    ASSERT_FALSE(ram_compare_and_set_by_name(memory, expected, desired, "x"));
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 7);
+    
+    // strings, missing variables and unknown ops are refused:
+    ram_write_str_by_name(memory, "s", 1, "s");
+    ASSERT_FALSE(ram_update_by_name(memory, RAM_UPDATE_ADD, val, "s", NULL));
+    ASSERT_FALSE(ram_update_by_name(memory, RAM_UPDATE_ADD, val, "nope", NULL));
+    ASSERT_FALSE(ram_update_by_addr(memory, 99, val, 0, NULL));
+    ASSERT_FALSE(ram_update_by_addr(memory, RAM_UPDATE_ADD, *ram_cell(memory, 1), 0, NULL));
+    ASSERT_FALSE(ram_compare_and_set_by_addr(memory, desired, *ram_cell(memory, 1), 0));
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, 7);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, update_rollback_journal_and_wrapper)
+{
+    remove("test_journal.tmp");
+    
+    struct RAM_JOURNAL_CONFIG config = { 0, 0 };
+    struct RAM* raw = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_TRUE(raw != NULL);
+    
+    {
+        using namespace nupython::literals;
+        
+        nupython::Ram memory(raw);
+        
+        memory.set("n"_var, 1);
+        memory.set("done"_var, false);
+        
+        for (int i = 0; i < 9; i++) {
+            ASSERT_TRUE(memory.update("n"_var, RAM_UPDATE_ADD, 1).has_value());
+        }
+        ASSERT_EQ(memory.update(std::string_view("n"), RAM_UPDATE_MUL, 0.5)->types.d, 5.0);
+        ASSERT_FALSE(memory.update("missing"_var, RAM_UPDATE_ADD, 1).has_value());
+        
+        memory.txn_begin();
+        memory.update("n"_var, RAM_UPDATE_SUB, 100);
+        ASSERT_TRUE(memory.compare_and_set("done"_var, false, true));
+        memory.txn_rollback();
+        
+        ASSERT_EQ(*memory.get<double>("n"_var), 5.0);
+        ASSERT_FALSE(*memory.get<bool>("done"_var));
+        ASSERT_FALSE(memory.compare_and_set("done"_var, true, false));
+        ASSERT_TRUE(memory.compare_and_set(1, 0, true));
+        
+        // keep a copy of the expected state, then "crash" and recover:
+        ASSERT_TRUE(ram_checkpoint_full(memory.get(), "test_journal.img"));
+    }
+    
+    struct RAM* expected = ram_load_checkpoint("test_journal.img", NULL, 0);
+    struct RAM* memory = ram_init_journaled("test_journal.tmp", config);
+    ASSERT_TRUE(memory != NULL);
+    assert_same_memory(expected, memory);
+    ASSERT_EQ(ram_cell(memory, 0)->types.d, 5.0);
+    ASSERT_EQ(ram_cell(memory, 1)->value_type, RAM_TYPE_BOOLEAN);
+    
+    remove("test_journal.tmp");
+    remove("test_journal.img");
+    ram_destroy(expected);
+    ram_destroy(memory);
+}
+
+TEST(memory_module, atomic_ops_on_cells)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = INT_MAX;
+    ram_write_cell_by_name(memory, val, "n");
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = 1.5;
+    ram_write_cell_by_name(memory, val, "x");
+    val.value_type = RAM_TYPE_BOOLEAN;
+    val.types.i = 0;
+    ram_write_cell_by_name(memory, val, "flag");
+    ram_write_str_by_name(memory, "s", 1, "s");
+    
+    // fetch-add wraps, and only works on ints:
+    int old;
+    ASSERT_TRUE(ram_fetch_add_int_by_addr(memory, 1, 0, &old));
+    ASSERT_EQ(old, INT_MAX);
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, INT_MIN);
+    ASSERT_TRUE(ram_fetch_add_int_by_addr(memory, -1, 0, NULL));
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, INT_MAX);
+    ASSERT_FALSE(ram_fetch_add_int_by_addr(memory, 1, 1, &old));
+    ASSERT_FALSE(ram_fetch_add_int_by_addr(memory, 1, 3, &old));
+    ASSERT_FALSE(ram_fetch_add_int_by_addr(memory, 1, 4, &old));
+    
+    // CAS compares exact values, and reports what it found:
+    struct RAM_VALUE expected;
+    struct RAM_VALUE desired;
+    expected.value_type = RAM_TYPE_REAL;
+    expected.types.d = 2.0;
+    desired.value_type = RAM_TYPE_REAL;
+    desired.types.d = 3.0;
+    ASSERT_FALSE(ram_cas_by_addr(memory, &expected, desired, 1));
+    ASSERT_EQ(expected.types.d, 1.5);
+    ASSERT_TRUE(ram_cas_by_addr(memory, &expected, desired, 1));
+    ASSERT_EQ(ram_cell(memory, 1)->types.d, 3.0);
+    
+    expected.value_type = RAM_TYPE_INT;
+    expected.types.i = 3;
+    ASSERT_FALSE(ram_cas_by_addr(memory, &expected, desired, 1));  // 3 != 3.0 here
+    ASSERT_EQ(expected.value_type, RAM_TYPE_REAL);
+    ASSERT_FALSE(ram_cas_by_addr(memory, &expected, desired, 3));  // a string
+    
+    // exchange keeps the cell's type, and normalizes booleans:
+    struct RAM_VALUE before;
+    desired.value_type = RAM_TYPE_BOOLEAN;
+    desired.types.i = 42;
+    ASSERT_TRUE(ram_exchange_by_addr(memory, desired, 2, &before));
+    ASSERT_EQ(before.value_type, RAM_TYPE_BOOLEAN);
+    ASSERT_EQ(before.types.i, 0);
+    ASSERT_EQ(ram_cell(memory, 2)->types.i, 1);
+    ASSERT_FALSE(ram_exchange_by_addr(memory, desired, 0, &before));
+    
+    // inside a transaction they can't be atomic, so they refuse
+    // rather than quietly becoming a read and a write:
+    ASSERT_TRUE(ram_atomic_ready(memory, 0));
+    ASSERT_FALSE(ram_atomic_ready(memory, 3));
+    ASSERT_FALSE(ram_atomic_ready(memory, 4));
+    ram_txn_begin(memory);
+    ASSERT_FALSE(ram_atomic_ready(memory, 0));
+    ASSERT_FALSE(ram_fetch_add_int_by_addr(memory, 5, 0, &old));
+    expected.value_type = RAM_TYPE_BOOLEAN;
+    expected.types.i = 1;
+    desired.types.i = 0;
+    ASSERT_FALSE(ram_cas_by_addr(memory, &expected, desired, 2));
+    ASSERT_EQ(expected.types.i, 1);
+    desired.value_type = RAM_TYPE_REAL;
+    desired.types.d = 9.0;
+    ASSERT_FALSE(ram_exchange_by_addr(memory, desired, 1, NULL));
+    ram_txn_rollback(memory);
+    
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, INT_MAX);
+    ASSERT_EQ(ram_cell(memory, 1)->types.d, 3.0);
+    ASSERT_EQ(ram_cell(memory, 2)->types.i, 1);
+    
+    // ordinary writes take over (under the caller's own lock):
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 5, 0));
+    ASSERT_TRUE(ram_txn_commit(memory));
+    ASSERT_TRUE(ram_atomic_ready(memory, 0));
+    ASSERT_TRUE(ram_fetch_add_int_by_addr(memory, 1, 0, &old));
+    ASSERT_EQ(old, 5);
+    
+    ram_destroy(memory);
+    
+    // and through the C++ wrapper:
+    using namespace nupython::literals;
+    
+    nupython::Ram wrapped(ram_init());
+    wrapped.set("hits"_var, 10);
+    wrapped.set("ratio"_var, 0.25);
+    ASSERT_EQ(*wrapped.fetch_add("hits"_var, 5), 10);
+    ASSERT_EQ(*wrapped.fetch_add(0, 1), 15);
+    ASSERT_FALSE(wrapped.fetch_add("ratio"_var, 1).has_value());
+    ASSERT_EQ(wrapped.exchange("ratio"_var, 0.5)->types.d, 0.25);
+    ASSERT_FALSE(wrapped.exchange("hits"_var, 0.5).has_value());
+    ASSERT_EQ(*wrapped.get<double>("ratio"_var), 0.5);
+}
+
+//
+// Hammers 3 shared cells of a memory unit: a counter with
+// fetch-add, a real with a CAS loop, and a boolean spin lock with
+// exchange guarding a plain int.
+//
+#define ATOMIC_THREADS 4
+#define ATOMIC_ITERS   20000
+
+static void* atomic_worker(void* arg)
+{
+    struct RAM* memory = (struct RAM*) arg;
+    struct RAM_VALUE locked;
+    struct RAM_VALUE unlocked;
+    locked.value_type = RAM_TYPE_BOOLEAN;
+    locked.types.i = 1;
+    unlocked.value_type = RAM_TYPE_BOOLEAN;
+    unlocked.types.i = 0;
+    
+    for (int i = 0; i < ATOMIC_ITERS; i++) {
+        ram_fetch_add_int_by_addr(memory, 1, 0, NULL);
+        
+        struct RAM_VALUE expected;  // a guess; a failed CAS corrects it
+        struct RAM_VALUE desired;
+        expected.value_type = RAM_TYPE_REAL;
+        expected.types.d = 0.0;
+        do {
+            desired = expected;
+            desired.types.d += 0.5;
+        } while (!ram_cas_by_addr(memory, &expected, desired, 1));
+        
+        struct RAM_VALUE was;
+        do {
+            ram_exchange_by_addr(memory, locked, 2, &was);
+        } while (was.types.i != 0);
+        ram_cell(memory, 3)->types.i++;
+        ram_exchange_by_addr(memory, unlocked, 2, NULL);
+    }
+    
+    return NULL;
+}
+
+TEST(memory_module, atomic_ops_across_threads)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 0;
+    ram_write_cell_by_name(memory, val, "count");
+    val.value_type = RAM_TYPE_REAL;
+    val.types.d = 0.0;
+    ram_write_cell_by_name(memory, val, "total");
+    val.value_type = RAM_TYPE_BOOLEAN;
+    val.types.i = 0;
+    ram_write_cell_by_name(memory, val, "lock");
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 0;
+    ram_write_cell_by_name(memory, val, "guarded");
+    
+    pthread_t threads[ATOMIC_THREADS];
+    for (int t = 0; t < ATOMIC_THREADS; t++) {
+        pthread_create(&threads[t], NULL, atomic_worker, memory);
+    }
+    for (int t = 0; t < ATOMIC_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    
+    ASSERT_EQ(ram_cell(memory, 0)->types.i, ATOMIC_THREADS * ATOMIC_ITERS);
+    ASSERT_EQ(ram_cell(memory, 1)->types.d, ATOMIC_THREADS * ATOMIC_ITERS * 0.5);
+    ASSERT_EQ(ram_cell(memory, 2)->types.i, 0);
+    ASSERT_EQ(ram_cell(memory, 3)->types.i, ATOMIC_THREADS * ATOMIC_ITERS);
+    
+    ram_destroy(memory);
+}
+
+//
+// Fills a memory unit in a process with little memory to spare,
+// until a write fails. Returns the # of checks that failed.
+//
+static int fill_until_out_of_memory(void)
+{
+    // a string more than the memory to spare, allocated before the
+    // limit is set:
+    int big_length = 96 * 1024 * 1024;
+    char* big = (char*) malloc((size_t) big_length + 1);
+    if (big == NULL) {
+        return 100;
+    }
+    memset(big, 'x', big_length);
+    big[big_length] = '\0';
+    
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL || fscanf(statm, "%ld", &pages) != 1) {
+        return 100;
+    }
+    fclose(statm);
+    
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = (rlim_t) pages * sysconf(_SC_PAGESIZE) + 64 * 1024 * 1024;
+    if (setrlimit(RLIMIT_AS, &limit) != 0) {
+        return 100;
+    }
+    
+    int failures = 0;
+    struct RAM* memory = ram_init();
+    int capacity = ram_capacity(memory);
+    
+    // far more cells than there is memory for:
+    failures += ram_reserve(memory, RAM_MAX_CAPACITY);
+    failures += (ram_capacity(memory) != capacity);
+    
+    char name[16];
+    int n = 0;
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (;;) {
+        sprintf(name, "v%09d", n);
+        val.types.i = n;
+        if (!ram_write_cell_by_name(memory, val, name)) {
+            break;
+        }
+        n++;
+    }
+    
+    // the write that didn't fit changed nothing:
+    failures += (n < 100000);
+    failures += (ram_size(memory) != n);
+    failures += (ram_get_addr(memory, name) != -1);
+    
+    // and what was written is intact and can still be updated, also
+    // inside a transaction:
+    int x = -1;
+    failures += !(ram_read_int_by_addr(memory, n - 1, &x) && x == n - 1);
+    ram_txn_begin(memory);
+    failures += !ram_write_int_by_addr(memory, -1, 0);
+    failures += ram_write_cell_by_name(memory, val, name);
+    ram_txn_rollback(memory);
+    failures += !(ram_read_int_by_addr(memory, 0, &x) && x == 0);
+    failures += (ram_size(memory) != n);
+    
+    // strings and arrays that don't fit leave the cell as it was:
+    struct RAM_VALUE str;
+    str.value_type = RAM_TYPE_STR;
+    str.types.s = big;
+    failures += ram_write_cell_by_addr(memory, str, 0);
+    failures += ram_write_cell_by_name(memory, str, (char*) "v000000001");
+    failures += ram_write_str_by_addr(memory, big, big_length, 2);
+    failures += ram_write_str_by_name(memory, big, big_length, (char*) "v000000003");
+    failures += ram_write_array_by_addr(memory, RAM_ARRAY_REAL, big, big_length / (int) sizeof(double), 4);
+    failures += ram_write_array_by_name(memory, RAM_ARRAY_INT, big, big_length / (int) sizeof(int), (char*) "v000000005");
+    for (int i = 0; i < 6; i++) {
+        failures += !(ram_read_int_by_addr(memory, i, &x) && x == i);
+    }
+    failures += ram_write_str_by_name(memory, big, big_length, name);
+    failures += (ram_size(memory) != n);
+    
+    ram_destroy(memory);
+    free(big);
+    return failures;
+}
+
+TEST(memory_module, out_of_memory_is_reported)
+{
+#if defined(__SANITIZE_ADDRESS__)
+    GTEST_SKIP() << "ASan's shadow memory doesn't fit under an address-space limit";
+#endif
+    
+    pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if (child == 0) {
+        _exit(fill_until_out_of_memory());
+    }
+    
+    int status = -1;
+    ASSERT_EQ(waitpid(child, &status, 0), child);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+//
+// builds a list of n objects, each with slots { int i, PTR next },
+// allocating the given # of garbage objects before each one, and
+// returns the handle of its head:
+//
+static int heap_list(struct RAM* memory, int n, int garbage)
+{
+    struct RAM_VALUE next;
+    next.value_type = RAM_TYPE_NONE;
+    next.types.i = 0;
+    
+    for (int i = n - 1; i >= 0; i--) {
+        for (int g = 0; g < garbage; g++) {
+            ram_heap_alloc(memory, 2);
+        }
+        int ptr = ram_heap_alloc(memory, 2);
+        struct RAM_VALUE val;
+        val.value_type = RAM_TYPE_INT;
+        val.types.i = i;
+        ram_heap_write(memory, ptr, 0, val);
+        ram_heap_write(memory, ptr, 1, next);
+        next.value_type = RAM_TYPE_PTR;
+        next.types.i = ptr;
+    }
+    return next.types.i;
+}
+
+//
+// # of objects in the list starting at ptr, checking that their ints
+// count up from first:
+//
+static int heap_list_length(struct RAM* memory, int ptr, int first)
+{
+    int n = 0;
+    struct RAM_VALUE val;
+    
+    while (ram_heap_read(memory, ptr, 0, &val)) {
+        if (val.value_type != RAM_TYPE_INT || val.types.i != first + n) {
+            return -1;
+        }
+        n++;
+        ram_heap_read(memory, ptr, 1, &val);
+        ptr = (val.value_type == RAM_TYPE_PTR) ? val.types.i : 0;
+    }
+    return n;
+}
+
+TEST(memory_module, heap_collects_unreachable_objects)
+{
+    struct RAM* memory = ram_init();
+    struct RAM_HEAP_CONFIG config = { 0, 0, 0 };
+    
+    ASSERT_EQ(ram_heap_alloc(memory, 1), 0);  // no heap yet
+    ASSERT_TRUE(ram_heap_enable(memory, config));
+    ASSERT_FALSE(ram_heap_enable(memory, config));
+    
+    struct RAM_VALUE ptr;
+    ptr.value_type = RAM_TYPE_PTR;
+    ptr.types.i = heap_list(memory, 100, 0);
+    ram_write_cell_by_name(memory, ptr, (char*) "list");
+    
+    heap_list(memory, 50, 0);  // garbage
+    int big = ram_heap_alloc(memory, 100000);  // allocated by itself, also garbage
+    ASSERT_GT(big, 0);
+    ASSERT_EQ(ram_heap_num_slots(memory, big), 100000);
+    
+    struct RAM_HEAP_STATS stats = ram_heap_stats(memory);
+    ASSERT_EQ(stats.objects, 151);
+    ASSERT_EQ(ram_memory_usage(memory).heap, ram_memory_usage(memory).total - 
+              (ram_memory_usage(memory).header + ram_memory_usage(memory).cells + ram_memory_usage(memory).map +
+               ram_memory_usage(memory).names));
+    long long heap_bytes = ram_memory_usage(memory).heap;
+    
+    ram_heap_collect(memory);
+    stats = ram_heap_stats(memory);
+    ASSERT_EQ(stats.objects, 100);
+    ASSERT_EQ(stats.freed, 51);
+    ASSERT_EQ(stats.cycles, 1);
+    ASSERT_FALSE(stats.collecting);
+    ASSERT_EQ(ram_heap_num_slots(memory, big), -1);
+    ASSERT_LT(ram_memory_usage(memory).heap, heap_bytes);
+    ASSERT_EQ(heap_list_length(memory, ptr.types.i, 0), 100);
+    
+    // old values in an open transaction's undo log are roots too:
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 0, 0));
+    ram_heap_collect(memory);
+    ASSERT_EQ(ram_heap_stats(memory).objects, 100);
+    ASSERT_TRUE(ram_txn_rollback(memory));
+    ASSERT_EQ(ram_type_by_addr(memory, 0), RAM_TYPE_PTR);
+    ASSERT_EQ(heap_list_length(memory, ptr.types.i, 0), 100);
+    
+    // strings and arrays don't go in slots:
+    struct RAM_VALUE s;
+    s.value_type = RAM_TYPE_STR;
+    s.types.s = (char*) "abc";
+    ASSERT_FALSE(ram_heap_write(memory, ptr.types.i, 0, s));
+    ASSERT_FALSE(ram_heap_write(memory, ptr.types.i, 2, ptr));
+    
+    // once the last PTR to the list is gone, so is the list:
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 0, 0));
+    ram_heap_collect(memory);
+    ASSERT_EQ(ram_heap_stats(memory).objects, 0);
+    ASSERT_EQ(heap_list_length(memory, ptr.types.i, 0), 0);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, heap_collects_incrementally)
+{
+    struct RAM* memory = ram_init();
+    struct RAM_HEAP_CONFIG config = { 4096, 512, 50 };
+    ASSERT_TRUE(ram_heap_enable(memory, config));
+    
+    struct RAM_VALUE a, b;
+    a.value_type = RAM_TYPE_PTR;
+    a.types.i = heap_list(memory, 1000, 2);  // and 2000 garbage objects
+    ram_write_cell_by_name(memory, a, (char*) "a");
+    b.value_type = RAM_TYPE_NONE;
+    ram_write_cell_by_name(memory, b, (char*) "b");
+    
+    // a collection starts at the first step, and takes many:
+    ASSERT_TRUE(ram_heap_step(memory));
+    ASSERT_TRUE(ram_heap_stats(memory).collecting);
+    
+    // while it marks, cut the list in two, keeping the back half only
+    // in b (whose cell was already scanned); and grow the list:
+    int ptr = a.types.i;
+    struct RAM_VALUE val;
+    for (int i = 0; i < 499; i++) {
+        ram_heap_read(memory, ptr, 1, &val);
+        ptr = val.types.i;
+    }
+    ram_heap_read(memory, ptr, 1, &b);
+    ram_write_cell_by_name(memory, b, (char*) "b");
+    val.value_type = RAM_TYPE_NONE;
+    ram_heap_write(memory, ptr, 1, val);
+    
+    int head = ram_heap_alloc(memory, 2);
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = -1;
+    ram_heap_write(memory, head, 0, val);
+    ram_heap_write(memory, head, 1, a);
+    a.types.i = head;
+    ram_write_cell_by_name(memory, a, (char*) "a");
+    
+    int steps = 1;
+    bool collecting = true;
+    while (collecting) {
+        collecting = ram_heap_step(memory);
+        steps++;
+    }
+    ASSERT_GT(steps, 10);
+    
+    struct RAM_HEAP_STATS stats = ram_heap_stats(memory);
+    ASSERT_EQ(stats.cycles, 1);
+    ASSERT_EQ(stats.objects, 1001);
+    ASSERT_EQ(stats.freed, 2000);
+    // the garbage left the chunks sparse, so most live objects were
+    // moved (all but those in the chunk being allocated from):
+    ASSERT_GT(stats.moved, 900);
+    
+    ram_heap_read(memory, head, 1, &val);
+    ASSERT_EQ(heap_list_length(memory, val.types.i, 0), 500);
+    ASSERT_EQ(heap_list_length(memory, b.types.i, 500), 500);
+    
+    // nothing more to do until the heap grows again:
+    ASSERT_FALSE(ram_heap_step(memory));
+    ASSERT_EQ(ram_heap_stats(memory).steps, steps);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, heap_budget_and_reset)
+{
+    struct RAM* memory = ram_init();
+    struct RAM_HEAP_CONFIG config = { 4096, 0, 0 };
+    ASSERT_TRUE(ram_heap_enable(memory, config));
+    
+    struct RAM_VALUE ptr;
+    ptr.value_type = RAM_TYPE_PTR;
+    ptr.types.i = ram_heap_alloc(memory, 4);
+    ASSERT_GT(ptr.types.i, 0);
+    ram_write_cell_by_name(memory, ptr, (char*) "p");
+    
+    // objects count toward the budget:
+    ram_set_memory_budget(memory, ram_memory_usage(memory).total + 10000);
+    int n = 0;
+    while (ram_heap_alloc(memory, 4) != 0) {
+        n++;
+    }
+    ASSERT_GT(n, 0);
+    ASSERT_LE(ram_memory_usage(memory).total, memory->budget);
+    ASSERT_EQ(ram_heap_stats(memory).objects, n + 1);
+    
+    // collecting makes room again:
+    ram_heap_collect(memory);
+    ASSERT_EQ(ram_heap_stats(memory).objects, 1);
+    ASSERT_GT(ram_heap_alloc(memory, 4), 0);
+    
+    // a PTR overwritten by a typed write no longer keeps its object:
+    ram_set_memory_budget(memory, 0);
+    ptr.types.i = heap_list(memory, 10, 0);
+    ram_write_cell_by_name(memory, ptr, (char*) "q");
+    ram_heap_collect(memory);
+    ASSERT_EQ(ram_heap_stats(memory).objects, 11);
+    ASSERT_TRUE(ram_write_int_by_addr(memory, 7, ram_get_addr(memory, (char*) "q")));
+    ram_heap_collect(memory);
+    ASSERT_EQ(ram_heap_stats(memory).objects, 1);
+    
+    // a reset frees every object, keeping the heap:
+    ram_reset(memory);
+    ASSERT_EQ(ram_heap_stats(memory).objects, 0);
+    ASSERT_EQ(ram_heap_num_slots(memory, ptr.types.i), -1);
+    ptr.types.i = ram_heap_alloc(memory, 3);
+    ASSERT_EQ(ram_heap_num_slots(memory, ptr.types.i), 3);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, layout_packs_hot_cells)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 1000; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    
+    ASSERT_FALSE(ram_renumber_hot_first(memory, NULL));  // nothing sampled
+    ASSERT_EQ(ram_layout_report(memory).samples, 0);
+    
+    // sample every access; 5 cells far apart get all of them:
+    ASSERT_TRUE(ram_layout_sample_start(memory, 1));
+    ASSERT_FALSE(ram_layout_sample_start(memory, 1));
+    int hot[] = { 999, 500, 3, 250, 777 };
+    for (int h = 0; h < 5; h++) {
+        for (int i = 0; i < 50 - 10 * h; i++) {
+            int x;
+            ASSERT_TRUE(ram_read_int_by_addr(memory, hot[h], &x));
+        }
+    }
+    
+    struct RAM_LAYOUT_REPORT report = ram_layout_report(memory);
+    ASSERT_EQ(report.samples, 150);
+    ASSERT_EQ(report.cells, 1000);
+    ASSERT_EQ(report.touched, 5);
+    ASSERT_EQ(report.cells_for_50, 2);   // 50 + 40 of 150
+    ASSERT_EQ(report.cells_for_90, 4);   // 140 of 150
+    ASSERT_EQ(report.cells_for_99, 5);
+    ASSERT_EQ(report.lines_for_90, 4);
+    ASSERT_EQ(report.deciles[0], 1.0);
+    ASSERT_EQ(report.deciles[9], 0.0);
+    
+    unsigned int epoch = memory->epoch;
+    int new_addrs[1000];
+    ASSERT_TRUE(ram_renumber_hot_first(memory, new_addrs));
+    ASSERT_NE(memory->epoch, epoch);
+    
+    // hottest first, then the rest in their old order:
+    for (int h = 0; h < 5; h++) {
+        ASSERT_EQ(new_addrs[hot[h]], h);
+    }
+    ASSERT_EQ(new_addrs[0], 5);
+    ASSERT_EQ(new_addrs[4], 8);
+    ASSERT_EQ(new_addrs[998], 999);
+    
+    // every name still leads to its value:
+    for (int i = 0; i < 1000; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        ASSERT_EQ(ram_get_addr(memory, name), new_addrs[i]);
+        ASSERT_EQ(ram_cell(memory, new_addrs[i])->types.i, i);
+    }
+    
+    // the counts moved with the cells, so the 90% now share a line:
+    report = ram_layout_report(memory);
+    ASSERT_EQ(report.samples, 150);
+    ASSERT_EQ(report.cells_for_90, 4);
+    ASSERT_EQ(report.lines_for_90, 1);
+    
+    // optimizing again moves nothing:
+    epoch = memory->epoch;
+    ASSERT_TRUE(ram_renumber_hot_first(memory, new_addrs));
+    ASSERT_EQ(memory->epoch, epoch);
+    ASSERT_EQ(new_addrs[0], 0);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, layout_refusals_and_checkpoints)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    for (int i = 0; i < 100; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    
+    ASSERT_TRUE(ram_layout_sample_start(memory, 1));
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(ram_write_int_by_addr(memory, -1, 99));
+    }
+    
+    ram_txn_begin(memory);
+    ASSERT_FALSE(ram_renumber_hot_first(memory, NULL));
+    ram_txn_commit(memory);
+    
+    ASSERT_TRUE(ram_trace_start(memory, "test_layout.trace"));
+    ASSERT_FALSE(ram_renumber_hot_first(memory, NULL));
+    ASSERT_TRUE(ram_trace_stop(memory));
+    remove("test_layout.trace");
+    
+    // moving cells ends the chain of deltas:
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_layout.img"));
+    ASSERT_TRUE(ram_renumber_hot_first(memory, NULL));
+    ASSERT_EQ(ram_get_addr(memory, "v99"), 0);
+    ASSERT_FALSE(ram_checkpoint_delta(memory, "test_layout.d1"));
+    ASSERT_TRUE(ram_checkpoint_full(memory, "test_layout.img"));
+    ram_write_int_by_addr(memory, 7, 0);
+    ASSERT_TRUE(ram_checkpoint_delta(memory, "test_layout.d1"));
+    
+    char* deltas[] = { "test_layout.d1" };
+    struct RAM* loaded = ram_load_checkpoint("test_layout.img", deltas, 1);
+    ASSERT_TRUE(loaded != NULL);
+    assert_same_memory(memory, loaded);
+    ram_destroy(loaded);
+    remove("test_layout.img");
+    remove("test_layout.d1");
+    
+    // reset forgets the counts, stopping ends sampling:
+    ram_reset(memory);
+    ASSERT_EQ(ram_layout_report(memory).samples, 0);
+    ASSERT_TRUE(ram_layout_sample_stop(memory));
+    ASSERT_FALSE(ram_layout_sample_stop(memory));
+    ASSERT_TRUE(memory->layout == NULL);
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, layout_keeps_heap_objects_alive)
+{
+    struct RAM* memory = ram_init();
+    struct RAM_HEAP_CONFIG config = { 4096, 512, 50 };
+    ASSERT_TRUE(ram_heap_enable(memory, config));
+    
+    struct RAM_VALUE ptr;
+    ptr.value_type = RAM_TYPE_PTR;
+    for (int i = 0; i < 2000; i++) {
+        char name[10];
+        sprintf(name, "o%d", i);
+        ptr.types.i = ram_heap_alloc(memory, 1);
+        ram_write_cell_by_name(memory, ptr, name);
+        ram_heap_alloc(memory, 1);  // garbage
+    }
+    
+    ASSERT_TRUE(ram_layout_sample_start(memory, 1));
+    for (int i = 1900; i < 2000; i++) {
+        ASSERT_EQ(ram_type_by_addr(memory, i), RAM_TYPE_PTR);
+    }
+    
+    // the collector has scanned only the first few cells when the
+    // last ones move in front of them:
+    ASSERT_TRUE(ram_heap_step(memory));
+    ASSERT_TRUE(ram_renumber_hot_first(memory, NULL));
+    ASSERT_EQ(ram_get_addr(memory, "o1900"), 0);
+    while (ram_heap_step(memory)) {
+    }
+    
+    struct RAM_HEAP_STATS stats = ram_heap_stats(memory);
+    ASSERT_EQ(stats.cycles, 1);
+    ASSERT_EQ(stats.objects, 2000);
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_EQ(ram_heap_num_slots(memory, ram_cell(memory, i)->types.i), 1);
+    }
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, names_share_one_block)
+{
+    struct RAM* memory = ram_init();
+    
+    ASSERT_EQ(sizeof(struct RAM_MAP), 8u);  // 32-bit name offset and cell
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    unsigned int chars = 0;
+    for (int i = 0; i < 1000; i++) {
+        char name[10];
+        sprintf(name, "v%d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+        chars += (unsigned int) strlen(name) + 1;
+    }
+    ASSERT_EQ(memory->names.used, chars);
+    ASSERT_EQ(memory->names.garbage, 0u);
+    ASSERT_EQ(ram_memory_usage(memory).names, (long long) memory->names.capacity);
+    
+    // names rolled back come off the end of the block:
+    unsigned int capacity = memory->names.capacity;
+    char* names[] = { (char*) "q2", (char*) "q1", (char*) "a0", (char*) "q1" };
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "zz"));
+    ASSERT_TRUE(ram_bulk_load(memory, names, NULL, 4, NULL));
+    ASSERT_EQ(memory->names.used, chars + 3 + 3 * 3);
+    ram_txn_rollback(memory);
+    ASSERT_EQ(memory->names.used, chars);
+    ASSERT_EQ(memory->names.garbage, 0u);
+    ASSERT_EQ(memory->names.capacity, capacity);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "q1"), -1);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "v999"), 999);
+    
+    // ... others are garbage until compacted; here "a" is dropped from
+    // the image, where it came first, by the delta:
+    ram_reset(memory);
+    ASSERT_EQ(ram_memory_usage(memory).names, 0);
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "b"));
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "c"));
+    ram_txn_begin(memory);
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "a"));
+    ASSERT_TRUE(ram_checkpoint_full(memory, (char*) "test_names.img"));
+    ram_txn_rollback(memory);
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "d"));
+    ASSERT_TRUE(ram_checkpoint_delta(memory, (char*) "test_names.d1"));
+    
+    char* deltas[] = { (char*) "test_names.d1" };
+    struct RAM* loaded = ram_load_checkpoint((char*) "test_names.img", deltas, 1);
+    ASSERT_TRUE(loaded != NULL);
+    assert_same_memory(memory, loaded);
+    ASSERT_EQ(loaded->names.garbage, 2u);
+    ASSERT_EQ(loaded->names.used, 4u * 2);
+    
+    ASSERT_TRUE(ram_compact_names(loaded, false));
+    ASSERT_EQ(loaded->names.garbage, 0u);
+    ASSERT_EQ(loaded->names.used, 3u * 2);
+    ASSERT_EQ(ram_memory_usage(loaded).names, 3 * 2);
+    assert_same_memory(memory, loaded);
+    
+    ram_destroy(loaded);
+    remove("test_names.img");
+    remove("test_names.d1");
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, compact_names_front_codes)
+{
+    struct RAM* memory = ram_init();
+    
+    enum { N = 3000 + 9 };
+    static char chars[N][320];
+    char* names[N];
+    for (int i = 0; i < 3000; i++) {
+        sprintf(chars[i], "v%08d", (i * 7919) % 3000);  // in no particular order
+    }
+    const char* odd[] = { "a", "ab", "abc", "abcd", "abcdz", "v0000", "v00001000x" };
+    for (int i = 0; i < 7; i++) {
+        strcpy(chars[3000 + i], odd[i]);
+    }
+    memset(chars[3007], 'x', 300);  // these two share more than 255 chars
+    memset(chars[3008], 'x', 300);
+    chars[3008][300] = 'y';
+    unsigned int whole = 0;
+    for (int i = 0; i < N; i++) {
+        names[i] = chars[i];
+        whole += (unsigned int) strlen(names[i]) + 1;
+    }
+    
+    int addrs[N];
+    ASSERT_TRUE(ram_bulk_load(memory, names, NULL, N, addrs));
+    ASSERT_EQ(memory->names.used, whole);
+    
+    ram_txn_begin(memory);
+    ASSERT_FALSE(ram_compact_names(memory, true));  // the undo log holds name offsets
+    ram_txn_commit(memory);
+    
+    ASSERT_TRUE(ram_compact_names(memory, true));
+    ASSERT_LT(memory->names.used * 5, whole * 3);  // about 5 bytes a name instead of 10
+    ASSERT_EQ(ram_memory_usage(memory).names, (long long) memory->names.used + memory->names.scratch_capacity);
+    
+    // every name still leads to its cell, and the map is still in order:
+    for (int i = 0; i < N; i++) {
+        ASSERT_EQ(ram_get_addr(memory, names[i]), addrs[i]);
+    }
+    int found[N];
+    ASSERT_EQ(ram_get_addrs(memory, names, N, found), N);
+    ASSERT_EQ(memcmp(found, addrs, sizeof(addrs)), 0);
+    for (int i = 1; i < ram_size(memory); i++) {
+        char previous[320];
+        strcpy(previous, ram_map_name(memory, i - 1));
+        ASSERT_LT(strcmp(previous, ram_map_name(memory, i)), 0);
+    }
+    
+    int v1000 = ram_get_addr(memory, (char*) "v00001000");
+    ASSERT_EQ(ram_get_addr_n(memory, (char*) "v00001000xyz", 9), v1000);
+    ASSERT_EQ(ram_get_addr_n(memory, (char*) "v00001000xyz", 10), addrs[3006]);
+    ASSERT_EQ(ram_get_addr_n(memory, (char*) "v00001000xyz", 8), -1);
+    ASSERT_EQ(ram_get_addr_n(memory, (char*) "v00001000xyz", 11), -1);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "abcde"), -1);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "v000010000"), -1);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "v0000100"), -1);
+    
+    // names added afterwards are stored whole, among the coded ones:
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    val.types.i = 5;
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "v00001000a"));
+    ASSERT_EQ(ram_get_addr(memory, (char*) "v00001000a"), N);
+    ASSERT_EQ(ram_get_addr(memory, (char*) "v00001000"), v1000);
+    
+    // and compacting without front-coding stores every name whole again:
+    ASSERT_TRUE(ram_compact_names(memory, false));
+    ASSERT_EQ(memory->names.used, whole + 11);
+    ASSERT_TRUE(memory->names.scratch == NULL);
+    for (int i = 0; i < N; i++) {
+        ASSERT_EQ(ram_get_addr(memory, names[i]), addrs[i]);
+    }
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, compact_names_between_checkpoints)
+{
+    struct RAM* memory = ram_init();
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_INT;
+    char name[16];
+    for (int i = 0; i < 50; i++) {
+        sprintf(name, "w%04d", i);
+        val.types.i = i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ASSERT_TRUE(ram_checkpoint_full(memory, (char*) "test_names.img"));
+    
+    // names added since the checkpoint are moved along with the rest:
+    for (int i = 0; i < 20; i++) {
+        sprintf(name, "w%04dx", i * 2);
+        val.types.i = 100 + i;
+        ram_write_cell_by_name(memory, val, name);
+    }
+    ASSERT_TRUE(ram_compact_names(memory, true));
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "w0007y"));
+    ASSERT_TRUE(ram_write_int_by_addr(memory, -1, 3));
+    ASSERT_TRUE(ram_checkpoint_delta(memory, (char*) "test_names.d1"));
+    
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "a"));
+    ASSERT_TRUE(ram_compact_names(memory, false));
+    ASSERT_TRUE(ram_checkpoint_delta(memory, (char*) "test_names.d2"));
+    
+    char* deltas[] = { (char*) "test_names.d1", (char*) "test_names.d2" };
+    struct RAM* loaded = ram_load_checkpoint((char*) "test_names.img", deltas, 2);
+    ASSERT_TRUE(loaded != NULL);
+    ASSERT_EQ(ram_size(loaded), 72);
+    assert_same_memory(memory, loaded);
+    ram_destroy(loaded);
+    
+    remove("test_names.img");
+    remove("test_names.d1");
+    remove("test_names.d2");
+    
+    ram_destroy(memory);
+}
+
+TEST(memory_module, write_from_own_value)
+{
+    struct RAM* memory = ram_init();
+    
+    // a string written from itself, or a part of itself:
+    ASSERT_TRUE(ram_write_str_by_name(memory, (char*) "abcdef", 6, (char*) "s"));
+    char* s = ram_cell(memory, 0)->types.s;
+    ASSERT_TRUE(ram_write_str_by_addr(memory, s, 6, 0));
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "abcdef");
+    s = ram_cell(memory, 0)->types.s;
+    ASSERT_TRUE(ram_write_str_by_addr(memory, s + 1, 5, 0));
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "bcdef");
+    s = ram_cell(memory, 0)->types.s;
+    ASSERT_TRUE(ram_write_str_by_name(memory, s + 1, 3, (char*) "s"));
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "cde");
+    
+    struct RAM_VALUE val;
+    val.value_type = RAM_TYPE_STR;
+    val.types.s = ram_cell(memory, 0)->types.s + 1;
+    ASSERT_TRUE(ram_write_cell_by_addr(memory, val, 0));
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "de");
+    val.types.s = ram_cell(memory, 0)->types.s + 1;
+    ASSERT_TRUE(ram_write_cell_by_name(memory, val, (char*) "s"));
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "e");
+    
+    // ... or into another variable, and by a bulk load:
+    ASSERT_TRUE(ram_write_str_by_name(memory, (char*) "xyz", 3, (char*) "t"));
+    char* names[] = { (char*) "s", (char*) "t" };
+    struct RAM_VALUE values[2];
+    values[0].value_type = RAM_TYPE_STR;
+    values[0].types.s = ram_cell(memory, 1)->types.s;
+    values[1].value_type = RAM_TYPE_STR;
+    values[1].types.s = ram_cell(memory, 0)->types.s;
+    ASSERT_TRUE(ram_bulk_load(memory, names, values, 2, NULL));
+    ASSERT_STREQ(ram_cell(memory, 0)->types.s, "xyz");
+    ASSERT_STREQ(ram_cell(memory, 1)->types.s, "e");
+    
+    // an array from a slice of itself:
+    int ints[] = { 1, 2, 3, 4 };
+    ASSERT_TRUE(ram_write_array_by_name(memory, RAM_ARRAY_INT, ints, 4, (char*) "a"));
+    struct RAM_ARRAY* a = ram_borrow_array_by_addr(memory, 2);
+    ASSERT_TRUE(ram_write_array_by_addr(memory, RAM_ARRAY_INT, a->elems.i + 1, 3, 2));
+    a = ram_borrow_array_by_addr(memory, 2);
+    ASSERT_TRUE(ram_write_array_by_name(memory, RAM_ARRAY_INT, a->elems.i + 1, 2, (char*) "a"));
+    a = ram_borrow_array_by_addr(memory, 2);
+    ASSERT_EQ(a->length, 2);
+    ASSERT_EQ(a->elems.i[0], 3);
+    ASSERT_EQ(a->elems.i[1], 4);
+    
+    ram_destroy(memory);
+    
+    // and through the C++ wrapper:
+    using namespace nupython::literals;
+    nupython::Ram ram;
+    ASSERT_TRUE(ram.set("w"_var, std::string_view("hello")));
+    int w = ram.addr("w"_var);
+    ASSERT_TRUE(ram.set(w, ram.get<std::string_view>(w)->substr(1)));
+    ASSERT_EQ(*ram.get<std::string_view>(w), "ello");
+}